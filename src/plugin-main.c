@@ -29,6 +29,7 @@ MODULE_EXPORT const char *obs_module_description(void)
 
 extern struct obs_source_info transcription_filter_info;
 extern void load_packet_callback_functions();
+extern void release_unused_whisper_models();
 
 bool obs_module_load(void)
 {
@@ -40,5 +41,6 @@ bool obs_module_load(void)
 
 void obs_module_unload(void)
 {
+	release_unused_whisper_models();
 	obs_log(LOG_INFO, "plugin unloaded");
 }
@@ -0,0 +1,58 @@
+import argparse
+import json
+import os
+import re
+import subprocess
+import tempfile
+
+from evaluate_output import calculate_wer, read_text_from_file, tokenize
+
+# Runs the offline test tool with the full encoder context and with the context sized to the
+# segments (dynamic_audio_ctx) and compares their WER and decoding time per segment
+
+def run_tool(tool, audio, config, dynamic_audio_ctx):
+    config = dict(config)
+    config['dynamic_audio_ctx'] = dynamic_audio_ctx
+    # the tool writes output.txt to its working directory
+    work_dir = tempfile.mkdtemp(prefix='localvocal-audio-ctx-')
+    config_path = os.path.join(work_dir, 'config.json')
+    with open(config_path, 'w', encoding='utf-8') as file:
+        json.dump(config, file)
+    result = subprocess.run([tool, os.path.abspath(audio), config_path], cwd=work_dir,
+                            capture_output=True, text=True, encoding='utf-8', errors='ignore')
+    if result.returncode != 0:
+        raise RuntimeError(f'{tool} failed with code {result.returncode}:\n{result.stdout[-2000:]}')
+    stats = re.search(r'Whisper: (\d+) segments, ([\d.]+) ms per segment, (\d+) audio_ctx fallbacks',
+                      result.stdout)
+    if stats is None:
+        raise RuntimeError('no whisper statistics in the output of the tool')
+    return {
+        'text': read_text_from_file(os.path.join(work_dir, 'output.txt')),
+        'segments': int(stats.group(1)),
+        'ms_per_segment': float(stats.group(2)),
+        'fallbacks': int(stats.group(3)),
+    }
+
+parser = argparse.ArgumentParser(description='Compare the full and the dynamic encoder context')
+parser.add_argument('tool_path', type=str, help='Path to the offline test tool')
+parser.add_argument('audio_file_path', type=str, help='Path to the audio file')
+parser.add_argument('config_file_path', type=str, help='Path to the JSON configuration of the tool')
+parser.add_argument('ref_file_path', type=str, help='Path to the reference transcription')
+parser.add_argument('--remove_punctuation', action='store_true', help='Remove punctuation from text')
+args = parser.parse_args()
+
+with open(args.config_file_path, 'r', encoding='utf-8') as file:
+    base_config = json.load(file)
+ref_tokens = tokenize(read_text_from_file(args.ref_file_path), remove_punctuation=args.remove_punctuation)
+
+results = {}
+for name, dynamic in (('full', False), ('dynamic', True)):
+    run = run_tool(args.tool_path, args.audio_file_path, base_config, dynamic)
+    run['wer'] = calculate_wer(ref_tokens, tokenize(run['text'], remove_punctuation=args.remove_punctuation))
+    results[name] = run
+    print(f"{name:<8} WER {run['wer']:.3f}  {run['ms_per_segment']:8.1f} ms per segment  "
+          f"{run['segments']} segments  {run['fallbacks']} fallbacks")
+
+full, dynamic = results['full'], results['dynamic']
+speedup = full['ms_per_segment'] / max(dynamic['ms_per_segment'], 1e-9)
+print(f"dynamic context: {speedup:.2f}x faster per segment, WER {dynamic['wer'] - full['wer']:+.3f}")
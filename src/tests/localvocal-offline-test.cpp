@@ -17,6 +17,7 @@
 #include "transcription-filter.h"
 #include "transcription-utils.h"
 #include "whisper-utils/whisper-utils.h"
+#include "whisper-utils/whisper-processing.h"
 #include "whisper-utils/vad-processing.h"
 #include "audio-file-utils.h"
 #include "translation/language_codes.h"
@@ -96,7 +97,9 @@ const std::map<std::string, ModelInfo> &models_info()
 transcription_filter_data *
 create_context(int sample_rate, int channels, const std::string &whisper_model_path,
 	       const std::string &silero_vad_model_file, const std::string &ct2ModelFolder,
-	       const whisper_sampling_strategy whisper_sampling_method = WHISPER_SAMPLING_GREEDY)
+	       const whisper_sampling_strategy whisper_sampling_method = WHISPER_SAMPLING_GREEDY,
+	       const std::string &partial_whisper_model_path = "",
+	       const std::string &language_id_model_path = "", bool model_warm_up = true)
 {
 	struct transcription_filter_data *gf = new transcription_filter_data();
 
@@ -116,11 +119,11 @@ create_context(int sample_rate, int channels, const std::string &whisper_model_p
 	gf->fix_utf8 = true;
 	gf->input_cv.emplace();
 
-	for (size_t i = 0; i < gf->channels; i++) {
-		deque_init(&gf->input_buffers[i]);
-	}
-	deque_init(&gf->info_buffer);
-	deque_init(&gf->whisper_buffer);
+	gf->input_ring.init(gf->channels, gf->sample_rate,
+			    (size_t)gf->sample_rate * INPUT_RING_BUFFER_MS / 1000,
+			    INPUT_RING_BUFFER_PACKETS);
+	gf->whisper_buffer.init(WHISPER_BUFFER_CAPACITY_MSEC * WHISPER_SAMPLE_RATE / 1000,
+				WHISPER_BUFFER_GUARD_SAMPLES);
 	deque_init(&gf->resampled_buffer);
 
 	// allocate copy buffers
@@ -146,6 +149,12 @@ create_context(int sample_rate, int channels, const std::string &whisper_model_p
 	dst.speakers = convert_speaker_layout((uint8_t)1);
 
 	gf->resampler_to_whisper = audio_resampler_create(&dst, &src);
+	if (gf->decimator.init(gf->sample_rate, gf->channels, gf->frames, WHISPER_SAMPLE_RATE)) {
+		gf->decimated_buffer.resize(gf->decimator.max_output_frames(gf->frames));
+		obs_log(LOG_INFO, "using %s decimator (%u:1) instead of resampler",
+			AudioDecimator::kernel_name(gf->decimator.kernel()),
+			gf->decimator.decimation_ratio());
+	}
 
 	gf->whisper_model_file_currently_loaded = "";
 	gf->output_file_path = std::string("output.txt");
@@ -198,8 +207,18 @@ create_context(int sample_rate, int channels, const std::string &whisper_model_p
 	gf->whisper_params.temperature = 0.0;
 	gf->whisper_params.max_initial_ts = 1.0;
 	gf->whisper_params.length_penalty = -1;
+	// the filter callbacks are not built into the tool
+	gf->whisper_params.abort_callback = [](void *data) {
+		const auto *filter = static_cast<transcription_filter_data *>(data);
+		return filter->inference_abort.should_abort();
+	};
+	gf->whisper_params.abort_callback_user_data = gf;
 	gf->active = true;
 
+	// loaded with the main model
+	gf->partial_whisper_model_file = partial_whisper_model_path;
+	gf->language_id_model_file = language_id_model_path;
+	gf->model_warm_up = model_warm_up;
 	start_whisper_thread_with_path(gf, whisper_model_path, silero_vad_model_file.c_str());
 
 	obs_log(gf->log_level, "context created");
@@ -364,21 +383,87 @@ void release_context(transcription_filter_data *gf)
 		audio_resampler_destroy(gf->resampler_to_whisper);
 	}
 
-	{
-		std::lock_guard<std::mutex> lockbuf(gf->whisper_buf_mutex);
-		free(gf->copy_buffers[0]);
-		gf->copy_buffers[0] = nullptr;
-		for (size_t i = 0; i < gf->channels; i++) {
-			deque_free(&gf->input_buffers[i]);
-		}
-	}
-	deque_free(&gf->info_buffer);
-	deque_free(&gf->whisper_buffer);
+	free(gf->copy_buffers[0]);
+	gf->copy_buffers[0] = nullptr;
+	obs_log(LOG_INFO, "input ring high water mark %d frames, %d overruns",
+		(int)gf->input_ring.high_water_mark(), (int)gf->input_ring.overrun_count());
+	gf->input_ring.release();
+	gf->whisper_buffer.release();
 	deque_free(&gf->resampled_buffer);
 
 	delete gf;
 }
 
+/**
+ * @brief The audio of the file as the whisper thread gets it: mono at 16 kHz.
+ */
+std::vector<float> resample_for_whisper(transcription_filter_data *gf,
+					const std::vector<std::vector<uint8_t>> &audio)
+{
+	std::vector<float> clip;
+	const size_t frames = audio[0].size() / sizeof(float);
+	for (size_t pos = 0; pos < frames; pos += gf->frames) {
+		const uint32_t chunk_frames = (uint32_t)std::min(gf->frames, frames - pos);
+		const uint8_t *input[MAX_AV_PLANES] = {};
+		for (size_t c = 0; c < gf->channels; c++) {
+			input[c] = audio[c].data() + pos * sizeof(float);
+		}
+		uint8_t *output[MAX_AV_PLANES] = {};
+		uint32_t out_frames = 0;
+		uint64_t ts_offset = 0;
+		if (!audio_resampler_resample(gf->resampler_to_whisper, output, &out_frames,
+					      &ts_offset, input, chunk_frames)) {
+			break;
+		}
+		const float *samples = (const float *)output[0];
+		clip.insert(clip.end(), samples, samples + out_frames);
+	}
+	return clip;
+}
+
+/**
+ * @brief Calibrates the machine on the audio file: runs the models of the calibration settings
+ * with the thread counts of the machine and saves the profile, see calibration.h.
+ */
+int run_calibration(transcription_filter_data *gf, const std::vector<std::vector<uint8_t>> &audio,
+		    const nlohmann::json &calibration)
+{
+	// the calibration loads the models one at a time
+	shutdown_whisper_thread(gf);
+	// the shutdown leaves the abort requested
+	gf->inference_abort.reset();
+
+	std::vector<CalibrationModel> models;
+	for (const nlohmann::json &model : calibration.value("models", nlohmann::json::array())) {
+		if (model.is_string()) {
+			models.push_back({"", model.get<std::string>()});
+		} else {
+			models.push_back({model.value("name", std::string()),
+					  model.value("file", std::string())});
+		}
+	}
+	if (models.empty()) {
+		obs_log(LOG_ERROR, "Calibration: no models to calibrate");
+		return 1;
+	}
+
+	CalibrationProfile profile;
+	profile.target_rtf = calibration.value("target_rtf", CALIBRATION_DEFAULT_TARGET_RTF);
+	profile.max_p95_ms =
+		calibration.value("max_p95_ms", (double)CALIBRATION_DEFAULT_MAX_P95_MSEC);
+	const std::string profile_path =
+		calibration.value("profile", std::string("calibration.json"));
+	if (!calibrate_whisper_models(gf, resample_for_whisper(gf, audio), models, profile)) {
+		return 1;
+	}
+	if (!save_calibration_profile(profile_path, profile)) {
+		obs_log(LOG_ERROR, "Calibration: cannot write %s", profile_path.c_str());
+		return 1;
+	}
+	obs_log(LOG_INFO, "Calibration profile saved to %s", profile_path.c_str());
+	return 0;
+}
+
 int wmain(int argc, wchar_t *argv[])
 {
 	if (argc < 3) {
@@ -417,6 +502,11 @@ int wmain(int argc, wchar_t *argv[])
 	std::string ct2ModelFolderStr = config["ct2_model_folder"];
 	std::string logLevelStr = config["log_level"];
 	whisper_sampling_strategy whisper_sampling_method = config["whisper_sampling_method"];
+	const std::string partialWhisperModelPathStr =
+		config.value("partial_whisper_model_path", std::string());
+	const std::string languageIdModelPathStr =
+		config.value("language_id_model_path", std::string());
+	const bool modelWarmUp = config.value("model_warm_up", true);
 
 	std::cout << "LocalVocal Offline Test" << std::endl;
 	transcription_filter_data *gf = nullptr;
@@ -426,7 +516,8 @@ int wmain(int argc, wchar_t *argv[])
 		read_audio_file(filenameStr.c_str(), [&](int sample_rate, int channels) {
 			gf = create_context(sample_rate, channels, whisperModelPathStr,
 					    sileroVadModelFileStr, ct2ModelFolderStr,
-					    whisper_sampling_method);
+					    whisper_sampling_method, partialWhisperModelPathStr,
+					    languageIdModelPathStr, modelWarmUp);
 			if (sourceLanguageStr.empty() || targetLanguageStr.empty() ||
 			    sourceLanguageStr == "none" || targetLanguageStr == "none") {
 				obs_log(LOG_INFO,
@@ -453,6 +544,63 @@ int wmain(int argc, wchar_t *argv[])
 					config["temperature"].get<float>());
 				gf->whisper_params.temperature = config["temperature"].get<float>();
 			}
+			if (config.contains("dynamic_audio_ctx")) {
+				obs_log(LOG_INFO, "Setting dynamic_audio_ctx to %s",
+					config["dynamic_audio_ctx"] ? "true" : "false");
+				gf->dynamic_audio_ctx = config["dynamic_audio_ctx"];
+			}
+			if (config.contains("incremental_mel")) {
+				obs_log(LOG_INFO, "Setting incremental_mel to %s",
+					config["incremental_mel"] ? "true" : "false");
+				gf->incremental_mel = config["incremental_mel"];
+			}
+			if (config.contains("adaptive_quality")) {
+				obs_log(LOG_INFO, "Setting adaptive_quality to %s",
+					config["adaptive_quality"] ? "true" : "false");
+				gf->adaptive_quality = config["adaptive_quality"];
+			}
+			if (config.contains("partial_transcription")) {
+				obs_log(LOG_INFO, "Setting partial_transcription to %s",
+					config["partial_transcription"] ? "true" : "false");
+				gf->partial_transcription = config["partial_transcription"];
+			}
+			if (config.contains("partial_latency")) {
+				obs_log(LOG_INFO, "Setting partial_latency to %d",
+					config["partial_latency"].get<int>());
+				gf->partial_latency = config["partial_latency"];
+			}
+			if (config.contains("adaptive_partial_latency")) {
+				obs_log(LOG_INFO, "Setting adaptive_partial_latency to %s",
+					config["adaptive_partial_latency"] ? "true" : "false");
+				gf->adaptive_partial_latency = config["adaptive_partial_latency"];
+			}
+			if (config.contains("partial_strategy")) {
+				obs_log(LOG_INFO, "Setting partial_strategy to %d",
+					config["partial_strategy"].get<int>());
+				gf->partial_strategy = config["partial_strategy"];
+			}
+			if (config.contains("partial_temperature_fallback")) {
+				obs_log(LOG_INFO, "Setting partial_temperature_fallback to %s",
+					config["partial_temperature_fallback"] ? "true" : "false");
+				gf->partial_temperature_fallback =
+					config["partial_temperature_fallback"];
+			}
+			if (config.contains("partial_no_timestamps")) {
+				obs_log(LOG_INFO, "Setting partial_no_timestamps to %s",
+					config["partial_no_timestamps"] ? "true" : "false");
+				gf->partial_no_timestamps = config["partial_no_timestamps"];
+			}
+			if (config.contains("partial_max_tokens")) {
+				obs_log(LOG_INFO, "Setting partial_max_tokens to %d",
+					config["partial_max_tokens"].get<int>());
+				gf->partial_max_tokens = config["partial_max_tokens"];
+			}
+			if (config.contains("language_id_recheck_sec")) {
+				obs_log(LOG_INFO, "Setting language_id_recheck_sec to %d",
+					config["language_id_recheck_sec"].get<int>());
+				gf->language_id.set_recheck_interval(
+					config["language_id_recheck_sec"].get<uint64_t>() * 1000);
+			}
 			if (config.contains("no_context")) {
 				obs_log(LOG_INFO, "Setting no_context to %s",
 					config["no_context"] ? "true" : "false");
@@ -485,6 +633,13 @@ int wmain(int argc, wchar_t *argv[])
 		return 1;
 	}
 
+	if (config.contains("calibration")) {
+		const int result = run_calibration(gf, audio, config["calibration"]);
+		release_context(gf);
+		obs_log(LOG_INFO, "LocalVocal Offline Test Done");
+		return result;
+	}
+
 	if (gf->enable_audio_chunks_callback) {
 		audio_chunk_saver_thread.emplace(json_segments_saver_thread_function);
 	}
@@ -516,6 +671,8 @@ int wmain(int argc, wchar_t *argv[])
 					     .count();
 		auto start_time_time = std::chrono::system_clock::now();
 		uint64_t window_number = 0;
+		// lock of the waits on input_cv, the whisper thread notifies it without one
+		std::mutex input_cv_mutex;
 		while (true) {
 			// check if there are enough frames left in the audio buffer
 			if ((frames_count + frames) > (audio[0].size() / frame_size_bytes)) {
@@ -527,40 +684,42 @@ int wmain(int argc, wchar_t *argv[])
 				{
 					auto max_wait = start_time_time +
 							(window_number * window_size_in_ms);
-					std::unique_lock<std::mutex> lock(gf->whisper_buf_mutex);
+					std::unique_lock<std::mutex> lock(input_cv_mutex);
 					for (;;) {
 						// sleep up to window size in case whisper is processing, so the buffer builds up similar to OBS
 						auto now = std::chrono::system_clock::now();
 						if (false && now > max_wait)
 							break;
 
-						if (gf->input_buffers->size == 0)
+						// the whisper thread only wakes up once it has
+						// enough audio to work on
+						const auto caught_up = [&] {
+							return gf->input_ring.frames_available() <
+							       gf->whisper_wake.threshold_frames();
+						};
+						if (caught_up())
 							break;
 
 						gf->input_cv->wait_for(
-							lock, std::chrono::milliseconds(1), [&] {
-								return gf->input_buffers->size == 0;
-							});
+							lock, std::chrono::milliseconds(1), caught_up);
 					}
-					// push back current audio data to input deque
+					// push current audio data and packet info (timestamp/frame count)
+					// to the input ring
+					const uint8_t *channel_data[MAX_PREPROC_CHANNELS];
 					for (size_t c = 0; c < gf->channels; c++) {
-						deque_push_back(&gf->input_buffers[c],
-								audio[c].data() +
-									frames_count *
-										frame_size_bytes,
-								frames_size_bytes);
+						channel_data[c] = audio[c].data() +
+								  frames_count * frame_size_bytes;
 					}
-					// push audio packet info (timestamp/frame count) to info deque
-					struct transcription_filter_audio_info info = {0};
-					info.frames = frames; // number of frames in this packet
 					// make a timestamp from the current position in the audio buffer
-					info.timestamp_offset_ns =
+					const uint64_t timestamp_offset_ns =
 						start_time + (int64_t)(((float)frames_count /
 									(float)gf->sample_rate) *
 								       1e9);
-					deque_push_back(&gf->info_buffer, &info, sizeof(info));
+					gf->input_ring.push(channel_data, (uint32_t)frames,
+							    timestamp_offset_ns);
 				}
-				gf->wshiper_thread_cv.notify_one();
+				gf->whisper_wake.on_frames_available(
+					gf->input_ring.frames_available());
 			}
 			frames_count += frames;
 			window_number += 1;
@@ -571,39 +730,39 @@ int wmain(int argc, wchar_t *argv[])
 		// push a second of silence to the input deque
 		frames = 2 * gf->sample_rate;
 		frames_size_bytes = frames * frame_size_bytes;
+		const std::vector<uint8_t> silence(frames_size_bytes);
+		const uint8_t *channel_data[MAX_PREPROC_CHANNELS];
 		for (size_t c = 0; c < gf->channels; c++) {
-			deque_push_back(&gf->input_buffers[c],
-					std::vector<uint8_t>(frames_size_bytes).data(),
-					frames_size_bytes);
+			channel_data[c] = silence.data();
 		}
-		// push audio packet info (timestamp/frame count) to info deque
-		struct transcription_filter_audio_info info = {0};
-		info.frames = frames; // number of frames in this packet
 		// make a timestamp from the current frame count
-		info.timestamp_offset_ns = frames_count * 1000 / gf->sample_rate;
-		deque_push_back(&gf->info_buffer, &info, sizeof(info));
+		gf->input_ring.push(channel_data, (uint32_t)frames,
+				    frames_count * 1000 / gf->sample_rate);
 	}
 
 	obs_log(LOG_INFO, "Buffer filled with %d frames",
-		(int)gf->input_buffers[0].size / sizeof(float));
+		(int)gf->input_ring.frames_available());
 
 	// wait for processing to finish
 	obs_log(LOG_INFO, "Waiting for processing to finish");
 	while (true) {
 		std::this_thread::sleep_for(std::chrono::milliseconds(100));
 		// check the input deque has more data
-		size_t input_buf_size = 0;
-		{
-			std::lock_guard<std::mutex> lock(gf->whisper_buf_mutex);
-			input_buf_size = gf->input_buffers[0].size;
-		}
+		const size_t input_buf_frames = gf->input_ring.frames_available();
 
 		// if less than 500ms of audio left in the input buffer, break
-		if (input_buf_size < gf->sample_rate / 2 * sizeof(float)) {
+		if (input_buf_frames < gf->sample_rate / 2) {
 			break;
 		}
 	}
 
+	// parsed by benchmark_audio_ctx.py
+	const uint64_t whisper_runs = gf->whisper_runs;
+	obs_log(LOG_INFO, "Whisper: %llu segments, %.1f ms per segment, %llu audio_ctx fallbacks",
+		(unsigned long long)whisper_runs,
+		(double)gf->whisper_run_ms / (double)std::max<uint64_t>(whisper_runs, 1),
+		(unsigned long long)gf->audio_ctx_fallbacks.load());
+
 	if (audio_chunk_saver_thread.has_value()) {
 		{
 			auto lock = std::lock_guard(json_segments_input_mutex);
@@ -0,0 +1,2824 @@
+/*
+ * Performance and parity checks for the processing building blocks of the plugin.
+ *
+ * Usage: obs-localvocal-perf-tests <command> [options]
+ * Run without arguments to list the commands.
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdarg.h>
+
+#include <obs.h>
+#include <media-io/audio-resampler.h>
+#include <whisper.h>
+
+#include "plugin-support.h"
+#include "transcription-filter-utils.h"
+#include "transcription-utils.h"
+#include "whisper-utils/audio-ctx.h"
+#include "whisper-utils/audio-decimator.h"
+#include "whisper-utils/calibration.h"
+#include "whisper-utils/compute-threads.h"
+#include "whisper-utils/energy-gate.h"
+#include "whisper-utils/inference-abort.h"
+#include "whisper-utils/inference-scheduler.h"
+#include "whisper-utils/language-id.h"
+#include "whisper-utils/local-agreement.h"
+#include "whisper-utils/mapped-file.h"
+#include "whisper-utils/mel-cache.h"
+#include "whisper-utils/model-swap.h"
+#include "whisper-utils/partial-latency.h"
+#include "whisper-utils/quality-controller.h"
+#include "whisper-utils/silero-vad-native.h"
+#include "whisper-utils/silero-vad-onnx.h"
+#include "whisper-utils/vad-service.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+void obs_log(int log_level, const char *format, ...)
+{
+	if (log_level == LOG_DEBUG) {
+		return;
+	}
+	static std::mutex log_mutex;
+	auto lock = std::lock_guard(log_mutex);
+	switch (log_level) {
+	case LOG_INFO:
+		printf("[INFO] ");
+		break;
+	case LOG_WARNING:
+		printf("[WARNING] ");
+		break;
+	case LOG_ERROR:
+		printf("[ERROR] ");
+		break;
+	default:
+		break;
+	}
+	va_list args;
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
+	printf("\n");
+}
+
+// Count the heap allocations made through operator new, to check the hot paths do not allocate.
+// Only allocations of code that uses the operator new of this executable are seen (on Windows
+// that excludes other DLLs).
+static std::atomic<uint64_t> heap_allocations{0};
+
+void *operator new(size_t size)
+{
+	heap_allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void *p = malloc(size > 0 ? size : 1)) {
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	free(p);
+}
+
+namespace {
+
+// size of the audio packets OBS hands to the filter
+const size_t PACKET_FRAMES = 1024;
+
+double seconds_since(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+std::vector<std::string> args_from(int argc, char *argv[])
+{
+	std::vector<std::string> args;
+	for (int i = 2; i < argc; ++i) {
+		args.emplace_back(argv[i]);
+	}
+	return args;
+}
+
+// Planar input audio, one vector per channel
+typedef std::vector<std::vector<float>> PlanarAudio;
+
+PlanarAudio make_sine(uint32_t sample_rate, size_t channels, size_t frames, double frequency,
+		      float amplitude)
+{
+	PlanarAudio audio(channels, std::vector<float>(frames));
+	for (size_t i = 0; i < frames; ++i) {
+		const float v = amplitude * (float)std::sin(2.0 * M_PI * frequency * (double)i /
+							    (double)sample_rate);
+		for (size_t c = 0; c < channels; ++c) {
+			audio[c][i] = v;
+		}
+	}
+	return audio;
+}
+
+PlanarAudio make_noise(size_t channels, size_t frames)
+{
+	PlanarAudio audio(channels, std::vector<float>(frames));
+	uint32_t seed = 12345;
+	for (size_t c = 0; c < channels; ++c) {
+		for (size_t i = 0; i < frames; ++i) {
+			seed = seed * 1664525u + 1013904223u;
+			audio[c][i] = (float)(seed >> 8) / (float)(1u << 24) - 0.5f;
+		}
+	}
+	return audio;
+}
+
+// Runs the audio through a 16 kHz mono conversion in OBS sized packets
+typedef std::function<void(const float *const *, size_t, std::vector<float> &)> ConvertFn;
+
+std::vector<float> convert_in_packets(const PlanarAudio &audio, const ConvertFn &convert)
+{
+	std::vector<float> output;
+	const size_t frames = audio[0].size();
+	std::vector<const float *> ptrs(audio.size());
+	for (size_t offset = 0; offset < frames; offset += PACKET_FRAMES) {
+		for (size_t c = 0; c < audio.size(); ++c) {
+			ptrs[c] = audio[c].data() + offset;
+		}
+		convert(ptrs.data(), std::min(PACKET_FRAMES, frames - offset), output);
+	}
+	return output;
+}
+
+struct ResamplerPath {
+	audio_resampler_t *resampler = nullptr;
+
+	bool init(uint32_t sample_rate, size_t channels)
+	{
+		resample_info src;
+		src.samples_per_sec = sample_rate;
+		src.format = AUDIO_FORMAT_FLOAT_PLANAR;
+		src.speakers = convert_speaker_layout((uint8_t)channels);
+		resample_info dst;
+		dst.samples_per_sec = 16000;
+		dst.format = AUDIO_FORMAT_FLOAT_PLANAR;
+		dst.speakers = convert_speaker_layout((uint8_t)1);
+		resampler = audio_resampler_create(&dst, &src);
+		return resampler != nullptr;
+	}
+	~ResamplerPath()
+	{
+		if (resampler) {
+			audio_resampler_destroy(resampler);
+		}
+	}
+	void operator()(const float *const *input, size_t frames, std::vector<float> &output)
+	{
+		uint8_t *out[MAX_AV_PLANES];
+		memset(out, 0, sizeof(out));
+		uint32_t out_frames = 0;
+		uint64_t ts_offset = 0;
+		audio_resampler_resample(resampler, out, &out_frames, &ts_offset,
+					 (const uint8_t **)input, (uint32_t)frames);
+		const float *samples = (const float *)out[0];
+		output.insert(output.end(), samples, samples + out_frames);
+	}
+};
+
+struct DecimatorPath {
+	AudioDecimator decimator;
+	std::vector<float> buffer;
+
+	bool init(uint32_t sample_rate, size_t channels, AudioDecimatorKernel kernel)
+	{
+		if (!decimator.init(sample_rate, channels, PACKET_FRAMES, 16000, kernel)) {
+			return false;
+		}
+		buffer.resize(decimator.max_output_frames(PACKET_FRAMES));
+		return true;
+	}
+	void operator()(const float *const *input, size_t frames, std::vector<float> &output)
+	{
+		const size_t n = decimator.process(input, frames, buffer.data());
+		output.insert(output.end(), buffer.begin(), buffer.begin() + n);
+	}
+};
+
+double rms(const float *samples, size_t n)
+{
+	double sum = 0.0;
+	for (size_t i = 0; i < n; ++i) {
+		sum += (double)samples[i] * samples[i];
+	}
+	return n > 0 ? std::sqrt(sum / (double)n) : 0.0;
+}
+
+double gain_db(const std::vector<float> &output, float amplitude)
+{
+	// skip the filter warm-up, the resampler has a few ms of delay
+	const size_t skip = std::min(output.size(), (size_t)4000);
+	const double out_rms = rms(output.data() + skip, output.size() - skip);
+	const double in_rms = amplitude / std::sqrt(2.0);
+	return 20.0 * std::log10(std::max(out_rms, 1e-12) / in_rms);
+}
+
+/*
+ * resampler [sample_rate] [channels] [seconds]
+ *
+ * Compares the decimator fast path against the libobs resampler: throughput of every kernel
+ * available on this CPU and the frequency response of both paths. Fails if the decimator
+ * passband differs from the resampler or its stopband attenuation is too low.
+ */
+int run_resampler(const std::vector<std::string> &args)
+{
+	const uint32_t sample_rate = args.size() > 0 ? (uint32_t)std::stoul(args[0]) : 48000;
+	const size_t channels = args.size() > 1 ? (size_t)std::stoul(args[1]) : 2;
+	const double seconds = args.size() > 2 ? std::stod(args[2]) : 60.0;
+
+	if (!AudioDecimator::is_supported(sample_rate, channels)) {
+		fprintf(stderr, "decimator does not support %u Hz with %zu channels\n", sample_rate,
+			channels);
+		return 1;
+	}
+
+	const AudioDecimatorKernel kernels[] = {
+		AUDIO_DECIMATOR_KERNEL_SCALAR,
+		AUDIO_DECIMATOR_KERNEL_SSE,
+		AUDIO_DECIMATOR_KERNEL_AVX2,
+		AUDIO_DECIMATOR_KERNEL_NEON,
+	};
+
+	// throughput
+	const PlanarAudio noise = make_noise(channels, (size_t)(seconds * sample_rate));
+	printf("throughput (%u Hz, %zu channels, %.0f s of audio, %zu frame packets)\n",
+	       sample_rate, channels, seconds, PACKET_FRAMES);
+	{
+		ResamplerPath resampler;
+		if (!resampler.init(sample_rate, channels)) {
+			fprintf(stderr, "failed to create resampler\n");
+			return 1;
+		}
+		const auto start = std::chrono::steady_clock::now();
+		const auto out = convert_in_packets(noise, std::ref(resampler));
+		const double elapsed = seconds_since(start);
+		printf("  %-10s %8.3f s  %8.0fx realtime  (%zu samples)\n", "resampler", elapsed,
+		       seconds / elapsed, out.size());
+	}
+	for (const auto kernel : kernels) {
+		if (!AudioDecimator::kernel_available(kernel)) {
+			continue;
+		}
+		DecimatorPath decimator;
+		if (!decimator.init(sample_rate, channels, kernel)) {
+			continue;
+		}
+		const auto start = std::chrono::steady_clock::now();
+		const auto out = convert_in_packets(noise, std::ref(decimator));
+		const double elapsed = seconds_since(start);
+		printf("  %-10s %8.3f s  %8.0fx realtime  (%zu samples)\n",
+		       AudioDecimator::kernel_name(kernel), elapsed, seconds / elapsed, out.size());
+	}
+
+	// frequency response
+	const double frequencies[] = {100,  440,  1000, 2000, 3000,  4000,  5000,  6000,
+				      6500, 7000, 7500, 8000, 8500, 9000, 10000, 12000,
+				      15000, 18000, 20000};
+	const float amplitude = 0.5f;
+	const double max_passband_deviation_db = 1.0;
+	const double min_stopband_attenuation_db = 50.0;
+	bool ok = true;
+
+	printf("\nfrequency response (gain in dB)\n");
+	printf("  %8s %10s %10s\n", "Hz", "resampler", "decimator");
+	for (const double frequency : frequencies) {
+		if (frequency >= sample_rate / 2.0) {
+			continue;
+		}
+		const PlanarAudio sine = make_sine(sample_rate, channels, sample_rate, frequency,
+						   amplitude);
+		ResamplerPath resampler;
+		DecimatorPath decimator;
+		if (!resampler.init(sample_rate, channels) ||
+		    !decimator.init(sample_rate, channels, AUDIO_DECIMATOR_KERNEL_AUTO)) {
+			fprintf(stderr, "failed to create converters\n");
+			return 1;
+		}
+		const double ref = gain_db(convert_in_packets(sine, std::ref(resampler)), amplitude);
+		const double dec = gain_db(convert_in_packets(sine, std::ref(decimator)), amplitude);
+
+		const char *verdict = "";
+		if (frequency <= 6500 && std::fabs(dec - ref) > max_passband_deviation_db) {
+			verdict = "  <- passband deviation";
+			ok = false;
+		} else if (frequency >= 9000 && dec > -min_stopband_attenuation_db) {
+			verdict = "  <- insufficient attenuation";
+			ok = false;
+		}
+		printf("  %8.0f %10.2f %10.2f%s\n", frequency, ref, dec, verdict);
+	}
+
+	printf("\n%s\n", ok ? "PASS" : "FAIL");
+	return ok ? 0 : 1;
+}
+
+// make_speech_like() alternates 2 s of voiced sound and 2 s of background noise
+bool speech_like_is_voiced(size_t sample)
+{
+	return ((sample / 32000) % 2) == 0;
+}
+
+// 16 kHz mono test signal: 2 s of voiced, syllable-modulated harmonics alternating with 2 s of
+// low level noise
+std::vector<float> make_speech_like(size_t samples)
+{
+	std::vector<float> audio(samples);
+	uint32_t seed = 4321;
+	for (size_t i = 0; i < samples; ++i) {
+		seed = seed * 1664525u + 1013904223u;
+		const float noise = (float)(seed >> 8) / (float)(1u << 24) - 0.5f;
+		const double t = (double)i / 16000.0;
+		const bool voiced = speech_like_is_voiced(i);
+		float v = 0.002f * noise;
+		if (voiced) {
+			const double f0 = 120.0 + 30.0 * std::sin(2.0 * M_PI * 0.5 * t);
+			const double envelope = 0.5 + 0.5 * std::sin(2.0 * M_PI * 4.0 * t);
+			double s = 0.0;
+			for (int h = 1; h <= 10; ++h) {
+				s += std::sin(2.0 * M_PI * f0 * h * t) / h;
+			}
+			v += (float)(0.2 * envelope * s) + 0.02f * noise;
+		}
+		audio[i] = v;
+	}
+	return audio;
+}
+
+/*
+ * vad <silero_vad.onnx> [seconds]
+ *
+ * Runs Silero VAD over a synthetic signal with tensors created for every window (the previous
+ * implementation, still used as fallback) and with the preallocated IoBinding. Prints windows
+ * per second and heap allocations per window, and fails if the two paths do not find the same
+ * speech segments.
+ */
+int run_vad(const std::vector<std::string> &args)
+{
+	if (args.empty()) {
+		fprintf(stderr, "vad: missing the path to the Silero VAD model\n");
+		return 1;
+	}
+	const double seconds = args.size() > 1 ? std::stod(args[1]) : 60.0;
+	const std::vector<float> audio = make_speech_like((size_t)(seconds * 16000));
+#ifdef _WIN32
+	const SileroString model_path(args[0].begin(), args[0].end());
+#else
+	const SileroString model_path = args[0];
+#endif
+	// same parameters as the filter
+	VadIterator vad(model_path, 16000, 32, 0.5f, 100, 100, 100);
+	const size_t windows = audio.size() / (size_t)vad.get_window_size_samples();
+
+	printf("VAD over %.0f s of audio (%zu windows)\n", seconds, windows);
+	std::vector<timestamp_t> reference;
+	bool ok = true;
+	for (const bool io_binding : {false, true}) {
+		if (!vad.set_io_binding(io_binding)) {
+			printf("  %-12s not available\n", "io binding");
+			ok = false;
+			continue;
+		}
+		// warm up the session and the buffers
+		vad.process(audio.data(), std::min(audio.size(), (size_t)16000), true);
+
+		const uint64_t allocations_before = heap_allocations.load();
+		const auto start = std::chrono::steady_clock::now();
+		vad.process(audio.data(), audio.size(), true);
+		const double elapsed = seconds_since(start);
+		const uint64_t allocations = heap_allocations.load() - allocations_before;
+
+		const std::vector<timestamp_t> &speeches = vad.get_speech_timestamps();
+		printf("  %-12s %8.3f s  %10.0f windows/s  %6.2f allocations/window  %zu segments\n",
+		       io_binding ? "io binding" : "per window", elapsed,
+		       (double)windows / elapsed, (double)allocations / (double)windows,
+		       speeches.size());
+		if (!io_binding) {
+			reference = speeches;
+		} else if (speeches != reference) {
+			printf("  speech segments differ from the per window run\n");
+			ok = false;
+		}
+	}
+
+	// streaming in packet sized chunks (a 48 kHz packet decimates to 341 frames) must find
+	// the same segments as the batch run
+	const size_t chunk = PACKET_FRAMES / 3;
+	std::vector<VadEvent> events;
+	vad.stream_reset();
+	const auto start = std::chrono::steady_clock::now();
+	for (size_t offset = 0; offset < audio.size(); offset += chunk) {
+		vad.stream_process(audio.data() + offset, std::min(chunk, audio.size() - offset),
+				   events);
+	}
+	const double elapsed = seconds_since(start);
+	std::vector<timestamp_t> streamed;
+	for (const VadEvent &event : events) {
+		if (event.type == VAD_EVENT_SPEECH_START) {
+			streamed.emplace_back((int)event.sample, -1);
+		} else if (!streamed.empty()) {
+			streamed.back().end = (int)event.sample;
+		}
+	}
+	if (!streamed.empty() && streamed.back().end < 0) {
+		// the batch run closes the last segment at the end of the audio
+		streamed.back().end = (int)vad.stream_end();
+	}
+	printf("  %-12s %8.3f s  %10.0f windows/s  %zu events\n", "streaming", elapsed,
+	       (double)windows / elapsed, events.size());
+	if (streamed != reference) {
+		printf("  streamed speech segments differ from the batch run\n");
+		ok = false;
+	}
+
+	printf("\n%s\n", ok ? "PASS" : "FAIL");
+	return ok ? 0 : 1;
+}
+
+/*
+ * gate [seconds]
+ *
+ * Checks the SIMD kernels of the energy gate against the scalar one and measures their speed,
+ * then runs the gate over a synthetic signal of speech and background noise. Fails if a kernel
+ * differs from the scalar one or if a window of speech is gated.
+ */
+int run_gate(const std::vector<std::string> &args)
+{
+	const double seconds = args.empty() ? 60.0 : std::stod(args[0]);
+	const std::vector<float> audio = make_speech_like((size_t)(seconds * 16000));
+	const size_t window = 512;
+	const size_t windows = audio.size() / window;
+	bool ok = true;
+
+	printf("Energy gate over %.0f s of audio (%zu windows)\n", seconds, windows);
+	std::vector<EnergyMeasure> reference(windows);
+	for (const AudioDecimatorKernel kernel :
+	     {AUDIO_DECIMATOR_KERNEL_SCALAR, AUDIO_DECIMATOR_KERNEL_SSE,
+	      AUDIO_DECIMATOR_KERNEL_AVX2, AUDIO_DECIMATOR_KERNEL_NEON}) {
+		if (!AudioDecimator::kernel_available(kernel)) {
+			continue;
+		}
+		double max_rms_error = 0.0;
+		double max_peak_error = 0.0;
+		double max_zcr_error = 0.0;
+		const auto start = std::chrono::steady_clock::now();
+		for (size_t w = 0; w < windows; ++w) {
+			const EnergyMeasure m =
+				EnergyGate::measure(audio.data() + w * window, window, kernel);
+			if (kernel == AUDIO_DECIMATOR_KERNEL_SCALAR) {
+				reference[w] = m;
+				continue;
+			}
+			const EnergyMeasure &r = reference[w];
+			max_rms_error = std::max(max_rms_error,
+						 std::fabs((double)(m.rms - r.rms)) /
+							 std::max((double)r.rms, 1e-9));
+			max_peak_error =
+				std::max(max_peak_error, std::fabs((double)(m.peak - r.peak)));
+			max_zcr_error = std::max(
+				max_zcr_error,
+				std::fabs((double)(m.zero_crossing_rate - r.zero_crossing_rate)));
+		}
+		const double elapsed = seconds_since(start);
+		printf("  %-8s %10.0f windows/s  rms error %.2e  peak error %.2e  zcr error %.2e\n",
+		       AudioDecimator::kernel_name(kernel), (double)windows / elapsed, max_rms_error,
+		       max_peak_error, max_zcr_error);
+		if (max_rms_error > 1e-4 || max_peak_error > 0.0 || max_zcr_error > 0.0) {
+			printf("  %s differs from the scalar kernel\n",
+			       AudioDecimator::kernel_name(kernel));
+			ok = false;
+		}
+	}
+
+	// only windows entirely in speech or in noise are counted
+	EnergyGate gate;
+	size_t speech_windows = 0;
+	size_t speech_gated = 0;
+	size_t noise_windows = 0;
+	size_t noise_gated = 0;
+	for (size_t w = 0; w < windows; ++w) {
+		const bool gated = gate.classify(audio.data() + w * window, window);
+		const bool first_voiced = speech_like_is_voiced(w * window);
+		if (first_voiced != speech_like_is_voiced(w * window + window - 1)) {
+			continue;
+		}
+		if (first_voiced) {
+			speech_windows++;
+			speech_gated += gated ? 1 : 0;
+		} else {
+			noise_windows++;
+			noise_gated += gated ? 1 : 0;
+		}
+	}
+	printf("  gated: %zu of %zu speech windows, %zu of %zu noise windows (%.1f%%), noise floor %.1f dB\n",
+	       speech_gated, speech_windows, noise_gated, noise_windows,
+	       100.0 * (double)noise_gated / (double)std::max<size_t>(noise_windows, 1),
+	       gate.noise_floor_db());
+	if (speech_gated > 0) {
+		printf("  speech windows were gated\n");
+		ok = false;
+	}
+
+	printf("\n%s\n", ok ? "PASS" : "FAIL");
+	return ok ? 0 : 1;
+}
+
+// Events and the duration of every stream_process() call that ran the model, for one stream
+struct VadStreamRun {
+	std::vector<VadEvent> events;
+	std::vector<double> call_ms;
+};
+
+double percentile(std::vector<double> values, double p)
+{
+	if (values.empty()) {
+		return 0.0;
+	}
+	std::sort(values.begin(), values.end());
+	return values[std::min(values.size() - 1, (size_t)(p * (double)values.size()))];
+}
+
+// Streams the audio through every iterator from its own thread, like the whisper threads of
+// several filters, and returns the wall time
+double stream_vad_threads(std::vector<std::unique_ptr<VadIterator>> &vads,
+			  const std::vector<std::vector<float>> &audio,
+			  std::vector<VadStreamRun> &runs)
+{
+	const size_t chunk = PACKET_FRAMES / 3;
+	runs.assign(vads.size(), VadStreamRun());
+	std::vector<std::thread> threads;
+	const auto start = std::chrono::steady_clock::now();
+	for (size_t s = 0; s < vads.size(); ++s) {
+		threads.emplace_back([&, s] {
+			VadIterator &vad = *vads[s];
+			const std::vector<float> &samples = audio[s];
+			VadStreamRun &run = runs[s];
+			run.call_ms.reserve(samples.size() / chunk + 1);
+			vad.stream_reset();
+			for (size_t offset = 0; offset < samples.size(); offset += chunk) {
+				const uint64_t classified = vad.stream_classified_end();
+				const auto call_start = std::chrono::steady_clock::now();
+				vad.stream_process(samples.data() + offset,
+						   std::min(chunk, samples.size() - offset),
+						   run.events);
+				if (vad.stream_classified_end() != classified) {
+					run.call_ms.push_back(seconds_since(call_start) * 1000.0);
+				}
+			}
+		});
+	}
+	for (auto &thread : threads) {
+		thread.join();
+	}
+	return seconds_since(start);
+}
+
+/*
+ * vad-service <silero_vad.onnx> [streams] [seconds] [batch_delay_us]
+ *
+ * Streams the same audio from several threads, once with a VadIterator and ONNX session per
+ * stream (the previous setup) and once through the shared VadService. Prints the throughput of
+ * both and the latency of the calls that ran the model, i.e. the latency a stream pays for
+ * batching, and fails if any stream finds different speech events in the two runs.
+ */
+int run_vad_service(const std::vector<std::string> &args)
+{
+	if (args.empty()) {
+		fprintf(stderr, "vad-service: missing the path to the Silero VAD model\n");
+		return 1;
+	}
+	const size_t num_streams = args.size() > 1 ? (size_t)std::stoul(args[1]) : 8;
+	const double seconds = args.size() > 2 ? std::stod(args[2]) : 30.0;
+	const long batch_delay_us = args.size() > 3 ? std::stol(args[3]) : 0;
+#ifdef _WIN32
+	const SileroString model_path(args[0].begin(), args[0].end());
+#else
+	const SileroString model_path = args[0];
+#endif
+
+	// every stream gets the signal shifted by a different amount, so a state mix-up between
+	// the streams shows in the events
+	const std::vector<float> base = make_speech_like((size_t)(seconds * 16000));
+	std::vector<std::vector<float>> audio(num_streams, base);
+	for (size_t s = 0; s < num_streams; ++s) {
+		std::rotate(audio[s].begin(), audio[s].begin() + (s * 7919) % base.size(),
+			    audio[s].end());
+	}
+	const double windows = (double)(num_streams * (base.size() / 512));
+
+	printf("VAD of %zu streams x %.0f s of audio\n", num_streams, seconds);
+	std::vector<VadStreamRun> separate_runs;
+	std::vector<VadStreamRun> shared_runs;
+	double separate_seconds = 0.0;
+	double shared_seconds = 0.0;
+	VadService::stats service_stats;
+	{
+		std::vector<std::unique_ptr<VadIterator>> vads;
+		for (size_t s = 0; s < num_streams; ++s) {
+			vads.emplace_back(std::make_unique<VadIterator>(model_path, 16000, 32, 0.5f,
+									100, 100, 100));
+		}
+		separate_seconds = stream_vad_threads(vads, audio, separate_runs);
+	}
+	{
+		std::shared_ptr<VadService> service = VadService::acquire(model_path);
+		service->set_max_batch_delay(std::chrono::microseconds(batch_delay_us));
+		std::vector<std::unique_ptr<VadIterator>> vads;
+		for (size_t s = 0; s < num_streams; ++s) {
+			vads.emplace_back(
+				std::make_unique<VadIterator>(service, 0.5f, 100, 100, 100));
+		}
+		shared_seconds = stream_vad_threads(vads, audio, shared_runs);
+		service_stats = service->get_stats();
+	}
+
+	std::vector<double> separate_ms;
+	std::vector<double> shared_ms;
+	bool ok = true;
+	for (size_t s = 0; s < num_streams; ++s) {
+		separate_ms.insert(separate_ms.end(), separate_runs[s].call_ms.begin(),
+				   separate_runs[s].call_ms.end());
+		shared_ms.insert(shared_ms.end(), shared_runs[s].call_ms.begin(),
+				 shared_runs[s].call_ms.end());
+		const std::vector<VadEvent> &a = separate_runs[s].events;
+		const std::vector<VadEvent> &b = shared_runs[s].events;
+		if (a.size() != b.size() ||
+		    !std::equal(a.begin(), a.end(), b.begin(),
+				[](const VadEvent &x, const VadEvent &y) {
+					return x.type == y.type && x.sample == y.sample;
+				})) {
+			printf("  stream %zu: speech events differ between the two runs\n", s);
+			ok = false;
+		}
+	}
+
+	printf("  %-18s %8.3f s  %10.0f windows/s  latency p50 %7.3f ms  p99 %7.3f ms\n",
+	       "session per stream", separate_seconds, windows / separate_seconds,
+	       percentile(separate_ms, 0.5), percentile(separate_ms, 0.99));
+	printf("  %-18s %8.3f s  %10.0f windows/s  latency p50 %7.3f ms  p99 %7.3f ms\n",
+	       "shared, batched", shared_seconds, windows / shared_seconds,
+	       percentile(shared_ms, 0.5), percentile(shared_ms, 0.99));
+	printf("  %.2fx throughput, %.2f windows per run on average (batch delay %ld us), added latency p50 %+.3f ms  p99 %+.3f ms\n",
+	       separate_seconds / shared_seconds,
+	       service_stats.runs > 0 ? (double)service_stats.windows / (double)service_stats.runs
+				      : 0.0,
+	       batch_delay_us, percentile(shared_ms, 0.5) - percentile(separate_ms, 0.5),
+	       percentile(shared_ms, 0.99) - percentile(separate_ms, 0.99));
+
+	printf("\n%s\n", ok ? "PASS" : "FAIL");
+	return ok ? 0 : 1;
+}
+
+// raw 32 bit float samples, as written by ffmpeg -f f32le
+std::vector<float> read_f32_file(const std::string &path)
+{
+	std::vector<float> samples;
+	FILE *file = fopen(path.c_str(), "rb");
+	if (file == nullptr) {
+		throw std::runtime_error("cannot open " + path);
+	}
+	float buffer[4096];
+	size_t n;
+	while ((n = fread(buffer, sizeof(float), 4096, file)) > 0) {
+		samples.insert(samples.end(), buffer, buffer + n);
+	}
+	fclose(file);
+	return samples;
+}
+
+// Speech probability of every window of one stream, with the state carried from window to
+// window
+std::vector<float> native_probs(SileroVadNative &vad, const std::vector<float> &audio,
+				size_t windows)
+{
+	std::vector<float> probs(windows);
+	std::vector<float> state(SileroVadNative::STATE_SIZE, 0.0f);
+	std::vector<float> next_state(SileroVadNative::STATE_SIZE);
+	for (size_t w = 0; w < windows; ++w) {
+		vad.run(audio.data() + w * SileroVadNative::WINDOW_SIZE, 1, state.data(),
+			next_state.data(), &probs[w]);
+		state.swap(next_state);
+	}
+	return probs;
+}
+
+/*
+ * vad-native <silero_vad.onnx> [audio.f32] [weights_output]
+ *
+ * Runs the built-in Silero implementation next to ONNX Runtime over the same audio, either raw
+ * 16 kHz mono float samples (ffmpeg -i speech.wav -ar 16000 -ac 1 -f f32le speech.f32) or the
+ * synthetic signal. Compares the probability of every window for every kernel and the speech
+ * segments found through VadService with both engines, checks that batched runs match single
+ * stream runs and that the flat weight file (written to weights_output, or a temporary file)
+ * loads the same weights. Fails if a probability differs by more than 1e-4 from ONNX Runtime
+ * or if the segments differ.
+ */
+int run_vad_native(const std::vector<std::string> &args)
+{
+	if (args.empty()) {
+		fprintf(stderr, "vad-native: missing the path to the Silero VAD model\n");
+		return 1;
+	}
+#ifdef _WIN32
+	const SileroString model_path(args[0].begin(), args[0].end());
+#else
+	const SileroString model_path = args[0];
+#endif
+	const std::vector<float> audio = args.size() > 1 ? read_f32_file(args[1])
+							 : make_speech_like(60 * 16000);
+	const size_t window = SileroVadNative::WINDOW_SIZE;
+	const size_t windows = audio.size() / window;
+	if (windows == 0) {
+		fprintf(stderr, "vad-native: the audio is shorter than one window\n");
+		return 1;
+	}
+	bool ok = true;
+
+	printf("Silero VAD over %.1f s of audio (%zu windows)\n", (double)audio.size() / 16000.0,
+	       windows);
+	std::vector<float> reference(windows);
+	{
+		VadService service(model_path, 16000, (int64_t)window, VAD_ENGINE_ONNXRUNTIME);
+		std::vector<float> state(VadService::STATE_SIZE, 0.0f);
+		const auto start = std::chrono::steady_clock::now();
+		service.run(audio.data(), windows, state.data(), reference.data());
+		const double elapsed = seconds_since(start);
+		printf("  %-12s %10.0f windows/s\n", "onnxruntime", (double)windows / elapsed);
+	}
+
+	for (const AudioDecimatorKernel kernel :
+	     {AUDIO_DECIMATOR_KERNEL_SCALAR, AUDIO_DECIMATOR_KERNEL_SSE,
+	      AUDIO_DECIMATOR_KERNEL_AVX2, AUDIO_DECIMATOR_KERNEL_NEON}) {
+		if (!AudioDecimator::kernel_available(kernel)) {
+			continue;
+		}
+		SileroVadNative vad(model_path, kernel);
+		const auto start = std::chrono::steady_clock::now();
+		const std::vector<float> probs = native_probs(vad, audio, windows);
+		const double elapsed = seconds_since(start);
+		double max_error = 0.0;
+		size_t flips = 0;
+		for (size_t w = 0; w < windows; ++w) {
+			max_error = std::max(max_error,
+					     std::fabs((double)(probs[w] - reference[w])));
+			flips += (probs[w] >= 0.5f) != (reference[w] >= 0.5f) ? 1 : 0;
+		}
+		printf("  %-12s %10.0f windows/s  max error %.2e  %zu threshold flips\n",
+		       AudioDecimator::kernel_name(kernel), (double)windows / elapsed, max_error,
+		       flips);
+		if (max_error > 1e-4) {
+			printf("  %s differs from ONNX Runtime\n",
+			       AudioDecimator::kernel_name(kernel));
+			ok = false;
+		}
+	}
+
+	// the segments the filter would see, through the shared service of either engine
+	std::vector<timestamp_t> segments[2];
+	for (const VadEngine engine : {VAD_ENGINE_ONNXRUNTIME, VAD_ENGINE_NATIVE}) {
+		auto service = std::make_shared<VadService>(model_path, 16000, (int64_t)window,
+							    engine);
+		VadIterator vad(service, 0.5f, 100, 100, 100);
+		vad.process(audio.data(), audio.size(), true);
+		segments[engine] = vad.get_speech_timestamps();
+	}
+	printf("  %zu speech segments with ONNX Runtime, %zu with the built-in engine\n",
+	       segments[VAD_ENGINE_ONNXRUNTIME].size(), segments[VAD_ENGINE_NATIVE].size());
+	if (segments[VAD_ENGINE_ONNXRUNTIME] != segments[VAD_ENGINE_NATIVE]) {
+		printf("  speech segments differ between the engines\n");
+		ok = false;
+	}
+
+	// every stream of a batch gets the audio shifted by a different amount and must get the
+	// same probabilities as when it runs alone
+	SileroVadNative vad(model_path);
+	const size_t batch = 8;
+	const size_t batch_windows = std::min<size_t>(windows, 1000);
+	std::vector<std::vector<float>> streams(batch);
+	std::vector<std::vector<float>> single(batch);
+	for (size_t s = 0; s < batch; ++s) {
+		streams[s].assign(audio.begin(), audio.begin() + batch_windows * window);
+		std::rotate(streams[s].begin(),
+			    streams[s].begin() + (s * 7 % batch_windows) * window,
+			    streams[s].end());
+		single[s] = native_probs(vad, streams[s], batch_windows);
+	}
+	std::vector<float> input(batch * window);
+	std::vector<float> state(batch * SileroVadNative::STATE_SIZE, 0.0f);
+	std::vector<float> next_state(state.size());
+	std::vector<float> probs(batch);
+	size_t batch_mismatches = 0;
+	vad.reserve(batch);
+	const auto batch_start = std::chrono::steady_clock::now();
+	for (size_t w = 0; w < batch_windows; ++w) {
+		for (size_t s = 0; s < batch; ++s) {
+			std::copy(streams[s].begin() + w * window,
+				  streams[s].begin() + (w + 1) * window, input.begin() + s * window);
+		}
+		vad.run(input.data(), batch, state.data(), next_state.data(), probs.data());
+		state.swap(next_state);
+		for (size_t s = 0; s < batch; ++s) {
+			batch_mismatches += probs[s] != single[s][w] ? 1 : 0;
+		}
+	}
+	const double batch_elapsed = seconds_since(batch_start);
+	printf("  batch of %zu  %10.0f windows/s  %zu windows differ from single stream runs\n",
+	       batch, (double)(batch * batch_windows) / batch_elapsed, batch_mismatches);
+	if (batch_mismatches > 0) {
+		ok = false;
+	}
+
+	// flat weight file
+	const bool temporary = args.size() < 3;
+#ifdef _WIN32
+	const SileroString flat_path =
+		temporary ? (std::filesystem::temp_directory_path() / "silero_vad.bin").native()
+			  : SileroString(args[2].begin(), args[2].end());
+#else
+	const SileroString flat_path =
+		temporary ? (std::filesystem::temp_directory_path() / "silero_vad.bin").native()
+			  : args[2];
+#endif
+	SileroVadNative::convert(model_path, flat_path);
+	auto load_start = std::chrono::steady_clock::now();
+	SileroVadNative from_onnx(model_path);
+	const double onnx_load = seconds_since(load_start);
+	load_start = std::chrono::steady_clock::now();
+	SileroVadNative from_flat(flat_path);
+	const double flat_load = seconds_since(load_start);
+	const std::vector<float> onnx_probs = native_probs(from_onnx, audio, batch_windows);
+	const std::vector<float> flat_probs = native_probs(from_flat, audio, batch_windows);
+	printf("  load time %.2f ms from the ONNX file, %.2f ms from the flat file (%ju bytes)\n",
+	       onnx_load * 1000.0, flat_load * 1000.0,
+	       (uintmax_t)std::filesystem::file_size(flat_path));
+	if (temporary) {
+		std::filesystem::remove(flat_path);
+	}
+	if (onnx_probs != flat_probs) {
+		printf("  the flat weight file gives different probabilities\n");
+		ok = false;
+	}
+
+	printf("\n%s\n", ok ? "PASS" : "FAIL");
+	return ok ? 0 : 1;
+}
+
+/*
+ * scheduler [sources] [seconds] [thread_budget]
+ *
+ * Simulates busy filters on the inference scheduler. Every source submits a final job of 150 ms
+ * after two partials of 100 ms, all with 4 threads, so the sources together ask for more threads
+ * than the budget. The jobs sleep instead of computing: this checks the admission, not the
+ * CPU. Prints the statistics of every source and fails if the running jobs ever use more
+ * threads than the budget, if a partial is admitted while a final is waiting or if a source
+ * runs less than half as many finals as another.
+ */
+int run_scheduler(const std::vector<std::string> &args)
+{
+	const size_t num_sources = args.size() > 0 ? (size_t)std::stoul(args[0]) : 4;
+	const double seconds = args.size() > 1 ? std::stod(args[1]) : 10.0;
+	const int budget = args.size() > 2 ? std::stoi(args[2]) : 8;
+	const int job_threads = 4;
+
+	struct Admission {
+		bool partial;
+		double submitted_ms;
+		double admitted_ms;
+	};
+	InferenceScheduler scheduler(budget);
+	std::atomic<int> threads_in_use{0};
+	std::atomic<int> max_threads_in_use{0};
+	std::vector<size_t> finals(num_sources, 0);
+	std::vector<Admission> admissions;
+	std::mutex admissions_mutex;
+
+	printf("Inference scheduler: %zu sources x %d threads, budget %d threads, %.0f s\n",
+	       num_sources, job_threads, scheduler.get_thread_budget(), seconds);
+	const auto start = std::chrono::steady_clock::now();
+	const auto end = start + std::chrono::milliseconds((int64_t)(seconds * 1000));
+	std::vector<std::thread> threads;
+	for (size_t s = 0; s < num_sources; ++s) {
+		threads.emplace_back([&, s]() {
+			// the sources are out of phase, so that finals and partials compete
+			std::this_thread::sleep_for(std::chrono::milliseconds(30 * s));
+			for (size_t job = s; std::chrono::steady_clock::now() < end; ++job) {
+				const bool partial = job % 3 != 2;
+				const double submitted_ms = seconds_since(start) * 1000.0;
+				InferenceScheduler::Slot slot = scheduler.admit(
+					&finals[s],
+					partial ? INFERENCE_JOB_PARTIAL : INFERENCE_JOB_FINAL,
+					job_threads,
+					std::chrono::milliseconds(partial ? 300 : 0));
+				if (!slot) {
+					continue;
+				}
+				{
+					std::lock_guard<std::mutex> lock(admissions_mutex);
+					const double admitted_ms = seconds_since(start) * 1000.0;
+					admissions.push_back({partial, submitted_ms, admitted_ms});
+				}
+				const int in_use = threads_in_use += slot.threads();
+				int seen = max_threads_in_use.load();
+				while (in_use > seen &&
+				       !max_threads_in_use.compare_exchange_weak(seen, in_use)) {
+				}
+				std::this_thread::sleep_for(
+					std::chrono::milliseconds(partial ? 100 : 150));
+				threads_in_use -= slot.threads();
+				slot = InferenceScheduler::Slot();
+				if (!partial) {
+					finals[s]++;
+				}
+				// the audio of the next segment arrives
+				std::this_thread::sleep_for(std::chrono::milliseconds(20));
+			}
+		});
+	}
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
+
+	bool ok = true;
+	for (size_t s = 0; s < num_sources; ++s) {
+		const InferenceScheduler::source_stats stats = scheduler.get_stats(&finals[s]);
+		printf("  source %zu: %4zu finals  %4ju jobs  %4ju partials dropped  wait %7.1f ms  run %6.1f ms\n",
+		       s, finals[s], (uintmax_t)stats.jobs, (uintmax_t)stats.dropped_partials,
+		       stats.wait_ms, stats.run_ms);
+	}
+
+	// a final that was waiting when a partial got its slot, with some slack for the thread
+	// wakeups around the timestamps
+	const double slack_ms = 20.0;
+	size_t overtaken = 0;
+	double wait_ms[2] = {0.0, 0.0};
+	size_t count[2] = {0, 0};
+	for (const Admission &p : admissions) {
+		wait_ms[p.partial ? 1 : 0] += p.admitted_ms - p.submitted_ms;
+		count[p.partial ? 1 : 0]++;
+		if (!p.partial) {
+			continue;
+		}
+		for (const Admission &f : admissions) {
+			if (!f.partial && f.submitted_ms + slack_ms < p.admitted_ms &&
+			    f.admitted_ms > p.admitted_ms + slack_ms) {
+				overtaken++;
+				break;
+			}
+		}
+	}
+	printf("  mean wait: finals %.1f ms, partials %.1f ms; at most %d threads in use\n",
+	       wait_ms[0] / (double)std::max<size_t>(count[0], 1),
+	       wait_ms[1] / (double)std::max<size_t>(count[1], 1), max_threads_in_use.load());
+	if (max_threads_in_use > scheduler.get_thread_budget()) {
+		printf("  the running jobs used more threads than the budget\n");
+		ok = false;
+	}
+	if (overtaken > 0) {
+		printf("  %zu partials were admitted while a final was waiting\n", overtaken);
+		ok = false;
+	}
+	const size_t min_finals = *std::min_element(finals.begin(), finals.end());
+	const size_t max_finals = *std::max_element(finals.begin(), finals.end());
+	if (min_finals * 2 < max_finals) {
+		printf("  the sources were not served fairly\n");
+		ok = false;
+	}
+
+	printf("\n%s\n", ok ? "PASS" : "FAIL");
+	return ok ? 0 : 1;
+}
+
+// Text of a whisper_full run, on the samples or on the mel set in the state (no samples)
+std::string whisper_text(whisper_context *ctx, whisper_state *state,
+			 const whisper_full_params &params, const float *samples, size_t num_samples)
+{
+	if (whisper_full_with_state(ctx, state, params, samples, (int)num_samples) != 0) {
+		throw std::runtime_error("whisper_full failed");
+	}
+	std::string text;
+	for (int s = 0; s < whisper_full_n_segments_from_state(state); ++s) {
+		text += whisper_full_get_segment_text_from_state(state, s);
+	}
+	return text;
+}
+
+/*
+ * threads [whisper_model.bin] [cpu_list] [runs] [audio.f32]
+ *
+ * Checks the CPU list parsing of the "Inference CPUs" setting, then times short inferences: 1 s
+ * of audio (the start of the given raw 16 kHz mono float samples, or the synthetic signal)
+ * decoded greedily `runs` times (20 by default) by whisper_full_with_state from a thread that
+ * is not pinned, then from a thread pinned to the CPU list, as the whisper thread of the filter.
+ * The OpenMP runtime reads OMP_WAIT_POLICY when it loads, so the wait policy is compared by
+ * running the command again with OMP_WAIT_POLICY=ACTIVE and OMP_WAIT_POLICY=PASSIVE.
+ * Prints the mean and p95 time per inference of each run. Fails if a CPU list is parsed wrongly,
+ * if a pinned thread cannot be unpinned or if pinning changes the text.
+ */
+int run_threads(const std::vector<std::string> &args)
+{
+	const std::string model_path = args.size() > 0 ? args[0] : "";
+	const std::string cpu_list = args.size() > 1 ? args[1] : "";
+	const int runs = args.size() > 2 ? std::max(1, std::stoi(args[2])) : 20;
+
+	bool ok = true;
+	const struct {
+		const char *list;
+		bool valid;
+		std::vector<int> cpus;
+	} cases[] = {
+		{"", true, {}},
+		{"3", true, {3}},
+		{"0-3,6", true, {0, 1, 2, 3, 6}},
+		{" 1 , 4 - 5 ", true, {1, 4, 5}},
+		{"2,", true, {2}},
+		{"3-1", false, {}},
+		{"a", false, {}},
+		{"1-2-3", false, {}},
+		{"-1", false, {}},
+	};
+	for (const auto &c : cases) {
+		std::vector<int> cpus;
+		const bool valid = parse_cpu_list(c.list, cpus);
+		if (valid != c.valid || (valid && cpus != c.cpus)) {
+			printf("  CPU list '%s' parsed wrongly\n", c.list);
+			ok = false;
+		}
+	}
+
+	// the whisper thread is unpinned again when the CPU list is cleared
+	std::thread([&ok] {
+		std::vector<int> default_cpus;
+		if (!get_current_thread_affinity(default_cpus)) {
+			printf("  No thread affinity on this platform\n");
+			return;
+		}
+		std::vector<int> cpus;
+		if (!set_current_thread_affinity({default_cpus.front()}) ||
+		    !set_current_thread_affinity(default_cpus) ||
+		    !get_current_thread_affinity(cpus) || cpus != default_cpus) {
+			printf("  A pinned thread was not unpinned\n");
+			ok = false;
+		}
+	}).join();
+
+	if (model_path.empty()) {
+		printf("No whisper model given, no inference is timed\n");
+		printf("\n%s\n", ok ? "PASS" : "FAIL");
+		return ok ? 0 : 1;
+	}
+
+	std::vector<float> audio = args.size() > 3 ? read_f32_file(args[3])
+						   : make_speech_like(16000);
+	audio.resize(16000, 0.0f);
+	whisper_context_params cparams = whisper_context_default_params();
+	cparams.use_gpu = false;
+	whisper_context *ctx =
+		whisper_init_from_file_with_params_no_state(model_path.c_str(), cparams);
+	if (ctx == nullptr) {
+		throw std::runtime_error("cannot load " + model_path);
+	}
+	whisper_full_params params = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+	params.n_threads = (int)std::clamp(std::thread::hardware_concurrency(), 1u, 4u);
+	params.language = "en";
+	params.no_context = true;
+	params.single_segment = true;
+	params.print_progress = false;
+	params.print_realtime = false;
+	params.print_timestamps = false;
+
+	const char *wait_policy = getenv("OMP_WAIT_POLICY");
+	printf("Short inferences: 1 s of audio, %d threads, %d runs, OMP_WAIT_POLICY=%s\n",
+	       params.n_threads, runs, wait_policy != nullptr ? wait_policy : "(runtime default)");
+
+	// every run has its own thread, so that the OpenMP workers belong to it as they belong to
+	// the whisper thread
+	auto time_inferences = [&](const std::vector<int> &cpus, std::string &text) {
+		std::vector<double> inference_ms;
+		std::thread runner([&]() {
+			if (!cpus.empty() && !set_current_thread_affinity(cpus)) {
+				printf("  could not pin the thread\n");
+			}
+			whisper_state *state = whisper_init_state(ctx);
+			// the first inference allocates the compute buffers
+			text = whisper_text(ctx, state, params, audio.data(), audio.size());
+			for (int run = 0; run < runs; run++) {
+				const auto start = std::chrono::steady_clock::now();
+				whisper_text(ctx, state, params, audio.data(), audio.size());
+				inference_ms.push_back(1000.0 * seconds_since(start));
+			}
+			whisper_free_state(state);
+		});
+		runner.join();
+		double sum = 0.0;
+		for (double ms : inference_ms) {
+			sum += ms;
+		}
+		return std::make_pair(sum / (double)inference_ms.size(),
+				      percentile(inference_ms, 0.95));
+	};
+
+	std::string unpinned_text;
+	const auto unpinned = time_inferences({}, unpinned_text);
+	printf("  not pinned            mean %7.1f ms, p95 %7.1f ms\n", unpinned.first,
+	       unpinned.second);
+	std::vector<int> cpus;
+	if (!cpu_list.empty() && parse_cpu_list(cpu_list, cpus) && !cpus.empty()) {
+		std::string pinned_text;
+		const auto pinned = time_inferences(cpus, pinned_text);
+		printf("  pinned to '%s'  mean %7.1f ms, p95 %7.1f ms (%+.1f ms per inference)\n",
+		       cpu_list.c_str(), pinned.first, pinned.second,
+		       pinned.first - unpinned.first);
+		if (pinned_text != unpinned_text) {
+			printf("  pinning changes the text: '%s' vs. '%s'\n", unpinned_text.c_str(),
+			       pinned_text.c_str());
+			ok = false;
+		}
+	}
+	whisper_free(ctx);
+
+	printf("\n%s\n", ok ? "PASS" : "FAIL");
+	return ok ? 0 : 1;
+}
+
+/*
+ * agreement [segments] [seed]
+ *
+ * Streams simulated hypotheses of whisper through the local agreement. Every segment is 20 s
+ * of speech with a word each 250 ms. A partial runs every second on the audio left in the
+ * whisper buffer: its hypothesis is right up to the last two words, which are wrong half of the
+ * time, and its times are off by up to 40 ms. The same partials without the agreement decode
+ * the whole segment. Prints the audio decoded per partial and the caption words that a later
+ * partial may still change, with and without the agreement. Fails if a wrong word is committed,
+ * if a committed word changes or if the final text differs from the speech.
+ */
+int run_agreement(const std::vector<std::string> &args)
+{
+	const int num_segments = args.size() > 0 ? std::stoi(args[0]) : 20;
+	const unsigned seed = args.size() > 1 ? (unsigned)std::stoul(args[1]) : 1;
+	const uint64_t word_samples = 4000;
+	const uint64_t partial_samples = 16000;
+	const size_t num_words = 80;
+
+	std::mt19937 rng(seed);
+	int next_wrong_id = 100000;
+	auto hypothesis = [&](const std::vector<int> &words, uint64_t from, uint64_t to,
+			      bool noisy) {
+		std::vector<StreamToken> tokens;
+		for (size_t w = 0; w < words.size(); ++w) {
+			const uint64_t start = w * word_samples;
+			const uint64_t end = start + word_samples;
+			// whisper decodes the words that are in the audio, a cut word is guessed
+			if (end <= from || start >= to) {
+				continue;
+			}
+			const int jitter = (int)(rng() % 1281) - 640;
+			StreamToken token{words[w], " w" + std::to_string(words[w]), 0.9f,
+					  (uint64_t)std::max<int64_t>((int64_t)start + jitter, 0),
+					  (uint64_t)std::max<int64_t>((int64_t)end + jitter, 0)};
+			tokens.push_back(token);
+		}
+		if (noisy) {
+			for (size_t i = tokens.size() > 2 ? tokens.size() - 2 : 0; i < tokens.size();
+			     ++i) {
+				if (rng() % 2 == 0) {
+					tokens[i].id = next_wrong_id++;
+					tokens[i].text = " x" + std::to_string(tokens[i].id);
+				}
+			}
+		}
+		return tokens;
+	};
+	auto text_of = [](const std::vector<StreamToken> &tokens) {
+		std::string text;
+		for (const StreamToken &token : tokens) {
+			text += token.text;
+		}
+		return text;
+	};
+
+	bool ok = true;
+	uint64_t decoded_agreement = 0;
+	uint64_t decoded_full = 0;
+	size_t partials = 0;
+	size_t open_words_agreement = 0;
+	size_t open_words_full = 0;
+	size_t committed_words = 0;
+	LocalAgreement agreement;
+	for (int segment = 0; segment < num_segments; ++segment) {
+		std::vector<int> words(num_words);
+		for (int &word : words) {
+			// a small vocabulary, so words repeat
+			word = (int)(rng() % 50);
+		}
+		const uint64_t segment_end = num_words * word_samples;
+		uint64_t front = 0;
+		std::string committed;
+		for (uint64_t arrived = partial_samples; arrived < segment_end;
+		     arrived += partial_samples) {
+			partials++;
+			decoded_agreement += arrived - front;
+			decoded_full += arrived;
+
+			agreement.insert(hypothesis(words, front, arrived, true));
+			const std::string now_committed = agreement.committed_text();
+			if (now_committed.compare(0, committed.size(), committed) != 0) {
+				printf("  segment %d: a committed word changed\n", segment);
+				ok = false;
+			}
+			committed = now_committed;
+			// without the agreement every word of the caption comes from a new decode
+			open_words_agreement += agreement.tentative().size();
+			open_words_full += hypothesis(words, 0, arrived, true).size();
+
+			front = std::max(front, agreement.trim_position());
+		}
+		committed_words += agreement.committed().size();
+
+		std::string expected;
+		for (int word : words) {
+			expected += " w" + std::to_string(word);
+		}
+		if (committed.find(" x") != std::string::npos ||
+		    expected.compare(0, committed.size(), committed) != 0) {
+			printf("  segment %d: a wrong word was committed\n", segment);
+			ok = false;
+		}
+		const std::string final_text =
+			text_of(agreement.finish(hypothesis(words, front, segment_end, false)));
+		if (final_text != expected) {
+			printf("  segment %d: the final text differs from the speech\n", segment);
+			ok = false;
+		}
+	}
+
+	const double sample_rate = 16000.0;
+	const double per_partial = (double)std::max<size_t>(partials, 1) * sample_rate;
+	printf("Local agreement: %d segments of %.0f s, %zu partials, %.1f words committed per segment\n",
+	       num_segments, (double)(num_words * word_samples) / sample_rate, partials,
+	       (double)committed_words / std::max(num_segments, 1));
+	printf("  audio decoded per partial:     %5.2f s with the agreement, %5.2f s without\n",
+	       (double)decoded_agreement / per_partial, (double)decoded_full / per_partial);
+	printf("  caption words that may change: %5.1f with the agreement, %5.1f without\n",
+	       (double)open_words_agreement / (double)std::max<size_t>(partials, 1),
+	       (double)open_words_full / (double)std::max<size_t>(partials, 1));
+
+	printf("\n%s\n", ok ? "PASS" : "FAIL");
+	return ok ? 0 : 1;
+}
+
+/*
+ * audio-ctx
+ *
+ * Prints the encoder context picked for segments of 0.5 to 30 s and the share of the full
+ * context it encodes, and checks the detection of degenerate short context output. Fails if a
+ * context does not cover its segment and the margin, if a longer segment gets a smaller
+ * context or if a degenerate output is not detected (or a normal one is).
+ */
+int run_audio_ctx(const std::vector<std::string> &)
+{
+	bool ok = true;
+	printf("Encoder context per segment length:\n");
+	int previous = 1;
+	for (double seconds = 0.5; seconds <= 30.0; seconds += 0.5) {
+		const size_t samples = (size_t)(seconds * 16000.0);
+		const int ctx = audio_ctx_for_samples(samples);
+		const int effective = ctx == 0 ? 1500 : ctx;
+		const double covered = (double)effective / AUDIO_CTX_PER_SECOND;
+		if (ctx != 0 && covered < seconds + AUDIO_CTX_MARGIN_MSEC / 1000.0) {
+			printf("  %.1f s: audio_ctx %d covers only %.2f s\n", seconds, ctx, covered);
+			ok = false;
+		}
+		if (effective < previous) {
+			printf("  %.1f s: audio_ctx %d is smaller than for a shorter segment\n",
+			       seconds, ctx);
+			ok = false;
+		}
+		if (effective != previous) {
+			printf("  from %4.1f s: audio_ctx %4d (%3.0f%% of the full context)\n",
+			       seconds, effective, 100.0 * effective / 1500.0);
+		}
+		previous = effective;
+	}
+
+	// more tokens than anyone says in 2 s
+	std::vector<int> burst;
+	for (int i = 0; i < 60; ++i) {
+		burst.push_back(100 + i);
+	}
+	const struct {
+		const char *name;
+		std::vector<int> ids;
+		float mean_p;
+		double seconds;
+		bool degenerate;
+	} cases[] = {
+		{"normal sentence", {10, 11, 12, 13, 14, 15, 16, 17}, 0.8f, 2.0, false},
+		{"repeated word in a sentence", {10, 11, 11, 12, 13}, 0.8f, 2.0, false},
+		{"no text", {}, 0.0f, 2.0, true},
+		{"low confidence", {10, 11, 12}, 0.2f, 2.0, true},
+		{"burst of tokens", burst, 0.8f, 2.0, true},
+		{"word loop", {10, 11, 12, 12, 12, 12, 12}, 0.8f, 2.0, true},
+		{"phrase loop",
+		 {10, 20, 21, 22, 20, 21, 22, 20, 21, 22, 20, 21, 22},
+		 0.8f,
+		 5.0,
+		 true},
+	};
+	for (const auto &c : cases) {
+		const char *reason = audio_ctx_degenerate_reason(c.ids, c.mean_p, 0.4f, c.seconds);
+		printf("  %-28s %s\n", c.name, reason != nullptr ? reason : "ok");
+		if ((reason != nullptr) != c.degenerate) {
+			ok = false;
+		}
+	}
+
+	printf("\n%s\n", ok ? "PASS" : "FAIL");
+	return ok ? 0 : 1;
+}
+
+// Log-mel frames of a signal computed the way whisper.cpp's log_mel_spectrogram does: frame i
+// is centred on samples[i * 160], with the 200 samples before the signal reflected and zeros
+// after it, the Hann window, the power spectrum (an exact DFT in double instead of the FFT),
+// the mel filters summed in double and log10. num_frames rows of n_mel values, not normalized.
+std::vector<float> whisper_log_mel(const std::vector<float> &filters, int n_mel,
+				   const float *samples, size_t num_samples, size_t num_frames)
+{
+	const int n_fft = MelCache::FFT_SIZE;
+	const int n_bins = MelCache::N_BINS;
+	const int half = n_fft / 2;
+	std::vector<float> padded(half + std::max(num_samples, num_frames * MelCache::HOP) + n_fft,
+				  0.0f);
+	for (int i = 0; i < half && i + 1 < (int)num_samples; ++i) {
+		padded[half - 1 - i] = samples[i + 1];
+	}
+	std::copy(samples, samples + num_samples, padded.begin() + half);
+
+	static std::vector<double> table;
+	if (table.empty()) {
+		table.resize((size_t)n_bins * 2 * n_fft);
+		for (int b = 0; b < n_bins; ++b) {
+			for (int i = 0; i < n_fft; ++i) {
+				const double angle = 2.0 * M_PI * ((b * i) % n_fft) / n_fft;
+				table[(size_t)b * 2 * n_fft + i] = std::cos(angle);
+				table[(size_t)b * 2 * n_fft + n_fft + i] = std::sin(angle);
+			}
+		}
+	}
+	std::vector<float> hann(n_fft);
+	for (int i = 0; i < n_fft; ++i) {
+		hann[i] = (float)(0.5 * (1.0 - std::cos(2.0 * M_PI * i / n_fft)));
+	}
+
+	std::vector<float> log_mel(num_frames * n_mel);
+	std::vector<float> power(n_bins);
+	std::vector<double> windowed(n_fft);
+	for (size_t f = 0; f < num_frames; ++f) {
+		const float *frame = padded.data() + f * MelCache::HOP;
+		for (int i = 0; i < n_fft; ++i) {
+			windowed[i] = (double)(hann[i] * frame[i]);
+		}
+		for (int b = 0; b < n_bins; ++b) {
+			const double *c = table.data() + (size_t)b * 2 * n_fft;
+			double re = 0.0;
+			double im = 0.0;
+			for (int i = 0; i < n_fft; ++i) {
+				re += windowed[i] * c[i];
+				im += windowed[i] * c[n_fft + i];
+			}
+			power[b] = (float)(re * re + im * im);
+		}
+		for (int m = 0; m < n_mel; ++m) {
+			double sum = 0.0;
+			for (int b = 0; b < n_bins; ++b) {
+				sum += power[b] * filters[(size_t)m * n_bins + b];
+			}
+			log_mel[f * n_mel + m] = (float)std::log10(std::max(sum, 1e-10));
+		}
+	}
+	return log_mel;
+}
+
+// whisper's normalization of log-mel frames, to n_mel rows of the frames followed by the
+// silence frames as MelCache::build() returns them
+std::vector<float> whisper_normalize(const std::vector<float> &log_mel, int n_mel,
+				     size_t num_frames)
+{
+	const size_t n_len = num_frames + MelCache::PADDING_FRAMES;
+	float max_value = -10.0f;
+	for (const float v : log_mel) {
+		max_value = std::max(max_value, v);
+	}
+	const float min_value = max_value - 8.0f;
+	std::vector<float> mel((size_t)n_mel * n_len, (std::max(-10.0f, min_value) + 4.0f) / 4.0f);
+	for (size_t f = 0; f < num_frames; ++f) {
+		for (int m = 0; m < n_mel; ++m) {
+			mel[(size_t)m * n_len + f] =
+				(std::max(log_mel[f * n_mel + m], min_value) + 4.0f) / 4.0f;
+		}
+	}
+	return mel;
+}
+
+/*
+ * mel [whisper_model.bin] [audio.f32]
+ *
+ * Checks the rolling log-mel cache that replaces the spectrogram whisper computes for every
+ * inference, over raw 16 kHz mono float samples or the synthetic signal. Compares the power
+ * spectrum kernels with the scalar one, and the mel built from the cache, fed in packets while
+ * the front of the buffer moves as in streaming, with a port of whisper.cpp's
+ * log_mel_spectrogram (80 and 128 bands). Prints the time to prepare the mel of a partial over
+ * a 10 s buffer, recomputed and from the cache. With a model, the mel of whisper.cpp itself is
+ * compared through the model: the language probabilities and the decoded text of the samples
+ * and of the cached mel. Fails if a kernel or a value differs by more than 1e-3, or if the
+ * language or the text differ.
+ */
+int run_mel(const std::vector<std::string> &args)
+{
+	const std::string model_path = args.empty() ? "" : args[0];
+	const std::vector<float> audio = args.size() > 1 ? read_f32_file(args[1])
+							 : make_speech_like(20 * 16000);
+	if (audio.size() < 4 * 16000) {
+		fprintf(stderr, "mel: the audio is shorter than 4 s\n");
+		return 1;
+	}
+	const size_t total_frames = audio.size() / MelCache::HOP;
+	bool ok = true;
+
+	MelCache cache;
+	cache.init(80);
+	const size_t kernel_frames = std::min<size_t>(total_frames, 1000);
+	printf("Power spectrum kernels over %zu frames\n", kernel_frames);
+	std::vector<float> reference;
+	for (const AudioDecimatorKernel kernel :
+	     {AUDIO_DECIMATOR_KERNEL_SCALAR, AUDIO_DECIMATOR_KERNEL_SSE,
+	      AUDIO_DECIMATOR_KERNEL_AVX2, AUDIO_DECIMATOR_KERNEL_NEON}) {
+		if (!AudioDecimator::kernel_available(kernel)) {
+			continue;
+		}
+		std::vector<float> frames;
+		const auto start = std::chrono::steady_clock::now();
+		cache.compute_frames(audio.data(), audio.size(), kernel_frames, frames, kernel);
+		const double elapsed = seconds_since(start);
+		double max_error = 0.0;
+		if (kernel == AUDIO_DECIMATOR_KERNEL_SCALAR) {
+			reference = frames;
+		}
+		for (size_t i = 0; i < frames.size(); ++i) {
+			max_error =
+				std::max(max_error, std::fabs((double)(frames[i] - reference[i])));
+		}
+		printf("  %-8s %10.0f frames/s  max error %.2e\n",
+		       AudioDecimator::kernel_name(kernel), (double)kernel_frames / elapsed,
+		       max_error);
+		if (max_error > 1e-3) {
+			printf("  %s differs from the scalar kernel\n",
+			       AudioDecimator::kernel_name(kernel));
+			ok = false;
+		}
+	}
+
+	printf("Streaming cache vs. whisper.cpp's log_mel_spectrogram\n");
+	for (const int n_mel : {80, 128}) {
+		cache.init(n_mel);
+		// the frames of the whole stream, with the audio before every frame
+		const std::vector<float> stream_frames =
+			whisper_log_mel(cache.get_filters(), n_mel, audio.data(), audio.size(),
+					total_frames);
+		std::mt19937 rng(1234);
+		// packets of 10 to 100 ms, a partial every 200 ms
+		std::uniform_int_distribution<size_t> packet(160, 1600);
+		std::uniform_int_distribution<size_t> trim(0, 24000);
+		std::uniform_int_distribution<size_t> cut(1, 4000);
+		// away from the start of the stream, where whisper reflects the signal
+		uint64_t front = 8000 + 77;
+		uint64_t end = 0;
+		uint64_t next_partial = front + 16000;
+		const uint64_t computed_before = cache.frames_computed();
+		uint64_t recomputed = 0;
+		size_t inferences = 0;
+		double max_error = 0.0;
+		std::vector<float> mel;
+		while (end < audio.size()) {
+			const size_t n = std::min<size_t>(packet(rng), audio.size() - end);
+			cache.discard_before(front);
+			cache.append(audio.data() + end, n);
+			end += n;
+			if (end < next_partial) {
+				continue;
+			}
+			next_partial = end + 3200;
+			// every third segment ends before the buffer, as the VAD segments do
+			const uint64_t to = inferences % 3 == 2 ? end - cut(rng) : end;
+			const uint64_t computed = cache.frames_computed();
+			const int frames = cache.build(audio.data() + front, front, to - front, mel);
+			recomputed += cache.frames_computed() - computed;
+			if (cache.frames_computed() - computed > 3) {
+				printf("  %d bands: %llu frames recomputed for one inference\n",
+				       n_mel,
+				       (unsigned long long)(cache.frames_computed() - computed));
+				ok = false;
+			}
+
+			// frames whose window reaches past the segment see zeros after it
+			const uint64_t first = MelCache::first_frame_center(front) / MelCache::HOP;
+			std::vector<float> log_mel((size_t)frames * n_mel);
+			for (int i = 0; i < frames; ++i) {
+				const uint64_t k = first + i;
+				if (k * MelCache::HOP + MelCache::FFT_SIZE / 2 <= to) {
+					std::copy_n(stream_frames.begin() + k * n_mel, n_mel,
+						    log_mel.begin() + (size_t)i * n_mel);
+					continue;
+				}
+				const uint64_t base = k * MelCache::HOP - 3 * MelCache::HOP;
+				const std::vector<float> tail =
+					whisper_log_mel(cache.get_filters(), n_mel,
+							audio.data() + base, to - base, 4);
+				std::copy_n(tail.begin() + 3 * n_mel, n_mel,
+					    log_mel.begin() + (size_t)i * n_mel);
+			}
+			const std::vector<float> expected =
+				whisper_normalize(log_mel, n_mel, frames);
+			if (expected.size() != mel.size()) {
+				printf("  %d bands: %zu values instead of %zu\n", n_mel, mel.size(),
+				       expected.size());
+				ok = false;
+				break;
+			}
+			for (size_t i = 0; i < mel.size(); ++i) {
+				max_error = std::max(max_error,
+						     std::fabs((double)(mel[i] - expected[i])));
+			}
+			inferences++;
+			// the local agreement trims the buffer now and then, the segment stays
+			// within 10 s
+			if (inferences % 4 == 0) {
+				front = std::min<uint64_t>(front + trim(rng), to - 16000);
+			}
+			front = std::max<uint64_t>(front, end > 160000 ? end - 160000 : 0);
+		}
+		printf("  %3d bands: %zu inferences, max error %.2e, %.1f frames computed per inference, %.2f per frame of audio in total\n",
+		       n_mel, inferences, max_error,
+		       (double)recomputed / (double)std::max<size_t>(inferences, 1),
+		       (double)(cache.frames_computed() - computed_before) / (double)total_frames);
+		if (max_error > 1e-3) {
+			printf("  the cached mel differs from whisper's\n");
+			ok = false;
+		}
+	}
+
+	// a partial every 200 ms over the last 10 s of the stream
+	const size_t partial = 3200;
+	const size_t buffer = std::min<size_t>(audio.size() - partial, 10 * 16000);
+	cache.init(80);
+	cache.append(audio.data(), buffer);
+	MelCache scratch;
+	scratch.init(80);
+	std::vector<float> mel;
+	double cached_s = 0.0;
+	double recomputed_s = 0.0;
+	size_t partials = 0;
+	for (size_t end = buffer + partial; end <= audio.size(); end += partial, ++partials) {
+		const size_t front = end - buffer;
+		auto start = std::chrono::steady_clock::now();
+		cache.discard_before(front);
+		cache.append(audio.data() + end - partial, partial);
+		cache.build(audio.data() + front, front, buffer, mel);
+		cached_s += seconds_since(start);
+		start = std::chrono::steady_clock::now();
+		scratch.reset(front);
+		scratch.build(audio.data() + front, front, buffer, mel);
+		recomputed_s += seconds_since(start);
+	}
+	printf("Mel of a partial over %.1f s, %d ms new: recomputed %.2f ms, cached %.2f ms\n",
+	       (double)buffer / 16000.0, (int)(partial / 16), 1000.0 * recomputed_s / partials,
+	       1000.0 * cached_s / partials);
+
+	if (model_path.empty()) {
+		printf("No whisper model given, the mel of whisper.cpp itself is not compared\n");
+		printf("\n%s\n", ok ? "PASS" : "FAIL");
+		return ok ? 0 : 1;
+	}
+
+	whisper_context_params cparams = whisper_context_default_params();
+	cparams.use_gpu = false;
+	whisper_context *ctx =
+		whisper_init_from_file_with_params_no_state(model_path.c_str(), cparams);
+	if (ctx == nullptr) {
+		throw std::runtime_error("cannot load " + model_path);
+	}
+	whisper_state *state = whisper_init_state(ctx);
+	const int n_mel = whisper_model_n_mels(ctx);
+	const int threads = (int)std::clamp(std::thread::hardware_concurrency(), 1u, 4u);
+	cache.init(n_mel);
+	cache.append(audio.data(), buffer);
+	const int frames = cache.build(audio.data(), 0, buffer, mel);
+	printf("whisper.cpp (%d bands) over the first %.1f s\n", n_mel, (double)buffer / 16000.0);
+
+	std::vector<float> pcm_probs(whisper_lang_max_id() + 1);
+	std::vector<float> mel_probs(whisper_lang_max_id() + 1);
+	const auto start = std::chrono::steady_clock::now();
+	whisper_pcm_to_mel_with_state(ctx, state, audio.data(), (int)buffer, threads);
+	printf("  whisper_pcm_to_mel: %.2f ms\n", 1000.0 * seconds_since(start));
+	const int pcm_lang =
+		whisper_lang_auto_detect_with_state(ctx, state, 0, threads, pcm_probs.data());
+	whisper_set_mel_with_state(ctx, state, mel.data(), frames + MelCache::PADDING_FRAMES,
+				   n_mel);
+	const int mel_lang =
+		whisper_lang_auto_detect_with_state(ctx, state, 0, threads, mel_probs.data());
+	double max_p_error = 0.0;
+	for (size_t i = 0; i < pcm_probs.size(); ++i) {
+		max_p_error =
+			std::max(max_p_error, std::fabs((double)(pcm_probs[i] - mel_probs[i])));
+	}
+	printf("  language from the samples %s (p %.3f), from the cached mel %s (p %.3f), max probability difference %.4f\n",
+	       whisper_lang_str(pcm_lang), pcm_probs[pcm_lang], whisper_lang_str(mel_lang),
+	       mel_probs[mel_lang], max_p_error);
+	if (pcm_lang != mel_lang || max_p_error > 0.05) {
+		ok = false;
+	}
+
+	whisper_full_params params = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+	params.language = whisper_lang_str(pcm_lang);
+	params.n_threads = threads;
+	params.print_progress = false;
+	params.print_realtime = false;
+	params.print_timestamps = false;
+	params.duration_ms = (int)(buffer * 1000 / 16000);
+	const std::string pcm_text = whisper_text(ctx, state, params, audio.data(), buffer);
+	whisper_set_mel_with_state(ctx, state, mel.data(), frames + MelCache::PADDING_FRAMES,
+				   n_mel);
+	const std::string mel_text = whisper_text(ctx, state, params, nullptr, 0);
+	printf("  text from the samples:    %s\n  text from the cached mel: %s\n", pcm_text.c_str(),
+	       mel_text.c_str());
+	if (pcm_text != mel_text) {
+		printf("  the texts differ\n");
+		ok = false;
+	}
+	whisper_free_state(state);
+	whisper_free(ctx);
+
+	printf("\n%s\n", ok ? "PASS" : "FAIL");
+	return ok ? 0 : 1;
+}
+
+/*
+ * abort [whisper_model.bin] [audio.f32]
+ *
+ * Checks the cancellation of the running inference. First the rules: a final is not
+ * superseded, a partial is once the input holds the end of its segment, clearing the buffers
+ * cancels either, a shutdown also cancels the inferences that start until the thread starts
+ * again, also when it lands while an inference starts, and every abort is counted once. Then a simulated inference of 2 ms graph nodes that
+ * polls the abort like whisper is cancelled from another thread, which measures the delay
+ * until it returns. With a model, whisper_full runs on 10 s of audio without an abort and with
+ * an abort 100 ms in. Fails if a rule is broken, if the simulated inference takes more than
+ * 10 ms to stop or if the aborted whisper_full does not fail or takes more than half as long
+ * as the whole run.
+ */
+int run_abort(const std::vector<std::string> &args)
+{
+	const std::string model_path = args.empty() ? "" : args[0];
+	bool ok = true;
+	auto check = [&ok](bool condition, const char *rule) {
+		printf("  %-64s %s\n", rule, condition ? "ok" : "BROKEN");
+		ok = ok && condition;
+	};
+
+	printf("Cancellation rules\n");
+	InferenceAbort cancel;
+	cancel.begin(false);
+	cancel.request(INFERENCE_ABORT_SUPERSEDED);
+	cancel.on_input_frames(UINT64_MAX - 1);
+	check(cancel.end() == INFERENCE_ABORT_NONE, "a final is not superseded");
+	cancel.begin(true, 48000);
+	cancel.on_input_frames(47999);
+	const bool early = cancel.should_abort();
+	cancel.on_input_frames(48000);
+	check(!early && cancel.end() == INFERENCE_ABORT_SUPERSEDED,
+	      "a partial is superseded once its segment is complete");
+	cancel.begin(false);
+	cancel.request(INFERENCE_ABORT_CLEARED);
+	cancel.request(INFERENCE_ABORT_SHUTDOWN);
+	check(cancel.end() == INFERENCE_ABORT_CLEARED, "clearing the buffers cancels a final");
+	cancel.request(INFERENCE_ABORT_CLEARED);
+	cancel.begin(true);
+	check(cancel.should_abort() && cancel.end() == INFERENCE_ABORT_SHUTDOWN,
+	      "a shutdown cancels the next inference at once");
+	cancel.reset();
+	cancel.begin(true);
+	check(cancel.end() == INFERENCE_ABORT_NONE, "the thread starts again after a shutdown");
+	cancel.request(INFERENCE_ABORT_SUPERSEDED);
+	cancel.begin(false);
+	check(cancel.end() == INFERENCE_ABORT_NONE, "a request without an inference is dropped");
+	check(cancel.count(INFERENCE_ABORT_SUPERSEDED) == 1 &&
+		      cancel.count(INFERENCE_ABORT_CLEARED) == 1 &&
+		      cancel.count(INFERENCE_ABORT_SHUTDOWN) == 1,
+	      "every abort is counted once");
+
+	// the shutdown lands while begin() runs: either begin() sees it or it sees the inference
+	const int races = 20000;
+	int lost_shutdowns = 0;
+	for (int race = 0; race < races; ++race) {
+		InferenceAbort racing;
+		std::atomic<int> ready{0};
+		std::thread starter([&]() {
+			ready++;
+			while (ready.load() < 2) {
+				std::this_thread::yield();
+			}
+			racing.begin(true);
+		});
+		ready++;
+		while (ready.load() < 2) {
+			std::this_thread::yield();
+		}
+		racing.request(INFERENCE_ABORT_SHUTDOWN);
+		starter.join();
+		if (racing.end() != INFERENCE_ABORT_SHUTDOWN) {
+			lost_shutdowns++;
+		}
+	}
+	check(lost_shutdowns == 0, "a shutdown racing the start of an inference cancels it");
+
+	// graph nodes of 2 ms, the abort is polled between them as ggml does
+	const int runs = 20;
+	double max_delay_ms = 0.0;
+	double total_delay_ms = 0.0;
+	for (int run = 0; run < runs; ++run) {
+		std::atomic<bool> started{false};
+		std::chrono::steady_clock::time_point stopped;
+		std::thread inference([&]() {
+			cancel.begin(true, UINT64_MAX);
+			started = true;
+			const auto deadline =
+				std::chrono::steady_clock::now() + std::chrono::seconds(5);
+			volatile double work = 0.0;
+			while (!cancel.should_abort() &&
+			       std::chrono::steady_clock::now() < deadline) {
+				const auto node_end = std::chrono::steady_clock::now() +
+						      std::chrono::milliseconds(2);
+				while (std::chrono::steady_clock::now() < node_end) {
+					work = work + 1.0;
+				}
+			}
+			stopped = std::chrono::steady_clock::now();
+			cancel.end();
+		});
+		while (!started) {
+			std::this_thread::yield();
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(20 + run));
+		const auto requested = std::chrono::steady_clock::now();
+		cancel.request(run % 2 == 0 ? INFERENCE_ABORT_CLEARED : INFERENCE_ABORT_SUPERSEDED);
+		inference.join();
+		const double delay_ms =
+			std::chrono::duration<double, std::milli>(stopped - requested).count();
+		max_delay_ms = std::max(max_delay_ms, delay_ms);
+		total_delay_ms += delay_ms;
+	}
+	printf("Simulated inference, 2 ms nodes: stops %.2f ms after the request on average, %.2f ms at most\n",
+	       total_delay_ms / runs, max_delay_ms);
+	if (max_delay_ms > 10.0) {
+		printf("  the inference does not stop at the next node\n");
+		ok = false;
+	}
+
+	if (model_path.empty()) {
+		printf("No whisper model given, whisper_full is not aborted\n");
+		printf("\n%s\n", ok ? "PASS" : "FAIL");
+		return ok ? 0 : 1;
+	}
+
+	const std::vector<float> audio = args.size() > 1 ? read_f32_file(args[1])
+							 : make_speech_like(10 * 16000);
+	whisper_context_params cparams = whisper_context_default_params();
+	cparams.use_gpu = false;
+	whisper_context *ctx =
+		whisper_init_from_file_with_params_no_state(model_path.c_str(), cparams);
+	if (ctx == nullptr) {
+		throw std::runtime_error("cannot load " + model_path);
+	}
+	whisper_state *state = whisper_init_state(ctx);
+	whisper_full_params params = whisper_full_default_params(WHISPER_SAMPLING_BEAM_SEARCH);
+	params.n_threads = (int)std::clamp(std::thread::hardware_concurrency(), 1u, 4u);
+	params.print_progress = false;
+	params.print_realtime = false;
+	params.print_timestamps = false;
+	params.abort_callback = [](void *data) {
+		return static_cast<InferenceAbort *>(data)->should_abort();
+	};
+	params.abort_callback_user_data = &cancel;
+
+	cancel.begin(false);
+	auto start = std::chrono::steady_clock::now();
+	const int full_result =
+		whisper_full_with_state(ctx, state, params, audio.data(), (int)audio.size());
+	const double full_ms = 1000.0 * seconds_since(start);
+	cancel.end();
+
+	cancel.begin(false);
+	std::thread canceller([&cancel]() {
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		cancel.request(INFERENCE_ABORT_SHUTDOWN);
+	});
+	start = std::chrono::steady_clock::now();
+	const int aborted_result =
+		whisper_full_with_state(ctx, state, params, audio.data(), (int)audio.size());
+	const double aborted_ms = 1000.0 * seconds_since(start);
+	canceller.join();
+	cancel.end();
+	cancel.reset();
+	whisper_free_state(state);
+	whisper_free(ctx);
+
+	printf("whisper_full over %.1f s: %.1f ms (result %d), aborted after 100 ms: %.1f ms (result %d)\n",
+	       (double)audio.size() / 16000.0, full_ms, full_result, aborted_ms, aborted_result);
+	if (full_result != 0 || aborted_result == 0 || aborted_ms > full_ms / 2) {
+		printf("  whisper_full was not aborted\n");
+		ok = false;
+	}
+
+	printf("\n%s\n", ok ? "PASS" : "FAIL");
+	return ok ? 0 : 1;
+}
+
+/*
+ * language-id [whisper_model.bin] [language_id_model.bin] [audio.f32]
+ *
+ * Checks when the language ID cache asks for a detection: without a language, not again
+ * within a segment, again a second after a detection with a low confidence, after two decodes
+ * with a low confidence in a row, and at the start of a segment once the recheck interval
+ * passed. Then streams 30 minutes of simulated segments of 3 s with two partials each, the
+ * speaker switching language half way, and counts the detections against the per decode
+ * detection of auto mode. With models, times the detection on 5 s of audio (or the given raw
+ * 16 kHz mono float samples) with each model. Fails if a rule is broken, if the switch takes
+ * more than two decodes to be detected or if the cache detects more than once every
+ * 15 segments.
+ */
+int run_language_id(const std::vector<std::string> &args)
+{
+	bool ok = true;
+	auto check = [&ok](bool condition, const char *rule) {
+		printf("  %-64s %s\n", rule, condition ? "ok" : "BROKEN");
+		ok = ok && condition;
+	};
+
+	printf("Detection rules\n");
+	LanguageIdCache cache;
+	cache.set_recheck_interval(60000);
+	check(cache.detection_due(0, 0), "detects without a language");
+	cache.update(0, 0.9f, 0, 0);
+	check(!cache.detection_due(5000, 0), "not again within the segment");
+	check(!cache.detection_due(5000, 3000), "not at a segment start before the interval");
+	check(cache.detection_due(60000, 60000), "again at a segment start after the interval");
+	check(!cache.detection_due(70000, 0), "not within a segment after the interval");
+	cache.update(1, 0.3f, 100000, 100000);
+	check(!cache.detection_due(100500, 100000) && cache.detection_due(101000, 100000),
+	      "again a second after a detection with a low confidence");
+	cache.update(1, 0.9f, 102000, 100000);
+	cache.report_decode(0.3f);
+	cache.report_decode(0.8f);
+	cache.report_decode(0.3f);
+	check(!cache.detection_due(103000, 100000), "not after a single low confidence decode");
+	cache.report_decode(0.3f);
+	check(cache.detection_due(103000, 100000), "after two low confidence decodes in a row");
+	cache.update(1, 0.9f, 104000, 100000);
+	cache.set_recheck_interval(0);
+	check(!cache.detection_due(10000000, 9000000), "never periodically with no interval");
+	cache.reset();
+	check(cache.detection_due(10000000, 9000000) && cache.language_id() < 0,
+	      "detects again after a reset");
+
+	// a decode in the language of the speech comes out at 0.8, in another at 0.3
+	const int segments = 600;
+	const uint64_t segment_ms = 3000;
+	LanguageIdCache stream;
+	int decodes = 0;
+	int wrong_decodes = 0;
+	for (int segment = 0; segment < segments; ++segment) {
+		// the switch is not at a periodic detection
+		const int spoken = segment < segments / 2 + 7 ? 0 : 1;
+		const uint64_t start_ms = (uint64_t)segment * segment_ms;
+		// two partials and the final
+		for (int run = 1; run <= 3; ++run) {
+			const uint64_t now = start_ms + (uint64_t)run * segment_ms / 3;
+			if (stream.detection_due(now, start_ms)) {
+				stream.update(spoken, 0.9f, now, start_ms);
+			}
+			decodes++;
+			if (stream.language_id() != spoken) {
+				wrong_decodes++;
+			}
+			stream.report_decode(stream.language_id() == spoken ? 0.8f : 0.3f);
+		}
+	}
+	printf("%d segments, %d decodes: %llu detections with the cache, %d in auto mode; %d decodes in the wrong language after the switch\n",
+	       segments, decodes, (unsigned long long)stream.detections(), 2 * decodes,
+	       wrong_decodes);
+	if (wrong_decodes > LANGUAGE_ID_LOW_DECODES) {
+		printf("  the language switch is detected late\n");
+		ok = false;
+	}
+	if (stream.detections() > (uint64_t)segments / 15) {
+		printf("  too many detections\n");
+		ok = false;
+	}
+
+	const std::vector<float> audio = args.size() > 2 ? read_f32_file(args[2])
+							 : make_speech_like(5 * 16000);
+	const int n_threads = (int)std::clamp(std::thread::hardware_concurrency(), 1u, 4u);
+	for (size_t i = 0; i < std::min<size_t>(args.size(), 2); ++i) {
+		whisper_context_params cparams = whisper_context_default_params();
+		cparams.use_gpu = false;
+		whisper_context *ctx =
+			whisper_init_from_file_with_params_no_state(args[i].c_str(), cparams);
+		if (ctx == nullptr) {
+			throw std::runtime_error("cannot load " + args[i]);
+		}
+		whisper_state *state = whisper_init_state(ctx);
+		std::vector<float> probs((size_t)whisper_lang_max_id() + 1);
+		const auto start = std::chrono::steady_clock::now();
+		int lang_id = -1;
+		if (whisper_pcm_to_mel_with_state(ctx, state, audio.data(), (int)audio.size(),
+						  n_threads) == 0) {
+			lang_id = whisper_lang_auto_detect_with_state(ctx, state, 0, n_threads,
+								      probs.data());
+		}
+		const double detect_ms = 1000.0 * seconds_since(start);
+		printf("%s: %s (p %.3f) in %.1f ms\n", args[i].c_str(),
+		       lang_id >= 0 ? whisper_lang_str(lang_id) : "failed",
+		       lang_id >= 0 ? probs[(size_t)lang_id] : 0.0f, detect_ms);
+		if (lang_id < 0) {
+			ok = false;
+		}
+		whisper_free_state(state);
+		whisper_free(ctx);
+	}
+
+	printf("\n%s\n", ok ? "PASS" : "FAIL");
+	return ok ? 0 : 1;
+}
+
+/*
+ * model-swap [load_ms]
+ *
+ * Simulates model changes on a whisper thread that runs 15 ms inferences over speech segments
+ * of 2 s with 600 ms pauses, the models taking load_ms (500 by default) to load. A model is
+ * requested, replaced by another while it loads, then a model that fails to load and a last
+ * one are requested. Then a model is requested during continuous speech, and a load is stopped
+ * as the filter is disabled. Prints the longest pause between two inferences and when the
+ * models were swapped in. Fails if the inferences pause for more than 50 ms, if a model other
+ * than the newest loaded one is swapped in, if a swap happens during speech before
+ * MODEL_SWAP_MAX_DEFER_MSEC, or if stopping leaves a model to swap in.
+ */
+int run_model_swap(const std::vector<std::string> &args)
+{
+	const int load_ms = args.empty() ? 500 : std::stoi(args[0]);
+	bool ok = true;
+	auto check = [&ok](bool condition, const char *rule) {
+		printf("  %-64s %s\n", rule, condition ? "ok" : "BROKEN");
+		ok = ok && condition;
+	};
+	const ModelSwap::Loader loader = [load_ms](const ModelLoadRequest &request,
+						   WhisperModelSet &models) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(load_ms));
+		models.model_file = request.model_file;
+		return request.model_file != "broken";
+	};
+
+	struct Swap {
+		std::string model;
+		double at_s;
+		bool at_boundary;
+		uint64_t after_load_ms;
+	};
+	// runs the whisper thread for the duration, requests[i] is made at request_s[i]
+	auto simulate = [&loader](ModelSwap &swap, double seconds, double speech_s, double pause_s,
+				  const std::vector<std::pair<double, std::string>> &requests,
+				  double &max_gap_ms) {
+		std::vector<Swap> swaps;
+		std::string current = "initial";
+		size_t next_request = 0;
+		max_gap_ms = 0.0;
+		const auto start = std::chrono::steady_clock::now();
+		auto last_inference_end = start;
+		for (double elapsed = 0.0; elapsed < seconds; elapsed = seconds_since(start)) {
+			while (next_request < requests.size() &&
+			       requests[next_request].first <= elapsed) {
+				swap.request({requests[next_request].second, "", ""}, loader);
+				next_request++;
+			}
+			const bool speech = std::fmod(elapsed, speech_s + pause_s) < speech_s;
+			std::unique_ptr<WhisperModelSet> models = swap.take(!speech, now_ms());
+			if (models) {
+				std::swap(current, models->model_file);
+				swaps.push_back({current, elapsed, !speech,
+						 now_ms() - models->loaded_ms});
+			}
+			const auto inference_start = std::chrono::steady_clock::now();
+			max_gap_ms = std::max(max_gap_ms,
+					      std::chrono::duration<double, std::milli>(
+						      inference_start - last_inference_end)
+						      .count());
+			std::this_thread::sleep_for(std::chrono::milliseconds(15));
+			last_inference_end = std::chrono::steady_clock::now();
+		}
+		return swaps;
+	};
+	auto print_swaps = [](const std::vector<Swap> &swaps) {
+		for (const Swap &swap : swaps) {
+			printf("  %-10s swapped in at %.2f s, %llu ms after its load%s\n",
+			       swap.model.c_str(), swap.at_s, (unsigned long long)swap.after_load_ms,
+			       swap.at_boundary ? ", end of segment" : ", during speech");
+		}
+	};
+
+	printf("Model changes, loads of %d ms\n", load_ms);
+	double max_gap_ms = 0.0;
+	ModelSwap swap;
+	std::vector<Swap> swaps = simulate(
+		swap, 5.5, 2.0, 0.6,
+		{{0.2, "replaced"}, {0.4, "second"}, {2.5, "broken"}, {3.0, "last"}}, max_gap_ms);
+	print_swaps(swaps);
+	const ModelSwap::stats stats = swap.get_stats();
+	printf("  %llu loads, %llu failed, %llu dropped; longest pause between inferences %.1f ms (a restart pauses them for the whole load)\n",
+	       (unsigned long long)stats.loads, (unsigned long long)stats.failed_loads,
+	       (unsigned long long)stats.dropped_loads, max_gap_ms);
+	check(swaps.size() == 2 && swaps[0].model == "second" && swaps[1].model == "last",
+	      "only the newest loaded models are swapped in");
+	check(stats.dropped_loads == 1 && stats.failed_loads == 1,
+	      "the replaced and the failed loads are dropped");
+	check(std::all_of(swaps.begin(), swaps.end(),
+			  [](const Swap &s) { return s.at_boundary; }),
+	      "the swaps wait for the end of the segment");
+	check(max_gap_ms < 50.0, "the inferences go on while loading");
+
+	printf("Model change during continuous speech\n");
+	ModelSwap continuous;
+	const double continuous_s = 0.6 + (load_ms + MODEL_SWAP_MAX_DEFER_MSEC) / 1000.0;
+	swaps = simulate(continuous, continuous_s, 1000.0, 0.0, {{0.1, "forced"}}, max_gap_ms);
+	print_swaps(swaps);
+	check(swaps.size() == 1 && !swaps[0].at_boundary &&
+		      swaps[0].after_load_ms >= MODEL_SWAP_MAX_DEFER_MSEC &&
+		      continuous.get_stats().forced_swaps == 1,
+	      "swapped in during speech after the longest wait");
+
+	printf("Filter disabled while loading\n");
+	ModelSwap stopped;
+	stopped.request({"dropped", "", ""}, loader);
+	// the load is running
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	const auto stop_start = std::chrono::steady_clock::now();
+	stopped.stop();
+	printf("  stop waited %.0f ms for the load\n", 1000.0 * seconds_since(stop_start));
+	check(!stopped.ready() && stopped.requested_model_file().empty(),
+	      "nothing is left to swap in after stopping");
+
+	printf("\n%s\n", ok ? "PASS" : "FAIL");
+	return ok ? 0 : 1;
+}
+
+/*
+ * model-load [whisper_model.bin] [audio.f32]
+ *
+ * Checks the memory mapped model loader: a 64 MB file (or the model) is read into a heap
+ * buffer as the Windows loader did and mapped with prefetch, and both are compared byte for
+ * byte. Prints the time of both. With a model, creates
+ * the whisper context from the file and from the mapping, then times the first and the second
+ * inference on 3 s of audio (or the given raw 16 kHz mono float samples) on a new state,
+ * without and with a warm-up inference on 1 s of silence as the plugin runs after a load.
+ * Fails if the mapping differs from the file, if whisper cannot load the mapped model or if the
+ * texts of the inferences differ.
+ */
+int run_model_load(const std::vector<std::string> &args)
+{
+	bool ok = true;
+	std::string path = args.empty() ? "" : args[0];
+	const bool temporary = path.empty();
+	if (temporary) {
+		path = (std::filesystem::temp_directory_path() / "localvocal-model-load.bin")
+			       .string();
+		std::vector<uint32_t> pattern(16 * 1024 * 1024);
+		for (size_t i = 0; i < pattern.size(); i++) {
+			pattern[i] = (uint32_t)(i * 2654435761u);
+		}
+		FILE *file = fopen(path.c_str(), "wb");
+		if (file == nullptr) {
+			throw std::runtime_error("cannot write " + path);
+		}
+		fwrite(pattern.data(), sizeof(uint32_t), pattern.size(), file);
+		fclose(file);
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<char> buffer;
+	{
+		FILE *file = fopen(path.c_str(), "rb");
+		if (file == nullptr) {
+			throw std::runtime_error("cannot open " + path);
+		}
+		fseek(file, 0, SEEK_END);
+		buffer.resize((size_t)ftell(file));
+		fseek(file, 0, SEEK_SET);
+		buffer.resize(fread(buffer.data(), 1, buffer.size(), file));
+		fclose(file);
+	}
+	const double read_ms = 1000.0 * seconds_since(start);
+
+	start = std::chrono::steady_clock::now();
+	MappedFile mapped;
+	if (!mapped.open(path)) {
+		throw std::runtime_error("cannot map " + path);
+	}
+	// touch every page, as whisper does while copying the weights
+	const unsigned char *bytes = static_cast<const unsigned char *>(mapped.data());
+	volatile unsigned char sink = 0;
+	for (size_t i = 0; i < mapped.size(); i += 4096) {
+		sink = sink ^ bytes[i];
+	}
+	const double map_ms = 1000.0 * seconds_since(start);
+	const bool same = mapped.size() == buffer.size() &&
+			  memcmp(mapped.data(), buffer.data(), buffer.size()) == 0;
+	printf("%.1f MB: read into a buffer %.1f ms, mapped and paged in %.1f ms\n",
+	       (double)buffer.size() / (1024.0 * 1024.0), read_ms, map_ms);
+	if (!same) {
+		printf("  the mapping differs from the file\n");
+		ok = false;
+	}
+	buffer.clear();
+	buffer.shrink_to_fit();
+	if (temporary) {
+		mapped.close();
+		std::filesystem::remove(path);
+		printf("No whisper model given, no inference\n");
+		printf("\n%s\n", ok ? "PASS" : "FAIL");
+		return ok ? 0 : 1;
+	}
+
+	whisper_context_params cparams = whisper_context_default_params();
+	cparams.use_gpu = false;
+	start = std::chrono::steady_clock::now();
+	whisper_context *file_ctx =
+		whisper_init_from_file_with_params_no_state(path.c_str(), cparams);
+	const double file_ms = 1000.0 * seconds_since(start);
+	whisper_free(file_ctx);
+	start = std::chrono::steady_clock::now();
+	whisper_context *ctx = whisper_init_from_buffer_with_params_no_state(
+		const_cast<void *>(mapped.data()), mapped.size(), cparams);
+	const double mapped_ms = 1000.0 * seconds_since(start);
+	mapped.close();
+	printf("whisper context from the file %.1f ms, from the mapping %.1f ms\n", file_ms,
+	       mapped_ms);
+	if (ctx == nullptr) {
+		printf("  whisper cannot load the mapped model\n");
+		printf("\nFAIL\n");
+		return 1;
+	}
+
+	const std::vector<float> audio = args.size() > 1 ? read_f32_file(args[1])
+							 : make_speech_like(3 * 16000);
+	whisper_full_params params = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+	params.n_threads = (int)std::clamp(std::thread::hardware_concurrency(), 1u, 4u);
+	params.language = "en";
+	params.print_progress = false;
+	params.print_realtime = false;
+	params.print_timestamps = false;
+	std::string texts[2];
+	for (int warm_up = 0; warm_up < 2; warm_up++) {
+		whisper_state *state = whisper_init_state(ctx);
+		if (warm_up) {
+			whisper_full_params silence_params = params;
+			silence_params.no_context = true;
+			silence_params.single_segment = true;
+			silence_params.no_timestamps = true;
+			silence_params.max_tokens = 1;
+			silence_params.temperature_inc = 0.0f;
+			const std::vector<float> silence(16000, 0.0f);
+			start = std::chrono::steady_clock::now();
+			whisper_full_with_state(ctx, state, silence_params, silence.data(),
+						(int)silence.size());
+			printf("warm-up inference on 1 s of silence: %.1f ms\n",
+			       1000.0 * seconds_since(start));
+		}
+		start = std::chrono::steady_clock::now();
+		texts[warm_up] = whisper_text(ctx, state, params, audio.data(), audio.size());
+		const double first_ms = 1000.0 * seconds_since(start);
+		start = std::chrono::steady_clock::now();
+		whisper_text(ctx, state, params, audio.data(), audio.size());
+		const double second_ms = 1000.0 * seconds_since(start);
+		printf("%s: first inference %.1f ms, second %.1f ms (%.2fx)\n",
+		       warm_up ? "warmed up" : "cold state", first_ms, second_ms,
+		       first_ms / std::max(second_ms, 1e-3));
+		whisper_free_state(state);
+	}
+	whisper_free(ctx);
+	if (texts[0] != texts[1]) {
+		printf("  the warm-up changes the text: '%s' vs. '%s'\n", texts[0].c_str(),
+		       texts[1].c_str());
+		ok = false;
+	}
+
+	printf("\n%s\n", ok ? "PASS" : "FAIL");
+	return ok ? 0 : 1;
+}
+
+/*
+ * quality [seconds]
+ *
+ * Runs the adaptive quality controller against a simulated whisper thread that decodes the
+ * audio in 1 s jobs. Each stage makes the jobs cheaper. The load is light for the first fifth
+ * of the run (real-time factor 0.5 at full quality), three times heavier until three fifths,
+ * as when other sources speak at once, then light again. Prints every transition and the
+ * backlog. Also checks that stages that change nothing are skipped, what each stage does to
+ * the whisper parameters and the floor of the fast decoding overload policy. Fails if the controller does not step down while the thread falls
+ * behind, if the backlog keeps growing under the overload, if it is not back at full quality
+ * once the overload ends or if it changes the stage under a steady load.
+ */
+int run_quality(const std::vector<std::string> &args)
+{
+	const double seconds = args.empty() ? 600.0 : std::stod(args[0]);
+	bool ok = true;
+	auto check = [&ok](bool condition, const char *rule) {
+		printf("  %-64s %s\n", rule, condition ? "ok" : "BROKEN");
+		ok = ok && condition;
+	};
+
+	printf("Stages\n");
+	whisper_full_params full = whisper_full_default_params(WHISPER_SAMPLING_BEAM_SEARCH);
+	full.temperature_inc = 0.2f;
+	full.max_tokens = 0;
+	QualityController stages;
+	QualityController::Transition transition;
+	stages.reset(0);
+	uint64_t now = 0;
+	auto overload_window = [&](QualityController &controller) {
+		now += QUALITY_WINDOW_MSEC;
+		controller.report_inference(QUALITY_WINDOW_MSEC);
+		return controller.update(now, 0, transition);
+	};
+	whisper_full_params params = full;
+	stages.apply(params, false);
+	check(params.strategy == WHISPER_SAMPLING_BEAM_SEARCH && params.temperature_inc > 0.0f &&
+		      params.max_tokens == 0 && stages.partial_interval(1000) == 1000,
+	      "full quality changes nothing");
+	check(overload_window(stages) && transition.cause == QUALITY_CAUSE_RTF &&
+		      stages.stage() == QUALITY_STAGE_GREEDY,
+	      "an overloaded window steps down once");
+	params = full;
+	stages.apply(params, false);
+	check(params.strategy == WHISPER_SAMPLING_GREEDY && params.greedy.best_of == 1 &&
+		      params.temperature_inc > 0.0f,
+	      "greedy decoding");
+	overload_window(stages);
+	overload_window(stages);
+	params = full;
+	stages.apply(params, false);
+	whisper_full_params partial_params = full;
+	stages.apply(partial_params, true);
+	check(params.temperature_inc == 0.0f && params.max_tokens == QUALITY_FINAL_MAX_TOKENS &&
+		      partial_params.max_tokens == QUALITY_PARTIAL_MAX_TOKENS,
+	      "no temperature fallback and fewer tokens");
+	partial_params.max_tokens = 8;
+	stages.apply(partial_params, true);
+	check(partial_params.max_tokens == 8, "a lower token limit is kept");
+	overload_window(stages);
+	check(stages.partial_interval(1000) == 1000 * QUALITY_PARTIAL_INTERVAL_FACTOR &&
+		      !stages.use_smaller_model(),
+	      "longer partial interval");
+	overload_window(stages);
+	check(stages.use_smaller_model() && !overload_window(stages),
+	      "the smaller model is the last stage");
+
+	QualityController skipping;
+	skipping.reset(0);
+	now = 0;
+	skipping.set_available(QUALITY_STAGE_GREEDY, false);
+	skipping.set_available(QUALITY_STAGE_LONGER_PARTIALS, false);
+	skipping.set_available(QUALITY_STAGE_SMALLER_MODEL, false);
+	overload_window(skipping);
+	check(skipping.stage() == QUALITY_STAGE_NO_FALLBACK, "unavailable stages are skipped");
+	overload_window(skipping);
+	check(skipping.stage() == QUALITY_STAGE_FEWER_TOKENS && !overload_window(skipping),
+	      "the last available stage is the lowest");
+	int idle_windows = 0;
+	while (skipping.stage() != QUALITY_STAGE_FULL && idle_windows < 20) {
+		now += QUALITY_WINDOW_MSEC;
+		skipping.update(now, 0, transition);
+		idle_windows++;
+	}
+	check(idle_windows == 2 * QUALITY_STEP_UP_WINDOWS,
+	      "steps up after QUALITY_STEP_UP_WINDOWS windows with headroom");
+
+	// the fast decoding overload policy
+	QualityController floored;
+	now = 0;
+	floored.reset(0);
+	check(floored.set_floor(QUALITY_STAGE_NO_FALLBACK, QUALITY_CAUSE_OVERLOAD_POLICY, 3000,
+				transition) &&
+		      transition.to == QUALITY_STAGE_NO_FALLBACK &&
+		      transition.cause == QUALITY_CAUSE_OVERLOAD_POLICY,
+	      "the overload policy lowers the decoding at once");
+	params = full;
+	floored.apply(params, false);
+	check(params.strategy == WHISPER_SAMPLING_GREEDY && params.temperature_inc == 0.0f &&
+		      params.max_tokens == 0,
+	      "fast decoding: greedy without temperature fallback");
+	const bool under_floor = overload_window(floored) || overload_window(floored);
+	check(!under_floor && overload_window(floored) &&
+		      transition.from == QUALITY_STAGE_NO_FALLBACK &&
+		      floored.stage() == QUALITY_STAGE_FEWER_TOKENS,
+	      "steps under the floor are not transitions");
+	check(!floored.set_floor(QUALITY_STAGE_FULL, QUALITY_CAUSE_OVERLOAD_POLICY, 0, transition) &&
+		      floored.stage() == QUALITY_STAGE_FEWER_TOKENS,
+	      "the measured stage stays when the floor is lifted");
+	floored.set_floor(QUALITY_STAGE_NO_FALLBACK, QUALITY_CAUSE_OVERLOAD_POLICY, 3000,
+			  transition);
+	floored.reset(now);
+	check(floored.stage() == QUALITY_STAGE_NO_FALLBACK &&
+		      floored.set_floor(QUALITY_STAGE_FULL, QUALITY_CAUSE_OVERLOAD_POLICY, 0,
+					transition) &&
+		      transition.to == QUALITY_STAGE_FULL,
+	      "a reset keeps the floor until it is lifted");
+
+	// cost of a second of audio at each stage, relative to full quality
+	const double stage_cost[QUALITY_STAGE_COUNT] = {1.0, 0.55, 0.45, 0.4, 0.3, 0.15};
+	const double base_rtf = 0.5;
+	const uint64_t total_ms = (uint64_t)(seconds * 1000.0);
+	const uint64_t overload_start_ms = total_ms / 5;
+	const uint64_t overload_end_ms = total_ms * 3 / 5;
+	const uint64_t job_ms = 1000;
+
+	printf("\nSimulated whisper thread, %.0f s, overload from %.0f s to %.0f s\n", seconds,
+	       overload_start_ms / 1000.0, overload_end_ms / 1000.0);
+	QualityController controller;
+	controller.reset(0);
+	now = 0;
+	uint64_t backlog_ms = 0;
+	uint64_t next_print_ms = 0;
+	uint64_t max_backlog_ms = 0;
+	uint64_t backlog_at_overload_end = 0;
+	uint64_t first_step_down_ms = 0;
+	uint64_t last_transition_ms = 0;
+	int steady_transitions = 0;
+	while (now < total_ms) {
+		if (backlog_ms < job_ms) {
+			// waits for the audio of the next job
+			now += job_ms - backlog_ms;
+			backlog_ms = job_ms;
+		}
+		const bool overloaded = now >= overload_start_ms && now < overload_end_ms;
+		const uint64_t cost_ms = (uint64_t)((double)job_ms * base_rtf *
+						    stage_cost[controller.stage()] *
+						    (overloaded ? 3.0 : 1.0));
+		now += cost_ms;
+		// the audio that arrived during the job
+		backlog_ms = backlog_ms + cost_ms - job_ms;
+		controller.report_inference(cost_ms);
+		max_backlog_ms = std::max(max_backlog_ms, backlog_ms);
+		if (now >= overload_end_ms && backlog_at_overload_end == 0) {
+			backlog_at_overload_end = std::max<uint64_t>(backlog_ms, 1);
+		}
+
+		if (controller.update(now, backlog_ms, transition)) {
+			printf("  %6.1f s: %s -> %s (%s, RTF %.2f, backlog %llu ms)\n", now / 1000.0,
+			       QualityController::stage_name(transition.from),
+			       QualityController::stage_name(transition.to),
+			       QualityController::cause_name(transition.cause), transition.rtf,
+			       (unsigned long long)transition.backlog_ms);
+			if (transition.to > transition.from && first_step_down_ms == 0) {
+				first_step_down_ms = now;
+			}
+			if (now < overload_start_ms) {
+				steady_transitions++;
+			}
+			last_transition_ms = now;
+		}
+		if (now >= next_print_ms) {
+			printf("  %6.1f s: backlog %5llu ms, %s\n", now / 1000.0,
+			       (unsigned long long)backlog_ms,
+			       QualityController::stage_name(controller.stage()));
+			next_print_ms += total_ms / 10;
+		}
+	}
+	printf("%llu transitions, largest backlog %llu ms, %llu ms at the end of the overload\n",
+	       (unsigned long long)controller.transitions(), (unsigned long long)max_backlog_ms,
+	       (unsigned long long)backlog_at_overload_end);
+	check(steady_transitions == 0, "no transition under the light load");
+	check(first_step_down_ms >= overload_start_ms &&
+		      first_step_down_ms <= overload_start_ms + 2 * QUALITY_WINDOW_MSEC,
+	      "steps down within two windows of the overload");
+	check(backlog_at_overload_end < 2 * QUALITY_BACKLOG_HIGH_MSEC,
+	      "the backlog does not grow under the overload");
+	check(controller.stage() == QUALITY_STAGE_FULL, "back to full quality after the overload");
+	check(last_transition_ms < overload_end_ms + 20 * QUALITY_WINDOW_MSEC,
+	      "steady once back to full quality");
+
+	printf("\n%s\n", ok ? "PASS" : "FAIL");
+	return ok ? 0 : 1;
+}
+
+/*
+ * partial-latency [seconds]
+ *
+ * Checks the rules of the partial latency controller, then simulates partials over speech of
+ * 4 s turns with 2 s pauses (300 s by default), the VAD classifying 32 ms windows, with a
+ * partial latency of 1100 ms. A fast model (80 ms per partial) and a slow one (900 ms) run
+ * with the fixed latency and with the controller, which also skips the partials without voiced
+ * audio since the last one. Prints the partials per second, the share of the whisper thread
+ * they take and the partials skipped. Fails if a rule is broken, if the slow model's partials
+ * take more than 40% of the thread with the controller, if the fast model's partials are not
+ * closer together than the fixed latency, or if none of the fast model's partials is skipped in
+ * the pauses or a partial is skipped during speech.
+ */
+int run_partial_latency(const std::vector<std::string> &args)
+{
+	const double seconds = args.empty() ? 300.0 : std::stod(args[0]);
+	bool ok = true;
+	auto check = [&ok](bool condition, const char *rule) {
+		printf("  %-64s %s\n", rule, condition ? "ok" : "BROKEN");
+		ok = ok && condition;
+	};
+	const int partial_latency = 1100;
+
+	printf("Rules\n");
+	PartialLatencyController rules;
+	check(rules.interval(partial_latency, 0) == partial_latency,
+	      "the partial latency until a partial ran");
+	rules.report_partial(100);
+	check(rules.interval(partial_latency, 0) == partial_latency / 2,
+	      "a fast model is held at half the partial latency");
+	rules.reset();
+	rules.report_partial(500);
+	check(rules.interval(partial_latency, 0) == 500 * PARTIAL_LATENCY_RUN_FACTOR,
+	      "partials PARTIAL_LATENCY_RUN_FACTOR times their run time apart");
+	check(rules.interval(partial_latency, 1000) == 500 * PARTIAL_LATENCY_RUN_FACTOR &&
+		      rules.interval(partial_latency, 2000) == 1500 + 2000,
+	      "a backlog over the interval is added to it");
+	check(rules.interval(partial_latency, 60000) ==
+		      partial_latency * PARTIAL_LATENCY_MAX_FACTOR,
+	      "at most PARTIAL_LATENCY_MAX_FACTOR times the partial latency");
+	check(rules.interval(300, 0) == 300 * PARTIAL_LATENCY_MAX_FACTOR,
+	      "a slow model is held at the highest interval");
+	rules.report_partial(2000);
+	check(rules.average_run_ms() > 500.0 && rules.average_run_ms() < 2000.0,
+	      "the run time is a moving average");
+	PartialLatencyController low;
+	low.report_partial(1);
+	check(low.interval(400, 0) == PARTIAL_LATENCY_MIN_MSEC,
+	      "never below PARTIAL_LATENCY_MIN_MSEC");
+
+	const uint64_t total_ms = (uint64_t)(seconds * 1000.0);
+	const uint64_t window_ms = 32;
+	auto speaking = [](uint64_t t) { return t % 6000 < 4000; };
+	struct Result {
+		uint64_t partials = 0;
+		uint64_t skipped = 0;
+		uint64_t skipped_in_speech = 0;
+		uint64_t busy_ms = 0;
+		int last_interval = 0;
+	};
+	auto simulate = [&](uint64_t run_ms, bool adaptive) {
+		Result result;
+		PartialLatencyController controller;
+		std::mt19937 rng(7);
+		std::uniform_real_distribution<double> jitter(0.8, 1.2);
+		uint64_t voiced = 0;
+		uint64_t partial_voiced = 0;
+		uint64_t last_partial = 0;
+		uint64_t busy_until = 0;
+		for (uint64_t t = window_ms; t <= total_ms; t += window_ms) {
+			if (speaking(t - window_ms)) {
+				voiced = t;
+			}
+			// the whisper thread looks at the buffer once the partial before is done
+			if (t < busy_until) {
+				continue;
+			}
+			const int interval = adaptive ? controller.interval(partial_latency, 0)
+						      : partial_latency;
+			result.last_interval = interval;
+			if (t - last_partial <= (uint64_t)interval) {
+				continue;
+			}
+			last_partial = t;
+			if (adaptive && voiced <= partial_voiced) {
+				result.skipped++;
+				if (speaking(t - window_ms)) {
+					result.skipped_in_speech++;
+				}
+				continue;
+			}
+			partial_voiced = voiced;
+			const uint64_t busy = (uint64_t)((double)run_ms * jitter(rng));
+			controller.report_partial(busy);
+			busy_until = t + busy;
+			result.busy_ms += busy;
+			result.partials++;
+		}
+		return result;
+	};
+
+	printf("\nSimulated partials, %.0f s of 4 s turns and 2 s pauses, latency %d ms\n",
+	       seconds, partial_latency);
+	printf("  %-6s %-9s %12s %10s %10s %10s\n", "model", "latency", "partials/s", "busy",
+	       "skipped", "interval");
+	Result results[2][2];
+	const uint64_t run_ms[2] = {80, 900};
+	const char *model_names[2] = {"fast", "slow"};
+	for (int model = 0; model < 2; model++) {
+		for (int adaptive = 0; adaptive < 2; adaptive++) {
+			const Result &result = results[model][adaptive] =
+				simulate(run_ms[model], adaptive == 1);
+			printf("  %-6s %-9s %12.2f %9.1f%% %10llu %7d ms\n", model_names[model],
+			       adaptive ? "adaptive" : "fixed",
+			       (double)result.partials / seconds,
+			       100.0 * (double)result.busy_ms / (double)total_ms,
+			       (unsigned long long)result.skipped, result.last_interval);
+		}
+	}
+	const double slow_share = (double)results[1][1].busy_ms / (double)total_ms;
+	check(slow_share < 0.4, "the slow model's partials take less than 40% of the thread");
+	check(results[1][1].busy_ms < results[1][0].busy_ms,
+	      "the slow model runs fewer partials than with the fixed latency");
+	check(results[0][1].partials > results[0][0].partials,
+	      "the fast model runs partials closer together");
+	// the slow model's interval is longer than the pauses
+	check(results[0][1].skipped > 0, "the fast model's partials are skipped in the pauses");
+	check(results[0][1].skipped_in_speech == 0 && results[1][1].skipped_in_speech == 0,
+	      "no partial is skipped during speech");
+
+	printf("\n%s\n", ok ? "PASS" : "FAIL");
+	return ok ? 0 : 1;
+}
+
+/*
+ * calibration
+ *
+ * Checks the parts of the machine calibration that do not need a model: the cgroup CPU quota
+ * parsing, the thread counts of the sweep, the audio of a run, the p95 latency, the choice of
+ * the model and the thread count from a sweep, the profile saved and loaded again, and the WAV
+ * reader of the calibration clip. Prints the usable CPUs of this process and the time to count
+ * them, which the filter pays when it loads the profile. Fails if any of them differs from the
+ * expected result.
+ */
+int run_calibration(const std::vector<std::string> &)
+{
+	bool ok = true;
+	auto check = [&ok](bool condition, const char *rule) {
+		printf("  %-64s %s\n", rule, condition ? "ok" : "BROKEN");
+		ok = ok && condition;
+	};
+
+	double cpus = -1.0;
+	check(parse_cgroup_cpu_max("max 100000\n", cpus) && cpus == 0.0,
+	      "cpu.max without a quota is no limit");
+	check(parse_cgroup_cpu_max("250000 100000\n", cpus) && cpus == 2.5,
+	      "cpu.max quota of 2.5 CPUs");
+	check(!parse_cgroup_cpu_max("", cpus) && !parse_cgroup_cpu_max("lots 100000", cpus) &&
+		      !parse_cgroup_cpu_max("100000 0", cpus),
+	      "malformed cpu.max is rejected");
+	check(parse_cgroup_v2_path("12:cpu,cpuacct:/docker/1\n0::/user.slice/obs.scope\n") ==
+			      "/user.slice/obs.scope" &&
+		      parse_cgroup_v2_path("4:cpu:/docker/1\n").empty(),
+	      "cgroup v2 path of the process");
+
+	check(calibration_thread_counts(1) == std::vector<int>{1}, "thread counts for 1 CPU");
+	check(calibration_thread_counts(5) == std::vector<int>({1, 2, 3, 4, 5}),
+	      "thread counts end at the usable CPUs");
+	check(calibration_thread_counts(64) == std::vector<int>({1, 2, 3, 4, 6, 8, 12, 16}),
+	      "thread counts stop at CALIBRATION_MAX_THREADS");
+
+	// an 11 s clip in 5 s segments, as the clip of the Calibrate button
+	std::vector<float> short_clip(11 * 16000);
+	for (size_t i = 0; i < short_clip.size(); i++) {
+		short_clip[i] = (float)i;
+	}
+	const std::vector<float> run_audio = calibration_sweep_audio(short_clip, 5 * 16000, 20);
+	bool repeated = run_audio.size() == 20 * 5 * 16000;
+	for (size_t i = 0; repeated && i < run_audio.size(); i++) {
+		repeated = run_audio[i] == short_clip[i % short_clip.size()];
+	}
+	check(repeated, "a short clip is repeated to 20 full segments");
+	check(calibration_sweep_audio(short_clip, 5 * 16000, 1).size() == 2 * 5 * 16000,
+	      "the partial tail segment of a long clip is dropped");
+
+	std::vector<double> latencies;
+	for (int i = 1; i <= 100; i++) {
+		latencies.push_back((double)(101 - i));
+	}
+	check(std::fabs(latency_percentile(latencies, 0.95) - 95.05) < 1e-9 &&
+		      latency_percentile({}, 0.95) == 0.0,
+	      "p95 of 1..100 is 95.05");
+
+	// rtf by thread count of a small, a medium and a large model
+	CalibrationProfile profile;
+	profile.machine = calibration_machine_id();
+	profile.usable_cpus = usable_cpu_count();
+	const struct {
+		const char *name;
+		uint64_t bytes;
+		std::vector<std::pair<int, double>> rtf;
+	} sweep[] = {
+		{"small", 75u << 20, {{1, 0.40}, {2, 0.22}, {4, 0.13}, {6, 0.125}}},
+		{"medium", 500u << 20, {{2, 0.80}, {4, 0.45}, {6, 0.30}, {8, 0.29}}},
+		{"large", 1500u << 20, {{4, 0.90}, {6, 0.60}, {8, 0.55}}},
+	};
+	for (const auto &model : sweep) {
+		for (const auto &[n_threads, rtf] : model.rtf) {
+			CalibrationRun run;
+			run.model_name = model.name;
+			run.model_file = std::string(model.name) + ".bin";
+			run.model_bytes = model.bytes;
+			run.n_threads = n_threads;
+			run.rtf = rtf;
+			run.p95_ms = rtf * CALIBRATION_SEGMENT_MSEC * 1.2;
+			run.segments = 12;
+			profile.runs.push_back(run);
+		}
+	}
+	check(calibration_select(profile) && profile.meets_target &&
+		      profile.selected.model_name == "medium" && profile.selected.n_threads == 6,
+	      "largest model in real time, fewest threads near its best");
+	profile.max_p95_ms = 1000.0;
+	check(calibration_select(profile) && profile.selected.model_name == "small" &&
+		      profile.selected.n_threads == 4,
+	      "the p95 target excludes the slower models");
+	profile.target_rtf = 0.1;
+	check(calibration_select(profile) && !profile.meets_target &&
+		      profile.selected.model_name == "small" && profile.selected.n_threads == 6,
+	      "the fastest run when no model meets the target");
+	profile.target_rtf = CALIBRATION_DEFAULT_TARGET_RTF;
+	profile.max_p95_ms = CALIBRATION_DEFAULT_MAX_P95_MSEC;
+	calibration_select(profile);
+
+	const std::string path =
+		(std::filesystem::temp_directory_path() / "localvocal-calibration.json").string();
+	CalibrationProfile loaded;
+	const bool saved = save_calibration_profile(path, profile);
+	check(saved && load_calibration_profile(path, loaded) &&
+		      loaded.selected.model_name == profile.selected.model_name &&
+		      loaded.selected.n_threads == profile.selected.n_threads &&
+		      loaded.runs.size() == profile.runs.size() &&
+		      loaded.runs.back().rtf == profile.runs.back().rtf &&
+		      loaded.meets_target == profile.meets_target,
+	      "the profile is saved and loaded again");
+	std::filesystem::remove(path);
+	check(calibration_profile_applies(loaded), "the profile applies on the same machine");
+	loaded.usable_cpus++;
+	check(!calibration_profile_applies(loaded), "a profile of other CPUs does not apply");
+	check(!calibration_profile_from_json("{\"version\": 99}", loaded) &&
+		      !calibration_profile_from_json("not json", loaded),
+	      "other versions and malformed profiles are rejected");
+
+	// a stereo 16 kHz clip of 3 frames with a chunk to skip before its samples
+	auto wav = [](uint32_t rate, uint16_t bits, const std::vector<int16_t> &pcm) {
+		auto le = [](std::string &out, uint32_t value, int bytes) {
+			for (int i = 0; i < bytes; i++) {
+				out.push_back((char)((value >> (8 * i)) & 0xff));
+			}
+		};
+		std::string body = "WAVEfmt ";
+		le(body, 16, 4);
+		le(body, 1, 2);
+		le(body, 2, 2);
+		le(body, rate, 4);
+		le(body, rate * 4, 4);
+		le(body, 4, 2);
+		le(body, bits, 2);
+		body += "LIST";
+		le(body, 3, 4);
+		body += std::string(4, 'x');
+		body += "data";
+		le(body, (uint32_t)pcm.size() * 2, 4);
+		for (int16_t sample : pcm) {
+			le(body, (uint16_t)sample, 2);
+		}
+		std::string file = "RIFF";
+		le(file, (uint32_t)body.size(), 4);
+		return file + body;
+	};
+	const std::vector<int16_t> pcm = {16384, 16384, -32768, 0, 32767, -32767};
+	std::vector<float> clip;
+	check(parse_wav_clip(wav(16000, 16, pcm), clip) && clip.size() == 3 &&
+		      clip[0] == 0.5f && clip[1] == -0.5f && clip[2] == 0.0f,
+	      "the WAV clip is read and mixed down to mono");
+	check(!parse_wav_clip(wav(44100, 16, pcm), clip) &&
+		      !parse_wav_clip(wav(16000, 8, pcm), clip) &&
+		      !parse_wav_clip(wav(16000, 16, pcm).substr(0, 40), clip) &&
+		      !parse_wav_clip("not a wav file", clip),
+	      "other rates, sample formats and truncated files are rejected");
+
+	const int iterations = 1000;
+	const auto start = std::chrono::steady_clock::now();
+	int usable = 0;
+	for (int i = 0; i < iterations; i++) {
+		usable = usable_cpu_count();
+	}
+	printf("%d usable CPUs of %u hardware threads, counted in %.1f us\n", usable,
+	       std::thread::hardware_concurrency(), 1e6 * seconds_since(start) / iterations);
+	check(usable >= 1 && usable <= (int)std::max(std::thread::hardware_concurrency(), 1u),
+	      "usable CPUs are within the hardware threads");
+
+	printf("\n%s\n", ok ? "PASS" : "FAIL");
+	return ok ? 0 : 1;
+}
+
+struct Command {
+	const char *name;
+	const char *description;
+	int (*run)(const std::vector<std::string> &args);
+};
+
+const Command commands[] = {
+	{"resampler", "[sample_rate] [channels] [seconds]  decimator vs. libobs resampler",
+	 run_resampler},
+	{"vad", "<silero_vad.onnx> [seconds]  Silero VAD throughput, IoBinding vs. per window tensors vs. streaming",
+	 run_vad},
+	{"gate", "[seconds]  energy gate kernels and silence detection", run_gate},
+	{"vad-service",
+	 "<silero_vad.onnx> [streams] [seconds] [batch_delay_us]  shared batched VAD vs. a session per stream",
+	 run_vad_service},
+	{"vad-native",
+	 "<silero_vad.onnx> [audio.f32] [weights_output]  built-in Silero VAD engine vs. ONNX Runtime",
+	 run_vad_native},
+	{"scheduler", "[sources] [seconds] [thread_budget]  inference admission order and budget",
+	 run_scheduler},
+	{"threads", "[whisper_model.bin] [cpu_list] [runs] [audio.f32]  short inferences, pinned or not",
+	 run_threads},
+	{"agreement", "[segments] [seed]  local agreement of streaming partials vs. full re-decodes",
+	 run_agreement},
+	{"audio-ctx", " encoder context buckets and degenerate output detection", run_audio_ctx},
+	{"mel", "[whisper_model.bin] [audio.f32]  rolling log-mel cache vs. whisper.cpp's mel",
+	 run_mel},
+	{"abort", "[whisper_model.bin] [audio.f32]  cancellation of the running inference",
+	 run_abort},
+	{"language-id",
+	 "[whisper_model.bin] [language_id_model.bin] [audio.f32]  cached language detection",
+	 run_language_id},
+	{"model-swap", "[load_ms]  background model loading and swap at the end of a segment",
+	 run_model_swap},
+	{"model-load", "[whisper_model.bin] [audio.f32]  memory mapped model loading and warm-up",
+	 run_model_load},
+	{"quality", "[seconds]  adaptive decoding quality under a simulated overload",
+	 run_quality},
+	{"partial-latency", "[seconds]  partial interval from the run time and speech-delta skips",
+	 run_partial_latency},
+	{"calibration", " CPU quota, thread sweep and model choice of the machine calibration",
+	 run_calibration},
+};
+
+void print_usage(const char *program)
+{
+	fprintf(stderr, "Usage: %s <command> [options]\n\nCommands:\n", program);
+	for (const auto &command : commands) {
+		fprintf(stderr, "  %s %s\n", command.name, command.description);
+	}
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		print_usage(argv[0]);
+		return 1;
+	}
+	for (const auto &command : commands) {
+		if (strcmp(argv[1], command.name) == 0) {
+			try {
+				return command.run(args_from(argc, argv));
+			} catch (const std::exception &e) {
+				fprintf(stderr, "%s failed: %s\n", command.name, e.what());
+				return 1;
+			}
+		}
+	}
+	print_usage(argv[0]);
+	return 1;
+}
@@ -22,14 +22,15 @@
 #include "whisper-utils/whisper-language.h"
 #include "whisper-utils/whisper-utils.h"
 #include "whisper-utils/whisper-model-utils.h"
+#include "whisper-utils/inference-scheduler.h"
 #include "translation/language_codes.h"
 #include "translation/cloud-translation/translation-cloud.h"
 
 bool whisper_abort_callback(void *data)
 {
-	// Seems like data is usually a string?
-	obs_log(LOG_DEBUG, "Error in GGML processing - %s", (char *)(data));
-	return false;
+	// polled by the compute threads between the graph nodes, data is the filter
+	const transcription_filter_data *gf_ = static_cast<transcription_filter_data *>(data);
+	return gf_ != nullptr && gf_->inference_abort.should_abort();
 }
 
 void send_caption_to_source(const std::string &target_source_name, const std::string &caption,
@@ -760,19 +761,11 @@ void clear_current_caption(transcription_filter_data *gf_)
 void reset_caption_state(transcription_filter_data *gf_)
 {
 	clear_current_caption(gf_);
-	// flush the buffer
-	{
-		std::lock_guard<std::mutex> lock(gf_->whisper_buf_mutex);
-		for (size_t c = 0; c < gf_->channels; c++) {
-			if (gf_->input_buffers[c].data != nullptr) {
-				deque_free(&gf_->input_buffers[c]);
-			}
-		}
-		if (gf_->info_buffer.data != nullptr) {
-			deque_free(&gf_->info_buffer);
-		}
-	}
+	// flush the buffers. the input ring can only be drained by its consumer, so let the
+	// whisper thread do it on its next iteration
 	gf_->clear_buffers = true;
+	// the running inference decodes audio that is dropped
+	gf_->inference_abort.request(INFERENCE_ABORT_CLEARED);
 }
 
 void media_play_callback(void *data_, calldata_t *cd)
@@ -818,6 +811,46 @@ void media_stopped_callback(void *data_, calldata_t *cd)
 	reset_caption_state(gf_);
 }
 
+void get_lag_proc(void *data_, calldata_t *cd)
+{
+	transcription_filter_data *gf_ = static_cast<struct transcription_filter_data *>(data_);
+	calldata_set_int(cd, "lag_ms", (long long)gf_->inference_lag_ms.load());
+	calldata_set_int(cd, "backlog_ms", (long long)gf_->input_backlog_ms.load());
+	calldata_set_int(cd, "dropped_ms", (long long)gf_->overload_dropped_ms.load());
+}
+
+void get_gate_stats_proc(void *data_, calldata_t *cd)
+{
+	transcription_filter_data *gf_ = static_cast<struct transcription_filter_data *>(data_);
+	calldata_set_int(cd, "skipped_vad_windows", (long long)gf_->gated_vad_windows.load());
+	calldata_set_int(cd, "skipped_inferences", (long long)gf_->skipped_inferences.load());
+}
+
+void get_inference_stats_proc(void *data_, calldata_t *cd)
+{
+	transcription_filter_data *gf_ = static_cast<struct transcription_filter_data *>(data_);
+	const InferenceScheduler &scheduler = InferenceScheduler::instance();
+	const InferenceScheduler::source_stats stats = scheduler.get_stats(gf_);
+	calldata_set_int(cd, "queue_depth", (long long)scheduler.queue_depth());
+	calldata_set_int(cd, "wait_ms", (long long)stats.wait_ms);
+	calldata_set_int(cd, "run_ms", (long long)stats.run_ms);
+	calldata_set_int(cd, "dropped_partials", (long long)stats.dropped_partials);
+	calldata_set_int(cd, "aborted_superseded",
+			 (long long)gf_->inference_abort.count(INFERENCE_ABORT_SUPERSEDED));
+	calldata_set_int(cd, "aborted_cleared",
+			 (long long)gf_->inference_abort.count(INFERENCE_ABORT_CLEARED));
+	calldata_set_int(cd, "aborted_shutdown",
+			 (long long)gf_->inference_abort.count(INFERENCE_ABORT_SHUTDOWN));
+}
+
+void get_partial_stats_proc(void *data_, calldata_t *cd)
+{
+	transcription_filter_data *gf_ = static_cast<struct transcription_filter_data *>(data_);
+	calldata_set_int(cd, "interval_ms", (long long)gf_->partial_interval_current.load());
+	calldata_set_int(cd, "partials", (long long)gf_->partials_run.load());
+	calldata_set_int(cd, "skipped_partials", (long long)gf_->partials_skipped.load());
+}
+
 void enable_callback(void *data_, calldata_t *cd)
 {
 	transcription_filter_data *gf_ = static_cast<struct transcription_filter_data *>(data_);
@@ -28,5 +28,9 @@ void media_pause_callback(void *data_, calldata_t *cd);
 void media_restart_callback(void *data_, calldata_t *cd);
 void media_stopped_callback(void *data_, calldata_t *cd);
 void enable_callback(void *data_, calldata_t *cd);
+void get_lag_proc(void *data_, calldata_t *cd);
+void get_gate_stats_proc(void *data_, calldata_t *cd);
+void get_inference_stats_proc(void *data_, calldata_t *cd);
+void get_partial_stats_proc(void *data_, calldata_t *cd);
 
 #endif /* TRANSCRIPTION_FILTER_CALLBACKS_H */
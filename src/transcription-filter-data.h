@@ -21,13 +21,30 @@
 
 #include "translation/translation.h"
 #include "translation/translation-includes.h"
+#include "whisper-utils/audio-decimator.h"
+#include "whisper-utils/audio-ring-buffer.h"
+#include "whisper-utils/energy-gate.h"
+#include "whisper-utils/inference-abort.h"
+#include "whisper-utils/language-id.h"
+#include "whisper-utils/local-agreement.h"
+#include "whisper-utils/mel-cache.h"
+#include "whisper-utils/model-swap.h"
+#include "whisper-utils/partial-latency.h"
+#include "whisper-utils/quality-controller.h"
+#include "whisper-utils/whisper-audio-buffer.h"
 #include "whisper-utils/silero-vad-onnx.h"
 #include "whisper-utils/whisper-processing.h"
+#include "whisper-utils/whisper-model-registry.h"
 #include "whisper-utils/token-buffer-thread.h"
+#include "whisper-utils/wake-scheduler.h"
 #include "translation/cloud-translation/translation-cloud.h"
 
-#define MAX_PREPROC_CHANNELS 10
+#define MAX_PREPROC_CHANNELS AUDIO_RING_MAX_CHANNELS
 #define MAX_WEBVTT_TRACKS 5
+// Capacity of the input audio ring, in ms of audio at the input sample rate
+#define INPUT_RING_BUFFER_MS 20000
+// Capacity of the input audio ring, in number of audio packets
+#define INPUT_RING_BUFFER_PACKETS 4096
 
 #if !defined(LIBOBS_API_MAJOR_VER) || LIBOBS_API_MAJOR_VER < 31
 struct encoder_packet_time {
@@ -123,18 +140,121 @@ struct transcription_filter_data {
 
 	/* PCM buffers */
 	float *copy_buffers[MAX_PREPROC_CHANNELS];
-	struct deque info_buffer;
-	struct deque input_buffers[MAX_PREPROC_CHANNELS];
+	// Input audio from the OBS audio thread (producer) to the whisper thread (consumer)
+	AudioRingBuffer input_ring;
+	uint64_t input_ring_overruns_reported = 0;
+	// Limit of the unprocessed input audio and what to do above it (OverloadPolicy)
+	int max_backlog_ms = 10000;
+	int overload_policy = 0;
+	// Set by the whisper thread while the backlog is over the limit
+	bool overload_active = false;
+	// Monitoring, published through the "get_lag" proc handler: delay between capturing
+	// audio and finishing its inference, current input backlog and audio dropped on overload
+	std::atomic<uint64_t> inference_lag_ms{0};
+	std::atomic<uint64_t> input_backlog_ms{0};
+	std::atomic<uint64_t> overload_dropped_ms{0};
+	// Decoding cost lowered in stages while the whisper thread falls behind and raised again
+	// with headroom, see quality-controller.h. Owned by the whisper thread
+	bool adaptive_quality = false;
+	QualityController quality;
+	// Energy gate in front of the VAD and whisper, see energy-gate.h. Its counters are
+	// published through the "get_gate_stats" proc handler
+	bool energy_gate_enabled = true;
+	std::atomic<uint64_t> gated_vad_windows{0};
+	std::atomic<uint64_t> skipped_inferences{0};
+	// Encoder context sized to the segment, see audio-ctx.h, and the decodes that fell back to
+	// the full context. The segments decoded and their total decoding time, with the
+	// fallbacks, are kept for benchmarks
+	bool dynamic_audio_ctx = false;
+	std::atomic<uint64_t> audio_ctx_fallbacks{0};
+	std::atomic<uint64_t> whisper_runs{0};
+	std::atomic<uint64_t> whisper_run_ms{0};
+	// the ones decoded by the partial model
+	std::atomic<uint64_t> partial_model_runs{0};
+	std::atomic<uint64_t> partial_model_run_ms{0};
+	// Cancellation of the running inference, polled by whisper through abort_callback, see
+	// inference-abort.h. Its counts go out through the "get_inference_stats" proc handler
+	InferenceAbort inference_abort;
 	std::atomic<bool> clear_buffers;
-	struct deque whisper_buffer;
+	// 16 kHz mono audio waiting for inference, handed to whisper without copying
+	WhisperAudioBuffer whisper_buffer;
+	// Log-mel frames of the whisper buffer, computed as the audio arrives and handed to whisper
+	// instead of the samples, see mel-cache.h. The input of the last inference starts at
+	// inference_first_sample of the buffer, where its token times start
+	bool incremental_mel = false;
+	MelCache mel_cache;
+	std::vector<float> mel_input;
+	int64_t inference_first_sample = 0;
+	// Streaming VAD bookkeeping of the whisper thread: events of the last chunk, capture time
+	// of a recent sample of the whisper buffer and the end of the latest detected speech, in
+	// whisper buffer positions
+	std::vector<VadEvent> vad_events;
+	uint64_t stream_anchor_sample = 0;
+	uint64_t stream_anchor_ts_ms = 0;
+	uint64_t last_speech_sample = 0;
+	// Without the VAD, the gate classifies the whisper buffer up to gate_position and
+	// last_voiced_sample is the end of the latest window with sound
+	EnergyGate segment_gate;
+	uint64_t gate_position = 0;
+	uint64_t last_voiced_sample = 0;
+	std::vector<float> short_segment_buffer;
 
 	/* Resampler */
 	audio_resampler_t *resampler_to_whisper;
+	// Fast path for input rates that are a multiple of 16kHz, used instead of the resampler
+	AudioDecimator decimator;
+	std::vector<float> decimated_buffer;
 	struct deque resampled_buffer;
 
 	/* whisper */
 	std::string whisper_model_path;
+	// weights shared with the other filters through the model registry, and the decoding
+	// state of this filter. whisper_context is the context of whisper_model
+	std::shared_ptr<WhisperModel> whisper_model;
+	struct whisper_state *whisper_state = nullptr;
 	struct whisper_context *whisper_context;
+	// Optional smaller model for the partials, loaded and released with whisper_model:
+	// partial_whisper_model_path is the model of the settings (empty for none) and
+	// partial_whisper_model_file its file, set once it is downloaded
+	std::string partial_whisper_model_path;
+	std::string partial_whisper_model_file;
+	std::shared_ptr<WhisperModel> partial_whisper_model;
+	struct whisper_state *partial_whisper_state = nullptr;
+	struct whisper_context *partial_whisper_context = nullptr;
+	// With the language set to auto: the language detected at the start of the speech and
+	// cached, see language-id.h, guarded by whisper_ctx_mutex. The detection runs on the
+	// optional language ID model, a small multilingual model kept like the partial model
+	LanguageIdCache language_id;
+	std::vector<float> language_probs;
+	std::string language_id_model_path;
+	std::string language_id_model_file;
+	std::shared_ptr<WhisperModel> language_id_model;
+	struct whisper_state *language_id_state = nullptr;
+	struct whisper_context *language_id_context = nullptr;
+	// Models loaded in the background while the ones above keep decoding, swapped in by the
+	// whisper thread, see model-swap.h. The settings the models are loaded with (the backend
+	// device, flash attention, DTW timestamps, keep alive and warm-up) are guarded by
+	// whisper_ctx_mutex and copied into the load request
+	ModelSwap model_swap;
+	// how long the registry keeps the model loaded once no filter uses it
+	int model_keep_alive_sec = 120;
+	// run an inference on silence after loading a model, the latency of the first inference
+	// after a load is logged
+	bool model_warm_up = true;
+	bool first_inference_after_load = false;
+	// whether the loaded model ran the warm-up, owned by the whisper thread
+	bool whisper_model_warmed_up = false;
+	// CPUs the whisper thread and its compute threads run on (e.g. "0-3"), empty for any, see
+	// compute-threads.h. Guarded by whisper_ctx_mutex, the whisper thread pins itself again
+	// when the generation changes
+	std::string inference_cpu_affinity;
+	std::atomic<uint64_t> inference_cpu_affinity_generation{0};
+	// Calibration of the machine started by the Calibrate button, see calibration.h. The sweep
+	// runs on calibration_data, a filter data of its own, while this filter drops its audio
+	std::mutex calibration_mutex;
+	std::thread calibration_thread;
+	std::unique_ptr<transcription_filter_data> calibration_data;
+	std::atomic<bool> calibrating{false};
 	whisper_full_params whisper_params;
 
 	/* Silero VAD */
@@ -166,6 +286,27 @@ struct transcription_filter_data {
 	bool initial_creation = true;
 	bool partial_transcription = false;
 	int partial_latency = 1000;
+	// The partial interval follows the time the partials take, and partials without new voiced
+	// audio are skipped, see partial-latency.h. partial_voiced_sample is the end of the voiced
+	// audio at the last partial. The counts and the current interval go out through the
+	// "get_partial_stats" proc handler
+	bool adaptive_partial_latency = false;
+	PartialLatencyController partial_latency_controller;
+	uint64_t partial_voiced_sample = 0;
+	std::atomic<uint64_t> partials_run{0};
+	std::atomic<uint64_t> partials_skipped{0};
+	std::atomic<int> partial_interval_current{1000};
+	// Decoding of the partials, over the whisper parameters of the finals, see
+	// apply_partial_decoding_profile
+	int partial_strategy = WHISPER_SAMPLING_GREEDY;
+	bool partial_temperature_fallback = false;
+	bool partial_no_timestamps = true;
+	// 0: as many as the finals
+	int partial_max_tokens = 48;
+	// Partials commit the tokens two consecutive hypotheses agree on and only decode the
+	// audio after them, see local-agreement.h. Owned by the whisper thread
+	bool partial_agreement = false;
+	LocalAgreement local_agreement;
 	float duration_filter_threshold = 2.25f;
 	// Duration of the target segment buffer in ms
 	int segment_duration = 7000;
@@ -195,9 +336,9 @@ struct transcription_filter_data {
 	// Use std for thread and mutex
 	std::thread whisper_thread;
 
-	std::mutex whisper_buf_mutex;
 	std::mutex whisper_ctx_mutex;
-	std::condition_variable wshiper_thread_cv;
+	// wakes the whisper thread when enough audio is in the input ring
+	WakeScheduler whisper_wake;
 	std::optional<std::condition_variable> input_cv;
 
 	// translation context
@@ -249,7 +390,7 @@ struct transcription_filter_data {
 #endif
 
 	// ctor
-	transcription_filter_data() : whisper_buf_mutex(), whisper_ctx_mutex(), wshiper_thread_cv()
+	transcription_filter_data() : whisper_ctx_mutex()
 	{
 		// initialize all pointers to nullptr
 		for (size_t i = 0; i < MAX_PREPROC_CHANNELS; i++) {
@@ -264,12 +405,6 @@ struct transcription_filter_data {
 	}
 };
 
-// Audio packet info
-struct transcription_filter_audio_info {
-	uint32_t frames;
-	uint64_t timestamp_offset_ns; // offset (since start of processing) timestamp in ns
-};
-
 enum TranslationType { NO_TRANSLATION = 0, LOCAL_TRANSLATION = 1, CLOUD_TRANSLATION = 2 };
 
 // Callback sent when the transcription has a new result
@@ -10,6 +10,7 @@
 #include "whisper-utils/whisper-language.h"
 #include "whisper-utils/vad-processing.h"
 #include "whisper-utils/whisper-params.h"
+#include "whisper-utils/whisper-model-utils.h"
 #include "model-utils/model-downloader-types.h"
 #include "translation/language_codes.h"
 #include "ui/filter-replace-dialog.h"
@@ -520,6 +521,37 @@ void add_buffered_output_group_properties(obs_properties_t *ppts)
 				      MT_("buffer_num_chars_per_line"), 1, 100, 1);
 }
 
+// describes the calibration profile of this machine
+static std::string calibration_info_text(const struct transcription_filter_data *gf)
+{
+	if (gf != nullptr && gf->calibrating) {
+		return MT_("calibration_running");
+	}
+	const MachineCalibration calibration = machine_calibration();
+	if (!calibration.available) {
+		return MT_("calibration_none");
+	}
+	if (!calibration.applies) {
+		return MT_("calibration_other_machine");
+	}
+	const CalibrationProfile &profile = calibration.profile;
+	const CalibrationRun &run = profile.selected;
+	const std::string model =
+		!run.model_name.empty()
+			? run.model_name
+			: run.model_file.substr(run.model_file.find_last_of("/\\") + 1);
+	QString info = QString(MT_("calibration_info"))
+			       .arg(QString::fromStdString(model))
+			       .arg(run.n_threads)
+			       .arg(run.rtf, 0, 'f', 2)
+			       .arg((int)run.p95_ms)
+			       .arg(profile.usable_cpus);
+	if (!profile.meets_target) {
+		info += " " + QString(MT_("calibration_below_target"));
+	}
+	return info.toStdString();
+}
+
 void add_advanced_group_properties(obs_properties_t *ppts, struct transcription_filter_data *gf)
 {
 	// add a group for advanced configuration
@@ -550,6 +582,14 @@ void add_advanced_group_properties(obs_properties_t *ppts, struct transcription_
 	// add vad threshold slider
 	obs_properties_add_float_slider(advanced_config_group, "vad_threshold",
 					MT_("vad_threshold"), 0.0, 1.0, 0.05);
+	// skip the VAD and inference on clearly silent audio
+	obs_properties_add_bool(advanced_config_group, "energy_gate", MT_("energy_gate"));
+	obs_property_t *dynamic_audio_ctx = obs_properties_add_bool(
+		advanced_config_group, "dynamic_audio_ctx", MT_("dynamic_audio_ctx"));
+	obs_property_set_long_description(dynamic_audio_ctx, MT_("dynamic_audio_ctx_tooltip"));
+	obs_property_t *incremental_mel = obs_properties_add_bool(
+		advanced_config_group, "incremental_mel", MT_("incremental_mel"));
+	obs_property_set_long_description(incremental_mel, MT_("incremental_mel_tooltip"));
 	// add duration filter threshold slider
 	obs_properties_add_float_slider(advanced_config_group, "duration_filter_threshold",
 					MT_("duration_filter_threshold"), 0.1, 3.0, 0.05);
@@ -557,6 +597,49 @@ void add_advanced_group_properties(obs_properties_t *ppts, struct transcription_
 	obs_properties_add_int_slider(advanced_config_group, "segment_duration",
 				      MT_("segment_duration"), 3000, 15000, 100);
 
+	// what to do when inference is slower than real time
+	obs_properties_add_int_slider(advanced_config_group, "max_backlog_ms",
+				      MT_("max_backlog_ms"), 1000, 10000, 500);
+	obs_property_t *overload_policy_list = obs_properties_add_list(
+		advanced_config_group, "overload_policy", MT_("overload_policy"),
+		OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(overload_policy_list, MT_("overload_drop_oldest"),
+				  OVERLOAD_POLICY_DROP_OLDEST);
+	obs_property_list_add_int(overload_policy_list, MT_("overload_drop_silence"),
+				  OVERLOAD_POLICY_DROP_SILENCE);
+	obs_property_list_add_int(overload_policy_list, MT_("overload_fast_decoding"),
+				  OVERLOAD_POLICY_FAST_DECODING);
+	obs_property_t *adaptive_quality = obs_properties_add_bool(
+		advanced_config_group, "adaptive_quality", MT_("adaptive_quality"));
+	obs_property_set_long_description(adaptive_quality, MT_("adaptive_quality_tooltip"));
+	// keep the model loaded a while after the last filter using it stops
+	obs_properties_add_int_slider(advanced_config_group, "model_keep_alive",
+				      MT_("model_keep_alive"), 0, 600, 10);
+	obs_property_t *model_warm_up = obs_properties_add_bool(
+		advanced_config_group, "model_warm_up", MT_("model_warm_up"));
+	obs_property_set_long_description(model_warm_up, MT_("model_warm_up_tooltip"));
+	// the thread count and the model measured for this machine, see calibration.h
+	obs_property_t *use_calibration_profile = obs_properties_add_bool(
+		advanced_config_group, "use_calibration_profile", MT_("use_calibration_profile"));
+	obs_property_set_long_description(use_calibration_profile,
+					  MT_("use_calibration_profile_tooltip"));
+	obs_properties_add_text(advanced_config_group, "calibration_info",
+				calibration_info_text(gf).c_str(), OBS_TEXT_INFO);
+	obs_property_t *calibrate = obs_properties_add_button2(
+		advanced_config_group, "calibrate", MT_("calibrate"),
+		[](obs_properties_t *props, obs_property_t *property, void *data_) {
+			UNUSED_PARAMETER(property);
+			struct transcription_filter_data *gf_ =
+				static_cast<struct transcription_filter_data *>(data_);
+			calibrate_machine(gf_);
+			// shows that the calibration runs
+			obs_property_set_description(obs_properties_get(props, "calibration_info"),
+						     calibration_info_text(gf_).c_str());
+			return true;
+		},
+		gf);
+	obs_property_set_long_description(calibrate, MT_("calibrate_tooltip"));
+
 	// add button to open filter and replace UI dialog
 	obs_properties_add_button2(
 		advanced_config_group, "open_filter_ui", MT_("open_filter_ui"),
@@ -618,6 +701,26 @@ void add_general_group_properties(obs_properties_t *ppts)
 		obs_property_list_add_string(whisper_language_select_list, pair.first.c_str(),
 					     pair.second.c_str());
 	}
+
+	// with the language set to auto: the model that detects it and how often, see
+	// language-id.h
+	obs_property_t *language_id_models_list = obs_properties_add_list(
+		general_group, "language_id_model_path", MT_("language_id_model"),
+		OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_STRING);
+	obs_property_list_add_string(language_id_models_list, MT_("language_id_model_none"), "");
+	for (const auto &model_info :
+	     get_sorted_models_info(std::optional<ModelType>{MODEL_TYPE_TRANSCRIPTION})) {
+		obs_property_list_add_string(language_id_models_list,
+					     model_info.friendly_name.c_str(),
+					     model_info.friendly_name.c_str());
+	}
+	obs_property_set_long_description(language_id_models_list,
+					  MT_("language_id_model_tooltip"));
+	obs_property_t *language_id_recheck =
+		obs_properties_add_int(general_group, "language_id_recheck_sec",
+				       MT_("language_id_recheck_sec"), 0, 3600, 10);
+	obs_property_set_long_description(language_id_recheck,
+					  MT_("language_id_recheck_sec_tooltip"));
 }
 
 void add_partial_group_properties(obs_properties_t *ppts)
@@ -634,6 +737,43 @@ void add_partial_group_properties(obs_properties_t *ppts)
 	// add slider for partial latecy
 	obs_properties_add_int_slider(partial_group, "partial_latency", MT_("partial_latency"), 500,
 				      3000, 50);
+	obs_property_t *adaptive_partial_latency = obs_properties_add_bool(
+		partial_group, "adaptive_partial_latency", MT_("adaptive_partial_latency"));
+	obs_property_set_long_description(adaptive_partial_latency,
+					  MT_("adaptive_partial_latency_tooltip"));
+
+	// a smaller model for the partials, the finals use the model of the transcription group
+	obs_property_t *partial_models_list = obs_properties_add_list(
+		partial_group, "partial_whisper_model_path", MT_("partial_whisper_model"),
+		OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_STRING);
+	obs_property_list_add_string(partial_models_list, MT_("partial_whisper_model_none"), "");
+	for (const auto &model_info :
+	     get_sorted_models_info(std::optional<ModelType>{MODEL_TYPE_TRANSCRIPTION})) {
+		obs_property_list_add_string(partial_models_list, model_info.friendly_name.c_str(),
+					     model_info.friendly_name.c_str());
+	}
+	obs_property_set_long_description(partial_models_list,
+					  MT_("partial_whisper_model_tooltip"));
+
+	// decoding of the partials, the finals use the whisper parameters
+	obs_property_t *partial_strategy =
+		obs_properties_add_list(partial_group, "partial_strategy", MT_("partial_strategy"),
+					OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(partial_strategy, MT_("whisper_sampling_greedy"),
+				  WHISPER_SAMPLING_GREEDY);
+	obs_property_list_add_int(partial_strategy, MT_("whisper_sampling_beam_search"),
+				  WHISPER_SAMPLING_BEAM_SEARCH);
+	obs_property_set_long_description(partial_strategy, MT_("partial_strategy_tooltip"));
+	obs_properties_add_bool(partial_group, "partial_temperature_fallback",
+				MT_("partial_temperature_fallback"));
+	obs_properties_add_bool(partial_group, "partial_no_timestamps",
+				MT_("partial_no_timestamps"));
+	obs_properties_add_int(partial_group, "partial_max_tokens", MT_("partial_max_tokens"), 0,
+			       224, 1);
+
+	obs_property_t *partial_agreement = obs_properties_add_bool(
+		partial_group, "partial_agreement", MT_("partial_agreement"));
+	obs_property_set_long_description(partial_agreement, MT_("partial_agreement_tooltip"));
 }
 
 void add_whisper_backend_group_properties(obs_properties_t *ppts,
@@ -661,6 +801,12 @@ void add_whisper_backend_group_properties(obs_properties_t *ppts,
 	obs_property_t *enable_flash_attn = obs_properties_add_bool(
 		backend_group, "enable_flash_attn", MT_("enable_flash_attn"));
 	obs_property_set_long_description(enable_flash_attn, MT_("enable_flash_attn_tooltip"));
+
+	// CPU threads of whisper, see compute-threads.h
+	obs_property_t *cpu_affinity =
+		obs_properties_add_text(backend_group, "inference_cpu_affinity",
+					MT_("inference_cpu_affinity"), OBS_TEXT_DEFAULT);
+	obs_property_set_long_description(cpu_affinity, MT_("inference_cpu_affinity_tooltip"));
 }
 
 obs_properties_t *transcription_filter_properties(void *data)
@@ -716,13 +862,24 @@ void transcription_filter_defaults(obs_data_t *s)
 
 	obs_data_set_default_bool(s, "vad_mode", VAD_MODE_ACTIVE);
 	obs_data_set_default_double(s, "vad_threshold", 0.65);
+	obs_data_set_default_bool(s, "energy_gate", true);
+	obs_data_set_default_bool(s, "dynamic_audio_ctx", false);
+	obs_data_set_default_bool(s, "incremental_mel", false);
 	obs_data_set_default_double(s, "duration_filter_threshold", 2.25);
 	obs_data_set_default_int(s, "segment_duration", 7000);
+	obs_data_set_default_int(s, "max_backlog_ms", 10000);
+	obs_data_set_default_int(s, "overload_policy", OVERLOAD_POLICY_DROP_OLDEST);
+	obs_data_set_default_bool(s, "adaptive_quality", true);
+	obs_data_set_default_int(s, "model_keep_alive", 120);
+	obs_data_set_default_bool(s, "model_warm_up", true);
+	obs_data_set_default_bool(s, "use_calibration_profile", true);
 	obs_data_set_default_int(s, "log_level", LOG_DEBUG);
 	obs_data_set_default_bool(s, "log_words", false);
 	obs_data_set_default_bool(s, "caption_to_stream", false);
 	obs_data_set_default_string(s, "whisper_model_path", "Whisper Tiny English (74Mb)");
 	obs_data_set_default_string(s, "whisper_language_select", "en");
+	obs_data_set_default_string(s, "language_id_model_path", "");
+	obs_data_set_default_int(s, "language_id_recheck_sec", 60);
 	obs_data_set_default_string(s, "subtitle_sources", "none");
 	obs_data_set_default_bool(s, "process_while_muted", false);
 	obs_data_set_default_bool(s, "subtitle_save_srt", false);
@@ -735,6 +892,13 @@ void transcription_filter_defaults(obs_data_t *s)
 	obs_data_set_default_double(s, "sentence_psum_accept_thresh", 0.4);
 	obs_data_set_default_bool(s, "partial_group", true);
 	obs_data_set_default_int(s, "partial_latency", 1100);
+	obs_data_set_default_bool(s, "adaptive_partial_latency", true);
+	obs_data_set_default_string(s, "partial_whisper_model_path", "");
+	obs_data_set_default_int(s, "partial_strategy", WHISPER_SAMPLING_GREEDY);
+	obs_data_set_default_bool(s, "partial_temperature_fallback", false);
+	obs_data_set_default_bool(s, "partial_no_timestamps", true);
+	obs_data_set_default_int(s, "partial_max_tokens", 48);
+	obs_data_set_default_bool(s, "partial_agreement", false);
 
 	// translation options
 	obs_data_set_default_bool(s, "translate", false);
@@ -775,6 +939,7 @@ void transcription_filter_defaults(obs_data_t *s)
 	// backend options
 	obs_data_set_default_int(s, "backend_device", -1);
 	obs_data_set_default_bool(s, "enable_flash_attn", false);
+	obs_data_set_default_string(s, "inference_cpu_affinity", "");
 
 	// Whisper parameters
 	apply_whisper_params_defaults_on_settings(s);
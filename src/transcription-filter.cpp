@@ -29,6 +29,7 @@
 #include "whisper-utils/whisper-model-utils.h"
 #include "whisper-utils/whisper-utils.h"
 #include "whisper-utils/whisper-params.h"
+#include "whisper-utils/inference-scheduler.h"
 #include "translation/language_codes.h"
 #include "translation/translation-utils.h"
 #include "translation/translation.h"
@@ -155,21 +156,13 @@ struct obs_audio_data *transcription_filter_filter_audio(void *data, struct obs_
 		}
 	}
 
-	{
-		std::lock_guard<std::mutex> lock(gf->whisper_buf_mutex); // scoped lock
-		// push back current audio data to input deque
-		for (size_t c = 0; c < gf->channels; c++) {
-			deque_push_back(&gf->input_buffers[c], audio->data[c],
-					audio->frames * sizeof(float));
-		}
-		// push audio packet info (timestamp/frame count) to info deque
-		struct transcription_filter_audio_info info = {0};
-		info.frames = audio->frames; // number of frames in this packet
-		// calculate timestamp offset from the start of the stream
-		info.timestamp_offset_ns = now_ns() - gf->start_timestamp_ms * 1000000;
-		deque_push_back(&gf->info_buffer, &info, sizeof(info));
-		gf->wshiper_thread_cv.notify_one();
-	}
+	// push the audio data and packet info (timestamp/frame count) to the input ring.
+	// this never blocks or allocates: if the whisper thread is too far behind the packet is
+	// dropped and counted, the whisper thread reports it
+	const uint64_t timestamp_offset_ns = now_ns() - gf->start_timestamp_ms * 1000000;
+	gf->input_ring.push(audio->data, audio->frames, timestamp_offset_ns);
+	gf->whisper_wake.on_frames_available(gf->input_ring.frames_available());
+	gf->inference_abort.on_input_frames(gf->input_ring.frames_available());
 
 	return audio;
 }
@@ -205,21 +198,22 @@ void transcription_filter_destroy(void *data)
 	signal_handler_disconnect(sh_filter, "enable", enable_callback, gf);
 
 	obs_log(gf->log_level, "filter destroy");
+	stop_machine_calibration(gf);
 	shutdown_whisper_thread(gf);
+	InferenceScheduler::instance().forget(gf);
 
 	if (gf->resampler_to_whisper) {
 		audio_resampler_destroy(gf->resampler_to_whisper);
 	}
 
-	{
-		std::lock_guard<std::mutex> lockbuf(gf->whisper_buf_mutex);
-		bfree(gf->copy_buffers[0]);
-		gf->copy_buffers[0] = nullptr;
-		for (size_t i = 0; i < gf->channels; i++) {
-			deque_free(&gf->input_buffers[i]);
-		}
-	}
-	deque_free(&gf->info_buffer);
+	bfree(gf->copy_buffers[0]);
+	gf->copy_buffers[0] = nullptr;
+	obs_log(gf->log_level, "input ring high water mark %.1f ms, %llu overruns",
+		(float)gf->input_ring.high_water_mark() * 1000.0f / (float)gf->sample_rate,
+		(unsigned long long)gf->input_ring.overrun_count());
+	gf->input_ring.release();
+	gf->whisper_buffer.release();
+	gf->decimator.release();
 
 	deque_free(&gf->resampled_buffer);
 
@@ -323,6 +317,24 @@ void transcription_filter_update(void *data, obs_data_t *s)
 	gf->segment_duration = (int)obs_data_get_int(s, "segment_duration");
 	gf->partial_transcription = obs_data_get_bool(s, "partial_group");
 	gf->partial_latency = (int)obs_data_get_int(s, "partial_latency");
+	gf->adaptive_partial_latency = obs_data_get_bool(s, "adaptive_partial_latency");
+	gf->partial_strategy = (int)obs_data_get_int(s, "partial_strategy");
+	gf->partial_temperature_fallback = obs_data_get_bool(s, "partial_temperature_fallback");
+	gf->partial_no_timestamps = obs_data_get_bool(s, "partial_no_timestamps");
+	gf->partial_max_tokens = (int)obs_data_get_int(s, "partial_max_tokens");
+	gf->partial_agreement = obs_data_get_bool(s, "partial_agreement");
+	gf->max_backlog_ms = (int)obs_data_get_int(s, "max_backlog_ms");
+	gf->overload_policy = (int)obs_data_get_int(s, "overload_policy");
+	gf->adaptive_quality = obs_data_get_bool(s, "adaptive_quality");
+	gf->energy_gate_enabled = obs_data_get_bool(s, "energy_gate");
+	gf->dynamic_audio_ctx = obs_data_get_bool(s, "dynamic_audio_ctx");
+	gf->incremental_mel = obs_data_get_bool(s, "incremental_mel");
+	{
+		// read by the model load requests, see whisper_model_load_request
+		std::lock_guard<std::mutex> lock(gf->whisper_ctx_mutex);
+		gf->model_keep_alive_sec = (int)obs_data_get_int(s, "model_keep_alive");
+		gf->model_warm_up = obs_data_get_bool(s, "model_warm_up");
+	}
 	bool new_buffered_output = obs_data_get_bool(s, "buffered_output");
 	int new_buffer_num_lines = (int)obs_data_get_int(s, "buffer_num_lines");
 	int new_buffer_num_chars_per_line = (int)obs_data_get_int(s, "buffer_num_chars_per_line");
@@ -541,30 +553,50 @@ void transcription_filter_update(void *data, obs_data_t *s)
 
 	int new_backend_device = (int)obs_data_get_int(s, "backend_device");
 	bool enable_flash_attn = obs_data_get_bool(s, "enable_flash_attn");
+	const std::string cpu_affinity = obs_data_get_string(s, "inference_cpu_affinity");
 	bool whisper_backend_changed = (gf->gpu_device == new_backend_device) ||
 				       (enable_flash_attn != gf->enable_flash_attn);
-	gf->gpu_device = new_backend_device;
-	gf->enable_flash_attn = enable_flash_attn;
+	{
+		std::lock_guard<std::mutex> lock(gf->whisper_ctx_mutex);
+		gf->gpu_device = new_backend_device;
+		gf->enable_flash_attn = enable_flash_attn;
+	}
 
 	obs_log(gf->log_level, "update text source");
 	// update the text source
 	text_output_source_update(obs_data_get_string(s, "subtitle_sources"), gf->text_source_name,
 				  gf);
 
+	// the thread count of the calibration, when the setting is left at its default
+	CalibrationProfile calibration;
+	const bool calibrated_threads = !obs_data_has_user_value(s, "n_threads") &&
+					calibration_profile_for_settings(s, calibration);
+
 	obs_log(gf->log_level, "update whisper params");
 	{
 		std::lock_guard<std::mutex> lock(gf->whisper_ctx_mutex);
 
 		gf->n_context_sentences = (int)obs_data_get_int(s, "n_context_sentences");
 
+		if (cpu_affinity != gf->inference_cpu_affinity) {
+			// the whisper thread pins itself again, the models stay loaded
+			gf->inference_cpu_affinity = cpu_affinity;
+			gf->inference_cpu_affinity_generation++;
+		}
+
 		gf->sentence_psum_accept_thresh =
 			(float)obs_data_get_double(s, "sentence_psum_accept_thresh");
 
 		apply_whisper_params_from_settings(gf->whisper_params, s);
+		if (calibrated_threads) {
+			gf->whisper_params.n_threads = calibration.selected.n_threads;
+			obs_log(gf->log_level, "Calibration profile: %d threads",
+				gf->whisper_params.n_threads);
+		}
 
-		// if (gf->whisper_params.abort_callback == nullptr) {
-		// 	gf->whisper_params.abort_callback = whisper_abort_callback;
-		// }
+		// stops the running inference when it is cancelled, see inference-abort.h
+		gf->whisper_params.abort_callback = whisper_abort_callback;
+		gf->whisper_params.abort_callback_user_data = gf;
 
 		if (!new_translate || gf->translation_model_index != "whisper-based-translation") {
 			const char *whisper_language_select =
@@ -585,6 +617,10 @@ void transcription_filter_update(void *data, obs_data_t *s)
 				gf->whisper_params.detect_language = true;
 			}
 		}
+		// the language setting may have changed, detect it again
+		gf->language_id.set_recheck_interval(
+			(uint64_t)obs_data_get_int(s, "language_id_recheck_sec") * 1000);
+		gf->language_id.reset();
 
 		if (gf->vad) {
 			const float vad_threshold = (float)obs_data_get_double(s, "vad_threshold");
@@ -606,12 +642,24 @@ void transcription_filter_update(void *data, obs_data_t *s)
 				obs_data_get_string(s, "whisper_model_path") != nullptr
 					? obs_data_get_string(s, "whisper_model_path")
 					: "Whisper Tiny English (74Mb)";
+			const std::string new_partial_model_path =
+				obs_data_get_string(s, "partial_whisper_model_path");
+			const std::string new_language_id_model_path =
+				obs_data_get_string(s, "language_id_model_path");
 			if (gf->whisper_model_path != new_model_path) {
 				obs_log(LOG_INFO, "New model selected: %s", new_model_path.c_str());
 				update_whisper_model(gf);
 			} else if (whisper_backend_changed) {
 				obs_log(LOG_INFO, "Whisper backend changed");
 				update_whisper_model(gf, true);
+			} else if (gf->partial_whisper_model_path != new_partial_model_path) {
+				obs_log(LOG_INFO, "New partial model selected: '%s'",
+					new_partial_model_path.c_str());
+				update_whisper_model(gf, true);
+			} else if (gf->language_id_model_path != new_language_id_model_path) {
+				obs_log(LOG_INFO, "New language ID model selected: '%s'",
+					new_language_id_model_path.c_str());
+				update_whisper_model(gf, true);
 			}
 		}
 	} else {
@@ -644,11 +692,20 @@ void *transcription_filter_create(obs_data_t *settings, obs_source_t *filter)
 	gf->buffered_output = obs_data_get_bool(settings, "buffered_output");
 	gf->initial_creation = true;
 
-	for (size_t i = 0; i < gf->channels; i++) {
-		deque_init(&gf->input_buffers[i]);
+	// allocate the input ring up front so the audio thread never allocates
+	if (!gf->input_ring.init(gf->channels, gf->sample_rate,
+				 (size_t)gf->sample_rate * INPUT_RING_BUFFER_MS / 1000,
+				 INPUT_RING_BUFFER_PACKETS)) {
+		obs_log(LOG_ERROR, "Failed to allocate input audio ring");
+		gf->active = false;
+		return nullptr;
+	}
+	if (!gf->whisper_buffer.init(WHISPER_BUFFER_CAPACITY_MSEC * WHISPER_SAMPLE_RATE / 1000,
+				     WHISPER_BUFFER_GUARD_SAMPLES)) {
+		obs_log(LOG_ERROR, "Failed to allocate whisper audio buffer");
+		gf->active = false;
+		return nullptr;
 	}
-	deque_init(&gf->info_buffer);
-	deque_init(&gf->whisper_buffer);
 	deque_init(&gf->resampled_buffer);
 
 	// allocate copy buffers
@@ -662,7 +719,6 @@ void *transcription_filter_create(obs_data_t *settings, obs_source_t *filter)
 	for (size_t c = 1; c < gf->channels; c++) { // set the channel pointers
 		gf->copy_buffers[c] = gf->copy_buffers[0] + c * gf->frames;
 	}
-	memset(gf->copy_buffers[0], 0, gf->channels * gf->frames * sizeof(float));
 
 	gf->context = filter;
 
@@ -685,6 +741,12 @@ void *transcription_filter_create(obs_data_t *settings, obs_source_t *filter)
 		gf->active = false;
 		return nullptr;
 	}
+	if (gf->decimator.init(gf->sample_rate, gf->channels, gf->frames, WHISPER_SAMPLE_RATE)) {
+		gf->decimated_buffer.resize(gf->decimator.max_output_frames(gf->frames));
+		obs_log(gf->log_level, "using %s decimator (%u:1, %d taps) instead of resampler",
+			AudioDecimator::kernel_name(gf->decimator.kernel()),
+			gf->decimator.decimation_ratio(), (int)gf->decimator.num_taps());
+	}
 
 	obs_log(gf->log_level, "clear text source data");
 	const char *subtitle_sources = obs_data_get_string(settings, "subtitle_sources");
@@ -713,6 +775,22 @@ void *transcription_filter_create(obs_data_t *settings, obs_source_t *filter)
 
 	signal_handler_connect(sh_filter, "enable", enable_callback, gf);
 
+	// let scripts and plugins monitor how far the transcription is behind the audio
+	proc_handler_t *ph_filter = obs_source_get_proc_handler(gf->context);
+	proc_handler_add(ph_filter,
+			 "void get_lag(out int lag_ms, out int backlog_ms, out int dropped_ms)",
+			 get_lag_proc, gf);
+	proc_handler_add(ph_filter,
+			 "void get_gate_stats(out int skipped_vad_windows, out int skipped_inferences)",
+			 get_gate_stats_proc, gf);
+	proc_handler_add(
+		ph_filter,
+		"void get_inference_stats(out int queue_depth, out int wait_ms, out int run_ms, out int dropped_partials, out int aborted_superseded, out int aborted_cleared, out int aborted_shutdown)",
+		get_inference_stats_proc, gf);
+	proc_handler_add(ph_filter,
+			 "void get_partial_stats(out int interval_ms, out int partials, out int skipped_partials)",
+			 get_partial_stats_proc, gf);
+
 	enumerate_gpu_devices(gf);
 
 	obs_log(gf->log_level, "run update");
@@ -0,0 +1,70 @@
+#include "audio-ctx.h"
+
+namespace {
+
+// geometric steps, so that the context is at most 50% over the segment
+constexpr int AUDIO_CTX_BUCKETS[] = {128, 192, 256, 384, 512, 768, 1024};
+// a few words per second is speech, more is a hallucinated burst
+constexpr double MAX_TOKENS_PER_SECOND = 12.0;
+// output ending with an n-gram that repeats this many times is a loop
+constexpr size_t MIN_LOOP_REPEATS = 4;
+constexpr size_t MAX_LOOP_NGRAM = 4;
+
+bool ends_in_loop(const std::vector<int> &ids)
+{
+	for (size_t n = 1; n <= MAX_LOOP_NGRAM; ++n) {
+		if (ids.size() < n * MIN_LOOP_REPEATS) {
+			break;
+		}
+		const size_t last = ids.size() - n;
+		size_t repeats = 1;
+		for (size_t start = last; start >= n; start -= n) {
+			bool same = true;
+			for (size_t i = 0; i < n && same; ++i) {
+				same = ids[start - n + i] == ids[last + i];
+			}
+			if (!same) {
+				break;
+			}
+			repeats++;
+		}
+		if (repeats >= MIN_LOOP_REPEATS) {
+			return true;
+		}
+	}
+	return false;
+}
+
+} // namespace
+
+int audio_ctx_for_samples(size_t num_samples)
+{
+	const size_t margin_samples = AUDIO_CTX_MARGIN_MSEC * 16000 / 1000;
+	// encoder positions covering the segment, rounded up
+	const size_t needed =
+		((num_samples + margin_samples) * AUDIO_CTX_PER_SECOND + 15999) / 16000;
+	for (int bucket : AUDIO_CTX_BUCKETS) {
+		if (needed <= (size_t)bucket) {
+			return bucket;
+		}
+	}
+	return 0;
+}
+
+const char *audio_ctx_degenerate_reason(const std::vector<int> &token_ids, float mean_p,
+					float min_mean_p, double duration_s)
+{
+	if (token_ids.empty()) {
+		return "no text";
+	}
+	if (mean_p < min_mean_p) {
+		return "low confidence";
+	}
+	if ((double)token_ids.size() > MAX_TOKENS_PER_SECOND * duration_s + 4.0) {
+		return "too many tokens";
+	}
+	if (ends_in_loop(token_ids)) {
+		return "repetition loop";
+	}
+	return nullptr;
+}
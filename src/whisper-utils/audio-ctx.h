@@ -0,0 +1,45 @@
+/**
+ * @file audio-ctx.h
+ * @brief Encoder context (audio_ctx) sized to the length of a segment.
+ *
+ * whisper encodes a 30 s window (1500 encoder positions) whatever the length of the audio, so
+ * on CPU the encoder dominates the cost of short utterances. With a smaller audio_ctx the
+ * encoder only covers the start of the window. The context is the length of the segment plus a
+ * margin, rounded up to a few buckets, and the full context above the largest bucket.
+ *
+ * A model that was not trained on short contexts sometimes produces degenerate output on them
+ * (repetition loops, a burst of tokens, low confidence). Such output is detected from the
+ * decoded tokens, so the segment can be decoded again with the full context.
+ */
+#ifndef AUDIO_CTX_H
+#define AUDIO_CTX_H
+
+#include <cstddef>
+#include <vector>
+
+// encoder positions per second of 16 kHz audio, 1500 for the 30 s window
+#define AUDIO_CTX_PER_SECOND 50
+// added to the segment length before picking a bucket
+#define AUDIO_CTX_MARGIN_MSEC 500
+
+/**
+ * @brief Encoder context for a segment.
+ *
+ * @param num_samples Length of the segment at 16 kHz.
+ * @return The audio_ctx bucket, or 0 for the full context.
+ */
+int audio_ctx_for_samples(size_t num_samples);
+
+/**
+ * @brief Checks the output of a short context decode.
+ *
+ * @param token_ids Text tokens that were kept.
+ * @param mean_p Average probability of the kept tokens.
+ * @param min_mean_p Probability under which the output is dropped as unreliable.
+ * @param duration_s Length of the segment.
+ * @return Why the output looks degenerate, or nullptr if it looks fine.
+ */
+const char *audio_ctx_degenerate_reason(const std::vector<int> &token_ids, float mean_p,
+					float min_mean_p, double duration_s);
+
+#endif // AUDIO_CTX_H
@@ -0,0 +1,407 @@
+#include "audio-decimator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE__) || \
+	(defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define AUDIO_DECIMATOR_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__aarch64__) || defined(_M_ARM64) || defined(__ARM_NEON)
+#define AUDIO_DECIMATOR_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define AUDIO_DECIMATOR_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+#define AUDIO_DECIMATOR_TARGET_AVX2
+#endif
+
+namespace {
+
+/* Scalar kernels */
+
+float dot_scalar(const float *a, const float *b, size_t n)
+{
+	float acc0 = 0.0f, acc1 = 0.0f, acc2 = 0.0f, acc3 = 0.0f;
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		acc0 += a[i] * b[i];
+		acc1 += a[i + 1] * b[i + 1];
+		acc2 += a[i + 2] * b[i + 2];
+		acc3 += a[i + 3] * b[i + 3];
+	}
+	for (; i < n; i++) {
+		acc0 += a[i] * b[i];
+	}
+	return (acc0 + acc1) + (acc2 + acc3);
+}
+
+void downmix_scalar(const float *l, const float *r, float *out, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		out[i] = 0.5f * (l[i] + r[i]);
+	}
+}
+
+#ifdef AUDIO_DECIMATOR_X86
+
+/* SSE kernels */
+
+float dot_sse(const float *a, const float *b, size_t n)
+{
+	__m128 acc0 = _mm_setzero_ps();
+	__m128 acc1 = _mm_setzero_ps();
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+		acc1 = _mm_add_ps(acc1,
+				  _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+	}
+	acc0 = _mm_add_ps(acc0, acc1);
+	// horizontal sum
+	__m128 shuf = _mm_shuffle_ps(acc0, acc0, _MM_SHUFFLE(2, 3, 0, 1));
+	__m128 sums = _mm_add_ps(acc0, shuf);
+	shuf = _mm_movehl_ps(shuf, sums);
+	sums = _mm_add_ss(sums, shuf);
+	float result = _mm_cvtss_f32(sums);
+	for (; i < n; i++) {
+		result += a[i] * b[i];
+	}
+	return result;
+}
+
+void downmix_sse(const float *l, const float *r, float *out, size_t n)
+{
+	const __m128 half = _mm_set1_ps(0.5f);
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		_mm_storeu_ps(out + i,
+			      _mm_mul_ps(half, _mm_add_ps(_mm_loadu_ps(l + i), _mm_loadu_ps(r + i))));
+	}
+	for (; i < n; i++) {
+		out[i] = 0.5f * (l[i] + r[i]);
+	}
+}
+
+/* AVX2 + FMA kernels */
+
+AUDIO_DECIMATOR_TARGET_AVX2 float dot_avx2(const float *a, const float *b, size_t n)
+{
+	__m256 acc0 = _mm256_setzero_ps();
+	__m256 acc1 = _mm256_setzero_ps();
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+		acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8),
+				       acc1);
+	}
+	for (; i + 8 <= n; i += 8) {
+		acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+	}
+	acc0 = _mm256_add_ps(acc0, acc1);
+	// horizontal sum
+	__m128 lo = _mm256_castps256_ps128(acc0);
+	__m128 hi = _mm256_extractf128_ps(acc0, 1);
+	lo = _mm_add_ps(lo, hi);
+	__m128 shuf = _mm_movehdup_ps(lo);
+	__m128 sums = _mm_add_ps(lo, shuf);
+	shuf = _mm_movehl_ps(shuf, sums);
+	sums = _mm_add_ss(sums, shuf);
+	float result = _mm_cvtss_f32(sums);
+	for (; i < n; i++) {
+		result += a[i] * b[i];
+	}
+	return result;
+}
+
+AUDIO_DECIMATOR_TARGET_AVX2 void downmix_avx2(const float *l, const float *r, float *out,
+					      size_t n)
+{
+	const __m256 half = _mm256_set1_ps(0.5f);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		_mm256_storeu_ps(out + i, _mm256_mul_ps(half, _mm256_add_ps(_mm256_loadu_ps(l + i),
+									    _mm256_loadu_ps(r + i))));
+	}
+	for (; i < n; i++) {
+		out[i] = 0.5f * (l[i] + r[i]);
+	}
+}
+
+bool cpu_has_avx2_fma()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) {
+		return false;
+	}
+	__cpuid(info, 1);
+	const bool fma = (info[2] & (1 << 12)) != 0;
+	const bool osxsave = (info[2] & (1 << 27)) != 0;
+	const bool avx = (info[2] & (1 << 28)) != 0;
+	if (!fma || !osxsave || !avx) {
+		return false;
+	}
+	// the OS must save the YMM registers
+	if ((_xgetbv(0) & 0x6) != 0x6) {
+		return false;
+	}
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+
+#endif // AUDIO_DECIMATOR_X86
+
+#ifdef AUDIO_DECIMATOR_NEON
+
+/* NEON kernels */
+
+float dot_neon(const float *a, const float *b, size_t n)
+{
+	float32x4_t acc0 = vdupq_n_f32(0.0f);
+	float32x4_t acc1 = vdupq_n_f32(0.0f);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		acc0 = vmlaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+		acc1 = vmlaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+	}
+	acc0 = vaddq_f32(acc0, acc1);
+	float32x2_t sum2 = vadd_f32(vget_low_f32(acc0), vget_high_f32(acc0));
+	float result = vget_lane_f32(vpadd_f32(sum2, sum2), 0);
+	for (; i < n; i++) {
+		result += a[i] * b[i];
+	}
+	return result;
+}
+
+void downmix_neon(const float *l, const float *r, float *out, size_t n)
+{
+	const float32x4_t half = vdupq_n_f32(0.5f);
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		vst1q_f32(out + i, vmulq_f32(half, vaddq_f32(vld1q_f32(l + i), vld1q_f32(r + i))));
+	}
+	for (; i < n; i++) {
+		out[i] = 0.5f * (l[i] + r[i]);
+	}
+}
+
+#endif // AUDIO_DECIMATOR_NEON
+
+// Zeroth order modified Bessel function of the first kind, for the Kaiser window
+double bessel_i0(double x)
+{
+	double sum = 1.0;
+	double term = 1.0;
+	const double half_x = x / 2.0;
+	for (int k = 1; k < 50; k++) {
+		term *= (half_x / k) * (half_x / k);
+		sum += term;
+		if (term < sum * 1e-12) {
+			break;
+		}
+	}
+	return sum;
+}
+
+} // namespace
+
+bool AudioDecimator::is_supported(uint32_t input_rate, size_t channels, uint32_t output_rate)
+{
+	return output_rate > 0 && input_rate >= output_rate && input_rate % output_rate == 0 &&
+	       (channels == 1 || channels == 2);
+}
+
+bool AudioDecimator::kernel_available(AudioDecimatorKernel kernel)
+{
+	switch (kernel) {
+	case AUDIO_DECIMATOR_KERNEL_AUTO:
+	case AUDIO_DECIMATOR_KERNEL_SCALAR:
+		return true;
+#ifdef AUDIO_DECIMATOR_X86
+	case AUDIO_DECIMATOR_KERNEL_SSE:
+		return true;
+	case AUDIO_DECIMATOR_KERNEL_AVX2:
+		return cpu_has_avx2_fma();
+#endif
+#ifdef AUDIO_DECIMATOR_NEON
+	case AUDIO_DECIMATOR_KERNEL_NEON:
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+const char *AudioDecimator::kernel_name(AudioDecimatorKernel kernel)
+{
+	switch (kernel) {
+	case AUDIO_DECIMATOR_KERNEL_AUTO:
+		return "auto";
+	case AUDIO_DECIMATOR_KERNEL_SCALAR:
+		return "scalar";
+	case AUDIO_DECIMATOR_KERNEL_SSE:
+		return "sse";
+	case AUDIO_DECIMATOR_KERNEL_AVX2:
+		return "avx2";
+	case AUDIO_DECIMATOR_KERNEL_NEON:
+		return "neon";
+	default:
+		return "unknown";
+	}
+}
+
+bool AudioDecimator::init(uint32_t input_rate, size_t channels, size_t max_input_frames,
+			  uint32_t output_rate, AudioDecimatorKernel kernel)
+{
+	release();
+	if (!is_supported(input_rate, channels, output_rate) || max_input_frames == 0 ||
+	    !kernel_available(kernel)) {
+		return false;
+	}
+
+	if (kernel == AUDIO_DECIMATOR_KERNEL_AUTO) {
+		kernel = AUDIO_DECIMATOR_KERNEL_SCALAR;
+#ifdef AUDIO_DECIMATOR_X86
+		kernel = kernel_available(AUDIO_DECIMATOR_KERNEL_AVX2) ? AUDIO_DECIMATOR_KERNEL_AVX2
+								       : AUDIO_DECIMATOR_KERNEL_SSE;
+#endif
+#ifdef AUDIO_DECIMATOR_NEON
+		kernel = AUDIO_DECIMATOR_KERNEL_NEON;
+#endif
+	}
+
+	switch (kernel) {
+#ifdef AUDIO_DECIMATOR_X86
+	case AUDIO_DECIMATOR_KERNEL_SSE:
+		dot = dot_sse;
+		downmix = downmix_sse;
+		break;
+	case AUDIO_DECIMATOR_KERNEL_AVX2:
+		dot = dot_avx2;
+		downmix = downmix_avx2;
+		break;
+#endif
+#ifdef AUDIO_DECIMATOR_NEON
+	case AUDIO_DECIMATOR_KERNEL_NEON:
+		dot = dot_neon;
+		downmix = downmix_neon;
+		break;
+#endif
+	default:
+		dot = dot_scalar;
+		downmix = downmix_scalar;
+		break;
+	}
+	active_kernel = kernel;
+
+	ratio = input_rate / output_rate;
+	num_channels = channels;
+	max_frames = max_input_frames;
+
+	if (ratio > 1) {
+		// Kaiser windowed sinc low-pass. The cutoff sits at 0.95 of the output Nyquist
+		// frequency (7.6 kHz for 16 kHz output), and beta = 6 gives ~60 dB of stopband
+		// attenuation. With 48 taps per phase the transition band is ~1.2 kHz wide.
+		const size_t n = TAPS_PER_PHASE * ratio;
+		const double fc = 0.475 / (double)ratio; // cycles per input sample
+		const double beta = 6.0;
+		const double i0_beta = bessel_i0(beta);
+		const double center = (double)(n - 1) / 2.0;
+		const double pi = 3.14159265358979323846;
+		std::vector<double> h(n);
+		double sum = 0.0;
+		for (size_t i = 0; i < n; i++) {
+			const double t = (double)i - center;
+			const double x = 2.0 * fc * t;
+			const double sinc = t == 0.0 ? 1.0 : std::sin(pi * x) / (pi * x);
+			const double w = t / center;
+			const double window = bessel_i0(beta * std::sqrt(1.0 - w * w)) / i0_beta;
+			h[i] = 2.0 * fc * sinc * window;
+			sum += h[i];
+		}
+		// unity gain at DC. the filter is symmetric, so it is its own time reversal
+		taps.resize(n);
+		for (size_t i = 0; i < n; i++) {
+			taps[i] = (float)(h[i] / sum);
+		}
+	} else {
+		// same rate, downmix only
+		taps.assign(1, 1.0f);
+	}
+
+	work.assign(taps.size() - 1 + max_input_frames, 0.0f);
+	reset();
+	return true;
+}
+
+void AudioDecimator::release()
+{
+	ratio = 0;
+	num_channels = 0;
+	max_frames = 0;
+	dot = nullptr;
+	downmix = nullptr;
+	taps.clear();
+	work.clear();
+	next_pos = 0;
+}
+
+void AudioDecimator::reset()
+{
+	std::fill(work.begin(), work.end(), 0.0f);
+	next_pos = taps.empty() ? 0 : taps.size() - 1;
+}
+
+size_t AudioDecimator::max_output_frames(size_t input_frames) const
+{
+	return ratio == 0 ? 0 : input_frames / ratio + 1;
+}
+
+size_t AudioDecimator::process(const float *const *input, size_t input_frames, float *output)
+{
+	if (ratio == 0 || input_frames == 0) {
+		return 0;
+	}
+	if (input_frames > max_frames) {
+		input_frames = max_frames;
+	}
+
+	const size_t history = taps.size() - 1;
+	float *mono = work.data() + history;
+	if (num_channels == 2) {
+		downmix(input[0], input[1], mono, input_frames);
+	} else {
+		memcpy(mono, input[0], input_frames * sizeof(float));
+	}
+
+	if (ratio == 1) {
+		memcpy(output, mono, input_frames * sizeof(float));
+		return input_frames;
+	}
+
+	size_t num_out = 0;
+	const size_t total = history + input_frames;
+	size_t pos = next_pos;
+	for (; pos < total; pos += ratio) {
+		output[num_out++] = dot(taps.data(), work.data() + pos - history, taps.size());
+	}
+
+	// keep the last `history` samples for the next call
+	next_pos = pos - input_frames;
+	memmove(work.data(), work.data() + input_frames, history * sizeof(float));
+	return num_out;
+}
@@ -0,0 +1,96 @@
+/**
+ * @file audio-decimator.h
+ * @brief Integer-ratio downmix + decimation to mono 16 kHz for the whisper input.
+ *
+ * Most sources run at 48 kHz (or 32/96 kHz), an exact integer multiple of the whisper sample
+ * rate. For those the generic libobs resampler (swresample) is replaced by a windowed-sinc FIR
+ * decimator that downmixes the channels on the way in and only computes every D-th output
+ * sample. The FIR dot product has SSE, AVX2/FMA and NEON kernels (picked at runtime) with a
+ * scalar fallback.
+ */
+#ifndef AUDIO_DECIMATOR_H
+#define AUDIO_DECIMATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+enum AudioDecimatorKernel {
+	AUDIO_DECIMATOR_KERNEL_AUTO = 0,
+	AUDIO_DECIMATOR_KERNEL_SCALAR,
+	AUDIO_DECIMATOR_KERNEL_SSE,
+	AUDIO_DECIMATOR_KERNEL_AVX2,
+	AUDIO_DECIMATOR_KERNEL_NEON,
+};
+
+class AudioDecimator {
+public:
+	/** Number of FIR taps per polyphase branch (the filter has taps * ratio coefficients) */
+	static constexpr size_t TAPS_PER_PHASE = 48;
+
+	/**
+	 * @brief Whether the fast path can handle this input format.
+	 *
+	 * The input rate must be an integer multiple of the output rate and the layout must be
+	 * mono or stereo (other layouts need the LFE/surround handling of swresample).
+	 */
+	static bool is_supported(uint32_t input_rate, size_t channels,
+				 uint32_t output_rate = 16000);
+
+	/** Whether the given kernel can run on this CPU. */
+	static bool kernel_available(AudioDecimatorKernel kernel);
+	static const char *kernel_name(AudioDecimatorKernel kernel);
+
+	/**
+	 * @brief Designs the filter and allocates the work buffers.
+	 *
+	 * @param max_input_frames Maximal number of frames passed to a single process() call.
+	 * @param kernel Kernel to use, AUTO picks the fastest one available.
+	 * @return true on success, false if the format or kernel is not supported.
+	 */
+	bool init(uint32_t input_rate, size_t channels, size_t max_input_frames,
+		  uint32_t output_rate = 16000,
+		  AudioDecimatorKernel kernel = AUDIO_DECIMATOR_KERNEL_AUTO);
+	void release();
+	bool is_initialized() const { return ratio != 0; }
+
+	/** Clears the filter history. */
+	void reset();
+
+	/** Upper bound of the number of output frames for the given number of input frames. */
+	size_t max_output_frames(size_t input_frames) const;
+
+	/**
+	 * @brief Downmixes and decimates planar input.
+	 *
+	 * @param input Planar float input, one pointer per channel.
+	 * @param input_frames Number of frames, at most the max_input_frames given to init().
+	 * @param output Mono output with room for max_output_frames(input_frames) samples.
+	 * @return The number of output samples written.
+	 */
+	size_t process(const float *const *input, size_t input_frames, float *output);
+
+	AudioDecimatorKernel kernel() const { return active_kernel; }
+	uint32_t decimation_ratio() const { return ratio; }
+	size_t num_taps() const { return taps.size(); }
+
+private:
+	typedef float (*dot_fn)(const float *a, const float *b, size_t n);
+	typedef void (*downmix_fn)(const float *l, const float *r, float *out, size_t n);
+
+	uint32_t ratio = 0;
+	size_t num_channels = 0;
+	size_t max_frames = 0;
+	AudioDecimatorKernel active_kernel = AUDIO_DECIMATOR_KERNEL_SCALAR;
+	dot_fn dot = nullptr;
+	downmix_fn downmix = nullptr;
+
+	// time-reversed filter coefficients, so each output is a plain dot product
+	std::vector<float> taps;
+	// history (taps - 1 samples) followed by the downmixed input of the current call
+	std::vector<float> work;
+	// position in `work` of the last input sample of the next output's window
+	size_t next_pos = 0;
+};
+
+#endif // AUDIO_DECIMATOR_H
@@ -0,0 +1,245 @@
+#include "audio-ring-buffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <obs.h>
+
+namespace {
+
+uint64_t next_power_of_two(uint64_t v)
+{
+	uint64_t p = 1;
+	while (p < v) {
+		p <<= 1;
+	}
+	return p;
+}
+
+} // namespace
+
+AudioRingBuffer::~AudioRingBuffer()
+{
+	release();
+}
+
+bool AudioRingBuffer::init(size_t channels, uint32_t sample_rate, size_t capacity_frames_,
+			   size_t capacity_packets)
+{
+	release();
+
+	if (channels == 0 || channels > AUDIO_RING_MAX_CHANNELS || sample_rate == 0 ||
+	    capacity_frames_ == 0 || capacity_packets == 0) {
+		return false;
+	}
+
+	const uint64_t num_frames = next_power_of_two(capacity_frames_);
+	const uint64_t num_packets = next_power_of_two(capacity_packets);
+
+	storage = static_cast<float *>(bzalloc(channels * num_frames * sizeof(float)));
+	packets = static_cast<packet_slot *>(bzalloc(num_packets * sizeof(packet_slot)));
+	if (storage == nullptr || packets == nullptr) {
+		release();
+		return false;
+	}
+
+	num_channels = channels;
+	for (size_t c = 0; c < channels; c++) {
+		channel_data[c] = storage + c * num_frames;
+	}
+	frame_mask = num_frames - 1;
+	packet_mask = num_packets - 1;
+	rate = sample_rate;
+
+	write_packet.store(0, std::memory_order_relaxed);
+	write_frame.store(0, std::memory_order_relaxed);
+	read_packet.store(0, std::memory_order_relaxed);
+	read_frame.store(0, std::memory_order_relaxed);
+	cached_read_packet = 0;
+	cached_read_frame = 0;
+	high_water.store(0, std::memory_order_relaxed);
+	overruns.store(0, std::memory_order_relaxed);
+	dropped_frames.store(0, std::memory_order_relaxed);
+	return true;
+}
+
+void AudioRingBuffer::release()
+{
+	bfree(storage);
+	bfree(packets);
+	storage = nullptr;
+	packets = nullptr;
+	for (size_t c = 0; c < AUDIO_RING_MAX_CHANNELS; c++) {
+		channel_data[c] = nullptr;
+	}
+	num_channels = 0;
+	frame_mask = 0;
+	packet_mask = 0;
+}
+
+bool AudioRingBuffer::push(const uint8_t *const *data, uint32_t frames,
+			   uint64_t timestamp_offset_ns)
+{
+	if (storage == nullptr || frames == 0) {
+		return false;
+	}
+
+	const uint64_t wp = write_packet.load(std::memory_order_relaxed);
+	const uint64_t wf = write_frame.load(std::memory_order_relaxed);
+	const uint64_t frame_capacity = frame_mask + 1;
+	const uint64_t packet_capacity = packet_mask + 1;
+
+	// Only reload the consumer positions when the cached ones say the ring is full
+	if (wp - cached_read_packet >= packet_capacity ||
+	    wf + frames - cached_read_frame > frame_capacity) {
+		cached_read_packet = read_packet.load(std::memory_order_acquire);
+		cached_read_frame = read_frame.load(std::memory_order_acquire);
+		if (wp - cached_read_packet >= packet_capacity ||
+		    wf + frames - cached_read_frame > frame_capacity) {
+			overruns.fetch_add(1, std::memory_order_relaxed);
+			dropped_frames.fetch_add(frames, std::memory_order_relaxed);
+			return false;
+		}
+	}
+
+	// Copy the samples, splitting the copy where the ring wraps around
+	const uint64_t start = wf & frame_mask;
+	const uint64_t first_part = std::min<uint64_t>(frames, frame_capacity - start);
+	for (size_t c = 0; c < num_channels; c++) {
+		const float *src = reinterpret_cast<const float *>(data[c]);
+		memcpy(channel_data[c] + start, src, first_part * sizeof(float));
+		if (first_part < frames) {
+			memcpy(channel_data[c], src + first_part,
+			       (frames - first_part) * sizeof(float));
+		}
+	}
+
+	packet_slot &slot = packets[wp & packet_mask];
+	slot.info.frames = frames;
+	slot.info.timestamp_offset_ns = timestamp_offset_ns;
+	slot.first_frame = wf;
+
+	write_frame.store(wf + frames, std::memory_order_release);
+	write_packet.store(wp + 1, std::memory_order_release);
+
+	// the cached read position is only refreshed when the ring looks full, the peak is taken
+	// from the current one
+	const size_t used = (size_t)(wf + frames - read_frame.load(std::memory_order_acquire));
+	if (used > high_water.load(std::memory_order_relaxed)) {
+		high_water.store(used, std::memory_order_relaxed);
+	}
+	return true;
+}
+
+size_t AudioRingBuffer::pop(float *const *dst, size_t max_frames,
+			    transcription_filter_audio_info &first_info,
+			    transcription_filter_audio_info &last_info)
+{
+	if (storage == nullptr || max_frames == 0) {
+		return 0;
+	}
+
+	const uint64_t wp = write_packet.load(std::memory_order_acquire);
+	uint64_t rp = read_packet.load(std::memory_order_relaxed);
+	if (rp == wp) {
+		return 0;
+	}
+
+	const uint64_t start_frame = packets[rp & packet_mask].first_frame;
+	first_info = packets[rp & packet_mask].info;
+	uint64_t end_frame = start_frame;
+	size_t num_frames = 0;
+	while (rp != wp) {
+		packet_slot &slot = packets[rp & packet_mask];
+		if (num_frames + slot.info.frames > max_frames) {
+			if (num_frames == 0) {
+				// a single packet bigger than the request: split it, the rest stays
+				// in the ring. The producer does not touch the slot until rp moves.
+				num_frames = max_frames;
+				last_info = slot.info;
+				last_info.frames = (uint32_t)max_frames;
+				end_frame = slot.first_frame + max_frames;
+				slot.first_frame = end_frame;
+				slot.info.frames -= (uint32_t)max_frames;
+				slot.info.timestamp_offset_ns += max_frames * 1000000000ULL / rate;
+			}
+			break;
+		}
+		last_info = slot.info;
+		num_frames += slot.info.frames;
+		end_frame = slot.first_frame + slot.info.frames;
+		rp++;
+	}
+
+	const uint64_t frame_capacity = frame_mask + 1;
+	const uint64_t start = start_frame & frame_mask;
+	const uint64_t first_part = std::min<uint64_t>(num_frames, frame_capacity - start);
+	for (size_t c = 0; c < num_channels; c++) {
+		memcpy(dst[c], channel_data[c] + start, first_part * sizeof(float));
+		if (first_part < num_frames) {
+			memcpy(dst[c] + first_part, channel_data[c],
+			       (num_frames - first_part) * sizeof(float));
+		}
+	}
+
+	read_frame.store(end_frame, std::memory_order_release);
+	read_packet.store(rp, std::memory_order_release);
+	return num_frames;
+}
+
+size_t AudioRingBuffer::skip(size_t min_frames)
+{
+	if (storage == nullptr || min_frames == 0) {
+		return 0;
+	}
+
+	const uint64_t wp = write_packet.load(std::memory_order_acquire);
+	uint64_t rp = read_packet.load(std::memory_order_relaxed);
+	size_t num_frames = 0;
+	uint64_t end_frame = 0;
+	while (rp != wp && num_frames < min_frames) {
+		const packet_slot &slot = packets[rp & packet_mask];
+		num_frames += slot.info.frames;
+		end_frame = slot.first_frame + slot.info.frames;
+		rp++;
+	}
+	if (num_frames > 0) {
+		read_frame.store(end_frame, std::memory_order_release);
+		read_packet.store(rp, std::memory_order_release);
+	}
+	return num_frames;
+}
+
+void AudioRingBuffer::discard()
+{
+	if (storage == nullptr) {
+		return;
+	}
+	// Read the packet index first: any frames written after it belong to a packet that is
+	// not published yet and must stay in the ring.
+	const uint64_t wp = write_packet.load(std::memory_order_acquire);
+	const uint64_t rp = read_packet.load(std::memory_order_relaxed);
+	if (rp == wp) {
+		return;
+	}
+	const packet_slot &last = packets[(wp - 1) & packet_mask];
+	read_frame.store(last.first_frame + last.info.frames, std::memory_order_release);
+	read_packet.store(wp, std::memory_order_release);
+}
+
+size_t AudioRingBuffer::front_packet_frames() const
+{
+	if (storage == nullptr) {
+		return 0;
+	}
+	const uint64_t wp = write_packet.load(std::memory_order_acquire);
+	const uint64_t rp = read_packet.load(std::memory_order_relaxed);
+	return rp == wp ? 0 : packets[rp & packet_mask].info.frames;
+}
+
+size_t AudioRingBuffer::frames_available() const
+{
+	const uint64_t rf = read_frame.load(std::memory_order_acquire);
+	const uint64_t wf = write_frame.load(std::memory_order_acquire);
+	return wf > rf ? (size_t)(wf - rf) : 0;
+}
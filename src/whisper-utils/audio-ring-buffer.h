@@ -0,0 +1,143 @@
+/**
+ * @file audio-ring-buffer.h
+ * @brief Lock-free single-producer/single-consumer ring for planar input audio.
+ *
+ * The OBS audio callback is the only producer and the whisper thread is the only consumer.
+ * Samples are kept per channel in a fixed-capacity ring, next to a second ring that keeps the
+ * frame count and timestamp of every pushed packet. All memory is allocated up front, so
+ * pushing never allocates, locks or waits: if the consumer falls behind the packet is dropped
+ * and counted as an overrun.
+ */
+#ifndef AUDIO_RING_BUFFER_H
+#define AUDIO_RING_BUFFER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#define AUDIO_RING_MAX_CHANNELS 10
+#define AUDIO_RING_CACHE_LINE 64
+
+// Audio packet info
+struct transcription_filter_audio_info {
+	uint32_t frames;
+	uint64_t timestamp_offset_ns; // offset (since start of processing) timestamp in ns
+};
+
+class AudioRingBuffer {
+public:
+	AudioRingBuffer() = default;
+	~AudioRingBuffer();
+
+	AudioRingBuffer(const AudioRingBuffer &) = delete;
+	AudioRingBuffer &operator=(const AudioRingBuffer &) = delete;
+
+	/**
+	 * @brief Allocates the ring. Must be called before the producer and consumer start.
+	 *
+	 * @param channels Number of planar channels.
+	 * @param sample_rate Sample rate of the audio, to move the timestamp of a partly popped
+	 * packet.
+	 * @param capacity_frames Minimal capacity in frames per channel, rounded up to a power of 2.
+	 * @param capacity_packets Minimal number of packet infos, rounded up to a power of 2.
+	 * @return true on success.
+	 */
+	bool init(size_t channels, uint32_t sample_rate, size_t capacity_frames,
+		  size_t capacity_packets);
+
+	/**
+	 * @brief Frees the ring. The producer and consumer must both be stopped.
+	 */
+	void release();
+
+	bool is_initialized() const { return storage != nullptr; }
+
+	/**
+	 * @brief Producer side: copies one packet of planar audio into the ring.
+	 *
+	 * Never blocks or allocates. If there is no room for the whole packet it is dropped and
+	 * the overrun counters are incremented.
+	 *
+	 * @return true if the packet was stored, false if it was dropped.
+	 */
+	bool push(const uint8_t *const *data, uint32_t frames, uint64_t timestamp_offset_ns);
+
+	/**
+	 * @brief Consumer side: pops whole packets, up to max_frames in total, into planar buffers.
+	 *
+	 * A first packet bigger than max_frames is split: its first max_frames frames are popped
+	 * and the rest stays in the ring with its timestamp moved by the popped duration.
+	 *
+	 * @param dst Per-channel destination buffers with room for max_frames floats.
+	 * @param max_frames Maximal number of frames to pop.
+	 * @param first_info Receives the info of the first popped packet.
+	 * @param last_info Receives the info of the last popped packet, or of the popped part of
+	 * a split packet.
+	 * @return The number of frames popped, 0 if the ring is empty.
+	 */
+	size_t pop(float *const *dst, size_t max_frames,
+		   transcription_filter_audio_info &first_info,
+		   transcription_filter_audio_info &last_info);
+
+	/**
+	 * @brief Consumer side: drops whole packets from the front until at least min_frames
+	 * frames are dropped or the ring is empty.
+	 *
+	 * @return The number of frames dropped.
+	 */
+	size_t skip(size_t min_frames);
+
+	/**
+	 * @brief Consumer side: drops everything currently in the ring.
+	 */
+	void discard();
+
+	/** Consumer side: frames of the oldest packet in the ring, 0 if the ring is empty. */
+	size_t front_packet_frames() const;
+
+	/** Number of frames waiting in the ring. Safe to call from any thread. */
+	size_t frames_available() const;
+	size_t capacity_frames() const { return frame_mask + 1; }
+
+	/** Highest number of frames that were ever waiting in the ring. */
+	size_t high_water_mark() const { return high_water.load(std::memory_order_relaxed); }
+	/** Number of packets dropped because the ring was full. */
+	uint64_t overrun_count() const { return overruns.load(std::memory_order_relaxed); }
+	/** Number of frames dropped because the ring was full. */
+	uint64_t dropped_frame_count() const
+	{
+		return dropped_frames.load(std::memory_order_relaxed);
+	}
+
+private:
+	struct packet_slot {
+		transcription_filter_audio_info info;
+		uint64_t first_frame;
+	};
+
+	// Producer owned, read by the consumer
+	alignas(AUDIO_RING_CACHE_LINE) std::atomic<uint64_t> write_packet{0};
+	std::atomic<uint64_t> write_frame{0};
+	uint64_t cached_read_packet = 0;
+	uint64_t cached_read_frame = 0;
+
+	// Consumer owned, read by the producer
+	alignas(AUDIO_RING_CACHE_LINE) std::atomic<uint64_t> read_packet{0};
+	std::atomic<uint64_t> read_frame{0};
+
+	// Statistics, written by the producer only
+	alignas(AUDIO_RING_CACHE_LINE) std::atomic<size_t> high_water{0};
+	std::atomic<uint64_t> overruns{0};
+	std::atomic<uint64_t> dropped_frames{0};
+
+	// Immutable after init()
+	alignas(AUDIO_RING_CACHE_LINE) float *storage = nullptr;
+	float *channel_data[AUDIO_RING_MAX_CHANNELS] = {};
+	packet_slot *packets = nullptr;
+	size_t num_channels = 0;
+	uint64_t frame_mask = 0;
+	uint64_t packet_mask = 0;
+	uint32_t rate = 0;
+};
+
+#endif // AUDIO_RING_BUFFER_H
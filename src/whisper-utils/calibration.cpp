@@ -0,0 +1,421 @@
+#include "calibration.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include <nlohmann/json.hpp>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+using json = nlohmann::json;
+
+bool parse_cgroup_cpu_max(const std::string &content, double &cpus)
+{
+	cpus = 0.0;
+	std::istringstream stream(content);
+	std::string quota;
+	long long period = 0;
+	if (!(stream >> quota >> period) || period <= 0) {
+		return false;
+	}
+	if (quota == "max") {
+		return true;
+	}
+	char *end = nullptr;
+	const long long quota_us = strtoll(quota.c_str(), &end, 10);
+	if (end == quota.c_str() || *end != '\0' || quota_us <= 0) {
+		return false;
+	}
+	cpus = (double)quota_us / (double)period;
+	return true;
+}
+
+std::string parse_cgroup_v2_path(const std::string &proc_self_cgroup)
+{
+	std::istringstream stream(proc_self_cgroup);
+	std::string line;
+	while (std::getline(stream, line)) {
+		// the unified hierarchy is "0::<path>"
+		if (line.rfind("0::", 0) == 0) {
+			return line.substr(3);
+		}
+	}
+	return "";
+}
+
+#ifdef __linux__
+static bool read_file(const std::string &path, std::string &content)
+{
+	std::ifstream file(path);
+	if (!file.is_open()) {
+		return false;
+	}
+	std::stringstream buffer;
+	buffer << file.rdbuf();
+	content = buffer.str();
+	return true;
+}
+
+/**
+ * @brief The smallest CPU quota of the cgroup of the process and its parents, 0 for none.
+ */
+static double cgroup_cpu_quota()
+{
+	double quota = 0.0;
+	const auto limit = [&quota](double cpus) {
+		if (cpus > 0.0 && (quota == 0.0 || cpus < quota)) {
+			quota = cpus;
+		}
+	};
+
+	std::string content;
+	std::string path;
+	if (read_file("/proc/self/cgroup", content)) {
+		path = parse_cgroup_v2_path(content);
+	}
+	if (!path.empty()) {
+		// cgroup v2, every level of the hierarchy can limit the CPU time
+		while (true) {
+			double cpus = 0.0;
+			if (read_file("/sys/fs/cgroup" + path + "/cpu.max", content) &&
+			    parse_cgroup_cpu_max(content, cpus)) {
+				limit(cpus);
+			}
+			if (path == "/" || path.empty()) {
+				break;
+			}
+			const size_t slash = path.find_last_of('/');
+			path = slash == 0 || slash == std::string::npos ? "/"
+									: path.substr(0, slash);
+		}
+	}
+	// cgroup v1, a container sees its own group at the mount point
+	for (const char *dir : {"/sys/fs/cgroup/cpu", "/sys/fs/cgroup/cpu,cpuacct"}) {
+		std::string quota_us;
+		std::string period_us;
+		if (read_file(std::string(dir) + "/cpu.cfs_quota_us", quota_us) &&
+		    read_file(std::string(dir) + "/cpu.cfs_period_us", period_us)) {
+			double cpus = 0.0;
+			const std::string quota_us_value =
+				quota_us.substr(0, quota_us.find_last_not_of(" \n") + 1);
+			if (quota_us_value != "-1" &&
+			    parse_cgroup_cpu_max(quota_us_value + " " + period_us, cpus)) {
+				limit(cpus);
+			}
+		}
+	}
+	return quota;
+}
+#endif
+
+int usable_cpu_count()
+{
+	int cpus = (int)std::thread::hardware_concurrency();
+#ifdef _WIN32
+	DWORD_PTR process_mask = 0;
+	DWORD_PTR system_mask = 0;
+	if (GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask) &&
+	    process_mask != 0) {
+		int affinity_cpus = 0;
+		for (; process_mask != 0; process_mask &= process_mask - 1) {
+			affinity_cpus++;
+		}
+		// the mask only covers the processor group of the process
+		cpus = cpus > 0 ? std::min(cpus, affinity_cpus) : affinity_cpus;
+	}
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0) {
+		cpus = CPU_COUNT(&set);
+	}
+	const double quota = cgroup_cpu_quota();
+	if (quota > 0.0) {
+		cpus = std::min(cpus, std::max(1, (int)std::ceil(quota)));
+	}
+#endif
+	return std::max(cpus, 1);
+}
+
+std::string calibration_machine_id()
+{
+	char host[256] = {0};
+#ifdef _WIN32
+	DWORD host_length = sizeof(host);
+	if (!GetComputerNameA(host, &host_length)) {
+		host[0] = '\0';
+	}
+#else
+	if (gethostname(host, sizeof(host) - 1) != 0) {
+		host[0] = '\0';
+	}
+#endif
+	return std::string(host) + "/" + std::to_string(std::thread::hardware_concurrency());
+}
+
+std::vector<int> calibration_thread_counts(int usable_cpus)
+{
+	const int max_threads = std::clamp(usable_cpus, 1, CALIBRATION_MAX_THREADS);
+	std::vector<int> counts;
+	for (int n : {1, 2, 3, 4, 6, 8, 12, 16}) {
+		if (n <= max_threads) {
+			counts.push_back(n);
+		}
+	}
+	if (counts.back() != max_threads) {
+		counts.push_back(max_threads);
+	}
+	return counts;
+}
+
+std::vector<float> calibration_sweep_audio(const std::vector<float> &clip,
+					   size_t segment_samples, size_t min_segments)
+{
+	if (clip.empty() || segment_samples == 0) {
+		return {};
+	}
+	// a partial tail segment would be timed as a full one
+	const size_t samples =
+		std::max(clip.size() / segment_samples, min_segments) * segment_samples;
+	std::vector<float> audio;
+	audio.reserve(samples + clip.size());
+	while (audio.size() < samples) {
+		audio.insert(audio.end(), clip.begin(), clip.end());
+	}
+	audio.resize(samples);
+	return audio;
+}
+
+double latency_percentile(std::vector<double> values, double percentile)
+{
+	if (values.empty()) {
+		return 0.0;
+	}
+	std::sort(values.begin(), values.end());
+	const double rank = std::clamp(percentile, 0.0, 1.0) * (double)(values.size() - 1);
+	const size_t lower = (size_t)rank;
+	const size_t upper = std::min(lower + 1, values.size() - 1);
+	return values[lower] + (values[upper] - values[lower]) * (rank - (double)lower);
+}
+
+bool calibration_select(CalibrationProfile &profile)
+{
+	profile.selected = CalibrationRun();
+	profile.meets_target = false;
+	if (profile.runs.empty()) {
+		return false;
+	}
+
+	const CalibrationRun *fastest = nullptr;
+	const CalibrationRun *selected = nullptr;
+	std::vector<std::string> models;
+	for (const CalibrationRun &run : profile.runs) {
+		if (fastest == nullptr || run.rtf < fastest->rtf) {
+			fastest = &run;
+		}
+		if (std::find(models.begin(), models.end(), run.model_file) == models.end()) {
+			models.push_back(run.model_file);
+		}
+	}
+	for (const std::string &model : models) {
+		double best_rtf = 0.0;
+		for (const CalibrationRun &run : profile.runs) {
+			if (run.model_file == model && (best_rtf == 0.0 || run.rtf < best_rtf)) {
+				best_rtf = run.rtf;
+			}
+		}
+		// the fewest threads close to the best
+		const CalibrationRun *pick = nullptr;
+		for (const CalibrationRun &run : profile.runs) {
+			if (run.model_file == model &&
+			    run.rtf <= best_rtf * CALIBRATION_THREAD_TOLERANCE &&
+			    (pick == nullptr || run.n_threads < pick->n_threads)) {
+				pick = &run;
+			}
+		}
+		if (pick->rtf > profile.target_rtf ||
+		    (profile.max_p95_ms > 0.0 && pick->p95_ms > profile.max_p95_ms)) {
+			continue;
+		}
+		// the largest model is taken as the most accurate one
+		if (selected == nullptr || pick->model_bytes > selected->model_bytes) {
+			selected = pick;
+		}
+	}
+
+	profile.meets_target = selected != nullptr;
+	profile.selected = selected != nullptr ? *selected : *fastest;
+	return true;
+}
+
+static json run_to_json(const CalibrationRun &run)
+{
+	return json{{"model_name", run.model_name},   {"model_file", run.model_file},
+		    {"model_bytes", run.model_bytes}, {"n_threads", run.n_threads},
+		    {"rtf", run.rtf},                 {"p95_ms", run.p95_ms},
+		    {"segments", run.segments}};
+}
+
+static CalibrationRun run_from_json(const json &j)
+{
+	CalibrationRun run;
+	run.model_name = j.value("model_name", std::string());
+	run.model_file = j.value("model_file", std::string());
+	run.model_bytes = j.value("model_bytes", (uint64_t)0);
+	run.n_threads = j.value("n_threads", 0);
+	run.rtf = j.value("rtf", 0.0);
+	run.p95_ms = j.value("p95_ms", 0.0);
+	run.segments = j.value("segments", 0);
+	return run;
+}
+
+std::string calibration_profile_to_json(const CalibrationProfile &profile)
+{
+	json runs = json::array();
+	for (const CalibrationRun &run : profile.runs) {
+		runs.push_back(run_to_json(run));
+	}
+	const json j = {{"version", CALIBRATION_PROFILE_VERSION},
+			{"machine", profile.machine},
+			{"usable_cpus", profile.usable_cpus},
+			{"target_rtf", profile.target_rtf},
+			{"max_p95_ms", profile.max_p95_ms},
+			{"created", profile.created},
+			{"selected", run_to_json(profile.selected)},
+			{"meets_target", profile.meets_target},
+			{"runs", runs}};
+	return j.dump(2);
+}
+
+bool calibration_profile_from_json(const std::string &text, CalibrationProfile &profile)
+{
+	try {
+		const json j = json::parse(text);
+		if (j.value("version", 0) != CALIBRATION_PROFILE_VERSION) {
+			return false;
+		}
+		profile = CalibrationProfile();
+		profile.machine = j.value("machine", std::string());
+		profile.usable_cpus = j.value("usable_cpus", 0);
+		profile.target_rtf = j.value("target_rtf", CALIBRATION_DEFAULT_TARGET_RTF);
+		profile.max_p95_ms =
+			j.value("max_p95_ms", (double)CALIBRATION_DEFAULT_MAX_P95_MSEC);
+		profile.created = j.value("created", (uint64_t)0);
+		profile.meets_target = j.value("meets_target", false);
+		if (j.contains("selected")) {
+			profile.selected = run_from_json(j["selected"]);
+		}
+		if (j.contains("runs")) {
+			for (const json &run : j["runs"]) {
+				profile.runs.push_back(run_from_json(run));
+			}
+		}
+		return profile.selected.n_threads > 0;
+	} catch (const json::exception &) {
+		return false;
+	}
+}
+
+bool save_calibration_profile(const std::string &path, const CalibrationProfile &profile)
+{
+	std::ofstream file(path, std::ios::trunc);
+	if (!file.is_open()) {
+		return false;
+	}
+	file << calibration_profile_to_json(profile);
+	return file.good();
+}
+
+bool load_calibration_profile(const std::string &path, CalibrationProfile &profile)
+{
+	std::ifstream file(path);
+	if (!file.is_open()) {
+		return false;
+	}
+	std::stringstream buffer;
+	buffer << file.rdbuf();
+	return calibration_profile_from_json(buffer.str(), profile);
+}
+
+// little-endian integer of the given bytes at the offset
+static uint32_t read_le(const std::string &data, size_t offset, size_t bytes)
+{
+	uint32_t value = 0;
+	for (size_t i = 0; i < bytes; i++) {
+		value |= (uint32_t)(uint8_t)data[offset + i] << (8 * i);
+	}
+	return value;
+}
+
+bool parse_wav_clip(const std::string &data, std::vector<float> &samples)
+{
+	samples.clear();
+	if (data.size() < 12 || data.compare(0, 4, "RIFF") != 0 ||
+	    data.compare(8, 4, "WAVE") != 0) {
+		return false;
+	}
+	uint32_t channels = 0;
+	bool format_ok = false;
+	// the chunks, padded to an even size
+	for (size_t offset = 12; offset + 8 <= data.size();) {
+		const std::string id = data.substr(offset, 4);
+		const size_t size = read_le(data, offset + 4, 4);
+		const size_t body = offset + 8;
+		if (size > data.size() - body) {
+			return false;
+		}
+		if (id == "fmt " && size >= 16) {
+			const uint32_t format = read_le(data, body, 2);
+			channels = read_le(data, body + 2, 2);
+			const uint32_t rate = read_le(data, body + 4, 4);
+			const uint32_t bits = read_le(data, body + 14, 2);
+			format_ok = format == 1 && channels > 0 && rate == 16000 && bits == 16;
+		} else if (id == "data") {
+			if (!format_ok) {
+				return false;
+			}
+			const size_t frames = size / (2 * channels);
+			samples.resize(frames);
+			for (size_t frame = 0; frame < frames; frame++) {
+				float sum = 0.0f;
+				for (uint32_t channel = 0; channel < channels; channel++) {
+					const size_t at = body + 2 * (frame * channels + channel);
+					sum += (float)(int16_t)read_le(data, at, 2);
+				}
+				samples[frame] = sum / (32768.0f * (float)channels);
+			}
+			return frames > 0;
+		}
+		offset = body + size + (size & 1);
+	}
+	return false;
+}
+
+bool load_wav_clip(const std::string &path, std::vector<float> &samples)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file.is_open()) {
+		return false;
+	}
+	std::stringstream buffer;
+	buffer << file.rdbuf();
+	return parse_wav_clip(buffer.str(), samples);
+}
+
+bool calibration_profile_applies(const CalibrationProfile &profile)
+{
+	return profile.selected.n_threads > 0 && profile.machine == calibration_machine_id() &&
+	       profile.usable_cpus == usable_cpu_count();
+}
@@ -0,0 +1,138 @@
+/**
+ * @file calibration.h
+ * @brief Per-machine choice of the whisper model and thread count from a measured sweep.
+ *
+ * The default of 4 threads and the tiny model fit no machine in particular: a laptop behind a
+ * container CPU quota is overcommitted with 4 threads, a 16-core desktop runs a far better model
+ * in real time. The calibration runs a speech clip through the offline pipeline
+ * (run_whisper_inference) with every installed model and a sweep of thread counts, and measures
+ * the real-time factor (inference time / audio time) and the 95th percentile of the segment
+ * latency. A short clip is repeated to CALIBRATION_MIN_SEGMENTS full segments so the
+ * percentile has enough samples, and every inference waits for the whole thread budget of the
+ * inference scheduler so the inferences of other filters do not skew the times. The thread
+ * counts stop at the CPUs the process may use: its affinity mask and, on Linux, the cgroup CPU
+ * quota (cpu.max in cgroup v2, cpu.cfs_quota_us in v1). More threads than that are throttled by
+ * the kernel and only add latency.
+ *
+ * For every model the fewest threads within CALIBRATION_THREAD_TOLERANCE of its best real-time
+ * factor are picked, which leaves the other cores to OBS. The recommended model is the largest
+ * one that meets the target real-time factor and p95 latency. The profile is saved as JSON in
+ * the module config directory, the filter applies it when the thread count and the model are
+ * left at their defaults, as long as it was measured on the same machine with the same CPUs.
+ *
+ * The Calibrate button of the filter sweeps the installed models on a short speech clip it
+ * downloads (CALIBRATION_CLIP_URL), the offline test tool on any audio file.
+ */
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// thread counts of the sweep, up to the usable CPUs
+#define CALIBRATION_MAX_THREADS 16
+// real-time factor a model has to reach, leaves headroom for the partials and for OBS
+#define CALIBRATION_DEFAULT_TARGET_RTF 0.5
+// p95 segment latency a model has to reach, the default buffer size
+#define CALIBRATION_DEFAULT_MAX_P95_MSEC 3000
+// fewer threads are picked when their real-time factor is this close to the best one
+#define CALIBRATION_THREAD_TOLERANCE 1.1
+// length of the segments the clip is cut into
+#define CALIBRATION_SEGMENT_MSEC 5000
+// full segments a run times at least, a shorter clip is repeated
+#define CALIBRATION_MIN_SEGMENTS 20
+#define CALIBRATION_PROFILE_VERSION 1
+// speech clip of the Calibrate button, a 16 kHz 16-bit mono WAV file
+#define CALIBRATION_CLIP_URL "https://github.com/ggml-org/whisper.cpp/raw/master/samples/jfk.wav"
+
+/** An installed model, the name is the one of the model list of the filter, if any */
+struct CalibrationModel {
+	std::string name;
+	std::string file;
+};
+
+/** One model at one thread count */
+struct CalibrationRun {
+	std::string model_name;
+	std::string model_file;
+	uint64_t model_bytes = 0;
+	int n_threads = 0;
+	double rtf = 0.0;
+	double p95_ms = 0.0;
+	int segments = 0;
+};
+
+struct CalibrationProfile {
+	// where the profile was measured, see calibration_machine_id
+	std::string machine;
+	int usable_cpus = 0;
+	double target_rtf = CALIBRATION_DEFAULT_TARGET_RTF;
+	double max_p95_ms = CALIBRATION_DEFAULT_MAX_P95_MSEC;
+	// seconds since the epoch
+	uint64_t created = 0;
+	std::vector<CalibrationRun> runs;
+	// the recommendation
+	CalibrationRun selected;
+	// whether the selected run meets the targets, else it is the fastest run
+	bool meets_target = false;
+};
+
+/**
+ * @brief Parses cgroup v2 cpu.max, "<quota> <period>" or "max <period>".
+ *
+ * @param cpus The quota in CPUs, 0 for no quota.
+ * @return false if the content is malformed.
+ */
+bool parse_cgroup_cpu_max(const std::string &content, double &cpus);
+
+/** The cgroup v2 path of the process from /proc/self/cgroup, empty for none */
+std::string parse_cgroup_v2_path(const std::string &proc_self_cgroup);
+
+/**
+ * @brief CPUs the process may use: the CPUs of its affinity mask, limited by the cgroup CPU
+ * quota rounded up.
+ */
+int usable_cpu_count();
+
+/** Host name and hardware threads, a changed machine or CPU invalidates the profile */
+std::string calibration_machine_id();
+
+/** Thread counts of the sweep for the usable CPUs */
+std::vector<int> calibration_thread_counts(int usable_cpus);
+
+/**
+ * @brief The audio a run times: the full segments of the clip, the clip repeated to
+ * min_segments segments when it has fewer.
+ */
+std::vector<float> calibration_sweep_audio(const std::vector<float> &clip,
+					   size_t segment_samples, size_t min_segments);
+
+/** The given percentile (0-1) of the values, interpolated, 0 for none */
+double latency_percentile(std::vector<double> values, double percentile);
+
+/**
+ * @brief Picks the recommended run of the profile from its runs.
+ *
+ * @return false if the profile has no runs.
+ */
+bool calibration_select(CalibrationProfile &profile);
+
+std::string calibration_profile_to_json(const CalibrationProfile &profile);
+bool calibration_profile_from_json(const std::string &json, CalibrationProfile &profile);
+
+bool save_calibration_profile(const std::string &path, const CalibrationProfile &profile);
+bool load_calibration_profile(const std::string &path, CalibrationProfile &profile);
+
+/**
+ * @brief Reads the samples of a 16 kHz 16-bit PCM WAV file, its channels mixed down to mono.
+ *
+ * @return false if the data is not such a file.
+ */
+bool parse_wav_clip(const std::string &data, std::vector<float> &samples);
+bool load_wav_clip(const std::string &path, std::vector<float> &samples);
+
+/** Whether the profile was measured on this machine with the CPUs it has now */
+bool calibration_profile_applies(const CalibrationProfile &profile);
+
+#endif // CALIBRATION_H
@@ -0,0 +1,102 @@
+#include "compute-threads.h"
+
+#include <cstdio>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+bool parse_cpu_list(const std::string &list, std::vector<int> &cpus)
+{
+	cpus.clear();
+	size_t pos = 0;
+	while (pos < list.size()) {
+		size_t end = list.find(',', pos);
+		if (end == std::string::npos) {
+			end = list.size();
+		}
+		const std::string item = list.substr(pos, end - pos);
+		pos = end + 1;
+		if (item.find_first_not_of(" \t") == std::string::npos) {
+			continue;
+		}
+		int first = 0;
+		int last = 0;
+		char extra = 0;
+		if (sscanf(item.c_str(), " %d - %d %c", &first, &last, &extra) == 2) {
+			// range
+		} else if (sscanf(item.c_str(), " %d %c", &first, &extra) == 1) {
+			last = first;
+		} else {
+			return false;
+		}
+		if (first < 0 || last < first || last >= 1024) {
+			return false;
+		}
+		for (int cpu = first; cpu <= last; ++cpu) {
+			cpus.push_back(cpu);
+		}
+	}
+	return true;
+}
+
+bool set_current_thread_affinity(const std::vector<int> &cpus)
+{
+	if (cpus.empty()) {
+		return false;
+	}
+#ifdef _WIN32
+	DWORD_PTR mask = 0;
+	for (int cpu : cpus) {
+		if (cpu < (int)(sizeof(DWORD_PTR) * 8)) {
+			mask |= (DWORD_PTR)1 << cpu;
+		}
+	}
+	return mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int cpu : cpus) {
+		if (cpu < CPU_SETSIZE) {
+			CPU_SET(cpu, &set);
+		}
+	}
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+	// macOS has no thread affinity, only scheduling hints
+	return false;
+#endif
+}
+
+bool get_current_thread_affinity(std::vector<int> &cpus)
+{
+	cpus.clear();
+#ifdef _WIN32
+	DWORD_PTR process_mask = 0;
+	DWORD_PTR system_mask = 0;
+	if (!GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask)) {
+		return false;
+	}
+	for (int cpu = 0; cpu < (int)(sizeof(DWORD_PTR) * 8); cpu++) {
+		if (process_mask & ((DWORD_PTR)1 << cpu)) {
+			cpus.push_back(cpu);
+		}
+	}
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+		return false;
+	}
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (CPU_ISSET(cpu, &set)) {
+			cpus.push_back(cpu);
+		}
+	}
+#endif
+	return !cpus.empty();
+}
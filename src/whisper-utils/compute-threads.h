@@ -0,0 +1,40 @@
+/**
+ * @file compute-threads.h
+ * @brief Where the whisper compute threads run.
+ *
+ * whisper.cpp has no way to hand a ggml threadpool to a whisper state. Its CPU backend computes
+ * with OpenMP when the library is built with it, and the OpenMP workers persist in the runtime
+ * for the thread that calls whisper, the whisper thread of the filter. Without OpenMP, ggml
+ * starts n_threads threads for every graph. In both cases the compute threads are created by
+ * the whisper thread, so the plugin controls them through that thread:
+ *
+ * the whisper thread is pinned to a CPU list, and the compute threads it creates inherit the
+ * mask (Linux; Windows pins the whisper thread only). A changed list is applied by the whisper
+ * thread between two inferences; OpenMP workers it created before keep their mask.
+ *
+ * The OpenMP wait policy is not set by the plugin: libgomp and MSVC's vcomp read
+ * OMP_WAIT_POLICY when they are loaded, so only the environment OBS starts with applies.
+ */
+#ifndef COMPUTE_THREADS_H
+#define COMPUTE_THREADS_H
+
+#include <string>
+#include <vector>
+
+/**
+ * @brief Parses a CPU list such as "0-3,6".
+ *
+ * @return false if the list is malformed, an empty list parses to no CPUs.
+ */
+bool parse_cpu_list(const std::string &list, std::vector<int> &cpus);
+
+/** Pins the calling thread to the CPUs, returns false if the platform does not support it */
+bool set_current_thread_affinity(const std::vector<int> &cpus);
+
+/**
+ * @brief CPUs the calling thread may run on (Windows: the CPUs of the process), to unpin it
+ * again. Returns false if the platform does not support it.
+ */
+bool get_current_thread_affinity(std::vector<int> &cpus);
+
+#endif // COMPUTE_THREADS_H
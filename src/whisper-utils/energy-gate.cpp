@@ -0,0 +1,294 @@
+#include "energy-gate.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE__) || \
+	(defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define ENERGY_GATE_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) || defined(_M_ARM64) || defined(__ARM_NEON)
+#define ENERGY_GATE_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define ENERGY_GATE_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define ENERGY_GATE_TARGET_AVX2
+#endif
+
+namespace {
+
+// where the noise floor starts, it reaches the background within a few seconds
+const float INITIAL_FLOOR_DB = -60.0f;
+const float MIN_FLOOR_DB = -90.0f;
+// the floor follows a quieter background right away and a louder one slowly, so speech does
+// not pull it up
+const float FLOOR_ATTACK = 0.5f;
+const float FLOOR_RISE_DB_PER_S = 3.0f;
+// peak over the gate threshold that still counts as background (noise has a crest factor of
+// about 12 dB)
+const float MAX_CREST_DB = 20.0f;
+// zero-crossing rate over the background from which a window above the floor may be an
+// unvoiced sound
+const float ZCR_MARGIN = 0.15f;
+const float NOISE_ZCR_SMOOTHING = 0.05f;
+
+typedef void (*measure_fn)(const float *x, size_t n, float &sum_sq, float &peak,
+			   float &crossings);
+
+float to_db(float linear)
+{
+	return 20.0f * std::log10(std::max(linear, 1e-5f));
+}
+
+/* Scalar kernel */
+
+void measure_tail(const float *x, size_t start, size_t n, float &sum_sq, float &peak,
+		  float &crossings)
+{
+	for (size_t i = start; i < n; i++) {
+		sum_sq += x[i] * x[i];
+		peak = std::max(peak, std::fabs(x[i]));
+		if (i + 1 < n && (x[i] < 0.0f) != (x[i + 1] < 0.0f)) {
+			crossings += 1.0f;
+		}
+	}
+}
+
+void measure_scalar(const float *x, size_t n, float &sum_sq, float &peak, float &crossings)
+{
+	sum_sq = 0.0f;
+	peak = 0.0f;
+	crossings = 0.0f;
+	measure_tail(x, 0, n, sum_sq, peak, crossings);
+}
+
+#ifdef ENERGY_GATE_X86
+
+/* SSE kernel */
+
+float hsum_sse(__m128 v)
+{
+	__m128 shuf = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+	__m128 sums = _mm_add_ps(v, shuf);
+	shuf = _mm_movehl_ps(shuf, sums);
+	sums = _mm_add_ss(sums, shuf);
+	return _mm_cvtss_f32(sums);
+}
+
+float hmax_sse(__m128 v)
+{
+	v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+	v = _mm_max_ps(v, _mm_movehl_ps(v, v));
+	return _mm_cvtss_f32(v);
+}
+
+void measure_sse(const float *x, size_t n, float &sum_sq, float &peak, float &crossings)
+{
+	const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	__m128 acc = _mm_setzero_ps();
+	__m128 pk = _mm_setzero_ps();
+	__m128 zc = _mm_setzero_ps();
+	size_t i = 0;
+	// x[i + 4] is read for the crossing after the last sample of the block
+	for (; i + 5 <= n; i += 4) {
+		const __m128 a = _mm_loadu_ps(x + i);
+		const __m128 b = _mm_loadu_ps(x + i + 1);
+		acc = _mm_add_ps(acc, _mm_mul_ps(a, a));
+		pk = _mm_max_ps(pk, _mm_and_ps(a, abs_mask));
+		const __m128 sign_change = _mm_xor_ps(_mm_cmplt_ps(a, zero), _mm_cmplt_ps(b, zero));
+		zc = _mm_add_ps(zc, _mm_and_ps(sign_change, one));
+	}
+	sum_sq = hsum_sse(acc);
+	peak = hmax_sse(pk);
+	crossings = hsum_sse(zc);
+	measure_tail(x, i, n, sum_sq, peak, crossings);
+}
+
+/* AVX2 kernel */
+
+ENERGY_GATE_TARGET_AVX2 void measure_avx2(const float *x, size_t n, float &sum_sq, float &peak,
+					  float &crossings)
+{
+	const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.0f);
+	__m256 acc = _mm256_setzero_ps();
+	__m256 pk = _mm256_setzero_ps();
+	__m256 zc = _mm256_setzero_ps();
+	size_t i = 0;
+	for (; i + 9 <= n; i += 8) {
+		const __m256 a = _mm256_loadu_ps(x + i);
+		const __m256 b = _mm256_loadu_ps(x + i + 1);
+		acc = _mm256_add_ps(acc, _mm256_mul_ps(a, a));
+		pk = _mm256_max_ps(pk, _mm256_and_ps(a, abs_mask));
+		const __m256 sign_change = _mm256_xor_ps(_mm256_cmp_ps(a, zero, _CMP_LT_OQ),
+							 _mm256_cmp_ps(b, zero, _CMP_LT_OQ));
+		zc = _mm256_add_ps(zc, _mm256_and_ps(sign_change, one));
+	}
+	const __m128 acc4 = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+	const __m128 pk4 = _mm_max_ps(_mm256_castps256_ps128(pk), _mm256_extractf128_ps(pk, 1));
+	const __m128 zc4 = _mm_add_ps(_mm256_castps256_ps128(zc), _mm256_extractf128_ps(zc, 1));
+	sum_sq = hsum_sse(acc4);
+	peak = hmax_sse(pk4);
+	crossings = hsum_sse(zc4);
+	measure_tail(x, i, n, sum_sq, peak, crossings);
+}
+
+#endif // ENERGY_GATE_X86
+
+#ifdef ENERGY_GATE_NEON
+
+/* NEON kernel */
+
+void measure_neon(const float *x, size_t n, float &sum_sq, float &peak, float &crossings)
+{
+	const float32x4_t zero = vdupq_n_f32(0.0f);
+	const uint32x4_t one = vreinterpretq_u32_f32(vdupq_n_f32(1.0f));
+	float32x4_t acc = vdupq_n_f32(0.0f);
+	float32x4_t pk = vdupq_n_f32(0.0f);
+	float32x4_t zc = vdupq_n_f32(0.0f);
+	size_t i = 0;
+	for (; i + 5 <= n; i += 4) {
+		const float32x4_t a = vld1q_f32(x + i);
+		const float32x4_t b = vld1q_f32(x + i + 1);
+		acc = vmlaq_f32(acc, a, a);
+		pk = vmaxq_f32(pk, vabsq_f32(a));
+		const uint32x4_t sign_change = veorq_u32(vcltq_f32(a, zero), vcltq_f32(b, zero));
+		zc = vaddq_f32(zc, vreinterpretq_f32_u32(vandq_u32(sign_change, one)));
+	}
+	const float32x2_t acc2 = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+	const float32x2_t pk2 = vmax_f32(vget_low_f32(pk), vget_high_f32(pk));
+	const float32x2_t zc2 = vadd_f32(vget_low_f32(zc), vget_high_f32(zc));
+	sum_sq = vget_lane_f32(vpadd_f32(acc2, acc2), 0);
+	peak = vget_lane_f32(vpmax_f32(pk2, pk2), 0);
+	crossings = vget_lane_f32(vpadd_f32(zc2, zc2), 0);
+	measure_tail(x, i, n, sum_sq, peak, crossings);
+}
+
+#endif // ENERGY_GATE_NEON
+
+measure_fn kernel_function(AudioDecimatorKernel kernel)
+{
+	switch (kernel) {
+#ifdef ENERGY_GATE_X86
+	case AUDIO_DECIMATOR_KERNEL_SSE:
+		return measure_sse;
+	case AUDIO_DECIMATOR_KERNEL_AVX2:
+		return measure_avx2;
+#endif
+#ifdef ENERGY_GATE_NEON
+	case AUDIO_DECIMATOR_KERNEL_NEON:
+		return measure_neon;
+#endif
+	default:
+		return measure_scalar;
+	}
+}
+
+} // namespace
+
+AudioDecimatorKernel EnergyGate::default_kernel()
+{
+	// the CPU checks are the ones of the decimator kernels
+	static const AudioDecimatorKernel kernel = [] {
+#ifdef ENERGY_GATE_X86
+		return AudioDecimator::kernel_available(AUDIO_DECIMATOR_KERNEL_AVX2)
+			       ? AUDIO_DECIMATOR_KERNEL_AVX2
+			       : AUDIO_DECIMATOR_KERNEL_SSE;
+#elif defined(ENERGY_GATE_NEON)
+		return AUDIO_DECIMATOR_KERNEL_NEON;
+#else
+		return AUDIO_DECIMATOR_KERNEL_SCALAR;
+#endif
+	}();
+	return kernel;
+}
+
+EnergyMeasure EnergyGate::measure(const float *samples, size_t num_samples)
+{
+	static const measure_fn fn = kernel_function(default_kernel());
+	float sum_sq = 0.0f;
+	float peak = 0.0f;
+	float crossings = 0.0f;
+	if (num_samples > 0) {
+		fn(samples, num_samples, sum_sq, peak, crossings);
+	}
+	return {std::sqrt(sum_sq / (float)std::max<size_t>(num_samples, 1)), peak,
+		crossings / (float)std::max<size_t>(num_samples, 2)};
+}
+
+EnergyMeasure EnergyGate::measure(const float *samples, size_t num_samples,
+				  AudioDecimatorKernel kernel)
+{
+	if (kernel == AUDIO_DECIMATOR_KERNEL_AUTO) {
+		kernel = default_kernel();
+	}
+	float sum_sq = 0.0f;
+	float peak = 0.0f;
+	float crossings = 0.0f;
+	if (num_samples > 0 && AudioDecimator::kernel_available(kernel)) {
+		kernel_function(kernel)(samples, num_samples, sum_sq, peak, crossings);
+	}
+	return {std::sqrt(sum_sq / (float)std::max<size_t>(num_samples, 1)), peak,
+		crossings / (float)std::max<size_t>(num_samples, 2)};
+}
+
+EnergyGate::EnergyGate(int sample_rate_) : sample_rate(sample_rate_)
+{
+	reset();
+}
+
+void EnergyGate::reset()
+{
+	floor_db = INITIAL_FLOOR_DB;
+	noise_zcr = 0.5f;
+	hangover_left = 0;
+}
+
+bool EnergyGate::classify(const float *samples, size_t num_samples)
+{
+	if (num_samples == 0) {
+		return false;
+	}
+	const EnergyMeasure m = measure(samples, num_samples);
+	const float rms_db = to_db(m.rms);
+	const float peak_db = to_db(m.peak);
+	const float threshold_db = std::min(floor_db + margin_db, MAX_GATE_DB);
+
+	bool silent = rms_db <= DIGITAL_SILENCE_DB;
+	if (!silent && rms_db < threshold_db) {
+		// a single click or plosive in a quiet window is not silence
+		silent = peak_db < threshold_db + MAX_CREST_DB;
+		// noise-like and above the floor: may be the start of a fricative
+		if (silent && m.zero_crossing_rate > noise_zcr + ZCR_MARGIN &&
+		    rms_db > floor_db + margin_db / 2.0f) {
+			silent = false;
+		}
+	}
+
+	const float seconds = (float)num_samples / (float)sample_rate;
+	if (rms_db < floor_db) {
+		floor_db += (rms_db - floor_db) * FLOOR_ATTACK;
+	} else {
+		floor_db += std::min(FLOOR_RISE_DB_PER_S * seconds, rms_db - floor_db);
+	}
+	floor_db = std::clamp(floor_db, MIN_FLOOR_DB, MAX_GATE_DB - margin_db);
+	if (silent) {
+		noise_zcr += (m.zero_crossing_rate - noise_zcr) * NOISE_ZCR_SMOOTHING;
+	}
+
+	if (!silent) {
+		hangover_left = (int64_t)HANGOVER_MS * sample_rate / 1000;
+	} else if (hangover_left > 0) {
+		hangover_left -= (int64_t)num_samples;
+		silent = false;
+	}
+	return silent;
+}
@@ -0,0 +1,74 @@
+/**
+ * @file energy-gate.h
+ * @brief Cheap silence detector in front of Silero VAD and whisper.
+ *
+ * Classifies short windows of 16 kHz audio from their RMS level, peak level and zero-crossing
+ * rate against a noise floor that follows the background level of the source. A window is
+ * only called silent when it is clearly silent: below the floor plus a margin, and never when
+ * it is louder than an absolute limit or looks like an unvoiced sound (noise-like, above the
+ * floor). Windows right after sound are kept for a short hangover, so speech tails and the
+ * VAD state see real audio.
+ *
+ * The measurement is a single pass with SSE, AVX2 and NEON kernels and a scalar fallback.
+ */
+#ifndef ENERGY_GATE_H
+#define ENERGY_GATE_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "audio-decimator.h"
+
+struct EnergyMeasure {
+	// linear RMS and absolute peak of the window
+	float rms;
+	float peak;
+	// fraction of neighbouring samples with a different sign
+	float zero_crossing_rate;
+};
+
+class EnergyGate {
+public:
+	/** Windows at or below this level are silent whatever the noise floor */
+	static constexpr float DIGITAL_SILENCE_DB = -72.0f;
+	/** Windows above this level are never gated */
+	static constexpr float MAX_GATE_DB = -35.0f;
+	/** Default distance to the noise floor under which a window is silent */
+	static constexpr float DEFAULT_MARGIN_DB = 6.0f;
+	/** How long windows after sound stay open */
+	static constexpr int HANGOVER_MS = 250;
+
+	/** Measures a window with the fastest kernel available on this CPU. */
+	static EnergyMeasure measure(const float *samples, size_t num_samples);
+	/** Same with a given kernel (AUTO, SCALAR, SSE, AVX2 or NEON), for testing. */
+	static EnergyMeasure measure(const float *samples, size_t num_samples,
+				     AudioDecimatorKernel kernel);
+	/** The kernel measure() uses. */
+	static AudioDecimatorKernel default_kernel();
+
+	explicit EnergyGate(int sample_rate = 16000);
+
+	/** Forgets the noise floor, e.g. when the source changes. */
+	void reset();
+
+	/**
+	 * @brief Classifies the next window of the stream and updates the noise floor.
+	 *
+	 * @return true when the window is clearly silent and the model run can be skipped.
+	 */
+	bool classify(const float *samples, size_t num_samples);
+
+	void set_margin_db(float margin) { margin_db = margin; }
+	float noise_floor_db() const { return floor_db; }
+
+private:
+	int sample_rate;
+	float margin_db = DEFAULT_MARGIN_DB;
+	float floor_db;
+	// zero-crossing rate of the background, tracked over the silent windows
+	float noise_zcr;
+	// samples left in the hangover after the last window with sound
+	int64_t hangover_left = 0;
+};
+
+#endif // ENERGY_GATE_H
@@ -0,0 +1,75 @@
+#include "inference-abort.h"
+
+const char *InferenceAbort::reason_name(InferenceAbortReason reason)
+{
+	switch (reason) {
+	case INFERENCE_ABORT_SUPERSEDED:
+		return "superseded";
+	case INFERENCE_ABORT_CLEARED:
+		return "buffers cleared";
+	case INFERENCE_ABORT_SHUTDOWN:
+		return "shutdown";
+	default:
+		return "none";
+	}
+}
+
+void InferenceAbort::begin(bool partial, uint64_t supersede_frames)
+{
+	supersede_at = partial ? supersede_frames : UINT64_MAX;
+	running_partial = partial;
+	reason = INFERENCE_ABORT_NONE;
+	// published before shutting_down is read, and request() sets shutting_down before it reads
+	// running: a shutdown that races the start is seen by one side or the other
+	running = true;
+	if (shutting_down) {
+		int expected = INFERENCE_ABORT_NONE;
+		reason.compare_exchange_strong(expected, INFERENCE_ABORT_SHUTDOWN);
+	}
+}
+
+InferenceAbortReason InferenceAbort::end()
+{
+	running = false;
+	running_partial = false;
+	supersede_at = UINT64_MAX;
+	const InferenceAbortReason result =
+		(InferenceAbortReason)reason.exchange(INFERENCE_ABORT_NONE);
+	if (result != INFERENCE_ABORT_NONE) {
+		counts[result]++;
+	}
+	return result;
+}
+
+void InferenceAbort::request(InferenceAbortReason new_reason)
+{
+	if (new_reason == INFERENCE_ABORT_SHUTDOWN) {
+		shutting_down = true;
+	}
+	if (new_reason == INFERENCE_ABORT_NONE || !running ||
+	    (new_reason == INFERENCE_ABORT_SUPERSEDED && !running_partial)) {
+		return;
+	}
+	// the first reason is the one counted
+	int expected = INFERENCE_ABORT_NONE;
+	reason.compare_exchange_strong(expected, new_reason);
+}
+
+void InferenceAbort::on_input_frames(uint64_t frames_available)
+{
+	if (frames_available >= supersede_at.load(std::memory_order_relaxed)) {
+		request(INFERENCE_ABORT_SUPERSEDED);
+	}
+}
+
+void InferenceAbort::reset()
+{
+	shutting_down = false;
+}
+
+uint64_t InferenceAbort::count(InferenceAbortReason which) const
+{
+	return which > INFERENCE_ABORT_NONE && which < INFERENCE_ABORT_REASON_COUNT
+		       ? counts[which].load()
+		       : 0;
+}
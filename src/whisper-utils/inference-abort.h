@@ -0,0 +1,74 @@
+/**
+ * @file inference-abort.h
+ * @brief Cancellation of the running whisper inference.
+ *
+ * Once whisper_full started nothing stopped it: a partial kept decoding audio whose final was
+ * already due, and disabling the filter or switching the model waited for the inference to
+ * finish, seconds with the large models. whisper polls abort_callback between the graph nodes
+ * of the encoder and the decoder; the callback of the filter returns whether the running
+ * inference was cancelled, which makes whisper_full return an error within a node or so.
+ *
+ * An inference is cancelled when:
+ * - it is a partial and the input holds the end of its segment, so the final of the same audio
+ *   runs next (superseded), checked by the audio thread as it pushes audio;
+ * - the buffers of the filter are cleared (media restart), its audio is dropped anyway;
+ * - the whisper thread is stopping, which also cancels the inferences that start until reset().
+ * The aborts are counted per reason.
+ */
+#ifndef INFERENCE_ABORT_H
+#define INFERENCE_ABORT_H
+
+#include <atomic>
+#include <cstdint>
+
+enum InferenceAbortReason {
+	INFERENCE_ABORT_NONE = 0,
+	INFERENCE_ABORT_SUPERSEDED,
+	INFERENCE_ABORT_CLEARED,
+	INFERENCE_ABORT_SHUTDOWN,
+	INFERENCE_ABORT_REASON_COUNT,
+};
+
+class InferenceAbort {
+public:
+	static const char *reason_name(InferenceAbortReason reason);
+
+	/**
+	 * @brief Starts an inference, on the whisper thread.
+	 *
+	 * @param partial Whether the inference is a partial, which can be superseded.
+	 * @param supersede_frames Input frames available once the final of its audio is due,
+	 * UINT64_MAX for never.
+	 */
+	void begin(bool partial, uint64_t supersede_frames = UINT64_MAX);
+	/** Ends the inference, returns why it was cancelled and counts it. */
+	InferenceAbortReason end();
+
+	/**
+	 * @brief Cancels the running inference. SUPERSEDED only cancels partials, SHUTDOWN also
+	 * the inferences that start until reset().
+	 */
+	void request(InferenceAbortReason reason);
+	/** From the audio thread: supersedes the running partial once its segment is complete. */
+	void on_input_frames(uint64_t frames_available);
+	/** The whisper thread starts again. */
+	void reset();
+
+	/** Polled by whisper through abort_callback, from the compute threads */
+	bool should_abort() const { return reason.load(std::memory_order_relaxed) != 0; }
+	/** Whether a SHUTDOWN was requested since the last reset() */
+	bool shutdown_requested() const { return shutting_down.load(); }
+
+	/** Inferences cancelled for the reason */
+	uint64_t count(InferenceAbortReason which) const;
+
+private:
+	std::atomic<int> reason{INFERENCE_ABORT_NONE};
+	std::atomic<bool> running{false};
+	std::atomic<bool> running_partial{false};
+	std::atomic<bool> shutting_down{false};
+	std::atomic<uint64_t> supersede_at{UINT64_MAX};
+	std::atomic<uint64_t> counts[INFERENCE_ABORT_REASON_COUNT] = {};
+};
+
+#endif // INFERENCE_ABORT_H
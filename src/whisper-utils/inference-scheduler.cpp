@@ -0,0 +1,194 @@
+#include "inference-scheduler.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace {
+
+// weight of the latest job in the moving averages
+constexpr double STATS_SMOOTHING = 0.2;
+
+int default_budget()
+{
+	return std::max(1, (int)std::thread::hardware_concurrency());
+}
+
+void update_average(double &average, double value, uint64_t count)
+{
+	average = count <= 1 ? value : average + STATS_SMOOTHING * (value - average);
+}
+
+double ms_since(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start)
+		.count();
+}
+
+} // namespace
+
+InferenceScheduler::Slot::Slot(Slot &&other) noexcept
+	: scheduler(other.scheduler),
+	  source(other.source),
+	  num_threads(other.num_threads),
+	  start(other.start)
+{
+	other.scheduler = nullptr;
+}
+
+InferenceScheduler::Slot &InferenceScheduler::Slot::operator=(Slot &&other) noexcept
+{
+	if (this != &other) {
+		if (scheduler != nullptr) {
+			scheduler->release(source, num_threads, start);
+		}
+		scheduler = other.scheduler;
+		source = other.source;
+		num_threads = other.num_threads;
+		start = other.start;
+		other.scheduler = nullptr;
+	}
+	return *this;
+}
+
+InferenceScheduler::Slot::~Slot()
+{
+	if (scheduler != nullptr) {
+		scheduler->release(source, num_threads, start);
+	}
+}
+
+InferenceScheduler &InferenceScheduler::instance()
+{
+	static InferenceScheduler scheduler;
+	return scheduler;
+}
+
+InferenceScheduler::InferenceScheduler(int thread_budget)
+	: budget(thread_budget > 0 ? thread_budget : default_budget())
+{
+}
+
+void InferenceScheduler::set_thread_budget(int thread_budget)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	budget = thread_budget > 0 ? thread_budget : default_budget();
+	admit_waiting();
+}
+
+int InferenceScheduler::get_thread_budget() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return budget;
+}
+
+InferenceScheduler::Slot InferenceScheduler::admit(const void *source, InferenceJobKind kind,
+						   int threads, std::chrono::milliseconds max_wait)
+{
+	const auto enqueued = std::chrono::steady_clock::now();
+	Waiter waiter{source, kind, std::max(threads, 1), 0, false};
+
+	std::unique_lock<std::mutex> lock(mutex);
+	waiter.sequence = next_sequence++;
+	Source &state = sources[source];
+	state.stats.queued++;
+	waiting.push_back(&waiter);
+	admit_waiting();
+
+	const bool may_drop = kind == INFERENCE_JOB_PARTIAL && max_wait.count() > 0;
+	while (!waiter.admitted) {
+		if (!may_drop) {
+			cv.wait(lock);
+		} else if (cv.wait_until(lock, enqueued + max_wait) == std::cv_status::timeout &&
+			   !waiter.admitted) {
+			waiting.erase(std::find(waiting.begin(), waiting.end(), &waiter));
+			Source &dropped = sources[source];
+			dropped.stats.queued--;
+			dropped.stats.dropped_partials++;
+			// the jobs behind this one may fit now
+			admit_waiting();
+			return Slot();
+		}
+	}
+
+	Source &admitted = sources[source];
+	admitted.stats.queued--;
+	admitted.stats.jobs++;
+	update_average(admitted.stats.wait_ms, ms_since(enqueued), admitted.stats.jobs);
+
+	Slot slot;
+	slot.scheduler = this;
+	slot.source = source;
+	slot.num_threads = waiter.threads;
+	slot.start = std::chrono::steady_clock::now();
+	return slot;
+}
+
+void InferenceScheduler::admit_waiting()
+{
+	bool admitted_any = false;
+	while (!waiting.empty()) {
+		// finals first, then the source admitted least recently, then first come
+		auto next = std::min_element(
+			waiting.begin(), waiting.end(), [this](const Waiter *a, const Waiter *b) {
+				if (a->kind != b->kind) {
+					return a->kind < b->kind;
+				}
+				const uint64_t last_a = sources[a->source].last_admitted;
+				const uint64_t last_b = sources[b->source].last_admitted;
+				if (last_a != last_b) {
+					return last_a < last_b;
+				}
+				return a->sequence < b->sequence;
+			});
+		Waiter *waiter = *next;
+		waiter->threads = std::min(waiter->threads, budget);
+		// the first job in the queue waits for its threads, smaller jobs behind it do not
+		// overtake it
+		if (threads_in_use + waiter->threads > budget) {
+			break;
+		}
+		threads_in_use += waiter->threads;
+		sources[waiter->source].last_admitted = ++admissions;
+		waiter->admitted = true;
+		waiting.erase(next);
+		admitted_any = true;
+	}
+	if (admitted_any) {
+		cv.notify_all();
+	}
+}
+
+void InferenceScheduler::release(const void *source, int threads,
+				 std::chrono::steady_clock::time_point start)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	threads_in_use -= threads;
+	auto it = sources.find(source);
+	if (it != sources.end()) {
+		update_average(it->second.stats.run_ms, ms_since(start), it->second.stats.jobs);
+	}
+	admit_waiting();
+}
+
+size_t InferenceScheduler::queue_depth() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return waiting.size();
+}
+
+InferenceScheduler::source_stats InferenceScheduler::get_stats(const void *source) const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = sources.find(source);
+	return it != sources.end() ? it->second.stats : source_stats();
+}
+
+void InferenceScheduler::forget(const void *source)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = sources.find(source);
+	// a source with jobs in flight keeps its entry
+	if (it != sources.end() && it->second.stats.queued == 0) {
+		sources.erase(it);
+	}
+}
@@ -0,0 +1,122 @@
+/**
+ * @file inference-scheduler.h
+ * @brief Process-wide admission of whisper inference jobs within a CPU thread budget.
+ *
+ * Every filter runs whisper from its own thread with its own n_threads, so a few busy filters
+ * used to oversubscribe the CPU and all of them missed their latency. The whisper threads now
+ * ask the scheduler for a slot before each inference: a job reserves its number of threads
+ * from a global budget (the hardware threads by default) and waits while the running jobs use
+ * it up. The whisper threads thus act as a pool of workers that never runs more threads than
+ * the budget.
+ *
+ * Waiting jobs are admitted final segments first, then partials, and within each kind the
+ * filter served least recently goes first, so a busy filter cannot starve the others. A partial
+ * that waits longer than its max_wait is dropped: the next partial of the filter covers newer
+ * audio anyway. Per filter wait and run times are kept for monitoring.
+ */
+#ifndef INFERENCE_SCHEDULER_H
+#define INFERENCE_SCHEDULER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+enum InferenceJobKind {
+	INFERENCE_JOB_FINAL = 0,
+	INFERENCE_JOB_PARTIAL,
+};
+
+class InferenceScheduler {
+public:
+	struct source_stats {
+		uint64_t jobs = 0;
+		uint64_t dropped_partials = 0;
+		// jobs of the source waiting for a slot right now
+		uint64_t queued = 0;
+		// moving averages over the recent jobs
+		double wait_ms = 0.0;
+		double run_ms = 0.0;
+	};
+
+	/** Admission of one job, the threads go back to the budget when it is destroyed */
+	class Slot {
+	public:
+		Slot() = default;
+		Slot(Slot &&other) noexcept;
+		Slot &operator=(Slot &&other) noexcept;
+		Slot(const Slot &) = delete;
+		Slot &operator=(const Slot &) = delete;
+		~Slot();
+
+		/** false for a dropped partial */
+		explicit operator bool() const { return scheduler != nullptr; }
+		/** Threads the job may use, at most the budget */
+		int threads() const { return num_threads; }
+
+	private:
+		friend class InferenceScheduler;
+		InferenceScheduler *scheduler = nullptr;
+		const void *source = nullptr;
+		int num_threads = 0;
+		std::chrono::steady_clock::time_point start;
+	};
+
+	static InferenceScheduler &instance();
+
+	/** @param thread_budget 0 for the number of hardware threads */
+	explicit InferenceScheduler(int thread_budget = 0);
+
+	void set_thread_budget(int thread_budget);
+	int get_thread_budget() const;
+
+	/**
+	 * @brief Blocks until the job of the source may run.
+	 *
+	 * @param source Identifies the filter, for fairness and statistics.
+	 * @param threads Threads the job runs with, clamped to the budget.
+	 * @param max_wait For partials, how long the job may wait before it is dropped (0 waits
+	 *                 until admitted).
+	 * @return An empty slot if the partial was dropped.
+	 */
+	Slot admit(const void *source, InferenceJobKind kind, int threads,
+		   std::chrono::milliseconds max_wait = std::chrono::milliseconds(0));
+
+	/** Number of jobs of all sources waiting for a slot */
+	size_t queue_depth() const;
+	source_stats get_stats(const void *source) const;
+	/** Drops the statistics of a source that goes away */
+	void forget(const void *source);
+
+private:
+	struct Waiter {
+		const void *source;
+		InferenceJobKind kind;
+		int threads;
+		uint64_t sequence;
+		bool admitted = false;
+	};
+
+	struct Source {
+		source_stats stats;
+		// admission counter value when the source was last admitted, lower goes first
+		uint64_t last_admitted = 0;
+	};
+
+	void admit_waiting();
+	void release(const void *source, int threads, std::chrono::steady_clock::time_point start);
+
+	mutable std::mutex mutex;
+	std::condition_variable cv;
+	std::vector<Waiter *> waiting;
+	std::map<const void *, Source> sources;
+	int budget;
+	int threads_in_use = 0;
+	uint64_t next_sequence = 0;
+	uint64_t admissions = 0;
+};
+
+#endif // INFERENCE_SCHEDULER_H
@@ -0,0 +1,39 @@
+#include "language-id.h"
+
+bool LanguageIdCache::detection_due(uint64_t now_ms, uint64_t segment_start_ms) const
+{
+	if (lang_id < 0 || low_decodes >= LANGUAGE_ID_LOW_DECODES) {
+		return true;
+	}
+	const uint64_t since_ms = now_ms > detected_ms ? now_ms - detected_ms : 0;
+	if (probability < LANGUAGE_ID_MIN_CONFIDENCE &&
+	    since_ms >= LANGUAGE_ID_LOW_CONFIDENCE_RECHECK_MSEC) {
+		return true;
+	}
+	// a new segment, the language does not change within one
+	return recheck_interval_ms > 0 && segment_start_ms != detected_segment_ms &&
+	       since_ms >= recheck_interval_ms;
+}
+
+void LanguageIdCache::update(int lang_id_, float probability_, uint64_t now_ms,
+			     uint64_t segment_start_ms)
+{
+	lang_id = lang_id_;
+	probability = probability_;
+	detected_ms = now_ms;
+	detected_segment_ms = segment_start_ms;
+	low_decodes = 0;
+	detection_count++;
+}
+
+void LanguageIdCache::report_decode(float mean_p)
+{
+	low_decodes = mean_p < LANGUAGE_ID_LOW_DECODE_P ? low_decodes + 1 : 0;
+}
+
+void LanguageIdCache::reset()
+{
+	lang_id = -1;
+	probability = 0.0f;
+	low_decodes = 0;
+}
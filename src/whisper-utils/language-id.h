@@ -0,0 +1,65 @@
+/**
+ * @file language-id.h
+ * @brief Language of the speech, detected once and cached.
+ *
+ * With the language set to auto every segment paid for language detection, whisper before
+ * the decode and the filter again after it, each an encoder pass and a decoder step. Speakers
+ * rarely switch language, so the language is detected at the start of the speech and the
+ * decodes run with it fixed. The cache keeps the detected language and its probability, and
+ * asks for a new detection:
+ * - while no language is known;
+ * - when the last detection was not confident, once a second of audio arrived;
+ * - when consecutive decodes with the cached language come out with a low confidence, as when
+ *   the speaker switches language;
+ * - at the start of a segment, once the recheck interval passed (0 for never).
+ * The detection may run on a separate small multilingual model, see load_whisper_models.
+ */
+#ifndef LANGUAGE_ID_H
+#define LANGUAGE_ID_H
+
+#include <cstdint>
+
+// below this language probability the detection is repeated
+#define LANGUAGE_ID_MIN_CONFIDENCE 0.5f
+#define LANGUAGE_ID_LOW_CONFIDENCE_RECHECK_MSEC 1000
+// decodes with a mean token probability below this many times in a row trigger a detection
+#define LANGUAGE_ID_LOW_DECODE_P 0.45f
+#define LANGUAGE_ID_LOW_DECODES 2
+
+class LanguageIdCache {
+public:
+	/** Period of the detections at the start of the segments, 0 for none */
+	void set_recheck_interval(uint64_t interval_ms) { recheck_interval_ms = interval_ms; }
+	uint64_t get_recheck_interval() const { return recheck_interval_ms; }
+
+	/**
+	 * @brief Whether the language has to be detected before decoding.
+	 *
+	 * @param now_ms Current time.
+	 * @param segment_start_ms Start of the segment of the decode, which its partials share.
+	 */
+	bool detection_due(uint64_t now_ms, uint64_t segment_start_ms) const;
+	/** Stores a detection. */
+	void update(int lang_id, float probability, uint64_t now_ms, uint64_t segment_start_ms);
+	/** Reports the mean token probability of a decode with the cached language. */
+	void report_decode(float mean_p);
+	/** Forgets the language, e.g. when the settings change. */
+	void reset();
+
+	bool has_language() const { return lang_id >= 0; }
+	/** whisper language id, -1 for none */
+	int language_id() const { return lang_id; }
+	float confidence() const { return probability; }
+	uint64_t detections() const { return detection_count; }
+
+private:
+	int lang_id = -1;
+	float probability = 0.0f;
+	uint64_t detected_ms = 0;
+	uint64_t detected_segment_ms = 0;
+	int low_decodes = 0;
+	uint64_t recheck_interval_ms = 60000;
+	uint64_t detection_count = 0;
+};
+
+#endif // LANGUAGE_ID_H
@@ -0,0 +1,105 @@
+#include "local-agreement.h"
+
+#include <algorithm>
+
+namespace {
+
+// longest run of committed tokens looked for at the start of a hypothesis
+constexpr size_t MAX_REPEATED_TOKENS = 5;
+// a hypothesis that starts later than this after the committed tokens does not repeat them
+constexpr uint64_t MAX_REPEAT_DISTANCE_SAMPLES = 16000;
+
+std::string join_text(const std::vector<StreamToken> &tokens)
+{
+	std::string text;
+	for (const StreamToken &token : tokens) {
+		text += token.text;
+	}
+	return text;
+}
+
+bool same_ids(const StreamToken *a, const StreamToken *b, size_t count)
+{
+	for (size_t i = 0; i < count; ++i) {
+		if (a[i].id != b[i].id) {
+			return false;
+		}
+	}
+	return true;
+}
+
+} // namespace
+
+void LocalAgreement::reset()
+{
+	committed_tokens.clear();
+	tentative_tokens.clear();
+}
+
+std::vector<StreamToken>
+LocalAgreement::without_committed(const std::vector<StreamToken> &hypothesis) const
+{
+	if (committed_tokens.empty() || hypothesis.empty()) {
+		return hypothesis;
+	}
+	const StreamToken &last = committed_tokens.back();
+	// tokens placed before the last committed token belong to audio that is committed
+	auto first = std::find_if(hypothesis.begin(), hypothesis.end(),
+				  [&last](const StreamToken &t) {
+					  return t.end_sample > last.start_sample;
+				  });
+	std::vector<StreamToken> rest(first, hypothesis.end());
+	if (rest.empty() ||
+	    rest.front().start_sample > last.end_sample + MAX_REPEAT_DISTANCE_SAMPLES) {
+		return rest;
+	}
+	// the decode starts at the last committed token, drop the longest repetition of the end
+	// of the committed tokens
+	const size_t max_n = std::min({MAX_REPEATED_TOKENS, committed_tokens.size(), rest.size()});
+	for (size_t n = max_n; n > 0; --n) {
+		const StreamToken *committed_end = committed_tokens.data() + committed_tokens.size();
+		if (same_ids(committed_end - n, rest.data(), n)) {
+			rest.erase(rest.begin(), rest.begin() + n);
+			break;
+		}
+	}
+	return rest;
+}
+
+size_t LocalAgreement::insert(const std::vector<StreamToken> &hypothesis)
+{
+	std::vector<StreamToken> rest = without_committed(hypothesis);
+	size_t agreed = 0;
+	while (agreed < rest.size() && agreed < tentative_tokens.size() &&
+	       rest[agreed].id == tentative_tokens[agreed].id) {
+		agreed++;
+	}
+	// the latest hypothesis has the better timestamps, it saw more of the audio
+	committed_tokens.insert(committed_tokens.end(), rest.begin(), rest.begin() + agreed);
+	tentative_tokens.assign(rest.begin() + agreed, rest.end());
+	return agreed;
+}
+
+std::vector<StreamToken> LocalAgreement::finish(const std::vector<StreamToken> &hypothesis)
+{
+	std::vector<StreamToken> tokens = committed_tokens;
+	const std::vector<StreamToken> tail = without_committed(hypothesis);
+	tokens.insert(tokens.end(), tail.begin(), tail.end());
+	reset();
+	return tokens;
+}
+
+std::string LocalAgreement::committed_text() const
+{
+	return join_text(committed_tokens);
+}
+
+std::string LocalAgreement::text() const
+{
+	return join_text(committed_tokens) + join_text(tentative_tokens);
+}
+
+uint64_t LocalAgreement::trim_position() const
+{
+	return committed_tokens.empty() ? 0 : committed_tokens.back().start_sample;
+}
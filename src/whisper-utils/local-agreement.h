@@ -0,0 +1,76 @@
+/**
+ * @file local-agreement.h
+ * @brief Commits the start of a segment once consecutive partial hypotheses agree on it.
+ *
+ * Without it every partial re-decodes the whole segment from its start: the work per partial
+ * grows with the segment and consecutive partials can disagree anywhere, so the caption
+ * flickers. Following the LocalAgreement policy of whisper_streaming, the tokens at the start
+ * of two consecutive hypotheses that are the same are committed: they no longer change in the
+ * caption, the audio before them is trimmed from the whisper buffer and their text becomes the
+ * prompt of the next decode, which only covers the unconfirmed tail.
+ *
+ * The audio is trimmed at the start of the last committed token rather than at its end, as
+ * the token timestamps of whisper are not precise. The next decode then usually starts with
+ * the last committed tokens again, and tokens that repeat the end of the committed text at the
+ * start of a hypothesis are dropped.
+ */
+#ifndef LOCAL_AGREEMENT_H
+#define LOCAL_AGREEMENT_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/** A decoded token and the samples of the audio stream it covers */
+struct StreamToken {
+	int id;
+	std::string text;
+	float p;
+	uint64_t start_sample;
+	uint64_t end_sample;
+};
+
+class LocalAgreement {
+public:
+	/** Forgets the tokens of the segment */
+	void reset();
+	bool empty() const { return committed_tokens.empty() && tentative_tokens.empty(); }
+
+	/**
+	 * @brief Compares a partial hypothesis with the previous one and commits the tokens they
+	 * agree on.
+	 *
+	 * @return Number of tokens committed by this hypothesis.
+	 */
+	size_t insert(const std::vector<StreamToken> &hypothesis);
+
+	/**
+	 * @brief Ends the segment with the hypothesis of the final decode of the tail.
+	 *
+	 * @return The committed tokens followed by the tail, the state is reset.
+	 */
+	std::vector<StreamToken> finish(const std::vector<StreamToken> &hypothesis);
+
+	const std::vector<StreamToken> &committed() const { return committed_tokens; }
+	/** Tokens of the last hypothesis after the committed ones */
+	const std::vector<StreamToken> &tentative() const { return tentative_tokens; }
+	std::string committed_text() const;
+	/** Committed and tentative text, the caption of the partial */
+	std::string text() const;
+
+	/**
+	 * First stream sample the next decode needs, the audio before it may be trimmed. 0 until
+	 * a token is committed.
+	 */
+	uint64_t trim_position() const;
+
+private:
+	/** The hypothesis without the tokens it repeats from the committed ones */
+	std::vector<StreamToken>
+	without_committed(const std::vector<StreamToken> &hypothesis) const;
+
+	std::vector<StreamToken> committed_tokens;
+	std::vector<StreamToken> tentative_tokens;
+};
+
+#endif // LOCAL_AGREEMENT_H
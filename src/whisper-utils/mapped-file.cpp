@@ -0,0 +1,126 @@
+#include "mapped-file.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+bool MappedFile::open(const std::string &path, bool prefetch)
+{
+	close();
+	const int count =
+		MultiByteToWideChar(CP_UTF8, 0, path.c_str(), (int)path.length(), NULL, 0);
+	std::wstring path_ws(count, 0);
+	MultiByteToWideChar(CP_UTF8, 0, path.c_str(), (int)path.length(), &path_ws[0], count);
+
+	HANDLE file = CreateFileW(path_ws.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+				  OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+	// the mapping keeps the file open
+	mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(file);
+	if (mapping == NULL) {
+		mapping = nullptr;
+		return false;
+	}
+	view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (view == NULL) {
+		close();
+		return false;
+	}
+	length = (size_t)file_size.QuadPart;
+
+	if (prefetch) {
+		// Windows 8 and later, looked up so that older systems still load the plugin
+		typedef BOOL(WINAPI * PrefetchVirtualMemoryFn)(HANDLE, ULONG_PTR,
+								PWIN32_MEMORY_RANGE_ENTRY, ULONG);
+		static const auto prefetch_virtual_memory = (PrefetchVirtualMemoryFn)(void *)
+			GetProcAddress(GetModuleHandleW(L"kernel32.dll"), "PrefetchVirtualMemory");
+		if (prefetch_virtual_memory != nullptr) {
+			WIN32_MEMORY_RANGE_ENTRY range;
+			range.VirtualAddress = view;
+			range.NumberOfBytes = length;
+			prefetch_virtual_memory(GetCurrentProcess(), 1, &range, 0);
+		}
+	}
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (view != nullptr) {
+		UnmapViewOfFile(view);
+		view = nullptr;
+	}
+	if (mapping != nullptr) {
+		CloseHandle(mapping);
+		mapping = nullptr;
+	}
+	length = 0;
+}
+
+#else
+
+bool MappedFile::open(const std::string &path, bool prefetch)
+{
+	close();
+	const int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+		::close(fd);
+		return false;
+	}
+	length = (size_t)st.st_size;
+#ifdef POSIX_FADV_SEQUENTIAL
+	if (prefetch) {
+		// starts reading the file into the page cache right away
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+		posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+	}
+#endif
+	void *address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+	// the mapping keeps the file open
+	::close(fd);
+	if (address == MAP_FAILED) {
+		length = 0;
+		return false;
+	}
+	view = address;
+	if (prefetch) {
+#ifdef MADV_HUGEPAGE
+		// a hint: its result does not tell whether huge pages are used
+		madvise(view, length, MADV_HUGEPAGE);
+#endif
+		madvise(view, length, MADV_SEQUENTIAL);
+		madvise(view, length, MADV_WILLNEED);
+	}
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (view != nullptr) {
+		munmap(view, length);
+		view = nullptr;
+	}
+	length = 0;
+}
+
+#endif
@@ -0,0 +1,48 @@
+/**
+ * @file mapped-file.h
+ * @brief Read-only memory mapping of a model file, read ahead by the OS.
+ *
+ * whisper reads the weights once while it creates the context and copies them to the backend
+ * buffers. On Windows the whole file was first read into a heap buffer, which doubled the peak
+ * memory of a load; elsewhere whisper read it through small buffered reads. The mapping pages
+ * the file in from the page cache, shares its pages with the other processes and needs no
+ * private copy, and the OS is told up front that the whole file is read sequentially:
+ * madvise(MADV_SEQUENTIAL | MADV_WILLNEED) and posix_fadvise on POSIX, PrefetchVirtualMemory on
+ * Windows. On Linux the mapping also asks for transparent huge pages, a hint only: the kernel
+ * uses them for read-only file mappings when it is built for it, and does not report it.
+ * The CoreML build of macOS keeps whisper's file loader, see whisper-model-registry.cpp.
+ */
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+class MappedFile {
+public:
+	MappedFile() = default;
+	~MappedFile() { close(); }
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	/**
+	 * @brief Maps the file (a UTF-8 path) read-only.
+	 *
+	 * @param prefetch Whether to ask the OS to read the whole file ahead.
+	 * @return false if the file cannot be opened or mapped, e.g. an empty file.
+	 */
+	bool open(const std::string &path, bool prefetch = true);
+	void close();
+
+	const void *data() const { return view; }
+	size_t size() const { return length; }
+
+private:
+	void *view = nullptr;
+	size_t length = 0;
+#ifdef _WIN32
+	void *mapping = nullptr;
+#endif
+};
+
+#endif // MAPPED_FILE_H
@@ -0,0 +1,408 @@
+#include "mel-cache.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE__) || \
+	(defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define MEL_CACHE_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) || defined(_M_ARM64) || defined(__ARM_NEON)
+#define MEL_CACHE_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define MEL_CACHE_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+#define MEL_CACHE_TARGET_AVX2
+#endif
+
+namespace {
+
+const int HALF_WINDOW = MelCache::FFT_SIZE / 2;
+// floor of whisper's power sums, its log10 is the value of the silence frames
+const double LOG_FLOOR = 1e-10;
+// whisper keeps 8 (80 dB) under the loudest value and maps to about [-1, 1]
+const float DYNAMIC_RANGE = 8.0f;
+
+typedef void (*power_fn)(const float *table, const float *x, float *power);
+
+/* Mel filters of librosa (htk=False, norm="slaney"), as stored in the ggml models */
+
+double hz_to_mel(double hz)
+{
+	const double f_sp = 200.0 / 3.0;
+	const double min_log_hz = 1000.0;
+	const double logstep = std::log(6.4) / 27.0;
+	if (hz < min_log_hz) {
+		return hz / f_sp;
+	}
+	return min_log_hz / f_sp + std::log(hz / min_log_hz) / logstep;
+}
+
+double mel_to_hz(double mel)
+{
+	const double f_sp = 200.0 / 3.0;
+	const double min_log_hz = 1000.0;
+	const double min_log_mel = min_log_hz / f_sp;
+	const double logstep = std::log(6.4) / 27.0;
+	if (mel < min_log_mel) {
+		return mel * f_sp;
+	}
+	return min_log_hz * std::exp(logstep * (mel - min_log_mel));
+}
+
+/* Scalar kernel */
+
+void power_scalar(const float *table, const float *x, float *power)
+{
+	for (int b = 0; b < MelCache::N_BINS; b++) {
+		const float *c = table + (size_t)b * 2 * MelCache::FFT_SIZE;
+		const float *s = c + MelCache::FFT_SIZE;
+		float re = 0.0f;
+		float im = 0.0f;
+		for (int i = 0; i < MelCache::FFT_SIZE; i++) {
+			re += c[i] * x[i];
+			im += s[i] * x[i];
+		}
+		power[b] = re * re + im * im;
+	}
+}
+
+#ifdef MEL_CACHE_X86
+
+/* SSE kernel */
+
+float hsum_sse(__m128 v)
+{
+	__m128 shuf = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+	__m128 sums = _mm_add_ps(v, shuf);
+	shuf = _mm_movehl_ps(shuf, sums);
+	sums = _mm_add_ss(sums, shuf);
+	return _mm_cvtss_f32(sums);
+}
+
+void power_sse(const float *table, const float *x, float *power)
+{
+	for (int b = 0; b < MelCache::N_BINS; b++) {
+		const float *c = table + (size_t)b * 2 * MelCache::FFT_SIZE;
+		const float *s = c + MelCache::FFT_SIZE;
+		__m128 re = _mm_setzero_ps();
+		__m128 im = _mm_setzero_ps();
+		// FFT_SIZE is a multiple of 8
+		for (int i = 0; i < MelCache::FFT_SIZE; i += 4) {
+			const __m128 v = _mm_loadu_ps(x + i);
+			re = _mm_add_ps(re, _mm_mul_ps(_mm_loadu_ps(c + i), v));
+			im = _mm_add_ps(im, _mm_mul_ps(_mm_loadu_ps(s + i), v));
+		}
+		const float r = hsum_sse(re);
+		const float m = hsum_sse(im);
+		power[b] = r * r + m * m;
+	}
+}
+
+/* AVX2 kernel */
+
+MEL_CACHE_TARGET_AVX2 float hsum_avx2(__m256 v)
+{
+	const __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	__m128 shuf = _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(2, 3, 0, 1));
+	__m128 sums = _mm_add_ps(sum, shuf);
+	shuf = _mm_movehl_ps(shuf, sums);
+	sums = _mm_add_ss(sums, shuf);
+	return _mm_cvtss_f32(sums);
+}
+
+MEL_CACHE_TARGET_AVX2 void power_avx2(const float *table, const float *x, float *power)
+{
+	for (int b = 0; b < MelCache::N_BINS; b++) {
+		const float *c = table + (size_t)b * 2 * MelCache::FFT_SIZE;
+		const float *s = c + MelCache::FFT_SIZE;
+		__m256 re = _mm256_setzero_ps();
+		__m256 im = _mm256_setzero_ps();
+		for (int i = 0; i < MelCache::FFT_SIZE; i += 8) {
+			const __m256 v = _mm256_loadu_ps(x + i);
+			re = _mm256_fmadd_ps(_mm256_loadu_ps(c + i), v, re);
+			im = _mm256_fmadd_ps(_mm256_loadu_ps(s + i), v, im);
+		}
+		const float r = hsum_avx2(re);
+		const float m = hsum_avx2(im);
+		power[b] = r * r + m * m;
+	}
+}
+
+#endif // MEL_CACHE_X86
+
+#ifdef MEL_CACHE_NEON
+
+/* NEON kernel */
+
+float hsum_neon(float32x4_t v)
+{
+	const float32x2_t sum = vadd_f32(vget_low_f32(v), vget_high_f32(v));
+	return vget_lane_f32(vpadd_f32(sum, sum), 0);
+}
+
+void power_neon(const float *table, const float *x, float *power)
+{
+	for (int b = 0; b < MelCache::N_BINS; b++) {
+		const float *c = table + (size_t)b * 2 * MelCache::FFT_SIZE;
+		const float *s = c + MelCache::FFT_SIZE;
+		float32x4_t re = vdupq_n_f32(0.0f);
+		float32x4_t im = vdupq_n_f32(0.0f);
+		for (int i = 0; i < MelCache::FFT_SIZE; i += 4) {
+			const float32x4_t v = vld1q_f32(x + i);
+			re = vmlaq_f32(re, vld1q_f32(c + i), v);
+			im = vmlaq_f32(im, vld1q_f32(s + i), v);
+		}
+		const float r = hsum_neon(re);
+		const float m = hsum_neon(im);
+		power[b] = r * r + m * m;
+	}
+}
+
+#endif // MEL_CACHE_NEON
+
+power_fn kernel_function(AudioDecimatorKernel kernel)
+{
+	switch (kernel) {
+#ifdef MEL_CACHE_X86
+	case AUDIO_DECIMATOR_KERNEL_SSE:
+		return power_sse;
+	case AUDIO_DECIMATOR_KERNEL_AVX2:
+		return power_avx2;
+#endif
+#ifdef MEL_CACHE_NEON
+	case AUDIO_DECIMATOR_KERNEL_NEON:
+		return power_neon;
+#endif
+	default:
+		return power_scalar;
+	}
+}
+
+// first frame centred at or after the sample
+uint64_t frame_at_or_after(uint64_t position)
+{
+	return MelCache::first_frame_center(position) / MelCache::HOP;
+}
+
+} // namespace
+
+AudioDecimatorKernel MelCache::default_kernel()
+{
+	// the CPU checks are the ones of the decimator kernels
+	static const AudioDecimatorKernel kernel = [] {
+#ifdef MEL_CACHE_X86
+		return AudioDecimator::kernel_available(AUDIO_DECIMATOR_KERNEL_AVX2)
+			       ? AUDIO_DECIMATOR_KERNEL_AVX2
+			       : AUDIO_DECIMATOR_KERNEL_SSE;
+#elif defined(MEL_CACHE_NEON)
+		return AUDIO_DECIMATOR_KERNEL_NEON;
+#else
+		return AUDIO_DECIMATOR_KERNEL_SCALAR;
+#endif
+	}();
+	return kernel;
+}
+
+void MelCache::init(int n_mel_bands)
+{
+	n_mel = n_mel_bands;
+	const double two_pi = 2.0 * 3.14159265358979323846;
+
+	// periodic Hann window
+	hann.resize(FFT_SIZE);
+	for (int i = 0; i < FFT_SIZE; i++) {
+		hann[i] = (float)(0.5 * (1.0 - std::cos(two_pi * i / FFT_SIZE)));
+	}
+
+	dft_table.resize((size_t)N_BINS * 2 * FFT_SIZE);
+	for (int b = 0; b < N_BINS; b++) {
+		float *c = dft_table.data() + (size_t)b * 2 * FFT_SIZE;
+		float *s = c + FFT_SIZE;
+		for (int i = 0; i < FFT_SIZE; i++) {
+			// reduced first, so that the angle stays exact
+			const double angle = two_pi * ((b * i) % FFT_SIZE) / FFT_SIZE;
+			c[i] = (float)std::cos(angle);
+			s[i] = (float)std::sin(angle);
+		}
+	}
+
+	// bands equally spaced on the mel scale up to the Nyquist frequency of 16 kHz audio
+	std::vector<double> band_hz(n_mel + 2);
+	const double max_mel = hz_to_mel(8000.0);
+	for (int i = 0; i < n_mel + 2; i++) {
+		band_hz[i] = mel_to_hz(i * (max_mel / (n_mel + 1)));
+	}
+	filters.assign((size_t)n_mel * N_BINS, 0.0f);
+	filter_first.assign(n_mel, N_BINS);
+	filter_last.assign(n_mel, -1);
+	for (int m = 0; m < n_mel; m++) {
+		const double norm = 2.0 / (band_hz[m + 2] - band_hz[m]);
+		for (int b = 0; b < N_BINS; b++) {
+			const double hz = 8000.0 * b / (N_BINS - 1);
+			const double lower = (hz - band_hz[m]) / (band_hz[m + 1] - band_hz[m]);
+			const double upper = (band_hz[m + 2] - hz) / (band_hz[m + 2] - band_hz[m + 1]);
+			// rounded twice like librosa, which builds the weights in float32
+			const float ramp = (float)std::max(0.0, std::min(lower, upper));
+			const float weight = (float)(ramp * norm);
+			filters[(size_t)m * N_BINS + b] = weight;
+			if (weight > 0.0f) {
+				filter_first[m] = std::min(filter_first[m], b);
+				filter_last[m] = b;
+			}
+		}
+	}
+	reset(0);
+}
+
+void MelCache::reset(uint64_t position)
+{
+	frames.clear();
+	frames_offset = 0;
+	first_frame = frame_at_or_after(position);
+	end = position;
+	// the stream starts with silence
+	history.assign(FFT_SIZE, 0.0f);
+}
+
+void MelCache::compute_frame(const float *window, float *log_mel,
+			     AudioDecimatorKernel kernel) const
+{
+	float windowed[FFT_SIZE];
+	float power[N_BINS];
+	for (int i = 0; i < FFT_SIZE; i++) {
+		windowed[i] = window[i] * hann[i];
+	}
+	kernel_function(kernel)(dft_table.data(), windowed, power);
+	// summed in double, as whisper does
+	for (int m = 0; m < n_mel; m++) {
+		const float *filter = filters.data() + (size_t)m * N_BINS;
+		double sum = 0.0;
+		for (int b = filter_first[m]; b <= filter_last[m]; b++) {
+			sum += filter[b] * power[b];
+		}
+		log_mel[m] = (float)std::log10(std::max(sum, LOG_FLOOR));
+	}
+}
+
+void MelCache::append(const float *samples, size_t num_samples)
+{
+	if (n_mel == 0 || num_samples == 0) {
+		return;
+	}
+	static const AudioDecimatorKernel kernel = default_kernel();
+
+	// history is the FFT_SIZE samples before end, followed by the new samples
+	const size_t history_size = history.size();
+	history.insert(history.end(), samples, samples + num_samples);
+	const int64_t base = (int64_t)end - (int64_t)history_size;
+	end += num_samples;
+
+	uint64_t next = first_frame + (frames.size() - frames_offset) / n_mel;
+	while (next * HOP + HALF_WINDOW <= end) {
+		const int64_t start = (int64_t)(next * HOP) - HALF_WINDOW - base;
+		frames.resize(frames.size() + n_mel);
+		compute_frame(history.data() + start, frames.data() + frames.size() - n_mel, kernel);
+		computed_count++;
+		next++;
+	}
+	history.erase(history.begin(), history.end() - FFT_SIZE);
+}
+
+void MelCache::discard_before(uint64_t position)
+{
+	if (n_mel == 0) {
+		return;
+	}
+	const uint64_t keep = frame_at_or_after(position);
+	if (keep <= first_frame) {
+		return;
+	}
+	const uint64_t drop = std::min<uint64_t>((frames.size() - frames_offset) / n_mel,
+						 keep - first_frame);
+	frames_offset += drop * n_mel;
+	first_frame += drop;
+	// move the frames back when most of the vector is dropped frames
+	if (frames_offset > frames.size() / 2) {
+		frames.erase(frames.begin(), frames.begin() + frames_offset);
+		frames_offset = 0;
+	}
+}
+
+int MelCache::build(const float *samples, uint64_t from, size_t num_samples,
+		    std::vector<float> &mel)
+{
+	if (n_mel == 0) {
+		mel.clear();
+		return 0;
+	}
+	static const AudioDecimatorKernel kernel = default_kernel();
+	const uint64_t to = from + num_samples;
+	const uint64_t first = frame_at_or_after(from);
+	const int n_frames = (int)(frame_at_or_after(to) - first);
+	const int n_len = n_frames + PADDING_FRAMES;
+	const uint64_t cached_end = first_frame + (frames.size() - frames_offset) / n_mel;
+
+	build_frames.resize((size_t)n_frames * n_mel);
+	float window[FFT_SIZE];
+	float max_value = (float)std::log10(LOG_FLOOR);
+	for (int i = 0; i < n_frames; i++) {
+		const uint64_t k = first + i;
+		float *frame = build_frames.data() + (size_t)i * n_mel;
+		// a cached frame whose window reaches past the audio saw samples whisper would not
+		if (k >= first_frame && k < cached_end && k * HOP + HALF_WINDOW <= to) {
+			const float *cached =
+				frames.data() + frames_offset + (size_t)(k - first_frame) * n_mel;
+			std::copy(cached, cached + n_mel, frame);
+			reused_count++;
+		} else {
+			const int64_t start = (int64_t)(k * HOP) - HALF_WINDOW - (int64_t)from;
+			for (int j = 0; j < FFT_SIZE; j++) {
+				const int64_t index = start + j;
+				window[j] = index >= 0 && index < (int64_t)num_samples ? samples[index]
+										      : 0.0f;
+			}
+			compute_frame(window, frame, kernel);
+			computed_count++;
+		}
+		max_value = std::max(max_value, *std::max_element(frame, frame + n_mel));
+	}
+
+	// normalized as in whisper's log_mel_spectrogram
+	const float min_value = max_value - DYNAMIC_RANGE;
+	const float silence = (std::max((float)std::log10(LOG_FLOOR), min_value) + 4.0f) / 4.0f;
+	mel.assign((size_t)n_mel * n_len, silence);
+	for (int i = 0; i < n_frames; i++) {
+		const float *frame = build_frames.data() + (size_t)i * n_mel;
+		for (int m = 0; m < n_mel; m++) {
+			mel[(size_t)m * n_len + i] = (std::max(frame[m], min_value) + 4.0f) / 4.0f;
+		}
+	}
+	return n_frames;
+}
+
+void MelCache::compute_frames(const float *samples, size_t num_samples, size_t num_frames,
+			      std::vector<float> &log_mel, AudioDecimatorKernel kernel) const
+{
+	if (kernel == AUDIO_DECIMATOR_KERNEL_AUTO) {
+		kernel = default_kernel();
+	}
+	if (!AudioDecimator::kernel_available(kernel)) {
+		kernel = AUDIO_DECIMATOR_KERNEL_SCALAR;
+	}
+	log_mel.assign(num_frames * n_mel, 0.0f);
+	float window[FFT_SIZE];
+	for (size_t i = 0; i < num_frames; i++) {
+		const int64_t start = (int64_t)(i * HOP) - HALF_WINDOW;
+		for (int j = 0; j < FFT_SIZE; j++) {
+			const int64_t index = start + j;
+			window[j] = index >= 0 && index < (int64_t)num_samples ? samples[index] : 0.0f;
+		}
+		compute_frame(window, log_mel.data() + i * n_mel, kernel);
+	}
+}
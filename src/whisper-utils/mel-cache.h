@@ -0,0 +1,102 @@
+/**
+ * @file mel-cache.h
+ * @brief Rolling log-mel spectrogram of the whisper buffer, every frame computed once.
+ *
+ * Frames are computed as audio is added to the buffer and kept until the buffer drops it, so a
+ * partial passes its mel with whisper_set_mel instead of recomputing the whole buffer. The
+ * frames follow whisper's log_mel_spectrogram on a 10 ms grid of the stream; build()
+ * normalizes them per inference and appends the 30 s of silence the encoder reads.
+ */
+#ifndef MEL_CACHE_H
+#define MEL_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "audio-decimator.h"
+
+class MelCache {
+public:
+	static constexpr int FFT_SIZE = 400;
+	static constexpr int HOP = 160;
+	static constexpr int N_BINS = FFT_SIZE / 2 + 1;
+	/** Silence frames after the audio in the mel of build(), the 30 s window of the encoder */
+	static constexpr int PADDING_FRAMES = 3000;
+
+	/** Centre of the first frame of the mel of build() from the sample, where its times start. */
+	static uint64_t first_frame_center(uint64_t from) { return (from + HOP - 1) / HOP * HOP; }
+	/** The kernel of the power spectrum. */
+	static AudioDecimatorKernel default_kernel();
+
+	/** Sets the number of mel bands (80, or 128 for large-v3) and forgets the frames. */
+	void init(int n_mel);
+	bool is_initialized() const { return n_mel > 0; }
+	int get_n_mel() const { return n_mel; }
+
+	/** Forgets the frames, the stream continues at the given sample. */
+	void reset(uint64_t position = 0);
+	/** Sample after the last one appended. */
+	uint64_t end_position() const { return end; }
+
+	/** Appends the samples that follow end_position() and computes the frames they complete. */
+	void append(const float *samples, size_t num_samples);
+	/** Drops the frames of the audio before the given sample. */
+	void discard_before(uint64_t position);
+
+	/**
+	 * @brief Builds the input of whisper_set_mel for the samples [from, from + num_samples).
+	 *
+	 * @param samples The samples, for the frames that are not cached (the last ones).
+	 * @param mel Receives n_mel rows of n_len values: the frames centred in the audio, then
+	 * PADDING_FRAMES of silence.
+	 * @return Number of frames of the audio, n_len without the silence.
+	 */
+	int build(const float *samples, uint64_t from, size_t num_samples, std::vector<float> &mel);
+
+	/**
+	 * @brief Log-mel frames of a separate signal, without the cache.
+	 *
+	 * Frame i is centred on samples[i * HOP], with zeros around the signal.
+	 *
+	 * @param log_mel Receives num_frames rows of n_mel log10 values.
+	 */
+	void compute_frames(const float *samples, size_t num_samples, size_t num_frames,
+			    std::vector<float> &log_mel,
+			    AudioDecimatorKernel kernel = AUDIO_DECIMATOR_KERNEL_AUTO) const;
+
+	/** Mel filters of the bands, n_mel rows of N_BINS weights. */
+	const std::vector<float> &get_filters() const { return filters; }
+
+	/** Frames computed, frames taken from the cache by build(). */
+	uint64_t frames_computed() const { return computed_count; }
+	uint64_t frames_reused() const { return reused_count; }
+
+private:
+	/** Log-mel values of the FFT_SIZE samples of a window. */
+	void compute_frame(const float *window, float *log_mel, AudioDecimatorKernel kernel) const;
+
+	int n_mel = 0;
+	// the Hann window and, for each bin, its cosine and sine rows
+	std::vector<float> hann;
+	std::vector<float> dft_table;
+	std::vector<float> filters;
+	// non-zero bins of each filter
+	std::vector<int> filter_first;
+	std::vector<int> filter_last;
+
+	// frames [first_frame, first_frame + frame count), n_mel log values each, from offset
+	std::vector<float> frames;
+	size_t frames_offset = 0;
+	uint64_t first_frame = 0;
+	uint64_t end = 0;
+	// the window of the next frame reaches back into these samples before end
+	std::vector<float> history;
+	// log values of the frames of build(), kept to not allocate per inference
+	std::vector<float> build_frames;
+
+	uint64_t computed_count = 0;
+	uint64_t reused_count = 0;
+};
+
+#endif // MEL_CACHE_H
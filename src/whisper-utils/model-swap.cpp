@@ -0,0 +1,145 @@
+#include "model-swap.h"
+
+#include <whisper.h>
+
+#include "transcription-utils.h"
+
+WhisperModelSet::~WhisperModelSet()
+{
+	for (struct whisper_state *s : {state, partial_state, language_id_state}) {
+		if (s != nullptr) {
+			whisper_free_state(s);
+		}
+	}
+}
+
+void ModelSwap::request(const ModelLoadRequest &request, Loader loader,
+			std::function<void()> on_loaded)
+{
+	std::unique_ptr<WhisperModelSet> replaced;
+	std::lock_guard<std::mutex> lock(mutex);
+	pending_request = request;
+	pending_request_ms = now_ms();
+	pending_loader = std::move(loader);
+	pending_on_loaded = std::move(on_loaded);
+	if (loaded) {
+		// not swapped in yet, the new request replaces it
+		replaced = std::move(loaded);
+		counters.dropped_loads++;
+	}
+	if (loader_running) {
+		// the loader thread picks the request up after its load
+		return;
+	}
+	if (loader_thread.joinable()) {
+		// finished its last request
+		loader_thread.join();
+	}
+	loader_running = true;
+	loader_thread = std::thread(&ModelSwap::loader_loop, this);
+}
+
+void ModelSwap::loader_loop()
+{
+	while (true) {
+		ModelLoadRequest request;
+		Loader loader;
+		std::function<void()> on_loaded;
+		uint64_t requested_ms = 0;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!pending_request) {
+				loader_running = false;
+				loading_model_file.clear();
+				return;
+			}
+			request = std::move(*pending_request);
+			pending_request.reset();
+			loader = std::move(pending_loader);
+			on_loaded = std::move(pending_on_loaded);
+			requested_ms = pending_request_ms;
+			loading_model_file = request.model_file;
+		}
+
+		auto models = std::make_unique<WhisperModelSet>();
+		const bool ok = loader(request, *models);
+		models->requested_ms = requested_ms;
+		models->loaded_ms = now_ms();
+
+		std::lock_guard<std::mutex> lock(mutex);
+		counters.loads++;
+		if (!ok) {
+			// the old models keep running
+			counters.failed_loads++;
+			continue;
+		}
+		if (pending_request) {
+			// a newer request came in while loading, the models are freed here
+			counters.dropped_loads++;
+			continue;
+		}
+		loaded = std::move(models);
+		if (on_loaded) {
+			on_loaded();
+		}
+	}
+}
+
+std::unique_ptr<WhisperModelSet> ModelSwap::take(bool segment_boundary, uint64_t now)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!loaded) {
+		return nullptr;
+	}
+	const bool overdue = now >= loaded->loaded_ms + MODEL_SWAP_MAX_DEFER_MSEC;
+	if (!segment_boundary && !overdue) {
+		return nullptr;
+	}
+	counters.swaps++;
+	if (!segment_boundary) {
+		counters.forced_swaps++;
+	}
+	return std::move(loaded);
+}
+
+bool ModelSwap::ready() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return loaded != nullptr;
+}
+
+std::string ModelSwap::requested_model_file() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (pending_request) {
+		return pending_request->model_file;
+	}
+	if (loaded) {
+		return loaded->model_file;
+	}
+	return loading_model_file;
+}
+
+void ModelSwap::stop()
+{
+	std::unique_ptr<WhisperModelSet> dropped;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		pending_request.reset();
+		dropped = std::move(loaded);
+	}
+	// a load cannot be interrupted, its models are dropped when it ends
+	if (loader_thread.joinable()) {
+		loader_thread.join();
+	}
+	std::lock_guard<std::mutex> lock(mutex);
+	if (loaded) {
+		dropped = std::move(loaded);
+	}
+}
+
+ModelSwap::stats ModelSwap::get_stats() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return counters;
+}
@@ -0,0 +1,140 @@
+/**
+ * @file model-swap.h
+ * @brief Loading of new whisper models while the old ones keep transcribing.
+ *
+ * Changing the model, the backend device or a setting the context is created with stopped the
+ * whisper thread and loaded the new model under whisper_ctx_mutex: no captions for the 5-20 s
+ * a large model takes to load. The models are now loaded on a loader thread while the whisper
+ * thread keeps decoding with the old ones. Once they are loaded the whisper thread swaps them
+ * in between two inferences, at the end of a speech segment, or after MODEL_SWAP_MAX_DEFER_MSEC
+ * of continuous speech. The buffered audio, the context sentences and the caption state are
+ * untouched, and the old models are freed after the swap, outside the lock.
+ *
+ * A request made while a load runs replaces the request; the models of the running load are
+ * dropped once loaded and the newest request is loaded next.
+ */
+#ifndef MODEL_SWAP_H
+#define MODEL_SWAP_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+
+#include <whisper.h>
+
+// longest wait for the end of a segment before the loaded models are swapped in anyway
+#define MODEL_SWAP_MAX_DEFER_MSEC 3000
+
+class WhisperModel;
+struct whisper_state;
+
+/**
+ * @brief Model files of a filter: the main model and the optional partial and language ID
+ * models, with the settings they are loaded with. The settings are taken from the filter when
+ * the load is requested, the loader thread does not read the filter.
+ */
+struct ModelLoadRequest {
+	std::string model_file;
+	std::string partial_model_file;
+	std::string language_id_model_file;
+	whisper_context_params context_params = whisper_context_default_params();
+	// of the whisper library messages
+	int log_level = 0;
+	// how long the registry keeps the models once no filter uses them
+	int keep_alive_sec = 120;
+	// threads and encoder context of the warm-up inference, no warm-up for 0 threads
+	int warm_up_threads = 0;
+	int warm_up_audio_ctx = 0;
+};
+
+/** Whisper models of a filter with their decoding states, frees the states it holds */
+struct WhisperModelSet {
+	std::string model_file;
+	std::shared_ptr<WhisperModel> model;
+	struct whisper_state *state = nullptr;
+	std::shared_ptr<WhisperModel> partial_model;
+	struct whisper_state *partial_state = nullptr;
+	std::shared_ptr<WhisperModel> language_id_model;
+	struct whisper_state *language_id_state = nullptr;
+	// whether the main model ran the warm-up inference
+	bool warmed_up = false;
+	// when the load was requested and when it finished
+	uint64_t requested_ms = 0;
+	uint64_t loaded_ms = 0;
+
+	WhisperModelSet() = default;
+	WhisperModelSet(const WhisperModelSet &) = delete;
+	WhisperModelSet &operator=(const WhisperModelSet &) = delete;
+	~WhisperModelSet();
+};
+
+class ModelSwap {
+public:
+	// loads the models of a request, on the loader thread
+	using Loader = std::function<bool(const ModelLoadRequest &, WhisperModelSet &)>;
+
+	struct stats {
+		uint64_t loads = 0;
+		uint64_t failed_loads = 0;
+		// loads replaced by a newer request before their models were swapped in
+		uint64_t dropped_loads = 0;
+		uint64_t swaps = 0;
+		// swaps made in the middle of a segment after MODEL_SWAP_MAX_DEFER_MSEC
+		uint64_t forced_swaps = 0;
+	};
+
+	ModelSwap() = default;
+	~ModelSwap() { stop(); }
+	ModelSwap(const ModelSwap &) = delete;
+	ModelSwap &operator=(const ModelSwap &) = delete;
+
+	/**
+	 * @brief Loads the models on the loader thread, replacing the pending request and the
+	 * loaded models that were not swapped in yet.
+	 *
+	 * @param on_loaded Called from the loader thread once the models are ready, to wake the
+	 * whisper thread.
+	 */
+	void request(const ModelLoadRequest &request, Loader loader,
+		     std::function<void()> on_loaded = nullptr);
+
+	/**
+	 * @brief From the whisper thread between two inferences: the loaded models, if it is
+	 * time to swap them in.
+	 *
+	 * @param segment_boundary Whether no speech segment is in progress.
+	 */
+	std::unique_ptr<WhisperModelSet> take(bool segment_boundary, uint64_t now_ms);
+
+	/** Whether loaded models wait to be swapped in */
+	bool ready() const;
+	/** Model file of the request being loaded or waiting to be swapped in, empty for none */
+	std::string requested_model_file() const;
+
+	/** Waits for the running load and drops the request and the loaded models. */
+	void stop();
+
+	stats get_stats() const;
+
+private:
+	void loader_loop();
+
+	mutable std::mutex mutex;
+	std::thread loader_thread;
+	bool loader_running = false;
+	std::optional<ModelLoadRequest> pending_request;
+	uint64_t pending_request_ms = 0;
+	Loader pending_loader;
+	std::function<void()> pending_on_loaded;
+	// the request the loader thread is working on, for requested_model_file()
+	std::string loading_model_file;
+	std::unique_ptr<WhisperModelSet> loaded;
+	stats counters;
+};
+
+#endif // MODEL_SWAP_H
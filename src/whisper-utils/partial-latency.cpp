@@ -0,0 +1,25 @@
+#include "partial-latency.h"
+
+#include <algorithm>
+
+void PartialLatencyController::report_partial(uint64_t busy_ms)
+{
+	average_ms = average_ms == 0.0 ? (double)busy_ms
+				       : average_ms + PARTIAL_LATENCY_SMOOTHING *
+							      ((double)busy_ms - average_ms);
+}
+
+int PartialLatencyController::interval(int partial_latency_ms, uint64_t backlog_ms) const
+{
+	if (average_ms == 0.0) {
+		return partial_latency_ms;
+	}
+	const int lowest = std::max(PARTIAL_LATENCY_MIN_MSEC, partial_latency_ms / 2);
+	const int highest = std::max(lowest, partial_latency_ms * PARTIAL_LATENCY_MAX_FACTOR);
+	int interval_ms = (int)(average_ms * PARTIAL_LATENCY_RUN_FACTOR);
+	if (backlog_ms > (uint64_t)std::max(interval_ms, lowest)) {
+		// the finals catch up first
+		interval_ms += (int)std::min<uint64_t>(backlog_ms, (uint64_t)highest);
+	}
+	return std::clamp(interval_ms, lowest, highest);
+}
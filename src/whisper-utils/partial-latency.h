@@ -0,0 +1,52 @@
+/**
+ * @file partial-latency.h
+ * @brief Interval between two partials, from the time the partials take.
+ *
+ * With a fixed latency the segmenters sent a partial whenever that much audio built up: a slow
+ * model or a busy CPU ran partials back to back and the finals waited behind them, a fast one
+ * left the captions a second behind with the CPU idle. The controller keeps a moving average of
+ * the time the whisper thread spends on a partial (the wait for the inference scheduler
+ * included) and spaces the partials PARTIAL_LATENCY_RUN_FACTOR times that apart, so that the
+ * partials take at most a third of the thread. The interval stays between half and
+ * PARTIAL_LATENCY_MAX_FACTOR times the partial latency of the settings: a fast model pulls it
+ * in, a slow one pushes it out. An input backlog over the interval is added to it, the finals
+ * catch up before the next partial.
+ *
+ * The segmenters also skip a partial when the VAD found no voiced audio since the previous
+ * one, its text could only be the same.
+ */
+#ifndef PARTIAL_LATENCY_H
+#define PARTIAL_LATENCY_H
+
+#include <cstdint>
+
+// partials are this many times their run time apart
+#define PARTIAL_LATENCY_RUN_FACTOR 3
+// shortest interval, whatever the partial latency
+#define PARTIAL_LATENCY_MIN_MSEC 250
+#define PARTIAL_LATENCY_MAX_FACTOR 4
+// weight of the last partial in the moving average of the run time
+#define PARTIAL_LATENCY_SMOOTHING 0.3
+
+class PartialLatencyController {
+public:
+	/** Time the whisper thread spent on a partial, waiting for the scheduler included. */
+	void report_partial(uint64_t busy_ms);
+	/**
+	 * @brief Interval between two partials.
+	 *
+	 * @param partial_latency_ms Partial latency of the settings, used until a partial ran.
+	 * @param backlog_ms Unprocessed input audio.
+	 */
+	int interval(int partial_latency_ms, uint64_t backlog_ms) const;
+	/** Forgets the run time, e.g. on a new model. */
+	void reset() { average_ms = 0.0; }
+
+	/** Moving average of the partial run time, 0 before the first partial */
+	double average_run_ms() const { return average_ms; }
+
+private:
+	double average_ms = 0.0;
+};
+
+#endif // PARTIAL_LATENCY_H
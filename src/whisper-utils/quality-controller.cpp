@@ -0,0 +1,157 @@
+#include "quality-controller.h"
+
+#include <algorithm>
+
+const char *QualityController::stage_name(QualityStage stage)
+{
+	switch (stage) {
+	case QUALITY_STAGE_FULL:
+		return "full quality";
+	case QUALITY_STAGE_GREEDY:
+		return "greedy decoding";
+	case QUALITY_STAGE_NO_FALLBACK:
+		return "no temperature fallback";
+	case QUALITY_STAGE_FEWER_TOKENS:
+		return "fewer tokens";
+	case QUALITY_STAGE_LONGER_PARTIALS:
+		return "longer partial interval";
+	case QUALITY_STAGE_SMALLER_MODEL:
+		return "smaller model";
+	default:
+		return "unknown";
+	}
+}
+
+const char *QualityController::cause_name(QualityCause cause)
+{
+	switch (cause) {
+	case QUALITY_CAUSE_RTF:
+		return "real-time factor too high";
+	case QUALITY_CAUSE_BACKLOG:
+		return "backlog growing";
+	case QUALITY_CAUSE_HEADROOM:
+		return "headroom";
+	case QUALITY_CAUSE_OVERLOAD_POLICY:
+		return "overload policy";
+	default:
+		return "unknown";
+	}
+}
+
+void QualityController::set_available(QualityStage stage, bool available_)
+{
+	if (stage > QUALITY_STAGE_FULL && stage < QUALITY_STAGE_COUNT) {
+		available[stage] = available_;
+	}
+}
+
+QualityStage QualityController::next_available(int from, int step) const
+{
+	for (int stage = from + step; stage >= 0 && stage < QUALITY_STAGE_COUNT; stage += step) {
+		if (stage == QUALITY_STAGE_FULL || available[stage]) {
+			return (QualityStage)stage;
+		}
+	}
+	return current;
+}
+
+bool QualityController::update(uint64_t now_ms, uint64_t backlog_ms, Transition &transition)
+{
+	if (!window_started || now_ms < window_start_ms) {
+		reset_window(now_ms, backlog_ms);
+		return false;
+	}
+	const uint64_t elapsed_ms = now_ms - window_start_ms;
+	if (elapsed_ms < QUALITY_WINDOW_MSEC) {
+		return false;
+	}
+	rtf = (double)window_busy_ms / (double)elapsed_ms;
+	// a high backlog that shrinks is being caught up with
+	const bool backlog_growing = backlog_ms > QUALITY_BACKLOG_HIGH_MSEC &&
+				     backlog_ms >= last_backlog_ms;
+	reset_window(now_ms, backlog_ms);
+
+	QualityStage next = current;
+	QualityCause cause = QUALITY_CAUSE_HEADROOM;
+	if (rtf > QUALITY_RTF_HIGH || backlog_growing) {
+		headroom_windows = 0;
+		cause = rtf > QUALITY_RTF_HIGH ? QUALITY_CAUSE_RTF : QUALITY_CAUSE_BACKLOG;
+		next = next_available(current, 1);
+	} else if (rtf < QUALITY_RTF_LOW && backlog_ms < QUALITY_BACKLOG_LOW_MSEC) {
+		if (++headroom_windows >= QUALITY_STEP_UP_WINDOWS) {
+			headroom_windows = 0;
+			next = next_available(current, -1);
+		}
+	} else {
+		headroom_windows = 0;
+	}
+	if (next == current) {
+		return false;
+	}
+	const QualityStage from = stage();
+	current = next;
+	if (stage() == from) {
+		// under the floor
+		return false;
+	}
+	transition = {from, stage(), cause, rtf, backlog_ms};
+	transition_count++;
+	return true;
+}
+
+bool QualityController::set_floor(QualityStage floor, QualityCause cause, uint64_t backlog_ms,
+				  Transition &transition)
+{
+	if (floor == floor_stage) {
+		return false;
+	}
+	const QualityStage from = stage();
+	floor_stage = floor;
+	if (stage() == from) {
+		return false;
+	}
+	transition = {from, stage(), cause, rtf, backlog_ms};
+	transition_count++;
+	return true;
+}
+
+void QualityController::reset(uint64_t now_ms)
+{
+	current = QUALITY_STAGE_FULL;
+	headroom_windows = 0;
+	rtf = 0.0;
+	reset_window(now_ms, 0);
+}
+
+void QualityController::reset_window(uint64_t now_ms, uint64_t backlog_ms)
+{
+	window_started = true;
+	window_start_ms = now_ms;
+	window_busy_ms = 0;
+	last_backlog_ms = backlog_ms;
+}
+
+void QualityController::apply(whisper_full_params &params, bool partial) const
+{
+	const QualityStage in_effect = stage();
+	if (in_effect >= QUALITY_STAGE_GREEDY) {
+		params.strategy = WHISPER_SAMPLING_GREEDY;
+		params.greedy.best_of = 1;
+	}
+	if (in_effect >= QUALITY_STAGE_NO_FALLBACK) {
+		params.temperature_inc = 0.0f;
+	}
+	if (in_effect >= QUALITY_STAGE_FEWER_TOKENS) {
+		const int max_tokens = partial ? QUALITY_PARTIAL_MAX_TOKENS
+					       : QUALITY_FINAL_MAX_TOKENS;
+		params.max_tokens = params.max_tokens > 0 ? std::min(params.max_tokens, max_tokens)
+							  : max_tokens;
+	}
+}
+
+int QualityController::partial_interval(int partial_latency_ms) const
+{
+	return stage() >= QUALITY_STAGE_LONGER_PARTIALS
+		       ? partial_latency_ms * QUALITY_PARTIAL_INTERVAL_FACTOR
+		       : partial_latency_ms;
+}
@@ -0,0 +1,131 @@
+/**
+ * @file quality-controller.h
+ * @brief Decoding quality that follows the load of the whisper thread.
+ *
+ * When several sources speak at once or OBS encoding takes the CPU, the inferences take longer
+ * than the audio they decode and the input backlog grows until the overload policy drops
+ * audio. The controller measures the real-time factor of the whisper thread (the time it spends
+ * on inferences, waiting for the scheduler included, per second of wall clock) over windows of
+ * QUALITY_WINDOW_MSEC together with the input backlog, and lowers the decoding cost one stage
+ * per window while the thread falls behind:
+ * - QUALITY_STAGE_GREEDY: beam search and best-of candidates become a single greedy candidate;
+ * - QUALITY_STAGE_NO_FALLBACK: no decoding again at a higher temperature;
+ * - QUALITY_STAGE_FEWER_TOKENS: at most QUALITY_FINAL_MAX_TOKENS tokens per final and
+ *   QUALITY_PARTIAL_MAX_TOKENS per partial;
+ * - QUALITY_STAGE_LONGER_PARTIALS: partials QUALITY_PARTIAL_INTERVAL_FACTOR times further apart;
+ * - QUALITY_STAGE_SMALLER_MODEL: the finals are decoded by the partial model too.
+ * Stages that change nothing for the filter (e.g. greedy decoding already, no partial model)
+ * are skipped. After QUALITY_STEP_UP_WINDOWS windows in a row with headroom it steps back up,
+ * one stage at a time. The thresholds leave a gap so that a step up does not fall behind
+ * right away. A floor holds the decoding at a stage or lower whatever the measurements, as the
+ * fast decoding overload policy does while the backlog is over its limit; the stage in effect
+ * is the lower of the two, and its changes are the transitions.
+ */
+#ifndef QUALITY_CONTROLLER_H
+#define QUALITY_CONTROLLER_H
+
+#include <cstdint>
+
+#include <whisper.h>
+
+// length of the measurement windows, one step at most per window
+#define QUALITY_WINDOW_MSEC 5000
+// behind: a real-time factor above this, or a backlog above QUALITY_BACKLOG_HIGH_MSEC that did
+// not shrink over the window
+#define QUALITY_RTF_HIGH 0.9
+#define QUALITY_BACKLOG_HIGH_MSEC 2000
+// headroom: a real-time factor below this with less backlog than QUALITY_BACKLOG_LOW_MSEC
+#define QUALITY_RTF_LOW 0.45
+#define QUALITY_BACKLOG_LOW_MSEC 500
+#define QUALITY_STEP_UP_WINDOWS 3
+#define QUALITY_FINAL_MAX_TOKENS 64
+#define QUALITY_PARTIAL_MAX_TOKENS 24
+#define QUALITY_PARTIAL_INTERVAL_FACTOR 2
+
+enum QualityStage {
+	QUALITY_STAGE_FULL = 0,
+	QUALITY_STAGE_GREEDY,
+	QUALITY_STAGE_NO_FALLBACK,
+	QUALITY_STAGE_FEWER_TOKENS,
+	QUALITY_STAGE_LONGER_PARTIALS,
+	QUALITY_STAGE_SMALLER_MODEL,
+	QUALITY_STAGE_COUNT,
+};
+
+enum QualityCause {
+	QUALITY_CAUSE_RTF = 0,
+	QUALITY_CAUSE_BACKLOG,
+	QUALITY_CAUSE_HEADROOM,
+	QUALITY_CAUSE_OVERLOAD_POLICY,
+};
+
+class QualityController {
+public:
+	struct Transition {
+		QualityStage from = QUALITY_STAGE_FULL;
+		QualityStage to = QUALITY_STAGE_FULL;
+		QualityCause cause = QUALITY_CAUSE_RTF;
+		// measurements of the window that caused it
+		double rtf = 0.0;
+		uint64_t backlog_ms = 0;
+	};
+
+	static const char *stage_name(QualityStage stage);
+	static const char *cause_name(QualityCause cause);
+
+	/** Whether a stage changes anything for the filter, the others are skipped */
+	void set_available(QualityStage stage, bool available);
+
+	/** Time the whisper thread spent on an inference, waiting for the scheduler included. */
+	void report_inference(uint64_t busy_ms) { window_busy_ms += busy_ms; }
+	/**
+	 * @brief From the whisper thread between two inferences: ends the window when it is due
+	 * and steps down or up.
+	 *
+	 * @param backlog_ms Unprocessed input audio.
+	 * @return Whether the stage changed, described in transition.
+	 */
+	bool update(uint64_t now_ms, uint64_t backlog_ms, Transition &transition);
+	/** Back to full quality with a new window, e.g. on a new model. The floor is kept. */
+	void reset(uint64_t now_ms);
+	/**
+	 * @brief Holds the decoding at the stage or lower until the floor is set back to
+	 * QUALITY_STAGE_FULL, whatever the measurements.
+	 *
+	 * @return Whether the stage in effect changed, described in transition.
+	 */
+	bool set_floor(QualityStage floor, QualityCause cause, uint64_t backlog_ms,
+		       Transition &transition);
+
+	/** Lowers the decoding of an inference to the current stage. */
+	void apply(whisper_full_params &params, bool partial) const;
+	/** Interval between two partials at the current stage */
+	int partial_interval(int partial_latency_ms) const;
+	/** Whether the finals are decoded by the partial model */
+	bool use_smaller_model() const { return stage() >= QUALITY_STAGE_SMALLER_MODEL; }
+
+	/** Stage in effect, the lower of the measured one and the floor */
+	QualityStage stage() const { return current > floor_stage ? current : floor_stage; }
+	/** Stage from the measurements alone */
+	QualityStage measured_stage() const { return current; }
+	/** Real-time factor of the last window */
+	double last_rtf() const { return rtf; }
+	uint64_t transitions() const { return transition_count; }
+
+private:
+	QualityStage next_available(int from, int step) const;
+	void reset_window(uint64_t now_ms, uint64_t backlog_ms);
+
+	QualityStage current = QUALITY_STAGE_FULL;
+	QualityStage floor_stage = QUALITY_STAGE_FULL;
+	bool available[QUALITY_STAGE_COUNT] = {true, true, true, true, true, true};
+	bool window_started = false;
+	uint64_t window_start_ms = 0;
+	uint64_t window_busy_ms = 0;
+	uint64_t last_backlog_ms = 0;
+	double rtf = 0.0;
+	int headroom_windows = 0;
+	uint64_t transition_count = 0;
+};
+
+#endif // QUALITY_CONTROLLER_H
@@ -0,0 +1,819 @@
+#include "silero-vad-native.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE__) || \
+	(defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define SILERO_NATIVE_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) || defined(_M_ARM64) || defined(__ARM_NEON)
+#define SILERO_NATIVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define SILERO_NATIVE_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+#define SILERO_NATIVE_TARGET_AVX2
+#endif
+
+namespace {
+
+// fixed shapes of the 16 kHz graph
+const size_t PAD = 64;
+const size_t PADDED_SIZE = SileroVadNative::WINDOW_SIZE + PAD;
+const size_t N_FFT = 256;
+const size_t HOP = 128;
+const size_t FRAMES = (PADDED_SIZE - N_FFT) / HOP + 1;
+const size_t BINS = N_FFT / 2 + 1;
+const size_t HIDDEN = 128;
+const size_t GATES = 4 * HIDDEN;
+
+// tensors of the model in the order of the flat file
+struct TensorSpec {
+	const char *name;
+	std::vector<int64_t> dims;
+};
+
+const TensorSpec TENSORS[] = {
+	{"stft.forward_basis_buffer", {2 * (int64_t)BINS, 1, (int64_t)N_FFT}},
+	{"encoder.0.reparam_conv.weight", {128, (int64_t)BINS, 3}},
+	{"encoder.0.reparam_conv.bias", {128}},
+	{"encoder.1.reparam_conv.weight", {64, 128, 3}},
+	{"encoder.1.reparam_conv.bias", {64}},
+	{"encoder.2.reparam_conv.weight", {64, 64, 3}},
+	{"encoder.2.reparam_conv.bias", {64}},
+	{"encoder.3.reparam_conv.weight", {128, 64, 3}},
+	{"encoder.3.reparam_conv.bias", {128}},
+	{"decoder.rnn.weight_ih", {(int64_t)GATES, (int64_t)HIDDEN}},
+	{"decoder.rnn.weight_hh", {(int64_t)GATES, (int64_t)HIDDEN}},
+	{"decoder.rnn.bias_ih", {(int64_t)GATES}},
+	{"decoder.rnn.bias_hh", {(int64_t)GATES}},
+	{"decoder.decoder.2.weight", {1, (int64_t)HIDDEN, 1}},
+	{"decoder.decoder.2.bias", {1}},
+};
+const size_t NUM_TENSORS = sizeof(TENSORS) / sizeof(TENSORS[0]);
+
+const char FLAT_MAGIC[4] = {'S', 'V', 'A', 'D'};
+const uint32_t FLAT_VERSION = 1;
+
+size_t round_up16(size_t n)
+{
+	return (n + 15) & ~(size_t)15;
+}
+
+size_t num_elements(const std::vector<int64_t> &dims)
+{
+	size_t n = 1;
+	for (int64_t d : dims) {
+		n *= (size_t)d;
+	}
+	return n;
+}
+
+float sigmoid(float x)
+{
+	return 1.0f / (1.0f + std::exp(-x));
+}
+
+/* Model files */
+
+std::vector<uint8_t> read_file(const SileroString &path)
+{
+	std::ifstream file(path.c_str(), std::ios::binary);
+	if (!file) {
+		throw std::runtime_error("cannot open the VAD model file");
+	}
+	return std::vector<uint8_t>(std::istreambuf_iterator<char>(file),
+				    std::istreambuf_iterator<char>());
+}
+
+// Just enough of the protobuf wire format to find the tensors of an ONNX model
+class ProtoReader {
+public:
+	struct Field {
+		uint32_t number;
+		uint32_t wire_type;
+		uint64_t value;
+		const uint8_t *data;
+		size_t size;
+	};
+
+	ProtoReader(const uint8_t *data, size_t size) : p(data), end(data + size) {}
+
+	bool next(Field &field)
+	{
+		if (p >= end) {
+			return false;
+		}
+		const uint64_t key = varint();
+		field.number = (uint32_t)(key >> 3);
+		field.wire_type = (uint32_t)(key & 7);
+		field.value = 0;
+		field.data = nullptr;
+		field.size = 0;
+		switch (field.wire_type) {
+		case 0:
+			field.value = varint();
+			break;
+		case 1:
+			field.data = take(8);
+			field.size = 8;
+			break;
+		case 2: {
+			const uint64_t size = varint();
+			if (size > (uint64_t)(end - p)) {
+				throw std::runtime_error("truncated VAD model file");
+			}
+			field.size = (size_t)size;
+			field.data = take(field.size);
+			break;
+		}
+		case 5:
+			field.data = take(4);
+			field.size = 4;
+			break;
+		default:
+			throw std::runtime_error("the VAD model is not an ONNX file");
+		}
+		return true;
+	}
+
+	uint64_t varint()
+	{
+		uint64_t result = 0;
+		for (int shift = 0; shift < 64; shift += 7) {
+			if (p >= end) {
+				break;
+			}
+			const uint8_t byte = *p++;
+			result |= (uint64_t)(byte & 0x7f) << shift;
+			if ((byte & 0x80) == 0) {
+				return result;
+			}
+		}
+		throw std::runtime_error("the VAD model is not an ONNX file");
+	}
+
+	bool at_end() const { return p >= end; }
+
+private:
+	const uint8_t *take(size_t size)
+	{
+		if ((size_t)(end - p) < size) {
+			throw std::runtime_error("truncated VAD model file");
+		}
+		const uint8_t *data = p;
+		p += size;
+		return data;
+	}
+
+	const uint8_t *p;
+	const uint8_t *end;
+};
+
+struct OnnxTensor {
+	// index of the graph (the main graph or a branch of an If node) that holds the tensor
+	size_t graph;
+	std::string name;
+	std::vector<int64_t> dims;
+	int32_t data_type = 0;
+	std::vector<float> data;
+};
+
+// TensorProto: dims = 1, data_type = 2, float_data = 4, name = 8, raw_data = 9
+OnnxTensor parse_tensor(const uint8_t *data, size_t size, size_t graph)
+{
+	OnnxTensor tensor;
+	tensor.graph = graph;
+	ProtoReader reader(data, size);
+	ProtoReader::Field field;
+	while (reader.next(field)) {
+		if (field.number == 1 && field.wire_type == 0) {
+			tensor.dims.push_back((int64_t)field.value);
+		} else if (field.number == 1 && field.wire_type == 2) {
+			ProtoReader packed(field.data, field.size);
+			while (!packed.at_end()) {
+				tensor.dims.push_back((int64_t)packed.varint());
+			}
+		} else if (field.number == 2) {
+			tensor.data_type = (int32_t)field.value;
+		} else if (field.number == 4 && (field.wire_type == 2 || field.wire_type == 5)) {
+			const size_t count = field.size / sizeof(float);
+			const size_t offset = tensor.data.size();
+			tensor.data.resize(offset + count);
+			std::memcpy(tensor.data.data() + offset, field.data, count * sizeof(float));
+		} else if (field.number == 8 && field.wire_type == 2) {
+			tensor.name.assign((const char *)field.data, field.size);
+		} else if (field.number == 9 && field.wire_type == 2) {
+			tensor.data.resize(field.size / sizeof(float));
+			std::memcpy(tensor.data.data(), field.data,
+				    tensor.data.size() * sizeof(float));
+		}
+	}
+	return tensor;
+}
+
+void parse_graph(const uint8_t *data, size_t size, size_t &num_graphs,
+		 std::vector<OnnxTensor> &tensors);
+
+// NodeProto: output = 2, attribute = 5. AttributeProto: t = 5, g = 6, graphs = 11
+void parse_node(const uint8_t *data, size_t size, size_t graph, size_t &num_graphs,
+		std::vector<OnnxTensor> &tensors)
+{
+	std::string output;
+	const size_t first = tensors.size();
+	ProtoReader reader(data, size);
+	ProtoReader::Field field;
+	while (reader.next(field)) {
+		if (field.number == 2 && field.wire_type == 2 && output.empty()) {
+			output.assign((const char *)field.data, field.size);
+		} else if (field.number == 5 && field.wire_type == 2) {
+			ProtoReader attribute(field.data, field.size);
+			ProtoReader::Field value;
+			while (attribute.next(value)) {
+				if (value.wire_type != 2) {
+					continue;
+				}
+				if (value.number == 5) {
+					tensors.push_back(
+						parse_tensor(value.data, value.size, graph));
+				} else if (value.number == 6 || value.number == 11) {
+					parse_graph(value.data, value.size, num_graphs, tensors);
+				}
+			}
+		}
+	}
+	// the value of a Constant node is named after the output of the node
+	for (size_t i = first; i < tensors.size(); i++) {
+		if (tensors[i].graph == graph && tensors[i].name.empty()) {
+			tensors[i].name = output;
+		}
+	}
+}
+
+// GraphProto: node = 1, initializer = 5
+void parse_graph(const uint8_t *data, size_t size, size_t &num_graphs,
+		 std::vector<OnnxTensor> &tensors)
+{
+	const size_t graph = num_graphs++;
+	ProtoReader reader(data, size);
+	ProtoReader::Field field;
+	while (reader.next(field)) {
+		if (field.number == 1 && field.wire_type == 2) {
+			parse_node(field.data, field.size, graph, num_graphs, tensors);
+		} else if (field.number == 5 && field.wire_type == 2) {
+			tensors.push_back(parse_tensor(field.data, field.size, graph));
+		}
+	}
+}
+
+bool ends_with(const std::string &s, const char *suffix)
+{
+	const size_t n = std::strlen(suffix);
+	return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+const OnnxTensor *find_tensor(const std::vector<OnnxTensor> &tensors, size_t graph,
+			      const TensorSpec &spec)
+{
+	for (const OnnxTensor &tensor : tensors) {
+		if (tensor.graph == graph && tensor.data_type == 1 && tensor.dims == spec.dims &&
+		    ends_with(tensor.name, spec.name) &&
+		    tensor.data.size() == num_elements(spec.dims)) {
+			return &tensor;
+		}
+	}
+	return nullptr;
+}
+
+std::vector<std::vector<float>> load_onnx(const std::vector<uint8_t> &file)
+{
+	// ModelProto: graph = 7
+	std::vector<OnnxTensor> tensors;
+	size_t num_graphs = 0;
+	ProtoReader reader(file.data(), file.size());
+	ProtoReader::Field field;
+	while (reader.next(field)) {
+		if (field.number == 7 && field.wire_type == 2) {
+			parse_graph(field.data, field.size, num_graphs, tensors);
+		}
+	}
+
+	// the 8 kHz branch has tensors of the same names and partly of the same shapes, take the
+	// graph that holds the 16 kHz STFT basis. Single rate exports keep them in the main graph.
+	const OnnxTensor *basis = nullptr;
+	for (size_t graph = 0; graph < num_graphs && !basis; graph++) {
+		basis = find_tensor(tensors, graph, TENSORS[0]);
+	}
+	if (!basis) {
+		throw std::runtime_error("no Silero v5 16 kHz weights in the VAD model");
+	}
+
+	std::vector<std::vector<float>> weights(NUM_TENSORS);
+	for (size_t i = 0; i < NUM_TENSORS; i++) {
+		const OnnxTensor *tensor = find_tensor(tensors, basis->graph, TENSORS[i]);
+		if (!tensor) {
+			tensor = find_tensor(tensors, 0, TENSORS[i]);
+		}
+		if (!tensor) {
+			throw std::runtime_error(std::string("VAD model tensor not found: ") +
+						 TENSORS[i].name);
+		}
+		weights[i] = tensor->data;
+	}
+	return weights;
+}
+
+// "SVAD", version, number of tensors, then the element count and the floats of every tensor
+std::vector<std::vector<float>> load_flat(const std::vector<uint8_t> &file)
+{
+	size_t offset = sizeof(FLAT_MAGIC);
+	auto read_u32 = [&]() {
+		uint32_t v;
+		if (file.size() - offset < sizeof(v)) {
+			throw std::runtime_error("truncated VAD weight file");
+		}
+		std::memcpy(&v, file.data() + offset, sizeof(v));
+		offset += sizeof(v);
+		return v;
+	};
+	if (read_u32() != FLAT_VERSION || read_u32() != NUM_TENSORS) {
+		throw std::runtime_error("unsupported VAD weight file");
+	}
+	std::vector<std::vector<float>> weights(NUM_TENSORS);
+	for (size_t i = 0; i < NUM_TENSORS; i++) {
+		const size_t count = read_u32();
+		if (count != num_elements(TENSORS[i].dims) ||
+		    file.size() - offset < count * sizeof(float)) {
+			throw std::runtime_error("unsupported VAD weight file");
+		}
+		weights[i].resize(count);
+		std::memcpy(weights[i].data(), file.data() + offset, count * sizeof(float));
+		offset += count * sizeof(float);
+	}
+	return weights;
+}
+
+std::vector<std::vector<float>> load_weights(const SileroString &path)
+{
+	const std::vector<uint8_t> file = read_file(path);
+	if (file.size() >= sizeof(FLAT_MAGIC) &&
+	    std::memcmp(file.data(), FLAT_MAGIC, sizeof(FLAT_MAGIC)) == 0) {
+		return load_flat(file);
+	}
+	return load_onnx(file);
+}
+
+/* Scalar kernel */
+
+float dot_scalar(const float *a, const float *b, size_t n)
+{
+	float acc0 = 0.0f, acc1 = 0.0f, acc2 = 0.0f, acc3 = 0.0f;
+	for (size_t i = 0; i < n; i += 4) {
+		acc0 += a[i] * b[i];
+		acc1 += a[i + 1] * b[i + 1];
+		acc2 += a[i + 2] * b[i + 2];
+		acc3 += a[i + 3] * b[i + 3];
+	}
+	return (acc0 + acc1) + (acc2 + acc3);
+}
+
+// out[j * out_stride + r] = rows[r] . cols[j], n is a multiple of 16
+void matmul_scalar(const float *rows, size_t row_stride, size_t num_rows,
+		   const float *const *cols, size_t num_cols, size_t n, float *out,
+		   size_t out_stride)
+{
+	for (size_t r = 0; r < num_rows; r++) {
+		for (size_t j = 0; j < num_cols; j++) {
+			out[j * out_stride + r] = dot_scalar(rows + r * row_stride, cols[j], n);
+		}
+	}
+}
+
+/*
+ * The SIMD kernels take four rows at a time against one column, so that a single window still
+ * has eight independent accumulators. The rows stay in L1 while the columns of the batch go
+ * by. A row sums in the same order whether it is in a group of four or not, so the result of a
+ * window does not depend on the batch.
+ */
+
+#ifdef SILERO_NATIVE_X86
+
+/* SSE kernel */
+
+float hsum_sse(__m128 v)
+{
+	__m128 shuf = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+	__m128 sums = _mm_add_ps(v, shuf);
+	shuf = _mm_movehl_ps(shuf, sums);
+	sums = _mm_add_ss(sums, shuf);
+	return _mm_cvtss_f32(sums);
+}
+
+void matmul_sse(const float *rows, size_t row_stride, size_t num_rows, const float *const *cols,
+		size_t num_cols, size_t n, float *out, size_t out_stride)
+{
+	size_t r = 0;
+	for (; r + 4 <= num_rows; r += 4) {
+		const float *w0 = rows + r * row_stride;
+		const float *w1 = w0 + row_stride;
+		const float *w2 = w1 + row_stride;
+		const float *w3 = w2 + row_stride;
+		for (size_t j = 0; j < num_cols; j++) {
+			const float *c = cols[j];
+			__m128 a0 = _mm_setzero_ps(), b0 = _mm_setzero_ps();
+			__m128 a1 = _mm_setzero_ps(), b1 = _mm_setzero_ps();
+			__m128 a2 = _mm_setzero_ps(), b2 = _mm_setzero_ps();
+			__m128 a3 = _mm_setzero_ps(), b3 = _mm_setzero_ps();
+			for (size_t i = 0; i < n; i += 8) {
+				const __m128 x0 = _mm_loadu_ps(c + i);
+				const __m128 x1 = _mm_loadu_ps(c + i + 4);
+				a0 = _mm_add_ps(a0, _mm_mul_ps(_mm_loadu_ps(w0 + i), x0));
+				b0 = _mm_add_ps(b0, _mm_mul_ps(_mm_loadu_ps(w0 + i + 4), x1));
+				a1 = _mm_add_ps(a1, _mm_mul_ps(_mm_loadu_ps(w1 + i), x0));
+				b1 = _mm_add_ps(b1, _mm_mul_ps(_mm_loadu_ps(w1 + i + 4), x1));
+				a2 = _mm_add_ps(a2, _mm_mul_ps(_mm_loadu_ps(w2 + i), x0));
+				b2 = _mm_add_ps(b2, _mm_mul_ps(_mm_loadu_ps(w2 + i + 4), x1));
+				a3 = _mm_add_ps(a3, _mm_mul_ps(_mm_loadu_ps(w3 + i), x0));
+				b3 = _mm_add_ps(b3, _mm_mul_ps(_mm_loadu_ps(w3 + i + 4), x1));
+			}
+			float *y = out + j * out_stride + r;
+			y[0] = hsum_sse(_mm_add_ps(a0, b0));
+			y[1] = hsum_sse(_mm_add_ps(a1, b1));
+			y[2] = hsum_sse(_mm_add_ps(a2, b2));
+			y[3] = hsum_sse(_mm_add_ps(a3, b3));
+		}
+	}
+	for (; r < num_rows; r++) {
+		const float *w = rows + r * row_stride;
+		for (size_t j = 0; j < num_cols; j++) {
+			const float *c = cols[j];
+			__m128 a = _mm_setzero_ps(), b = _mm_setzero_ps();
+			for (size_t i = 0; i < n; i += 8) {
+				a = _mm_add_ps(a,
+					       _mm_mul_ps(_mm_loadu_ps(w + i), _mm_loadu_ps(c + i)));
+				b = _mm_add_ps(b, _mm_mul_ps(_mm_loadu_ps(w + i + 4),
+							     _mm_loadu_ps(c + i + 4)));
+			}
+			out[j * out_stride + r] = hsum_sse(_mm_add_ps(a, b));
+		}
+	}
+}
+
+/* AVX2 + FMA kernel */
+
+SILERO_NATIVE_TARGET_AVX2 float hsum_avx2(__m256 v)
+{
+	return hsum_sse(_mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1)));
+}
+
+SILERO_NATIVE_TARGET_AVX2 void matmul_avx2(const float *rows, size_t row_stride,
+					   size_t num_rows, const float *const *cols,
+					   size_t num_cols, size_t n, float *out,
+					   size_t out_stride)
+{
+	size_t r = 0;
+	for (; r + 4 <= num_rows; r += 4) {
+		const float *w0 = rows + r * row_stride;
+		const float *w1 = w0 + row_stride;
+		const float *w2 = w1 + row_stride;
+		const float *w3 = w2 + row_stride;
+		for (size_t j = 0; j < num_cols; j++) {
+			const float *c = cols[j];
+			__m256 a0 = _mm256_setzero_ps(), b0 = _mm256_setzero_ps();
+			__m256 a1 = _mm256_setzero_ps(), b1 = _mm256_setzero_ps();
+			__m256 a2 = _mm256_setzero_ps(), b2 = _mm256_setzero_ps();
+			__m256 a3 = _mm256_setzero_ps(), b3 = _mm256_setzero_ps();
+			for (size_t i = 0; i < n; i += 16) {
+				const __m256 x0 = _mm256_loadu_ps(c + i);
+				const __m256 x1 = _mm256_loadu_ps(c + i + 8);
+				a0 = _mm256_fmadd_ps(_mm256_loadu_ps(w0 + i), x0, a0);
+				b0 = _mm256_fmadd_ps(_mm256_loadu_ps(w0 + i + 8), x1, b0);
+				a1 = _mm256_fmadd_ps(_mm256_loadu_ps(w1 + i), x0, a1);
+				b1 = _mm256_fmadd_ps(_mm256_loadu_ps(w1 + i + 8), x1, b1);
+				a2 = _mm256_fmadd_ps(_mm256_loadu_ps(w2 + i), x0, a2);
+				b2 = _mm256_fmadd_ps(_mm256_loadu_ps(w2 + i + 8), x1, b2);
+				a3 = _mm256_fmadd_ps(_mm256_loadu_ps(w3 + i), x0, a3);
+				b3 = _mm256_fmadd_ps(_mm256_loadu_ps(w3 + i + 8), x1, b3);
+			}
+			float *y = out + j * out_stride + r;
+			y[0] = hsum_avx2(_mm256_add_ps(a0, b0));
+			y[1] = hsum_avx2(_mm256_add_ps(a1, b1));
+			y[2] = hsum_avx2(_mm256_add_ps(a2, b2));
+			y[3] = hsum_avx2(_mm256_add_ps(a3, b3));
+		}
+	}
+	for (; r < num_rows; r++) {
+		const float *w = rows + r * row_stride;
+		for (size_t j = 0; j < num_cols; j++) {
+			const float *c = cols[j];
+			__m256 a = _mm256_setzero_ps(), b = _mm256_setzero_ps();
+			for (size_t i = 0; i < n; i += 16) {
+				a = _mm256_fmadd_ps(_mm256_loadu_ps(w + i), _mm256_loadu_ps(c + i),
+						    a);
+				b = _mm256_fmadd_ps(_mm256_loadu_ps(w + i + 8),
+						    _mm256_loadu_ps(c + i + 8), b);
+			}
+			out[j * out_stride + r] = hsum_avx2(_mm256_add_ps(a, b));
+		}
+	}
+}
+
+#endif // SILERO_NATIVE_X86
+
+#ifdef SILERO_NATIVE_NEON
+
+/* NEON kernel */
+
+float hsum_neon(float32x4_t v)
+{
+	const float32x2_t sum2 = vadd_f32(vget_low_f32(v), vget_high_f32(v));
+	return vget_lane_f32(vpadd_f32(sum2, sum2), 0);
+}
+
+void matmul_neon(const float *rows, size_t row_stride, size_t num_rows,
+		 const float *const *cols, size_t num_cols, size_t n, float *out,
+		 size_t out_stride)
+{
+	size_t r = 0;
+	for (; r + 4 <= num_rows; r += 4) {
+		const float *w0 = rows + r * row_stride;
+		const float *w1 = w0 + row_stride;
+		const float *w2 = w1 + row_stride;
+		const float *w3 = w2 + row_stride;
+		for (size_t j = 0; j < num_cols; j++) {
+			const float *c = cols[j];
+			float32x4_t a0 = vdupq_n_f32(0.0f), b0 = vdupq_n_f32(0.0f);
+			float32x4_t a1 = vdupq_n_f32(0.0f), b1 = vdupq_n_f32(0.0f);
+			float32x4_t a2 = vdupq_n_f32(0.0f), b2 = vdupq_n_f32(0.0f);
+			float32x4_t a3 = vdupq_n_f32(0.0f), b3 = vdupq_n_f32(0.0f);
+			for (size_t i = 0; i < n; i += 8) {
+				const float32x4_t x0 = vld1q_f32(c + i);
+				const float32x4_t x1 = vld1q_f32(c + i + 4);
+				a0 = vmlaq_f32(a0, vld1q_f32(w0 + i), x0);
+				b0 = vmlaq_f32(b0, vld1q_f32(w0 + i + 4), x1);
+				a1 = vmlaq_f32(a1, vld1q_f32(w1 + i), x0);
+				b1 = vmlaq_f32(b1, vld1q_f32(w1 + i + 4), x1);
+				a2 = vmlaq_f32(a2, vld1q_f32(w2 + i), x0);
+				b2 = vmlaq_f32(b2, vld1q_f32(w2 + i + 4), x1);
+				a3 = vmlaq_f32(a3, vld1q_f32(w3 + i), x0);
+				b3 = vmlaq_f32(b3, vld1q_f32(w3 + i + 4), x1);
+			}
+			float *y = out + j * out_stride + r;
+			y[0] = hsum_neon(vaddq_f32(a0, b0));
+			y[1] = hsum_neon(vaddq_f32(a1, b1));
+			y[2] = hsum_neon(vaddq_f32(a2, b2));
+			y[3] = hsum_neon(vaddq_f32(a3, b3));
+		}
+	}
+	for (; r < num_rows; r++) {
+		const float *w = rows + r * row_stride;
+		for (size_t j = 0; j < num_cols; j++) {
+			const float *c = cols[j];
+			float32x4_t a = vdupq_n_f32(0.0f), b = vdupq_n_f32(0.0f);
+			for (size_t i = 0; i < n; i += 8) {
+				a = vmlaq_f32(a, vld1q_f32(w + i), vld1q_f32(c + i));
+				b = vmlaq_f32(b, vld1q_f32(w + i + 4), vld1q_f32(c + i + 4));
+			}
+			out[j * out_stride + r] = hsum_neon(vaddq_f32(a, b));
+		}
+	}
+}
+
+#endif // SILERO_NATIVE_NEON
+
+SileroVadNative::matmul_fn kernel_function(AudioDecimatorKernel kernel)
+{
+	switch (kernel) {
+#ifdef SILERO_NATIVE_X86
+	case AUDIO_DECIMATOR_KERNEL_SSE:
+		return matmul_sse;
+	case AUDIO_DECIMATOR_KERNEL_AVX2:
+		return matmul_avx2;
+#endif
+#ifdef SILERO_NATIVE_NEON
+	case AUDIO_DECIMATOR_KERNEL_NEON:
+		return matmul_neon;
+#endif
+	default:
+		return matmul_scalar;
+	}
+}
+
+} // namespace
+
+SileroVadNative::SileroVadNative(const SileroString &model_path, AudioDecimatorKernel kernel_)
+	: kernel(kernel_)
+{
+	// the CPU checks are the ones of the decimator kernels
+	if (!AudioDecimator::kernel_available(kernel)) {
+		throw std::runtime_error("VAD kernel not available on this CPU");
+	}
+	if (kernel == AUDIO_DECIMATOR_KERNEL_AUTO) {
+		kernel = AUDIO_DECIMATOR_KERNEL_SCALAR;
+#ifdef SILERO_NATIVE_X86
+		kernel = AudioDecimator::kernel_available(AUDIO_DECIMATOR_KERNEL_AVX2)
+				 ? AUDIO_DECIMATOR_KERNEL_AVX2
+				 : AUDIO_DECIMATOR_KERNEL_SSE;
+#endif
+#ifdef SILERO_NATIVE_NEON
+		kernel = AUDIO_DECIMATOR_KERNEL_NEON;
+#endif
+	}
+	matmul = kernel_function(kernel);
+
+	std::vector<std::vector<float>> tensors = load_weights(model_path);
+	build(tensors);
+	reserve(1);
+}
+
+void SileroVadNative::convert(const SileroString &model_path, const SileroString &flat_path)
+{
+	const std::vector<std::vector<float>> tensors = load_weights(model_path);
+	std::ofstream file(flat_path.c_str(), std::ios::binary);
+	const uint32_t header[2] = {FLAT_VERSION, (uint32_t)NUM_TENSORS};
+	file.write(FLAT_MAGIC, sizeof(FLAT_MAGIC));
+	file.write((const char *)header, sizeof(header));
+	for (const std::vector<float> &tensor : tensors) {
+		const uint32_t count = (uint32_t)tensor.size();
+		file.write((const char *)&count, sizeof(count));
+		file.write((const char *)tensor.data(), (std::streamsize)(count * sizeof(float)));
+	}
+	if (!file) {
+		throw std::runtime_error("cannot write the VAD weight file");
+	}
+}
+
+void SileroVadNative::build(std::vector<std::vector<float>> &tensors)
+{
+	stft_basis = std::move(tensors[0]);
+
+	// in channels, out channels, stride and frames of the encoder, the frames halve twice
+	const size_t shapes[4][4] = {{BINS, 128, 1, FRAMES},
+				     {128, 64, 2, FRAMES},
+				     {64, 64, 2, (FRAMES - 1) / 2 + 1},
+				     {64, 128, 1, 1}};
+	for (size_t l = 0; l < 4; l++) {
+		ConvLayer &layer = encoder[l];
+		layer.in_channels = shapes[l][0];
+		layer.out_channels = shapes[l][1];
+		layer.stride = shapes[l][2];
+		layer.in_frames = shapes[l][3];
+		// kernel 3, padding 1
+		layer.out_frames = (layer.in_frames - 1) / layer.stride + 1;
+		layer.row_size = round_up16(layer.in_channels * 3);
+		const std::vector<float> &weight = tensors[1 + 2 * l];
+		layer.weight.assign(layer.out_channels * layer.row_size, 0.0f);
+		for (size_t m = 0; m < layer.out_channels; m++) {
+			std::copy(weight.begin() + m * layer.in_channels * 3,
+				  weight.begin() + (m + 1) * layer.in_channels * 3,
+				  layer.weight.begin() + m * layer.row_size);
+		}
+		layer.bias = std::move(tensors[2 + 2 * l]);
+	}
+
+	const std::vector<float> &weight_ih = tensors[9];
+	const std::vector<float> &weight_hh = tensors[10];
+	lstm_weight.resize(GATES * 2 * HIDDEN);
+	lstm_bias.resize(GATES);
+	for (size_t r = 0; r < GATES; r++) {
+		std::copy(weight_ih.begin() + r * HIDDEN, weight_ih.begin() + (r + 1) * HIDDEN,
+			  lstm_weight.begin() + r * 2 * HIDDEN);
+		std::copy(weight_hh.begin() + r * HIDDEN, weight_hh.begin() + (r + 1) * HIDDEN,
+			  lstm_weight.begin() + r * 2 * HIDDEN + HIDDEN);
+		lstm_bias[r] = tensors[11][r] + tensors[12][r];
+	}
+	output_weight = std::move(tensors[13]);
+	output_bias = tensors[14][0];
+}
+
+void SileroVadNative::reserve(size_t max_batch)
+{
+	if (max_batch <= capacity) {
+		return;
+	}
+	capacity = max_batch;
+	padded.resize(capacity * PADDED_SIZE);
+	stft.resize(capacity * FRAMES * 2 * BINS);
+	activations[0].resize(capacity * FRAMES * BINS);
+	activations[1].resize(capacity * FRAMES * BINS);
+	columns.resize(capacity * FRAMES * encoder[0].row_size);
+	column_ptrs.resize(capacity * FRAMES);
+	gates.resize(capacity * GATES);
+}
+
+void SileroVadNative::conv(const ConvLayer &layer, const float *in, float *out, size_t batch)
+{
+	// one column per output frame: the 3 taps of every input channel around the frame
+	const size_t num_cols = batch * layer.out_frames;
+	for (size_t j = 0; j < num_cols; j++) {
+		const size_t b = j / layer.out_frames;
+		const size_t t = j % layer.out_frames;
+		float *col = columns.data() + j * layer.row_size;
+		for (size_t k = 0; k < 3; k++) {
+			const size_t p = t * layer.stride + k;
+			if (p < 1 || p > layer.in_frames) {
+				for (size_t c = 0; c < layer.in_channels; c++) {
+					col[c * 3 + k] = 0.0f;
+				}
+				continue;
+			}
+			const float *x = in + (b * layer.in_frames + p - 1) * layer.in_channels;
+			for (size_t c = 0; c < layer.in_channels; c++) {
+				col[c * 3 + k] = x[c];
+			}
+		}
+		std::fill(col + layer.in_channels * 3, col + layer.row_size, 0.0f);
+		column_ptrs[j] = col;
+	}
+
+	matmul(layer.weight.data(), layer.row_size, layer.out_channels, column_ptrs.data(),
+	       num_cols, layer.row_size, out, layer.out_channels);
+	for (size_t j = 0; j < num_cols; j++) {
+		float *y = out + j * layer.out_channels;
+		for (size_t m = 0; m < layer.out_channels; m++) {
+			y[m] = std::max(y[m] + layer.bias[m], 0.0f);
+		}
+	}
+}
+
+void SileroVadNative::run(const float *windows, size_t batch, const float *state_in,
+			  float *state_out, float *probs)
+{
+	if (batch == 0) {
+		return;
+	}
+	reserve(batch);
+
+	// STFT: reflection padding on the right, then the frames against the basis
+	for (size_t b = 0; b < batch; b++) {
+		const float *x = windows + b * WINDOW_SIZE;
+		float *p = padded.data() + b * PADDED_SIZE;
+		std::copy(x, x + WINDOW_SIZE, p);
+		for (size_t k = 0; k < PAD; k++) {
+			p[WINDOW_SIZE + k] = x[WINDOW_SIZE - 2 - k];
+		}
+		for (size_t t = 0; t < FRAMES; t++) {
+			column_ptrs[b * FRAMES + t] = p + t * HOP;
+		}
+	}
+	const size_t num_frames = batch * FRAMES;
+	matmul(stft_basis.data(), N_FFT, 2 * BINS, column_ptrs.data(), num_frames, N_FFT,
+	       stft.data(), 2 * BINS);
+	// magnitudes, [batch, frame, bin]
+	float *spectrum = activations[0].data();
+	for (size_t j = 0; j < num_frames; j++) {
+		const float *re = stft.data() + j * 2 * BINS;
+		const float *im = re + BINS;
+		for (size_t f = 0; f < BINS; f++) {
+			spectrum[j * BINS + f] = std::sqrt(re[f] * re[f] + im[f] * im[f]);
+		}
+	}
+
+	conv(encoder[0], activations[0].data(), activations[1].data(), batch);
+	conv(encoder[1], activations[1].data(), activations[0].data(), batch);
+	conv(encoder[2], activations[0].data(), activations[1].data(), batch);
+	conv(encoder[3], activations[1].data(), activations[0].data(), batch);
+	const float *features = activations[0].data();
+
+	// LSTM cell, the columns are [x | h]
+	for (size_t b = 0; b < batch; b++) {
+		float *col = columns.data() + b * 2 * HIDDEN;
+		std::copy(features + b * HIDDEN, features + (b + 1) * HIDDEN, col);
+		std::copy(state_in + b * HIDDEN, state_in + (b + 1) * HIDDEN, col + HIDDEN);
+		column_ptrs[b] = col;
+	}
+	matmul(lstm_weight.data(), 2 * HIDDEN, GATES, column_ptrs.data(), batch, 2 * HIDDEN,
+	       gates.data(), GATES);
+	for (size_t b = 0; b < batch; b++) {
+		// gate order of PyTorch: input, forget, cell, output
+		const float *g = gates.data() + b * GATES;
+		const float *c_in = state_in + (batch + b) * HIDDEN;
+		float *h_out = state_out + b * HIDDEN;
+		float *c_out = state_out + (batch + b) * HIDDEN;
+		float logit = output_bias;
+		for (size_t u = 0; u < HIDDEN; u++) {
+			const float i = sigmoid(g[u] + lstm_bias[u]);
+			const float f = sigmoid(g[HIDDEN + u] + lstm_bias[HIDDEN + u]);
+			const float cell = std::tanh(g[2 * HIDDEN + u] + lstm_bias[2 * HIDDEN + u]);
+			const float o = sigmoid(g[3 * HIDDEN + u] + lstm_bias[3 * HIDDEN + u]);
+			const float c = f * c_in[u] + i * cell;
+			const float h = o * std::tanh(c);
+			c_out[u] = c;
+			h_out[u] = h;
+			// decoder: ReLU and the 1x1 output convolution
+			logit += std::max(h, 0.0f) * output_weight[u];
+		}
+		probs[b] = sigmoid(logit);
+	}
+}
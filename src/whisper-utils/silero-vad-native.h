@@ -0,0 +1,113 @@
+/**
+ * @file silero-vad-native.h
+ * @brief Silero VAD v5 inference without ONNX Runtime.
+ *
+ * For a model this small most of an ONNX Runtime run is spent dispatching the graph. This is
+ * the 16 kHz branch of the Silero v5 graph written out with the shapes of a 512 sample window
+ * fixed at compile time: the STFT as a strided convolution with the basis of the model (the
+ * window reflection padded by 64 samples, 3 frames of 129 bins), four 3-tap convolutions with
+ * ReLU, the LSTM cell and the output convolution. Every layer is a set of dot products of a
+ * weight row with the input columns of all windows of the batch, computed with SSE, AVX2/FMA
+ * or NEON kernels and a scalar fallback.
+ *
+ * The weights are read from the shipped silero_vad.onnx, where the tensors of the 16 kHz branch
+ * are found by name and shape, or from a flat file written by convert(), which loads without
+ * parsing the graph.
+ */
+#ifndef SILERO_VAD_NATIVE_H
+#define SILERO_VAD_NATIVE_H
+
+#include <cstddef>
+#include <vector>
+
+#include "audio-decimator.h"
+#include "silero-vad-onnx.h"
+
+class SileroVadNative {
+public:
+	static constexpr int SAMPLE_RATE = 16000;
+	static constexpr size_t WINDOW_SIZE = 512;
+	/** Size of the LSTM state of one stream, in floats */
+	static constexpr size_t STATE_SIZE = 2 * 128;
+
+	/**
+	 * @brief Loads the weights from silero_vad.onnx or from a flat weight file.
+	 *
+	 * Throws std::runtime_error if the file cannot be read or does not hold the weights of a
+	 * Silero v5 model.
+	 *
+	 * @param kernel Kernel to use, AUTO picks the fastest one available.
+	 */
+	explicit SileroVadNative(const SileroString &model_path,
+				 AudioDecimatorKernel kernel = AUDIO_DECIMATOR_KERNEL_AUTO);
+
+	/**
+	 * @brief Writes the weights of a model file (ONNX or flat) as a flat weight file.
+	 *
+	 * Throws std::runtime_error on failure.
+	 */
+	static void convert(const SileroString &model_path, const SileroString &flat_path);
+
+	/** Sizes the scratch buffers, so that batches up to max_batch do not allocate. */
+	void reserve(size_t max_batch);
+
+	/**
+	 * @brief Runs one window of every stream of the batch.
+	 *
+	 * Same layout as the ONNX model. Not thread safe, the scratch buffers belong to the
+	 * instance.
+	 *
+	 * @param windows batch * WINDOW_SIZE samples.
+	 * @param state_in LSTM state [2, batch, 128].
+	 * @param state_out Receives the next state, must not overlap state_in.
+	 * @param probs Receives the speech probability of every window.
+	 */
+	void run(const float *windows, size_t batch, const float *state_in, float *state_out,
+		 float *probs);
+
+	AudioDecimatorKernel get_kernel() const { return kernel; }
+
+	// out[j * out_stride + r] = rows[r] . cols[j] for num_rows rows and num_cols columns
+	typedef void (*matmul_fn)(const float *rows, size_t row_stride, size_t num_rows,
+				  const float *const *cols, size_t num_cols, size_t n, float *out,
+				  size_t out_stride);
+
+private:
+	struct ConvLayer {
+		size_t in_channels;
+		size_t out_channels;
+		size_t stride;
+		size_t in_frames;
+		size_t out_frames;
+		// row length of the weights and the input columns, in_channels * 3 rounded up to 16
+		size_t row_size;
+		std::vector<float> weight;
+		std::vector<float> bias;
+	};
+
+	void build(std::vector<std::vector<float>> &tensors);
+	void conv(const ConvLayer &layer, const float *in, float *out, size_t batch);
+
+	AudioDecimatorKernel kernel;
+	matmul_fn matmul;
+
+	// weights, rows zero padded to a multiple of 16 floats
+	std::vector<float> stft_basis;
+	ConvLayer encoder[4];
+	// [weight_ih | weight_hh] rows and bias_ih + bias_hh
+	std::vector<float> lstm_weight;
+	std::vector<float> lstm_bias;
+	std::vector<float> output_weight;
+	float output_bias = 0.0f;
+
+	// scratch
+	size_t capacity = 0;
+	std::vector<float> padded;
+	std::vector<float> stft;
+	std::vector<float> activations[2];
+	std::vector<float> columns;
+	std::vector<const float *> column_ptrs;
+	std::vector<float> gates;
+};
+
+#endif // SILERO_VAD_NATIVE_H
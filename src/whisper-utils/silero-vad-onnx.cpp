@@ -1,5 +1,7 @@
 #include "silero-vad-onnx.h"
+#include "vad-service.h"
 
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 #include <cstring>
@@ -118,17 +120,62 @@ void VadIterator::init_engine_threads(int inter_threads, int intra_threads)
 
 void VadIterator::init_onnx_model(const SileroString &model_path)
 {
+	env = Ort::Env(ORT_LOGGING_LEVEL_WARNING, "silero-vad");
 	// Init threads = 1 for
 	init_engine_threads(1, 1);
 	// Load model
 	session = std::make_shared<Ort::Session>(env, model_path.c_str(), session_options);
 };
 
+void VadIterator::init_io_binding()
+{
+	// All tensors wrap buffers owned by the iterator, so running the model does not
+	// allocate: the input window is copied into `input`, the probability is written to
+	// `output_prob` and the state goes back and forth between the two state buffers.
+	input_tensor = Ort::Value::CreateTensor<float>(memory_info, input.data(), input.size(),
+						       input_node_dims, 2);
+	sr_tensor = Ort::Value::CreateTensor<int64_t>(memory_info, sr.data(), sr.size(),
+						      sr_node_dims, 1);
+	output_tensor = Ort::Value::CreateTensor<float>(memory_info, &output_prob, 1,
+							output_node_dims, 2);
+	for (int i = 0; i < 2; i++) {
+		state_tensors[i] = Ort::Value::CreateTensor<float>(
+			memory_info, state[i].data(), state[i].size(), state_node_dims, 3);
+	}
+
+	try {
+		for (int i = 0; i < 2; i++) {
+			io_bindings[i] = std::make_unique<Ort::IoBinding>(*session);
+			io_bindings[i]->BindInput(input_node_names[0], input_tensor);
+			io_bindings[i]->BindInput(input_node_names[1], state_tensors[i]);
+			io_bindings[i]->BindInput(input_node_names[2], sr_tensor);
+			io_bindings[i]->BindOutput(output_node_names[0], output_tensor);
+			io_bindings[i]->BindOutput(output_node_names[1], state_tensors[i ^ 1]);
+		}
+		use_io_binding = true;
+	} catch (const Ort::Exception &e) {
+		obs_log(LOG_WARNING, "VAD: cannot bind the model tensors (%s), using regular runs",
+			e.what());
+		io_bindings[0].reset();
+		io_bindings[1].reset();
+		use_io_binding = false;
+	}
+}
+
+bool VadIterator::set_io_binding(bool enable)
+{
+	if (enable && !io_bindings[0]) {
+		return false;
+	}
+	use_io_binding = enable;
+	return true;
+}
+
 void VadIterator::reset_states(bool reset_state)
 {
 	if (reset_state) {
 		// Call reset before each audio start
-		std::memset(_state.data(), 0.0f, _state.size() * sizeof(float));
+		std::memset(state[current_state].data(), 0, size_state * sizeof(float));
 		triggered = false;
 	}
 	temp_end = 0;
@@ -140,15 +187,30 @@ void VadIterator::reset_states(bool reset_state)
 	current_speech = timestamp_t();
 };
 
-float VadIterator::predict_one(const std::vector<float> &data)
+float VadIterator::predict_one(const float *data)
+{
+	if (service) {
+		service->run(data, 1, state[current_state].data(), &output_prob);
+		return output_prob;
+	}
+	if (!use_io_binding) {
+		return predict_one_unbound(data);
+	}
+	std::copy(data, data + window_size_samples, input.begin());
+	session->Run(run_options, *io_bindings[current_state]);
+	current_state ^= 1;
+	return output_prob;
+}
+
+float VadIterator::predict_one_unbound(const float *data)
 {
 	// Infer
 	// Create ort tensors
-	input.assign(data.begin(), data.end());
+	std::copy(data, data + window_size_samples, input.begin());
 	Ort::Value input_ort = Ort::Value::CreateTensor<float>(memory_info, input.data(),
 							       input.size(), input_node_dims, 2);
 	Ort::Value state_ort = Ort::Value::CreateTensor<float>(
-		memory_info, _state.data(), _state.size(), state_node_dims, 3);
+		memory_info, state[current_state].data(), size_state, state_node_dims, 3);
 	Ort::Value sr_ort = Ort::Value::CreateTensor<int64_t>(memory_info, sr.data(), sr.size(),
 							      sr_node_dims, 1);
 
@@ -166,15 +228,18 @@ float VadIterator::predict_one(const std::vector<float> &data)
 	// Output probability & update h,c recursively
 	float speech_prob = ort_outputs[0].GetTensorMutableData<float>()[0];
 	float *stateN = ort_outputs[1].GetTensorMutableData<float>();
-	std::memcpy(_state.data(), stateN, size_state * sizeof(float));
+	std::memcpy(state[current_state].data(), stateN, size_state * sizeof(float));
 
 	return speech_prob;
 }
 
-void VadIterator::predict(const std::vector<float> &data)
+void VadIterator::predict(const float *data)
 {
-	const float speech_prob = predict_one(data);
+	advance(predict_one(data));
+}
 
+void VadIterator::advance(float speech_prob)
+{
 	// Push forward sample index
 	current_sample += (unsigned int)window_size_samples;
 
@@ -292,17 +357,21 @@ void VadIterator::predict(const std::vector<float> &data)
 };
 
 void VadIterator::process(const std::vector<float> &input_wav, bool reset_state)
+{
+	process(input_wav.data(), input_wav.size(), reset_state);
+};
+
+void VadIterator::process(const float *input_wav, size_t num_samples, bool reset_state)
 {
 	try {
 	  reset_states(reset_state);
 
-	  audio_length_samples = (int)input_wav.size();
+	  audio_length_samples = (int)num_samples;
 
 	  for (int j = 0; j < audio_length_samples; j += (int)window_size_samples) {
 		  if (j + (int)window_size_samples > audio_length_samples)
 			  break;
-		  std::vector<float> r{&input_wav[0] + j, &input_wav[0] + j + window_size_samples};
-		  predict(r);
+		  predict(input_wav + j);
 	  }
 
 	  if (current_speech.start >= 0) {
@@ -321,6 +390,151 @@ void VadIterator::process(const std::vector<float> &input_wav, bool reset_state)
 	}
 };
 
+void VadIterator::stream_reset(uint64_t start_sample)
+{
+	reset_states(true);
+	stream_base = start_sample;
+	stream_pending = 0;
+	stream_start_reported = false;
+	stream_voiced = start_sample;
+}
+
+void VadIterator::stream_advance(float speech_prob, std::vector<VadEvent> &events)
+{
+	advance(speech_prob);
+	if (speech_prob >= threshold) {
+		stream_voiced = stream_base + current_sample;
+	}
+
+	// segments closed by this window
+	for (const timestamp_t &speech : speeches) {
+		if (!stream_start_reported) {
+			events.push_back(
+				{VAD_EVENT_SPEECH_START, stream_base + (uint64_t)speech.start});
+		}
+		events.push_back({VAD_EVENT_SPEECH_END, stream_base + (uint64_t)speech.end});
+		stream_start_reported = false;
+	}
+	speeches.clear();
+
+	if (triggered && !stream_start_reported && current_speech.start >= 0) {
+		events.push_back(
+			{VAD_EVENT_SPEECH_START, stream_base + (uint64_t)current_speech.start});
+		stream_start_reported = true;
+	}
+
+	// the bookkeeping uses 32 bit offsets, move the base forward while there is no speech
+	if (!triggered && temp_end == 0 && current_sample > (1u << 30)) {
+		stream_base += current_sample;
+		current_sample = 0;
+		prev_end = next_start = 0;
+		current_speech = timestamp_t();
+	}
+}
+
+void VadIterator::stream_process(const float *samples, size_t num_samples,
+				 std::vector<VadEvent> &events)
+{
+	const size_t window = (size_t)window_size_samples;
+	try {
+	  // collect the complete windows, the first one may have been started by the previous call
+	  size_t offset = 0;
+	  bool carried = false;
+	  if (stream_pending > 0) {
+		  offset = std::min(num_samples, window - stream_pending);
+		  std::copy(samples, samples + offset, stream_window.begin() + stream_pending);
+		  stream_pending += offset;
+		  if (stream_pending < window) {
+			  return;
+		  }
+		  stream_pending = 0;
+		  carried = true;
+	  }
+	  const size_t whole = (num_samples - offset) / window * window;
+	  const size_t num_windows = (carried ? 1 : 0) + whole / window;
+	  if (stream_batch.size() < num_windows * window) {
+		  stream_batch.resize(num_windows * window);
+		  stream_probs.resize(num_windows);
+		  stream_gated.resize(num_windows);
+	  }
+	  float *batch = stream_batch.data();
+	  if (carried) {
+		  std::copy(stream_window.begin(), stream_window.end(), batch);
+		  batch += window;
+	  }
+	  std::copy(samples + offset, samples + offset + whole, batch);
+	  offset += whole;
+	  stream_pending = num_samples - offset;
+	  std::copy(samples + offset, samples + num_samples, stream_window.begin());
+
+	  // drop the clearly silent windows from the batch, the others move to the front
+	  size_t num_model_windows = num_windows;
+	  if (use_energy_gate) {
+		  num_model_windows = 0;
+		  for (size_t i = 0; i < num_windows; i++) {
+			  const float *w = stream_batch.data() + i * window;
+			  stream_gated[i] = gate.classify(w, window);
+			  if (stream_gated[i]) {
+				  continue;
+			  }
+			  if (num_model_windows != i) {
+				  std::copy(w, w + window,
+					    stream_batch.begin() + num_model_windows * window);
+			  }
+			  num_model_windows++;
+		  }
+		  gated_windows += num_windows - num_model_windows;
+	  }
+
+	  if (service) {
+		  // one request, so the windows share the model runs with the other streams
+		  service->run(stream_batch.data(), num_model_windows,
+			       state[current_state].data(), stream_probs.data());
+	  } else {
+		  for (size_t i = 0; i < num_model_windows; i++) {
+			  stream_probs[i] = predict_one(stream_batch.data() + i * window);
+		  }
+	  }
+	  for (size_t i = 0, j = 0; i < num_windows; i++) {
+		  const bool gated = use_energy_gate && stream_gated[i];
+		  stream_advance(gated ? 0.0f : stream_probs[j++], events);
+	  }
+	}
+	catch (const Ort::Exception &e) {
+	  obs_log(LOG_ERROR, "Caught exception when running VAD prediction. Error code: %s, message: %s",
+			  ort_error_code_str(e.GetOrtErrorCode()), e.what());
+	}
+}
+
+bool VadIterator::detect_speech(const float *samples, size_t num_samples)
+{
+	// save the stream, process() starts from a reset state
+	std::copy(state[current_state].begin(), state[current_state].end(), saved_state.begin());
+	const bool saved_triggered = triggered;
+	const unsigned int saved_temp_end = temp_end;
+	const unsigned int saved_current_sample = current_sample;
+	const int saved_prev_end = prev_end;
+	const int saved_next_start = next_start;
+	const int saved_speech_start = current_speech.start;
+	const int saved_speech_end = current_speech.end;
+	saved_speeches.swap(speeches);
+
+	process(samples, num_samples, true);
+	const bool has_speech = !speeches.empty();
+
+	std::copy(saved_state.begin(), saved_state.end(), state[current_state].begin());
+	triggered = saved_triggered;
+	temp_end = saved_temp_end;
+	current_sample = saved_current_sample;
+	prev_end = saved_prev_end;
+	next_start = saved_next_start;
+	current_speech.start = saved_speech_start;
+	current_speech.end = saved_speech_end;
+	speeches.swap(saved_speeches);
+	saved_speeches.clear();
+	return has_speech;
+}
+
 void VadIterator::process(const std::vector<float> &input_wav, std::vector<float> &output_wav)
 {
 	try {
@@ -347,7 +561,7 @@ void VadIterator::collect_chunks(const std::vector<float> &input_wav,
 	}
 };
 
-const std::vector<timestamp_t> VadIterator::get_speech_timestamps() const
+const std::vector<timestamp_t> &VadIterator::get_speech_timestamps() const
 {
 	return speeches;
 }
@@ -372,6 +586,34 @@ VadIterator::VadIterator(const SileroString &ModelPath, int Sample_rate, int win
 			 int min_speech_duration_ms, float max_speech_duration_s)
 {
 	init_onnx_model(ModelPath);
+	init_params(Sample_rate, windows_frame_size, Threshold, min_silence_duration_ms,
+		    speech_pad_ms, min_speech_duration_ms, max_speech_duration_s);
+	init_io_binding();
+}
+
+VadIterator::VadIterator(std::shared_ptr<VadService> shared_service, float Threshold,
+			 int min_silence_duration_ms, int speech_pad_ms, int min_speech_duration_ms,
+			 float max_speech_duration_s)
+	: service(std::move(shared_service))
+{
+	const int Sample_rate = service->get_sample_rate();
+	init_params(Sample_rate, (int)service->get_window_size_samples() / (Sample_rate / 1000),
+		    Threshold, min_silence_duration_ms, speech_pad_ms, min_speech_duration_ms,
+		    max_speech_duration_s);
+	service->attach();
+}
+
+VadIterator::~VadIterator()
+{
+	if (service) {
+		service->detach();
+	}
+}
+
+void VadIterator::init_params(int Sample_rate, int windows_frame_size, float Threshold,
+			      int min_silence_duration_ms, int speech_pad_ms,
+			      int min_speech_duration_ms, float max_speech_duration_s)
+{
 	threshold = Threshold;
 	sample_rate = Sample_rate;
 	sr_per_ms = sample_rate / 1000;
@@ -391,7 +633,17 @@ VadIterator::VadIterator(const SileroString &ModelPath, int Sample_rate, int win
 	input_node_dims[0] = 1;
 	input_node_dims[1] = window_size_samples;
 
-	_state.resize(size_state);
+	state[0].assign(size_state, 0.0f);
+	state[1].assign(size_state, 0.0f);
 	sr.resize(1);
 	sr[0] = sample_rate;
-};
+	speeches.reserve(16);
+	saved_speeches.reserve(16);
+	stream_window.resize(window_size_samples);
+	saved_state.resize(size_state);
+	// a 48 kHz packet of 1024 frames gives one window, leave room for a few
+	stream_batch.resize(8 * window_size_samples);
+	stream_probs.resize(8);
+	stream_gated.resize(8);
+	gate = EnergyGate(sample_rate);
+}
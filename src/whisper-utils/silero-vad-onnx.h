@@ -5,6 +5,9 @@
 #include <vector>
 #include <string>
 #include <limits>
+#include <memory>
+
+#include "energy-gate.h"
 
 #ifdef _WIN32
 typedef std::wstring SileroString;
@@ -31,10 +34,20 @@ private:
 	std::string format(const char *fmt, ...);
 };
 
+class VadService;
+
+enum VadEventType { VAD_EVENT_SPEECH_START = 0, VAD_EVENT_SPEECH_END };
+
+// Speech boundary found by the streaming API, at an absolute sample offset in the stream
+struct VadEvent {
+	VadEventType type;
+	uint64_t sample;
+};
+
 class VadIterator {
 private:
-	// OnnxRuntime resources
-	Ort::Env env;
+	// OnnxRuntime resources, unused when the model runs in a shared VadService
+	Ort::Env env{nullptr};
 	Ort::SessionOptions session_options;
 	std::shared_ptr<Ort::Session> session = nullptr;
 	Ort::AllocatorWithDefaultOptions allocator;
@@ -43,20 +56,61 @@ private:
 private:
 	void init_engine_threads(int inter_threads, int intra_threads);
 	void init_onnx_model(const SileroString &model_path);
+	void init_io_binding();
+	void init_params(int Sample_rate, int windows_frame_size, float Threshold,
+			 int min_silence_duration_ms, int speech_pad_ms, int min_speech_duration_ms,
+			 float max_speech_duration_s);
 	void reset_states(bool reset_state);
-	float predict_one(const std::vector<float> &data);
-	void predict(const std::vector<float> &data);
+	float predict_one(const float *data);
+	float predict_one_unbound(const float *data);
+	void predict(const float *data);
+	void advance(float speech_prob);
+	void stream_advance(float speech_prob, std::vector<VadEvent> &events);
 
 public:
 	void process(const std::vector<float> &input_wav, bool reset_state = true);
+	void process(const float *input_wav, size_t num_samples, bool reset_state = true);
 	void process(const std::vector<float> &input_wav, std::vector<float> &output_wav);
 	void collect_chunks(const std::vector<float> &input_wav, std::vector<float> &output_wav);
-	const std::vector<timestamp_t> get_speech_timestamps() const;
+	const std::vector<timestamp_t> &get_speech_timestamps() const;
 	void drop_chunks(const std::vector<float> &input_wav, std::vector<float> &output_wav);
 	void set_threshold(float threshold_) { this->threshold = threshold_; }
 
 	int64_t get_window_size_samples() const { return window_size_samples; }
 
+	/*
+	 * Streaming API. Audio is fed in chunks of any size as it arrives; every sample is
+	 * classified exactly once and the LSTM state and speech bookkeeping carry over between
+	 * calls. Speech start and end are reported as events with absolute sample offsets counted
+	 * from stream_reset(). Samples that do not fill a whole window wait for the next call.
+	 */
+	void stream_reset(uint64_t start_sample = 0);
+	void stream_process(const float *samples, size_t num_samples,
+			    std::vector<VadEvent> &events);
+	// Offset of the next sample to feed
+	uint64_t stream_end() const { return stream_base + current_sample + stream_pending; }
+	// Offset up to which the audio is classified
+	uint64_t stream_classified_end() const { return stream_base + current_sample; }
+	bool stream_in_speech() const { return triggered; }
+	// End of the latest window with a speech probability over the threshold
+	uint64_t stream_voiced_end() const { return stream_voiced; }
+
+	/**
+	 * @brief One-off check whether the audio contains speech. The stream is not affected.
+	 */
+	bool detect_speech(const float *samples, size_t num_samples);
+
+	// Run the model through the preallocated IoBinding (default) or by creating the tensors
+	// for every window. The latter is the fallback when the binding cannot be set up.
+	bool set_io_binding(bool enable);
+	bool io_binding_enabled() const { return use_io_binding; }
+
+	// Skip the model for the windows of the stream the energy gate finds clearly silent, they
+	// count as no speech
+	void set_energy_gate(bool enable) { use_energy_gate = enable; }
+	bool energy_gate_enabled() const { return use_energy_gate; }
+	uint64_t gated_window_count() const { return gated_windows; }
+
 private:
 	// model config
 	int64_t window_size_samples; // Assign when init, support 256 512 768 for 8k; 512 1024 1536 for 16k.
@@ -75,13 +129,33 @@ private:
 	unsigned int temp_end = 0;
 	unsigned int current_sample = 0;
 	// MAX 4294967295 samples / 8sample per ms / 1000 / 60 = 8947 minutes
-	int prev_end;
+	int prev_end = 0;
 	int next_start = 0;
 
 	//Output timestamp
 	std::vector<timestamp_t> speeches;
 	timestamp_t current_speech;
 
+	// streaming: offset of current_sample 0 in the stream, samples of an incomplete window and
+	// whether the start of the current speech was reported
+	uint64_t stream_base = 0;
+	std::vector<float> stream_window;
+	size_t stream_pending = 0;
+	bool stream_start_reported = false;
+	uint64_t stream_voiced = 0;
+	// complete windows of a stream_process() call and their probabilities, so that they go to
+	// the shared service in one request
+	std::vector<float> stream_batch;
+	std::vector<float> stream_probs;
+	// energy gate in front of the model, streaming API only
+	EnergyGate gate;
+	bool use_energy_gate = false;
+	std::vector<char> stream_gated;
+	uint64_t gated_windows = 0;
+	// scratch for detect_speech()
+	std::vector<float> saved_state;
+	std::vector<timestamp_t> saved_speeches;
+
 	// Onnx model
 	// Inputs
 	std::vector<Ort::Value> ort_inputs;
@@ -89,7 +163,10 @@ private:
 	std::vector<const char *> input_node_names = {"input", "state", "sr"};
 	std::vector<float> input;
 	unsigned int size_state = 2 * 1 * 128; // It's FIXED.
-	std::vector<float> _state;
+	// The LSTM state ping-pongs between two buffers: a run reads state[current_state] and
+	// writes the next state to state[current_state ^ 1]
+	std::vector<float> state[2];
+	int current_state = 0;
 	std::vector<int64_t> sr;
 
 	int64_t input_node_dims[2] = {};
@@ -99,6 +176,20 @@ private:
 	// Outputs
 	std::vector<Ort::Value> ort_outputs;
 	std::vector<const char *> output_node_names = {"output", "stateN"};
+	float output_prob = 0.0f;
+	const int64_t output_node_dims[2] = {1, 1};
+
+	// Tensors over the buffers above, bound once, one binding per state direction
+	Ort::Value input_tensor{nullptr};
+	Ort::Value state_tensors[2] = {Ort::Value{nullptr}, Ort::Value{nullptr}};
+	Ort::Value sr_tensor{nullptr};
+	Ort::Value output_tensor{nullptr};
+	std::unique_ptr<Ort::IoBinding> io_bindings[2];
+	Ort::RunOptions run_options;
+	bool use_io_binding = false;
+
+	// shared session, see vad-service.h. The LSTM state stays in state[current_state]
+	std::shared_ptr<VadService> service;
 
 public:
 	// Construction
@@ -108,8 +199,17 @@ public:
 		    int min_speech_duration_ms = 32,
 		    float max_speech_duration_s = std::numeric_limits<float>::infinity());
 
+	// Runs the model in a shared VadService, with its sample rate and window size
+	VadIterator(std::shared_ptr<VadService> shared_service, float Threshold = 0.5,
+		    int min_silence_duration_ms = 0, int speech_pad_ms = 32,
+		    int min_speech_duration_ms = 32,
+		    float max_speech_duration_s = std::numeric_limits<float>::infinity());
+
 	// Default constructor
 	VadIterator() = default;
+	~VadIterator();
+
+	bool uses_shared_service() const { return service != nullptr; }
 };
 
 #endif // SILERO_VAD_ONNX_H
@@ -4,12 +4,157 @@
 #include "transcription-filter-data.h"
 
 #include "vad-processing.h"
+#include "vad-service.h"
+
+#include <algorithm>
 
 #ifdef _WIN32
 #define NOMINMAX
 #include <Windows.h>
 #endif
 
+/**
+ * @brief Converts the first num_frames of gf->copy_buffers to 16 kHz mono.
+ *
+ * @return Pointer to the converted samples, valid until the next call.
+ */
+static const float *resample_copy_buffers(transcription_filter_data *gf, uint32_t num_frames,
+					  uint32_t &resampled_frames)
+{
+	float *resampled_16khz[MAX_PREPROC_CHANNELS];
+	uint64_t ts_offset;
+	if (gf->decimator.is_initialized()) {
+		// integer ratio: downmix and decimate in one pass
+		ProfileScope("decimate");
+		resampled_16khz[0] = gf->decimated_buffer.data();
+		resampled_frames = (uint32_t)gf->decimator.process(gf->copy_buffers, num_frames,
+								   resampled_16khz[0]);
+	} else {
+		ProfileScope("resample");
+		audio_resampler_resample(gf->resampler_to_whisper, (uint8_t **)resampled_16khz,
+					 &resampled_frames, &ts_offset,
+					 (const uint8_t **)gf->copy_buffers, num_frames);
+	}
+	return resampled_16khz[0];
+}
+
+/**
+ * @brief Applies gf->overload_policy when the input ring holds more than gf->max_backlog_ms.
+ *
+ * Audio over the limit that is kept (speech with the drop silence policy) is resampled into
+ * gf->resampled_buffer, and the timestamp offsets are updated for it. The kept audio is
+ * contiguous in the whisper buffer, so the silence dropped between two kept chunks is carried
+ * into the start offset: the samples then line up with the capture time of the newest audio.
+ *
+ * @param gap_ns Receives the duration dropped after the last kept chunk, for the caller to
+ * carry into the start offset when more audio follows.
+ */
+static void enforce_backlog_limit(transcription_filter_data *gf,
+				  uint64_t &start_timestamp_offset_ns,
+				  uint64_t &end_timestamp_offset_ns, uint64_t &gap_ns)
+{
+	gap_ns = 0;
+	const size_t backlog_frames = gf->input_ring.frames_available();
+	gf->input_backlog_ms = (uint64_t)backlog_frames * 1000 / gf->sample_rate;
+
+	const size_t limit_frames = (size_t)gf->max_backlog_ms * gf->sample_rate / 1000;
+	if (backlog_frames <= limit_frames) {
+		if (gf->overload_active && backlog_frames <= limit_frames / 2) {
+			obs_log(LOG_INFO,
+				"Transcription caught up: %llu ms backlog, %llu ms of audio dropped so far",
+				(unsigned long long)gf->input_backlog_ms.load(),
+				(unsigned long long)gf->overload_dropped_ms.load());
+			gf->overload_active = false;
+		}
+		return;
+	}
+
+	if (!gf->overload_active) {
+		obs_log(LOG_WARNING,
+			"Transcription is falling behind: %llu ms backlog (limit %d ms), policy %d",
+			(unsigned long long)gf->input_backlog_ms.load(), gf->max_backlog_ms,
+			gf->overload_policy);
+		gf->overload_active = true;
+	}
+
+	size_t dropped_frames = 0;
+	bool kept_audio = false;
+	if (gf->overload_policy == OVERLOAD_POLICY_DROP_OLDEST) {
+		dropped_frames = gf->input_ring.skip(backlog_frames - limit_frames);
+	} else {
+		if (gf->overload_policy == OVERLOAD_POLICY_DROP_SILENCE) {
+			// scan the audio over the limit, oldest first, in chunks of about a second.
+			// Chunks are whole packets: the last one rounds the scan up to the end of
+			// its packet.
+			size_t remaining = backlog_frames - limit_frames;
+			while (remaining > 0) {
+				const size_t packet_frames = gf->input_ring.front_packet_frames();
+				const size_t max_chunk = std::min<size_t>(
+					std::max<size_t>(
+						std::min<size_t>(remaining, gf->sample_rate),
+						packet_frames),
+					gf->frames);
+				transcription_filter_audio_info first_info = {0, 0};
+				transcription_filter_audio_info last_info = {0, 0};
+				const size_t chunk_frames =
+					gf->input_ring.pop(gf->copy_buffers, max_chunk,
+							   first_info, last_info);
+				if (chunk_frames == 0) {
+					break;
+				}
+				remaining -= std::min(remaining, chunk_frames);
+
+				uint32_t resampled_frames = 0;
+				const float *resampled = resample_copy_buffers(
+					gf, (uint32_t)chunk_frames, resampled_frames);
+				bool has_speech = true;
+				if (gf->vad) {
+					ProfileScope("vad->process");
+					has_speech =
+						gf->vad->detect_speech(resampled, resampled_frames);
+				}
+				if (!has_speech) {
+					dropped_frames += chunk_frames;
+					if (kept_audio) {
+						gap_ns += chunk_frames * 1000000000ULL /
+							  gf->sample_rate;
+					}
+					continue;
+				}
+				// keep the speech, it is processed with the rest of the input
+				deque_push_back(&gf->resampled_buffer, resampled,
+						resampled_frames * sizeof(float));
+				if (!kept_audio) {
+					start_timestamp_offset_ns = first_info.timestamp_offset_ns;
+					kept_audio = true;
+				}
+				start_timestamp_offset_ns += gap_ns;
+				gap_ns = 0;
+				end_timestamp_offset_ns = last_info.timestamp_offset_ns +
+							  last_info.frames * 1000000000ULL /
+								  gf->sample_rate;
+			}
+		}
+		// hard limit for the policies that keep audio
+		const size_t backlog_now = gf->input_ring.frames_available();
+		if (backlog_now > 2 * limit_frames) {
+			const size_t skipped_frames =
+				gf->input_ring.skip(backlog_now - limit_frames);
+			dropped_frames += skipped_frames;
+			if (kept_audio) {
+				gap_ns += skipped_frames * 1000000000ULL / gf->sample_rate;
+			}
+		}
+	}
+
+	if (dropped_frames > 0) {
+		const uint64_t dropped_ms = (uint64_t)dropped_frames * 1000 / gf->sample_rate;
+		gf->overload_dropped_ms += dropped_ms;
+		obs_log(gf->log_level, "Overload: dropped %llu ms of input audio",
+			(unsigned long long)dropped_ms);
+	}
+}
+
 /**
  * @brief Extracts audio data from the buffer, resamples it, and updates timestamp offsets.
  *
@@ -25,68 +170,56 @@ int get_data_from_buf_and_resample(transcription_filter_data *gf,
 				   uint64_t &start_timestamp_offset_ns,
 				   uint64_t &end_timestamp_offset_ns)
 {
-	uint32_t num_frames_from_infos = 0;
-
-	{
-		// scoped lock the buffer mutex
-		std::lock_guard<std::mutex> lock(gf->whisper_buf_mutex);
-
-		if (gf->input_buffers[0].size == 0) {
-			return 1;
-		}
-
 #ifdef LOCALVOCAL_EXTRA_VERBOSE
-		obs_log(gf->log_level,
-			"segmentation: currently %lu bytes in the audio input buffer",
-			gf->input_buffers[0].size);
+	obs_log(gf->log_level, "segmentation: currently %lu frames in the audio input ring",
+		gf->input_ring.frames_available());
 #endif
 
-		// max number of frames is 10 seconds worth of audio
-		const size_t max_num_frames = gf->sample_rate * 10;
-
-		// pop all infos from the info buffer and mark the beginning timestamp from the first
-		// info as the beginning timestamp of the segment
-		struct transcription_filter_audio_info info_from_buf = {0};
-		const size_t size_of_audio_info = sizeof(transcription_filter_audio_info);
-		while (gf->info_buffer.size >= size_of_audio_info) {
-			deque_pop_front(&gf->info_buffer, &info_from_buf, size_of_audio_info);
-			num_frames_from_infos += info_from_buf.frames;
-			if (start_timestamp_offset_ns == 0) {
-				start_timestamp_offset_ns = info_from_buf.timestamp_offset_ns;
-			}
-			// Check if we're within the needed segment length
-			if (num_frames_from_infos > max_num_frames) {
-				// too big, push the last info into the buffer's front where it was
-				num_frames_from_infos -= info_from_buf.frames;
-				deque_push_front(&gf->info_buffer, &info_from_buf,
-						 size_of_audio_info);
-				break;
-			}
-		}
-		// calculate the end timestamp from the info plus the number of frames in the packet
-		end_timestamp_offset_ns = info_from_buf.timestamp_offset_ns +
-					  info_from_buf.frames * 1000000000 / gf->sample_rate;
-
-		if (start_timestamp_offset_ns > end_timestamp_offset_ns) {
-			// this may happen when the incoming media has a timestamp reset
-			// in this case, we should figure out the start timestamp from the end timestamp
-			// and the number of frames
-			start_timestamp_offset_ns =
-				end_timestamp_offset_ns -
-				num_frames_from_infos * 1000000000 / gf->sample_rate;
-		}
+	// max number of frames is 10 seconds worth of audio
+	const size_t max_num_frames = gf->sample_rate * 10;
+
+	const size_t resampled_before = gf->resampled_buffer.size;
+	uint64_t overload_gap_ns = 0;
+	enforce_backlog_limit(gf, start_timestamp_offset_ns, end_timestamp_offset_ns,
+			      overload_gap_ns);
+	const bool kept_overload_audio = gf->resampled_buffer.size > resampled_before;
+
+	// pop whole packets from the input ring and mark the beginning timestamp from the first
+	// packet as the beginning timestamp of the segment
+	struct transcription_filter_audio_info first_info = {0, 0};
+	struct transcription_filter_audio_info last_info = {0, 0};
+	const uint32_t num_frames_from_infos = (uint32_t)gf->input_ring.pop(
+		gf->copy_buffers, max_num_frames, first_info, last_info);
+	if (num_frames_from_infos == 0) {
+		return kept_overload_audio ? 0 : 1;
+	}
 
-		for (size_t c = 0; c < gf->channels; c++) {
-			// zero the rest of copy_buffers
-			memset(gf->copy_buffers[c], 0, gf->frames * sizeof(float));
-		}
+	const uint64_t overruns = gf->input_ring.overrun_count();
+	if (overruns != gf->input_ring_overruns_reported) {
+		obs_log(LOG_WARNING,
+			"Input audio ring overrun: %llu packets (%llu frames) dropped so far, high water mark %.1f ms",
+			(unsigned long long)overruns,
+			(unsigned long long)gf->input_ring.dropped_frame_count(),
+			(float)gf->input_ring.high_water_mark() * 1000.0f / (float)gf->sample_rate);
+		gf->input_ring_overruns_reported = overruns;
+	}
 
-		/* Pop from input deque */
-		for (size_t c = 0; c < gf->channels; c++) {
-			// Push the new data to copy_buffers[c]
-			deque_pop_front(&gf->input_buffers[c], gf->copy_buffers[c],
-					num_frames_from_infos * sizeof(float));
-		}
+	if (start_timestamp_offset_ns == 0) {
+		start_timestamp_offset_ns = first_info.timestamp_offset_ns;
+	} else {
+		// the audio dropped between the kept overload audio and this audio
+		start_timestamp_offset_ns += overload_gap_ns;
+	}
+	// calculate the end timestamp from the info plus the number of frames in the packet
+	end_timestamp_offset_ns =
+		last_info.timestamp_offset_ns + last_info.frames * 1000000000ULL / gf->sample_rate;
+
+	if (start_timestamp_offset_ns > end_timestamp_offset_ns) {
+		// this may happen when the incoming media has a timestamp reset
+		// in this case, we should figure out the start timestamp from the end timestamp
+		// and the number of frames
+		start_timestamp_offset_ns =
+			end_timestamp_offset_ns - num_frames_from_infos * 1000000000ULL / gf->sample_rate;
 	}
 
 #ifdef LOCALVOCAL_EXTRA_VERBOSE
@@ -96,19 +229,11 @@ int get_data_from_buf_and_resample(transcription_filter_data *gf,
 
 	{
 		// resample to 16kHz
-		float *resampled_16khz[MAX_PREPROC_CHANNELS];
-		uint32_t resampled_16khz_frames;
-		uint64_t ts_offset;
-		{
-			ProfileScope("resample");
-			audio_resampler_resample(gf->resampler_to_whisper,
-						 (uint8_t **)resampled_16khz,
-						 &resampled_16khz_frames, &ts_offset,
-						 (const uint8_t **)gf->copy_buffers,
-						 (uint32_t)num_frames_from_infos);
-		}
+		uint32_t resampled_16khz_frames = 0;
+		const float *resampled_16khz =
+			resample_copy_buffers(gf, num_frames_from_infos, resampled_16khz_frames);
 
-		deque_push_back(&gf->resampled_buffer, resampled_16khz[0],
+		deque_push_back(&gf->resampled_buffer, resampled_16khz,
 				resampled_16khz_frames * sizeof(float));
 #ifdef LOCALVOCAL_EXTRA_VERBOSE
 		obs_log(gf->log_level,
@@ -122,6 +247,156 @@ int get_data_from_buf_and_resample(transcription_filter_data *gf,
 	return 0;
 }
 
+/**
+ * @brief Moves all the samples in gf->resampled_buffer to the back of gf->whisper_buffer.
+ *
+ * The samples are popped straight into the whisper buffer storage, without an intermediate copy.
+ *
+ * @param gf Pointer to the transcription filter data structure.
+ */
+static void move_resampled_to_whisper_buffer(transcription_filter_data *gf)
+{
+	const size_t num_frames = gf->resampled_buffer.size / sizeof(float);
+	if (num_frames == 0) {
+		return;
+	}
+	float *dst = gf->whisper_buffer.reserve_back(num_frames);
+	if (dst == nullptr) {
+		deque_pop_front(&gf->resampled_buffer, nullptr, num_frames * sizeof(float));
+		return;
+	}
+	deque_pop_front(&gf->resampled_buffer, dst, num_frames * sizeof(float));
+	gf->whisper_buffer.commit_back(num_frames);
+}
+
+/**
+ * @brief Capture time of a sample of the whisper buffer, in ms since the start of processing.
+ *
+ * Derived from the timestamp of the most recent input chunk (the anchor) and the distance in
+ * samples to it.
+ */
+static uint64_t stream_sample_ts_ms(const transcription_filter_data *gf, uint64_t sample)
+{
+	const int64_t delta_ms = ((int64_t)sample - (int64_t)gf->stream_anchor_sample) * 1000 /
+				 WHISPER_SAMPLE_RATE;
+	return (uint64_t)std::max<int64_t>((int64_t)gf->stream_anchor_ts_ms + delta_ms, 0);
+}
+
+/**
+ * @brief Runs the energy gate over the whisper buffer windows it has not seen yet.
+ *
+ * Used when the VAD does not run on the audio, to find segments that are silent throughout.
+ */
+static void gate_whisper_buffer(transcription_filter_data *gf)
+{
+	const size_t window = WHISPER_SAMPLE_RATE * 32 / 1000;
+	const uint64_t front = gf->whisper_buffer.front_position();
+	const uint64_t back = gf->whisper_buffer.back_position();
+	if (gf->gate_position < front || gf->gate_position > back) {
+		// the buffer was cleared or its start was dropped
+		gf->gate_position = front;
+	}
+	const float *data = gf->whisper_buffer.data();
+	for (; gf->gate_position + window <= back; gf->gate_position += window) {
+		if (!gf->segment_gate.classify(data + (gf->gate_position - front), window)) {
+			gf->last_voiced_sample = gf->gate_position + window;
+		}
+	}
+}
+
+/**
+ * @brief Computes the log-mel frames of the new samples of the whisper buffer.
+ */
+static void update_mel_cache(transcription_filter_data *gf, uint64_t first_sample,
+			     size_t num_samples)
+{
+	if (gf->mel_cache.end_position() != first_sample) {
+		// the cache does not continue the buffer (buffers cleared or the setting was off)
+		gf->mel_cache.reset(first_sample);
+	}
+	const uint64_t front = gf->whisper_buffer.front_position();
+	gf->mel_cache.discard_before(front);
+	gf->mel_cache.append(gf->whisper_buffer.data() + (first_sample - front), num_samples);
+}
+
+/**
+ * @brief Moves the resampled audio to the whisper buffer and classifies it with the streaming
+ * VAD, which sees every sample exactly once. The VAD events are left in gf->vad_events.
+ *
+ * @param start_timestamp_offset_ns Capture time of the first new sample.
+ * @param run_vad Whether to run the VAD on the new samples.
+ * @return The number of samples added to the whisper buffer.
+ */
+static size_t ingest_resampled_audio(transcription_filter_data *gf,
+				     uint64_t start_timestamp_offset_ns, bool run_vad)
+{
+	const uint64_t first_sample = gf->whisper_buffer.back_position();
+	move_resampled_to_whisper_buffer(gf);
+	const size_t num_samples = (size_t)(gf->whisper_buffer.back_position() - first_sample);
+	gf->stream_anchor_sample = first_sample;
+	gf->stream_anchor_ts_ms = start_timestamp_offset_ns / 1000000;
+
+	gf->vad_events.clear();
+	if (gf->energy_gate_enabled && gf->vad_mode != VAD_MODE_ACTIVE) {
+		ProfileScope("energy gate");
+		gate_whisper_buffer(gf);
+	}
+	if (gf->incremental_mel && gf->mel_cache.is_initialized() && num_samples > 0) {
+		ProfileScope("mel cache");
+		update_mel_cache(gf, first_sample, num_samples);
+	}
+	if (!run_vad || !gf->vad || num_samples == 0) {
+		return num_samples;
+	}
+	if (gf->vad->stream_end() != first_sample) {
+		// the stream does not continue the buffer (buffers cleared, VAD swapped or not run
+		// until now): restart it at the new audio
+		gf->vad->stream_reset(first_sample);
+	}
+	ProfileScope("vad->stream_process");
+	const uint64_t gated_before = gf->vad->gated_window_count();
+	gf->vad->set_energy_gate(gf->energy_gate_enabled);
+	gf->vad->stream_process(gf->whisper_buffer.data() +
+					(first_sample - gf->whisper_buffer.front_position()),
+				num_samples, gf->vad_events);
+	gf->gated_vad_windows += gf->vad->gated_window_count() - gated_before;
+	return num_samples;
+}
+
+/**
+ * @brief End of the latest voiced audio of the whisper buffer: found by the VAD when it runs on
+ * the audio, or by the energy gate. Without either all the audio counts as voiced.
+ */
+static uint64_t latest_voiced_sample(const transcription_filter_data *gf)
+{
+	if (gf->vad && gf->vad_mode != VAD_MODE_DISABLED) {
+		return gf->vad->stream_voiced_end();
+	}
+	if (gf->energy_gate_enabled) {
+		return gf->last_voiced_sample;
+	}
+	return gf->whisper_buffer.back_position();
+}
+
+/**
+ * @brief Whether a due partial is skipped because no voiced audio arrived since the last
+ * partial, its text could only be the same. Counts the skipped partials.
+ */
+static bool skip_partial_without_speech(transcription_filter_data *gf)
+{
+	if (!gf->adaptive_partial_latency) {
+		return false;
+	}
+	const uint64_t voiced = latest_voiced_sample(gf);
+	if (voiced > gf->partial_voiced_sample) {
+		gf->partial_voiced_sample = voiced;
+		return false;
+	}
+	gf->partials_skipped++;
+	obs_log(gf->log_level, "Partial skipped: no new speech since the last partial");
+	return true;
+}
+
 vad_state vad_disabled_segmentation(transcription_filter_data *gf, vad_state last_vad_state)
 {
 	// get data from buffer and resample
@@ -132,10 +407,10 @@ vad_state vad_disabled_segmentation(transcription_filter_data *gf, vad_state las
 						       end_timestamp_offset_ns);
 	if (ret != 0) {
 		// if there's data on the whisper buffer - run inference as "final" segment
-		if (gf->whisper_buffer.size > 0) {
+		if (!gf->whisper_buffer.empty()) {
 			obs_log(gf->log_level,
-				"VAD disabled: no new input but whisper buffer has %lu bytes, run inference",
-				gf->whisper_buffer.size);
+				"VAD disabled: no new input but whisper buffer has %lu frames, run inference",
+				gf->whisper_buffer.size());
 			run_inference_and_callbacks(gf, last_vad_state.start_ts_offest_ms,
 						    last_vad_state.end_ts_offset_ms,
 						    VAD_STATE_WAS_OFF);
@@ -143,19 +418,17 @@ vad_state vad_disabled_segmentation(transcription_filter_data *gf, vad_state las
 		return last_vad_state;
 	}
 
-	// push the data into gf-whisper_buffer
-	deque_push_back(&gf->whisper_buffer, gf->resampled_buffer.data, gf->resampled_buffer.size);
-	// clear the resampled buffer
-	deque_pop_front(&gf->resampled_buffer, nullptr, gf->resampled_buffer.size);
+	// move the data from the resampled buffer into gf->whisper_buffer, no VAD
+	ingest_resampled_audio(gf, start_timestamp_offset_ns, false);
 
-	const uint64_t whisper_buf_samples = gf->whisper_buffer.size / sizeof(float);
+	const uint64_t whisper_buf_samples = gf->whisper_buffer.size();
 	const bool is_partial_segment =
 		whisper_buf_samples < (uint64_t)(gf->segment_duration * WHISPER_SAMPLE_RATE / 1000);
 
 #ifdef LOCALVOCAL_EXTRA_VERBOSE
 	obs_log(gf->log_level,
-		"VAD disabled: total %d frames (%lu bytes) in whisper buffer, state was %s new state is %s",
-		whisper_buf_samples, gf->whisper_buffer.size, last_vad_state.vad_on ? "ON" : "OFF",
+		"VAD disabled: total %d frames in whisper buffer, state was %s new state is %s",
+		whisper_buf_samples, last_vad_state.vad_on ? "ON" : "OFF",
 		is_partial_segment ? "PARTIAL" : "OFF");
 #endif
 
@@ -166,7 +439,7 @@ vad_state vad_disabled_segmentation(transcription_filter_data *gf, vad_state las
 		// the last partial segment end timestamp
 		const uint64_t unprocessed_length_ms =
 			end_ts_offset_ms - last_vad_state.last_partial_segment_end_ts;
-		if (unprocessed_length_ms > (uint64_t)gf->partial_latency) {
+		if (unprocessed_length_ms > (uint64_t)partial_interval_ms(gf)) {
 			if (gf->partial_transcription) {
 				obs_log(gf->log_level,
 					"VAD disabled: partial segment with %lu ms unprocessed audio. start %lu, end %lu",
@@ -210,149 +483,110 @@ vad_state vad_based_segmentation(transcription_filter_data *gf, vad_state last_v
 		return last_vad_state;
 	}
 
-	const size_t vad_window_size_samples = gf->vad->get_window_size_samples() * sizeof(float);
-	const size_t min_vad_buffer_size = vad_window_size_samples * 8;
-	if (gf->resampled_buffer.size < min_vad_buffer_size)
-		return last_vad_state;
+	const uint64_t first_new_sample = gf->whisper_buffer.back_position();
+	const size_t num_new_samples = ingest_resampled_audio(gf, start_timestamp_offset_ns, true);
 
-	size_t vad_num_windows = gf->resampled_buffer.size / vad_window_size_samples;
+	// take at least 100ms of audio before the speech, if available
+	const uint64_t pre_roll = WHISPER_SAMPLE_RATE / 10;
 
-	std::vector<float> vad_input;
-	vad_input.resize(vad_num_windows * gf->vad->get_window_size_samples());
-	deque_pop_front(&gf->resampled_buffer, vad_input.data(), vad_input.size() * sizeof(float));
+	vad_state current_vad_state = last_vad_state;
+	bool started_in_this_chunk = false;
+	for (const VadEvent &event : gf->vad_events) {
+		const uint64_t buffer_start = gf->whisper_buffer.front_position();
+		if (event.type == VAD_EVENT_SPEECH_START) {
+			if (current_vad_state.vad_on) {
+				continue;
+			}
+			// drop the silence before the speech, except the pre-roll
+			const uint64_t segment_start = std::max(
+				event.sample > pre_roll ? event.sample - pre_roll : 0, buffer_start);
+			gf->whisper_buffer.pop_front((size_t)(segment_start - buffer_start));
+			current_vad_state.vad_on = true;
+			current_vad_state.start_ts_offest_ms =
+				stream_sample_ts_ms(gf, segment_start);
+			current_vad_state.last_partial_segment_end_ts = 0;
+			started_in_this_chunk = true;
+			obs_log(gf->log_level, "VAD speech start at sample %llu, ts %llu ms",
+				(unsigned long long)event.sample,
+				(unsigned long long)current_vad_state.start_ts_offest_ms);
+			continue;
+		}
 
-#ifdef LOCALVOCAL_EXTRA_VERBOSE
-	obs_log(gf->log_level, "sending %d frames to vad, %d windows, reset state? %s",
-		vad_input.size(), vad_num_windows, (!last_vad_state.vad_on) ? "yes" : "no");
-#endif
-	{
-		ProfileScope("vad->process");
-		gf->vad->process(vad_input, !last_vad_state.vad_on);
+		if (!current_vad_state.vad_on) {
+			continue;
+		}
+		// segment end: send the audio up to it to inference, the rest stays in the buffer
+		const size_t segment_samples =
+			event.sample > buffer_start ? (size_t)(event.sample - buffer_start) : 0;
+		const uint64_t segment_end_ts = stream_sample_ts_ms(gf, event.sample);
+		obs_log(gf->log_level,
+			"VAD segment end -> send to inference. %lu frames / %lu ms, start %llu, end %llu",
+			segment_samples, segment_samples * 1000 / WHISPER_SAMPLE_RATE,
+			current_vad_state.start_ts_offest_ms, segment_end_ts);
+		if (segment_samples > 0) {
+			run_inference_and_callbacks(gf, current_vad_state.start_ts_offest_ms,
+						    segment_end_ts,
+						    started_in_this_chunk ? VAD_STATE_WAS_OFF
+									  : VAD_STATE_WAS_ON,
+						    segment_samples);
+		}
+		current_vad_state = {false, segment_end_ts, segment_end_ts, 0};
 	}
 
-	const uint64_t start_ts_offset_ms = start_timestamp_offset_ns / 1000000;
-	const uint64_t end_ts_offset_ms = end_timestamp_offset_ns / 1000000;
-
-	vad_state current_vad_state = {false, start_ts_offset_ms, end_ts_offset_ms,
-				       last_vad_state.last_partial_segment_end_ts};
-
-	std::vector<timestamp_t> stamps = gf->vad->get_speech_timestamps();
-	if (stamps.size() == 0) {
+	if (!current_vad_state.vad_on) {
 #ifdef LOCALVOCAL_EXTRA_VERBOSE
-		obs_log(gf->log_level, "VAD detected no speech in %u frames", vad_input.size());
+		obs_log(gf->log_level, "VAD detected no speech in %zu frames", num_new_samples);
 #endif
-		if (last_vad_state.vad_on) {
-			obs_log(gf->log_level, "Last VAD was ON: segment end -> send to inference");
-			run_inference_and_callbacks(gf, last_vad_state.start_ts_offest_ms,
-						    last_vad_state.end_ts_offset_ms,
-						    VAD_STATE_WAS_ON);
-			current_vad_state.last_partial_segment_end_ts = 0;
-		}
-
-		if (gf->enable_audio_chunks_callback) {
-			audio_chunk_callback(gf, vad_input.data(), vad_input.size(),
-					     VAD_STATE_IS_OFF,
+		if (gf->enable_audio_chunks_callback && gf->vad_events.empty() &&
+		    num_new_samples > 0) {
+			// nothing was popped, the new samples are at the end of the buffer
+			audio_chunk_callback(gf,
+					     gf->whisper_buffer.data() +
+						     (first_new_sample -
+						      gf->whisper_buffer.front_position()),
+					     num_new_samples, VAD_STATE_IS_OFF,
 					     {DETECTION_RESULT_SILENCE,
 					      "[silence]",
-					      current_vad_state.start_ts_offest_ms,
-					      current_vad_state.end_ts_offset_ms,
+					      stream_sample_ts_ms(gf, first_new_sample),
+					      end_timestamp_offset_ns / 1000000,
 					      {}});
 		}
 
+		// no speech: only keep the pre-roll before the audio the VAD has not classified
+		const uint64_t classified_end = gf->vad ? gf->vad->stream_classified_end()
+							: gf->whisper_buffer.back_position();
+		const uint64_t keep_from = std::max(
+			classified_end > pre_roll ? classified_end - pre_roll : 0,
+			gf->whisper_buffer.front_position());
+		gf->whisper_buffer.pop_front(
+			(size_t)(keep_from - gf->whisper_buffer.front_position()));
+		current_vad_state.start_ts_offest_ms = stream_sample_ts_ms(gf, keep_from);
+		current_vad_state.end_ts_offset_ms = end_timestamp_offset_ns / 1000000;
 		return current_vad_state;
 	}
 
-	// process vad segments
-	for (size_t i = 0; i < stamps.size(); i++) {
-		int start_frame = stamps[i].start;
-		if (i > 0) {
-			// if this is not the first segment, start from the end of the previous segment
-			start_frame = stamps[i - 1].end;
-		} else {
-			// take at least 100ms of audio before the first speech segment, if available
-			start_frame = std::max(0, start_frame - WHISPER_SAMPLE_RATE / 10);
-		}
-
-		int end_frame = stamps[i].end;
-		// if (i == stamps.size() - 1 && stamps[i].end < (int)vad_input.size()) {
-		// 	// take at least 100ms of audio after the last speech segment, if available
-		// 	end_frame = std::min(end_frame + WHISPER_SAMPLE_RATE / 10,
-		// 			     (int)vad_input.size());
-		// }
-
-		const int number_of_frames = end_frame - start_frame;
-
-		// push the data into gf-whisper_buffer
-		deque_push_back(&gf->whisper_buffer, vad_input.data() + start_frame,
-				number_of_frames * sizeof(float));
-
-		obs_log(gf->log_level,
-			"VAD segment %d/%d. pushed %d to %d (%d frames / %lu ms). current size: %lu bytes / %lu frames / %lu ms",
-			i, (stamps.size() - 1), start_frame, end_frame, number_of_frames,
-			number_of_frames * 1000 / WHISPER_SAMPLE_RATE, gf->whisper_buffer.size,
-			gf->whisper_buffer.size / sizeof(float),
-			gf->whisper_buffer.size / sizeof(float) * 1000 / WHISPER_SAMPLE_RATE);
-
-		// segment "end" is in the middle of the buffer, send it to inference
-		if (stamps[i].end < (int)vad_input.size()) {
-			// new "ending" segment (not up to the end of the buffer)
-			obs_log(gf->log_level, "VAD segment end -> send to inference");
-			// find the end timestamp of the segment
-			const uint64_t segment_end_ts =
-				start_ts_offset_ms + end_frame * 1000 / WHISPER_SAMPLE_RATE;
-			run_inference_and_callbacks(
-				gf, last_vad_state.start_ts_offest_ms, segment_end_ts,
-				last_vad_state.vad_on ? VAD_STATE_WAS_ON : VAD_STATE_WAS_OFF);
-			current_vad_state.vad_on = false;
-			current_vad_state.start_ts_offest_ms = current_vad_state.end_ts_offset_ms;
-			current_vad_state.end_ts_offset_ms = 0;
-			current_vad_state.last_partial_segment_end_ts = 0;
-			last_vad_state = current_vad_state;
-			continue;
-		}
-
-		// end not reached - speech is ongoing
-		current_vad_state.vad_on = true;
-		if (last_vad_state.vad_on) {
-			obs_log(gf->log_level,
-				"last vad state was: ON, start ts: %llu, end ts: %llu",
-				last_vad_state.start_ts_offest_ms, last_vad_state.end_ts_offset_ms);
-			current_vad_state.start_ts_offest_ms = last_vad_state.start_ts_offest_ms;
-		} else {
-			obs_log(gf->log_level,
-				"last vad state was: OFF, start ts: %llu, end ts: %llu. start_ts_offset_ms: %llu, start_frame: %d",
-				last_vad_state.start_ts_offest_ms, last_vad_state.end_ts_offset_ms,
-				start_ts_offset_ms, start_frame);
-			current_vad_state.start_ts_offest_ms =
-				start_ts_offset_ms + start_frame * 1000 / WHISPER_SAMPLE_RATE;
-		}
-		current_vad_state.end_ts_offset_ms =
-			start_ts_offset_ms + end_frame * 1000 / WHISPER_SAMPLE_RATE;
-		obs_log(gf->log_level,
-			"end not reached. vad state: ON, start ts: %llu, end ts: %llu",
-			current_vad_state.start_ts_offest_ms, current_vad_state.end_ts_offset_ms);
+	// speech is ongoing
+	current_vad_state.end_ts_offset_ms =
+		stream_sample_ts_ms(gf, gf->whisper_buffer.back_position());
 
-		last_vad_state = current_vad_state;
-
-		// if partial transcription is enabled, check if we should send a partial segment
-		if (!gf->partial_transcription) {
-			continue;
-		}
+	// if partial transcription is enabled, check if we should send a partial segment
+	if (!gf->partial_transcription) {
+		return current_vad_state;
+	}
 
-		// current length of audio in buffer
-		const uint64_t current_length_ms =
-			(current_vad_state.end_ts_offset_ms > 0
-				 ? current_vad_state.end_ts_offset_ms
-				 : current_vad_state.start_ts_offest_ms) -
-			(current_vad_state.last_partial_segment_end_ts > 0
+	// current length of audio in buffer
+	const uint64_t current_length_ms =
+		current_vad_state.end_ts_offset_ms -
+		std::min(current_vad_state.end_ts_offset_ms,
+			 current_vad_state.last_partial_segment_end_ts > 0
 				 ? current_vad_state.last_partial_segment_end_ts
 				 : current_vad_state.start_ts_offest_ms);
-		obs_log(gf->log_level, "current buffer length after last partial (%lu): %lu ms",
-			current_vad_state.last_partial_segment_end_ts, current_length_ms);
+	obs_log(gf->log_level, "current buffer length after last partial (%lu): %lu ms",
+		current_vad_state.last_partial_segment_end_ts, current_length_ms);
 
-		if (current_length_ms > (uint64_t)gf->partial_latency) {
-			current_vad_state.last_partial_segment_end_ts =
-				current_vad_state.end_ts_offset_ms;
+	if (current_length_ms > (uint64_t)partial_interval_ms(gf)) {
+		current_vad_state.last_partial_segment_end_ts = current_vad_state.end_ts_offset_ms;
+		if (!skip_partial_without_speech(gf)) {
 			// send partial segment to inference
 			obs_log(gf->log_level, "Partial segment -> send to inference");
 			run_inference_and_callbacks(gf, current_vad_state.start_ts_offest_ms,
@@ -377,15 +611,18 @@ vad_state hybrid_vad_segmentation(transcription_filter_data *gf, vad_state last_
 
 	last_vad_state.end_ts_offset_ms = end_timestamp_offset_ns / 1000000;
 
-	// extract the data from the resampled buffer with deque_pop_front into a temp buffer
-	// and then push it into the whisper buffer
-	const size_t resampled_buffer_size = gf->resampled_buffer.size;
-	std::vector<uint8_t> temp_buffer;
-	temp_buffer.resize(resampled_buffer_size);
-	deque_pop_front(&gf->resampled_buffer, temp_buffer.data(), resampled_buffer_size);
-	deque_push_back(&gf->whisper_buffer, temp_buffer.data(), resampled_buffer_size);
+	// move the data from the resampled buffer into the whisper buffer, the VAD only decides
+	// on the partials
+	ingest_resampled_audio(gf, start_timestamp_offset_ns, gf->partial_transcription);
+	for (const VadEvent &event : gf->vad_events) {
+		gf->last_speech_sample = std::max(gf->last_speech_sample, event.sample);
+	}
+	if (gf->vad && gf->vad->stream_in_speech()) {
+		gf->last_speech_sample =
+			std::max(gf->last_speech_sample, gf->vad->stream_classified_end());
+	}
 
-	obs_log(gf->log_level, "whisper buffer size: %lu bytes", gf->whisper_buffer.size);
+	obs_log(gf->log_level, "whisper buffer size: %lu frames", gf->whisper_buffer.size());
 
 	// use last_vad_state timestamps to calculate the duration of the current segment
 	if (last_vad_state.end_ts_offset_ms - last_vad_state.start_ts_offest_ms >=
@@ -411,39 +648,29 @@ vad_state hybrid_vad_segmentation(transcription_filter_data *gf, vad_state last_
 		obs_log(gf->log_level, "current buffer length after last partial (%lu): %lu ms",
 			last_vad_state.last_partial_segment_end_ts, current_length_ms);
 
-		if (current_length_ms > (uint64_t)gf->partial_latency) {
+		if (current_length_ms > (uint64_t)partial_interval_ms(gf)) {
 			// send partial segment to inference
 			obs_log(gf->log_level, "Partial segment -> send to inference");
 			last_vad_state.last_partial_segment_end_ts =
 				last_vad_state.end_ts_offset_ms;
 
-			// run vad on the current buffer
-			std::vector<float> vad_input;
-			vad_input.resize(gf->whisper_buffer.size / sizeof(float));
-			deque_peek_front(&gf->whisper_buffer, vad_input.data(),
-					 vad_input.size() * sizeof(float));
-
-			obs_log(gf->log_level, "sending %d frames to vad, %.1f ms",
-				vad_input.size(),
-				(float)vad_input.size() * 1000.0f / (float)WHISPER_SAMPLE_RATE);
-			{
-				ProfileScope("vad->process");
-				gf->vad->process(vad_input, true);
-			}
-
-			if (gf->vad->get_speech_timestamps().size() > 0) {
+			// the streaming VAD already classified the buffer as it came in
+			if (gf->last_speech_sample > gf->whisper_buffer.front_position()) {
 				// VAD detected speech in the partial segment
-				run_inference_and_callbacks(gf, last_vad_state.start_ts_offest_ms,
-							    last_vad_state.end_ts_offset_ms,
-							    VAD_STATE_PARTIAL);
+				if (!skip_partial_without_speech(gf)) {
+					run_inference_and_callbacks(
+						gf, last_vad_state.start_ts_offest_ms,
+						last_vad_state.end_ts_offset_ms, VAD_STATE_PARTIAL);
+				}
 			} else {
 				// VAD detected silence in the partial segment
 				obs_log(gf->log_level, "VAD detected silence in partial segment");
 				// pop the partial segment from the whisper buffer, save some audio for the next segment
-				const size_t num_bytes_to_keep =
-					(WHISPER_SAMPLE_RATE / 4) * sizeof(float);
-				deque_pop_front(&gf->whisper_buffer, nullptr,
-						gf->whisper_buffer.size - num_bytes_to_keep);
+				const size_t num_frames_to_keep = WHISPER_SAMPLE_RATE / 4;
+				if (gf->whisper_buffer.size() > num_frames_to_keep) {
+					gf->whisper_buffer.pop_front(gf->whisper_buffer.size() -
+								     num_frames_to_keep);
+				}
 			}
 		}
 	}
@@ -466,8 +693,10 @@ void initialize_vad(transcription_filter_data *gf, const char *silero_vad_model_
 	std::string silero_vad_model_path = silero_vad_model_file;
 	obs_log(gf->log_level, "Create silero VAD: %s", silero_vad_model_path.c_str());
 #endif
+	// all filters run the model in one shared session, batched when their calls overlap
+	std::shared_ptr<VadService> service = VadService::acquire(
+		silero_vad_model_path, WHISPER_SAMPLE_RATE, 32 * WHISPER_SAMPLE_RATE / 1000);
 	// roughly following https://github.com/SYSTRAN/faster-whisper/blob/master/faster_whisper/vad.py
 	// for silero vad parameters
-	gf->vad.reset(new VadIterator(silero_vad_model_path, WHISPER_SAMPLE_RATE, 32, 0.5f, 100,
-				      100, 100));
+	gf->vad.reset(new VadIterator(service, 0.5f, 100, 100, 100));
 }
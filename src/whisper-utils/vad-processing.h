@@ -30,6 +30,22 @@ enum VadState { VAD_STATE_WAS_ON = 0, VAD_STATE_WAS_OFF, VAD_STATE_IS_OFF, VAD_S
  */
 enum VadMode { VAD_MODE_ACTIVE = 0, VAD_MODE_HYBRID, VAD_MODE_DISABLED };
 
+/**
+ * @enum OverloadPolicy
+ * @brief What the whisper thread does when the unprocessed input exceeds the backlog limit.
+ *
+ * - OVERLOAD_POLICY_DROP_OLDEST: drop the oldest audio down to the limit.
+ * - OVERLOAD_POLICY_DROP_SILENCE: drop the audio over the limit in which VAD finds no speech.
+ * - OVERLOAD_POLICY_FAST_DECODING: decode with a cheaper profile until the backlog is cleared.
+ *
+ * With the last two the oldest audio is still dropped once the backlog reaches twice the limit.
+ */
+enum OverloadPolicy {
+	OVERLOAD_POLICY_DROP_OLDEST = 0,
+	OVERLOAD_POLICY_DROP_SILENCE,
+	OVERLOAD_POLICY_FAST_DECODING
+};
+
 /**
  * @struct vad_state
  * @brief Structure representing the state of VAD.
@@ -0,0 +1,293 @@
+#include "vad-service.h"
+
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+#include <tuple>
+
+#include <obs.h>
+#include "plugin-support.h"
+
+VadEngine VadService::default_engine()
+{
+#ifdef LOCALVOCAL_NATIVE_VAD
+	return VAD_ENGINE_NATIVE;
+#else
+	return VAD_ENGINE_ONNXRUNTIME;
+#endif
+}
+
+std::shared_ptr<VadService> VadService::acquire(const SileroString &model_path, int sample_rate,
+						int64_t window_size_samples, VadEngine engine)
+{
+	static std::mutex services_mutex;
+	static std::map<std::tuple<SileroString, int, int64_t, VadEngine>,
+			std::weak_ptr<VadService>>
+		services;
+
+	std::lock_guard<std::mutex> lock(services_mutex);
+	std::weak_ptr<VadService> &entry =
+		services[std::make_tuple(model_path, sample_rate, window_size_samples, engine)];
+	std::shared_ptr<VadService> service = entry.lock();
+	if (service) {
+		return service;
+	}
+
+	if (engine == VAD_ENGINE_NATIVE) {
+		if (sample_rate != SileroVadNative::SAMPLE_RATE ||
+		    window_size_samples != (int64_t)SileroVadNative::WINDOW_SIZE) {
+			obs_log(LOG_WARNING,
+				"VAD: the built-in engine only runs %d Hz windows of %d samples, using ONNX Runtime",
+				SileroVadNative::SAMPLE_RATE, (int)SileroVadNative::WINDOW_SIZE);
+		} else {
+			try {
+				service = std::make_shared<VadService>(model_path, sample_rate,
+								       window_size_samples,
+								       VAD_ENGINE_NATIVE);
+			} catch (const std::exception &e) {
+				obs_log(LOG_WARNING,
+					"VAD: cannot load the model into the built-in engine (%s), using ONNX Runtime",
+					e.what());
+			}
+		}
+	}
+	if (!service) {
+		service = std::make_shared<VadService>(model_path, sample_rate, window_size_samples,
+						       VAD_ENGINE_ONNXRUNTIME);
+	}
+	entry = service;
+	obs_log(LOG_INFO, "VAD: loaded the shared VAD model (%d Hz, %d samples per window, %s)",
+		sample_rate, (int)window_size_samples,
+		service->get_engine() == VAD_ENGINE_NATIVE ? "built-in engine" : "ONNX Runtime");
+	return service;
+}
+
+VadService::VadService(const SileroString &model_path, int sample_rate_,
+		       int64_t window_size_samples_, VadEngine engine)
+	: sample_rate(sample_rate_),
+	  window_size_samples(window_size_samples_)
+{
+	if (engine == VAD_ENGINE_NATIVE) {
+		if (sample_rate != SileroVadNative::SAMPLE_RATE ||
+		    window_size_samples != (int64_t)SileroVadNative::WINDOW_SIZE) {
+			throw std::runtime_error("unsupported sample rate or window size");
+		}
+		native = std::make_unique<SileroVadNative>(model_path);
+		native->reserve(MAX_BATCH);
+	} else {
+		env = Ort::Env(ORT_LOGGING_LEVEL_WARNING, "localvocal-vad");
+		// one thread per run, the batch is the parallelism
+		session_options.SetIntraOpNumThreads(1);
+		session_options.SetInterOpNumThreads(1);
+		session_options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_ALL);
+		session = std::make_unique<Ort::Session>(env, model_path.c_str(), session_options);
+	}
+
+	input.assign(MAX_BATCH * (size_t)window_size_samples, 0.0f);
+	state_in.assign(MAX_BATCH * STATE_SIZE, 0.0f);
+	state_out.assign(MAX_BATCH * STATE_SIZE, 0.0f);
+	output.assign(MAX_BATCH, 0.0f);
+	sr.assign(1, sample_rate);
+	const int64_t sr_dims[1] = {1};
+	sr_tensor = Ort::Value::CreateTensor<int64_t>(memory_info, sr.data(), sr.size(), sr_dims,
+						      1);
+
+	pending.reserve(MAX_BATCH * 2);
+	active.reserve(MAX_BATCH * 2);
+}
+
+void VadService::attach()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	attached_streams++;
+}
+
+void VadService::detach()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (attached_streams > 0) {
+		attached_streams--;
+	}
+	// a leader may be waiting for this stream
+	cv.notify_all();
+}
+
+void VadService::set_max_batch_delay(std::chrono::microseconds delay)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	max_batch_delay = delay;
+}
+
+VadService::stats VadService::get_stats() const
+{
+	stats s;
+	s.runs = num_runs.load(std::memory_order_relaxed);
+	s.windows = num_windows.load(std::memory_order_relaxed);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		s.streams = attached_streams;
+	}
+	return s;
+}
+
+void VadService::run(const float *windows, size_t count, float *state, float *probs)
+{
+	if (count == 0) {
+		return;
+	}
+
+	Request request;
+	request.windows = windows;
+	request.num_windows = count;
+	request.state = state;
+	request.probs = probs;
+
+	std::unique_lock<std::mutex> lock(mutex);
+	pending.push_back(&request);
+	// a leader waiting for the batch to fill counts the new request
+	cv.notify_all();
+	while (!request.done) {
+		if (leader) {
+			cv.wait(lock);
+			continue;
+		}
+		leader = true;
+		lead(lock);
+		leader = false;
+		// wake the callers of this batch, and hand over to a caller still pending
+		cv.notify_all();
+	}
+	lock.unlock();
+
+	if (request.failed) {
+		throw Ort::Exception(std::move(request.error), request.error_code);
+	}
+}
+
+void VadService::lead(std::unique_lock<std::mutex> &lock)
+{
+	if (max_batch_delay.count() > 0) {
+		cv.wait_for(lock, max_batch_delay,
+			    [this] { return pending.size() >= attached_streams; });
+	}
+	active.swap(pending);
+	lock.unlock();
+
+	bool failed = false;
+	OrtErrorCode error_code = ORT_OK;
+	std::string error;
+	try {
+		run_requests();
+	} catch (const Ort::Exception &e) {
+		failed = true;
+		error_code = e.GetOrtErrorCode();
+		error = e.what();
+	} catch (const std::exception &e) {
+		failed = true;
+		error_code = ORT_FAIL;
+		error = e.what();
+	}
+
+	lock.lock();
+	for (Request *request : active) {
+		if (failed && request->next < request->num_windows) {
+			request->failed = true;
+			request->error_code = error_code;
+			request->error = error;
+		}
+		request->done = true;
+	}
+	active.clear();
+}
+
+void VadService::run_requests()
+{
+	// the windows of one stream depend on each other through the state, so every run takes
+	// the next window of each stream
+	Request *batch[MAX_BATCH];
+	for (;;) {
+		size_t batch_size = 0;
+		for (Request *request : active) {
+			if (request->next < request->num_windows) {
+				batch[batch_size++] = request;
+				if (batch_size == MAX_BATCH) {
+					break;
+				}
+			}
+		}
+		if (batch_size == 0) {
+			return;
+		}
+		run_batch(batch, batch_size);
+	}
+}
+
+void VadService::run_batch(Request *const *requests, size_t batch_size)
+{
+	const size_t window = (size_t)window_size_samples;
+	const size_t half = STATE_SIZE / 2;
+
+	// gather, the state of a stream is [2, 1, 128] and the batch state [2, batch, 128]
+	for (size_t i = 0; i < batch_size; i++) {
+		const Request *request = requests[i];
+		const float *samples = request->windows + request->next * window;
+		std::copy(samples, samples + window, input.begin() + i * window);
+		for (size_t l = 0; l < 2; l++) {
+			std::copy(request->state + l * half, request->state + (l + 1) * half,
+				  state_in.begin() + (l * batch_size + i) * half);
+		}
+	}
+
+	if (native) {
+		native->run(input.data(), batch_size, state_in.data(), state_out.data(),
+			    output.data());
+	} else {
+		session->Run(run_options, *get_binding(batch_size).io_binding);
+	}
+
+	// scatter
+	for (size_t i = 0; i < batch_size; i++) {
+		Request *request = requests[i];
+		request->probs[request->next] = output[i];
+		for (size_t l = 0; l < 2; l++) {
+			const auto from = state_out.begin() + (l * batch_size + i) * half;
+			std::copy(from, from + half, request->state + l * half);
+		}
+		request->next++;
+	}
+
+	num_runs.fetch_add(1, std::memory_order_relaxed);
+	num_windows.fetch_add(batch_size, std::memory_order_relaxed);
+}
+
+VadService::Binding &VadService::get_binding(size_t batch_size)
+{
+	Binding &binding = bindings[batch_size - 1];
+	if (binding.io_binding) {
+		return binding;
+	}
+
+	// the tensors of all batch sizes share the buffers, only the shapes differ
+	const int64_t batch = (int64_t)batch_size;
+	const int64_t input_dims[2] = {batch, window_size_samples};
+	const int64_t state_dims[3] = {2, batch, (int64_t)(STATE_SIZE / 2)};
+	const int64_t output_dims[2] = {batch, 1};
+	binding.input = Ort::Value::CreateTensor<float>(memory_info, input.data(),
+							batch_size * (size_t)window_size_samples,
+							input_dims, 2);
+	binding.state_in = Ort::Value::CreateTensor<float>(
+		memory_info, state_in.data(), batch_size * STATE_SIZE, state_dims, 3);
+	binding.state_out = Ort::Value::CreateTensor<float>(
+		memory_info, state_out.data(), batch_size * STATE_SIZE, state_dims, 3);
+	binding.output = Ort::Value::CreateTensor<float>(memory_info, output.data(), batch_size,
+							 output_dims, 2);
+
+	auto io_binding = std::make_unique<Ort::IoBinding>(*session);
+	io_binding->BindInput("input", binding.input);
+	io_binding->BindInput("state", binding.state_in);
+	io_binding->BindInput("sr", sr_tensor);
+	io_binding->BindOutput("output", binding.output);
+	io_binding->BindOutput("stateN", binding.state_out);
+	binding.io_binding = std::move(io_binding);
+	return binding;
+}
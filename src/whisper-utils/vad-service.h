@@ -0,0 +1,167 @@
+/**
+ * @file vad-service.h
+ * @brief Process-wide Silero VAD session shared by all filter instances.
+ *
+ * Every filter used to create its own ONNX Runtime session for the VAD model and run it one
+ * 32 ms window at a time. The service loads the model once per model file and runs the windows
+ * of all streams that are waiting at the same time in one batched call: the Silero graph takes
+ * a [batch, window] input and a [2, batch, 128] LSTM state.
+ *
+ * The LSTM state stays with the stream (the VadIterator of each filter) and is passed to run(),
+ * so the service itself holds no per-stream state. There is no service thread either: the
+ * first caller that finds no batch in flight becomes the leader, collects the windows of all
+ * callers waiting at that moment, runs them and wakes the others. A stream alone never waits
+ * for anybody; with several streams the calls that overlap are batched.
+ *
+ * The model runs either in ONNX Runtime or in the built-in implementation of SileroVadNative,
+ * which only covers the 16 kHz model with 512 sample windows. Builds with ENABLE_NATIVE_VAD use
+ * the built-in engine by default and fall back to ONNX Runtime for other shapes or when the
+ * weights cannot be read.
+ */
+#ifndef VAD_SERVICE_H
+#define VAD_SERVICE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "silero-vad-onnx.h"
+#include "silero-vad-native.h"
+
+enum VadEngine {
+	VAD_ENGINE_ONNXRUNTIME = 0,
+	VAD_ENGINE_NATIVE,
+};
+
+class VadService {
+public:
+	/** Maximal number of streams in one model run */
+	static constexpr size_t MAX_BATCH = 16;
+	/** Size of the LSTM state of one stream, in floats */
+	static constexpr size_t STATE_SIZE = 2 * 128;
+
+	struct stats {
+		uint64_t runs = 0;
+		uint64_t windows = 0;
+		// number of streams attached right now
+		uint64_t streams = 0;
+	};
+
+	/** VAD_ENGINE_NATIVE in builds with ENABLE_NATIVE_VAD, VAD_ENGINE_ONNXRUNTIME otherwise */
+	static VadEngine default_engine();
+
+	/**
+	 * @brief Returns the service for the model file, loading the model if no stream holds it.
+	 *
+	 * The service is released with the last reference to it. Throws Ort::Exception if the
+	 * model cannot be loaded. The native engine falls back to ONNX Runtime when it does not
+	 * support the shapes or cannot read the model.
+	 */
+	static std::shared_ptr<VadService> acquire(const SileroString &model_path,
+						   int sample_rate = 16000,
+						   int64_t window_size_samples = 512,
+						   VadEngine engine = default_engine());
+
+	/** Throws Ort::Exception or, for the native engine, std::runtime_error */
+	VadService(const SileroString &model_path, int sample_rate, int64_t window_size_samples,
+		   VadEngine engine = VAD_ENGINE_ONNXRUNTIME);
+
+	int get_sample_rate() const { return sample_rate; }
+	int64_t get_window_size_samples() const { return window_size_samples; }
+	VadEngine get_engine() const { return native ? VAD_ENGINE_NATIVE : VAD_ENGINE_ONNXRUNTIME; }
+
+	/** Stream registration, a leader waits at most for the attached streams. */
+	void attach();
+	void detach();
+
+	/**
+	 * @brief How long a leader waits for the other attached streams to join its batch.
+	 *
+	 * 0 (the default) runs the windows that are waiting right away, so batching never adds
+	 * latency beyond the wait for a run already in flight.
+	 */
+	void set_max_batch_delay(std::chrono::microseconds delay);
+
+	/**
+	 * @brief Runs the model over consecutive windows of one stream.
+	 *
+	 * Blocks until all windows are processed. Windows of other streams submitted in the
+	 * meantime share the model runs. Throws Ort::Exception if the model run fails.
+	 *
+	 * @param windows num_windows * window_size_samples samples.
+	 * @param state LSTM state of the stream (STATE_SIZE floats), updated in place.
+	 * @param probs Receives the speech probability of every window.
+	 */
+	void run(const float *windows, size_t num_windows, float *state, float *probs);
+
+	stats get_stats() const;
+
+private:
+	struct Request {
+		const float *windows;
+		size_t num_windows;
+		float *state;
+		float *probs;
+		// next window to run
+		size_t next = 0;
+		bool done = false;
+		bool failed = false;
+		OrtErrorCode error_code = ORT_OK;
+		std::string error;
+	};
+
+	// tensors over the batch buffers for one batch size
+	struct Binding {
+		Ort::Value input{nullptr};
+		Ort::Value state_in{nullptr};
+		Ort::Value state_out{nullptr};
+		Ort::Value output{nullptr};
+		std::unique_ptr<Ort::IoBinding> io_binding;
+	};
+
+	void lead(std::unique_lock<std::mutex> &lock);
+	void run_requests();
+	void run_batch(Request *const *requests, size_t batch_size);
+	Binding &get_binding(size_t batch_size);
+
+	// either the native engine or the ONNX Runtime session is loaded
+	std::unique_ptr<SileroVadNative> native;
+	Ort::Env env{nullptr};
+	Ort::SessionOptions session_options;
+	std::unique_ptr<Ort::Session> session;
+	Ort::MemoryInfo memory_info = Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeCPU);
+	Ort::RunOptions run_options;
+
+	int sample_rate;
+	int64_t window_size_samples;
+
+	// batch buffers, sized for MAX_BATCH streams: input [batch, window], state [2, batch, 128]
+	std::vector<float> input;
+	std::vector<float> state_in;
+	std::vector<float> state_out;
+	std::vector<float> output;
+	std::vector<int64_t> sr;
+	Ort::Value sr_tensor{nullptr};
+	// indexed by batch size - 1, created on first use
+	Binding bindings[MAX_BATCH];
+
+	mutable std::mutex mutex;
+	std::condition_variable cv;
+	std::vector<Request *> pending;
+	// requests of the batch in flight, only touched by the leader
+	std::vector<Request *> active;
+	bool leader = false;
+	size_t attached_streams = 0;
+	std::chrono::microseconds max_batch_delay{0};
+
+	std::atomic<uint64_t> num_runs{0};
+	std::atomic<uint64_t> num_windows{0};
+};
+
+#endif // VAD_SERVICE_H
@@ -0,0 +1,77 @@
+#include "wake-scheduler.h"
+
+#include <algorithm>
+
+void WakeScheduler::set_threshold_frames(size_t frames)
+{
+	threshold.store(std::max<size_t>(frames, 1), std::memory_order_relaxed);
+}
+
+void WakeScheduler::on_frames_available(size_t frames_available)
+{
+	if (frames_available < threshold.load(std::memory_order_relaxed)) {
+		return;
+	}
+	// pairs with the fence in wait(): either the worker sees the new frames when it checks
+	// the ring, or this sees the worker waiting
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (!waiting.exchange(false, std::memory_order_acq_rel)) {
+		// the worker is busy, or it was already woken
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		signaled = true;
+	}
+	cv.notify_one();
+}
+
+void WakeScheduler::notify()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		signaled = true;
+	}
+	cv.notify_one();
+}
+
+WakeReason WakeScheduler::wait(std::chrono::milliseconds timeout,
+			       const std::function<size_t()> &frames_available)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	WakeReason reason;
+	waiting.store(true, std::memory_order_seq_cst);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (signaled) {
+		reason = WAKE_REASON_NOTIFIED;
+	} else if (frames_available() >= threshold.load(std::memory_order_relaxed)) {
+		// the audio arrived while the worker was busy
+		reason = WAKE_REASON_DATA_READY;
+	} else if (cv.wait_for(lock, timeout, [this] { return signaled; })) {
+		reason = waiting.load(std::memory_order_acquire) ? WAKE_REASON_NOTIFIED
+								 : WAKE_REASON_DATA_READY;
+	} else {
+		reason = WAKE_REASON_DEADLINE;
+	}
+	waiting.store(false, std::memory_order_release);
+	signaled = false;
+	lock.unlock();
+
+	counters.wakeups++;
+	switch (reason) {
+	case WAKE_REASON_DATA_READY:
+		counters.data_wakeups++;
+		break;
+	case WAKE_REASON_DEADLINE:
+		counters.deadline_wakeups++;
+		break;
+	case WAKE_REASON_NOTIFIED:
+		counters.notified_wakeups++;
+		break;
+	}
+	if (frames_available() == 0) {
+		counters.wasted_wakeups++;
+	}
+	return reason;
+}
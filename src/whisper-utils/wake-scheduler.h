@@ -0,0 +1,78 @@
+/**
+ * @file wake-scheduler.h
+ * @brief Wakes the whisper thread when enough new audio is ready or a deadline expires.
+ *
+ * The audio callback reports the number of frames in the input ring after every push, but the
+ * worker is only signalled once that number crosses the threshold the worker asked for (e.g.
+ * one VAD batch or the distance to the next partial). Until then the producer does not touch
+ * the mutex, so an idle or filling filter costs one atomic load per packet instead of a wake
+ * of the whisper thread. The worker also wakes on a deadline for time based work such as
+ * clearing an expired subtitle, and on an explicit notify() (e.g. shutdown).
+ *
+ * The scheduler keeps wake counters so the idle cost of a filter can be checked in the logs.
+ */
+#ifndef WAKE_SCHEDULER_H
+#define WAKE_SCHEDULER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+
+enum WakeReason {
+	WAKE_REASON_DATA_READY = 0,
+	WAKE_REASON_DEADLINE,
+	WAKE_REASON_NOTIFIED,
+};
+
+class WakeScheduler {
+public:
+	struct stats {
+		uint64_t wakeups = 0;
+		uint64_t data_wakeups = 0;
+		uint64_t deadline_wakeups = 0;
+		uint64_t notified_wakeups = 0;
+		// wakeups that found no new audio at all
+		uint64_t wasted_wakeups = 0;
+	};
+
+	/** Number of frames in the input ring that wakes the worker. Set by the worker. */
+	void set_threshold_frames(size_t frames);
+	size_t threshold_frames() const { return threshold.load(std::memory_order_relaxed); }
+
+	/**
+	 * @brief Producer side, called after pushing to the input ring.
+	 *
+	 * Wakes the worker if it is waiting and frames_available reached the threshold. Only
+	 * locks when it actually wakes the worker.
+	 */
+	void on_frames_available(size_t frames_available);
+
+	/** Wakes the worker unconditionally (shutdown, reset). */
+	void notify();
+
+	/**
+	 * @brief Worker side, blocks until the threshold is reached, a notify() or the timeout.
+	 *
+	 * @param timeout Maximal time to sleep.
+	 * @param frames_available Returns the current number of frames in the input ring.
+	 */
+	WakeReason wait(std::chrono::milliseconds timeout,
+			const std::function<size_t()> &frames_available);
+
+	/** Counters since the start, read by the worker. */
+	const stats &get_stats() const { return counters; }
+
+private:
+	std::mutex mutex;
+	std::condition_variable cv;
+	bool signaled = false;
+	std::atomic<bool> waiting{false};
+	std::atomic<size_t> threshold{1};
+	stats counters;
+};
+
+#endif // WAKE_SCHEDULER_H
@@ -0,0 +1,126 @@
+#include "whisper-audio-buffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <obs.h>
+
+#include "plugin-support.h"
+
+WhisperAudioBuffer::~WhisperAudioBuffer()
+{
+	release();
+}
+
+bool WhisperAudioBuffer::init(size_t capacity_samples, size_t guard_samples)
+{
+	release();
+
+	// twice the capacity, so compaction happens at most once per capacity worth of audio
+	const size_t new_size = 2 * capacity_samples + 2 * guard_samples;
+	storage = static_cast<float *>(bzalloc(new_size * sizeof(float)));
+	if (storage == nullptr) {
+		return false;
+	}
+	storage_size = new_size;
+	guard = guard_samples;
+	begin = end = guard;
+	position = 0;
+	return true;
+}
+
+void WhisperAudioBuffer::release()
+{
+	bfree(storage);
+	storage = nullptr;
+	storage_size = 0;
+	guard = 0;
+	begin = end = 0;
+	position = 0;
+}
+
+bool WhisperAudioBuffer::ensure_room(size_t num_samples)
+{
+	if (end + num_samples + guard <= storage_size) {
+		return true;
+	}
+
+	const size_t current = size();
+	const size_t capacity = (storage_size - 2 * guard) / 2;
+	if (current + num_samples <= capacity) {
+		// enough room once the data is moved back to the front
+		memmove(storage + guard, storage + begin, current * sizeof(float));
+		begin = guard;
+		end = guard + current;
+		return true;
+	}
+
+	// the buffer is holding more audio than it was sized for (e.g. very long speech
+	// segments), grow it
+	const size_t new_size = 2 * (current + num_samples) + 2 * guard;
+	float *new_storage = static_cast<float *>(bzalloc(new_size * sizeof(float)));
+	if (new_storage == nullptr) {
+		obs_log(LOG_ERROR, "Failed to grow whisper audio buffer to %zu samples", new_size);
+		return false;
+	}
+	memcpy(new_storage + guard, storage + begin, current * sizeof(float));
+	bfree(storage);
+	obs_log(LOG_INFO, "Whisper audio buffer grown to %zu samples", new_size);
+	storage = new_storage;
+	storage_size = new_size;
+	begin = guard;
+	end = guard + current;
+	return true;
+}
+
+const float *WhisperAudioBuffer::data_with_guards(size_t &num_samples)
+{
+	if (storage == nullptr) {
+		num_samples = 0;
+		return nullptr;
+	}
+	// the space around the data may hold stale samples from earlier pops
+	memset(storage + begin - guard, 0, guard * sizeof(float));
+	memset(storage + end, 0, guard * sizeof(float));
+	num_samples = size() + 2 * guard;
+	return storage + begin - guard;
+}
+
+float *WhisperAudioBuffer::reserve_back(size_t num_samples)
+{
+	if (storage == nullptr || !ensure_room(num_samples)) {
+		return nullptr;
+	}
+	return storage + end;
+}
+
+void WhisperAudioBuffer::commit_back(size_t num_samples)
+{
+	end = std::min(end + num_samples, storage_size - guard);
+}
+
+void WhisperAudioBuffer::push_back(const float *samples, size_t num_samples)
+{
+	float *dst = reserve_back(num_samples);
+	if (dst == nullptr) {
+		return;
+	}
+	memcpy(dst, samples, num_samples * sizeof(float));
+	commit_back(num_samples);
+}
+
+void WhisperAudioBuffer::pop_front(size_t num_samples)
+{
+	num_samples = std::min(num_samples, size());
+	begin += num_samples;
+	position += num_samples;
+	if (begin == end) {
+		begin = end = guard;
+	}
+}
+
+void WhisperAudioBuffer::clear()
+{
+	begin = end = guard;
+	position = 0;
+}
@@ -0,0 +1,88 @@
+/**
+ * @file whisper-audio-buffer.h
+ * @brief Preallocated, always contiguous 16 kHz sample store for whisper inference.
+ *
+ * The samples waiting for inference are kept in one linear allocation with room for a
+ * silence guard on both sides, so whisper can be given a pointer into the store directly
+ * instead of a fresh copy of the buffer for every (partial or final) run. Popping from the
+ * front only moves an offset; the samples are moved back to the start of the allocation when
+ * the free space at the back runs out, which happens at most once per capacity worth of audio.
+ *
+ * The buffer is owned by the whisper thread and is not thread safe.
+ */
+#ifndef WHISPER_AUDIO_BUFFER_H
+#define WHISPER_AUDIO_BUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+
+class WhisperAudioBuffer {
+public:
+	WhisperAudioBuffer() = default;
+	~WhisperAudioBuffer();
+
+	WhisperAudioBuffer(const WhisperAudioBuffer &) = delete;
+	WhisperAudioBuffer &operator=(const WhisperAudioBuffer &) = delete;
+
+	/**
+	 * @brief Allocates the store.
+	 *
+	 * @param capacity_samples Number of samples the store holds without growing.
+	 * @param guard_samples Number of zero samples kept before and after the data.
+	 * @return true on success.
+	 */
+	bool init(size_t capacity_samples, size_t guard_samples);
+	void release();
+
+	/** Number of samples in the buffer (without the guards). */
+	size_t size() const { return end - begin; }
+	bool empty() const { return end == begin; }
+	size_t guard_size() const { return guard; }
+
+	/**
+	 * Absolute position of the first sample, i.e. the number of samples popped since the
+	 * last clear(). Lets other consumers of the same audio (the streaming VAD) refer to
+	 * samples by their offset in the stream.
+	 */
+	uint64_t front_position() const { return position; }
+	/** Absolute position one past the last sample. */
+	uint64_t back_position() const { return position + size(); }
+
+	/** Pointer to the first sample. Valid until the next call that adds samples. */
+	const float *data() const { return storage + begin; }
+
+	/**
+	 * @brief Returns the samples with zeroed guards on both sides.
+	 *
+	 * @param num_samples Receives size() + 2 * guard_size().
+	 * @return Pointer to the start of the leading guard. Valid until the next call that adds
+	 * samples.
+	 */
+	const float *data_with_guards(size_t &num_samples);
+
+	/**
+	 * @brief Returns a pointer where up to num_samples can be written at the back.
+	 *
+	 * The samples are only part of the buffer after commit_back(). Grows the store if needed.
+	 */
+	float *reserve_back(size_t num_samples);
+	void commit_back(size_t num_samples);
+
+	void push_back(const float *samples, size_t num_samples);
+	void pop_front(size_t num_samples);
+	/** Removes all samples and restarts the positions at 0. */
+	void clear();
+
+private:
+	bool ensure_room(size_t num_samples);
+
+	float *storage = nullptr;
+	size_t storage_size = 0;
+	size_t guard = 0;
+	// Data lives in storage[begin, end), with at least `guard` samples before begin
+	size_t begin = 0;
+	size_t end = 0;
+	uint64_t position = 0;
+};
+
+#endif // WHISPER_AUDIO_BUFFER_H
@@ -0,0 +1,310 @@
+#include "whisper-model-registry.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#ifdef _WIN32
+#include <fstream>
+#define NOMINMAX
+#include <Windows.h>
+#endif
+
+#include <obs.h>
+#include "plugin-support.h"
+#include "mapped-file.h"
+
+namespace {
+
+// the context parameters that change what is loaded
+typedef std::tuple<std::string, bool, int, bool, bool, int> ModelKey;
+
+ModelKey make_key(const std::string &model_path, const whisper_context_params &params)
+{
+	return std::make_tuple(model_path, params.use_gpu, params.use_gpu ? params.gpu_device : 0,
+			       params.flash_attn, params.dtw_token_timestamps,
+			       params.dtw_token_timestamps ? (int)params.dtw_aheads_preset : 0);
+}
+
+struct ModelEntry {
+	std::shared_ptr<WhisperModel> model;
+	// references handed out by acquire() and not released yet
+	size_t users = 0;
+	// another caller is loading the model, the entry has no model yet
+	bool loading = false;
+	std::chrono::milliseconds keep_alive{0};
+	// when an unused model is unloaded
+	std::chrono::steady_clock::time_point expires;
+};
+
+// Unused models are unloaded by a thread that only runs while there are any
+struct ModelRegistry {
+	std::mutex mutex;
+	// signals finished loads and new unused models
+	std::condition_variable cv;
+	std::map<ModelKey, ModelEntry> entries;
+	std::thread reaper;
+	bool reaper_running = false;
+	bool stopping = false;
+
+	~ModelRegistry()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+			cv.notify_all();
+		}
+		if (reaper.joinable()) {
+			reaper.join();
+		}
+	}
+};
+
+ModelRegistry &registry()
+{
+	static ModelRegistry instance;
+	return instance;
+}
+
+struct whisper_context *load_model(const std::string &model_path,
+				   const whisper_context_params &params)
+{
+	struct whisper_context *ctx = nullptr;
+	try {
+#ifndef LOCALVOCAL_WITH_COREML
+		// whisper copies the weights out of the mapping, it is unmapped once loaded. With
+		// CoreML whisper finds the -encoder.mlmodelc next to the model through the path of
+		// the context, which only the file loader below sets.
+		MappedFile mapped;
+		if (mapped.open(model_path)) {
+			const auto load_start = std::chrono::steady_clock::now();
+			ctx = whisper_init_from_buffer_with_params_no_state(
+				const_cast<void *>(mapped.data()), mapped.size(), params);
+			obs_log(LOG_INFO, "Whisper model %s mapped, initialized in %lld ms",
+				model_path.c_str(),
+				(long long)std::chrono::duration_cast<std::chrono::milliseconds>(
+					std::chrono::steady_clock::now() - load_start)
+					.count());
+			return ctx;
+		}
+		obs_log(LOG_WARNING, "Cannot map whisper model file %s, reading it",
+			model_path.c_str());
+#endif
+#ifdef _WIN32
+		// convert model path UTF8 to wstring (wchar_t) for whisper
+		int count = MultiByteToWideChar(CP_UTF8, 0, model_path.c_str(),
+						(int)model_path.length(), NULL, 0);
+		std::wstring model_path_ws(count, 0);
+		MultiByteToWideChar(CP_UTF8, 0, model_path.c_str(), (int)model_path.length(),
+				    &model_path_ws[0], count);
+
+		// Read model into buffer
+		std::ifstream modelFile(model_path_ws, std::ios::binary);
+		if (!modelFile.is_open()) {
+			obs_log(LOG_ERROR, "Failed to open whisper model file %s",
+				model_path.c_str());
+			return nullptr;
+		}
+		modelFile.seekg(0, std::ios::end);
+		const size_t modelFileSize = modelFile.tellg();
+		modelFile.seekg(0, std::ios::beg);
+		std::vector<char> modelBuffer(modelFileSize);
+		modelFile.read(modelBuffer.data(), modelFileSize);
+		modelFile.close();
+
+		// Initialize whisper, the states are created per filter
+		ctx = whisper_init_from_buffer_with_params_no_state(modelBuffer.data(),
+								    modelFileSize, params);
+#else
+		ctx = whisper_init_from_file_with_params_no_state(model_path.c_str(), params);
+#endif
+	} catch (const std::exception &e) {
+		obs_log(LOG_ERROR, "Exception while loading whisper model: %s", e.what());
+		return nullptr;
+	}
+	return ctx;
+}
+
+void reap_unused_models()
+{
+	ModelRegistry &r = registry();
+	std::unique_lock<std::mutex> lock(r.mutex);
+	while (!r.stopping) {
+		const auto now = std::chrono::steady_clock::now();
+		std::vector<std::shared_ptr<WhisperModel>> expired;
+		bool unused = false;
+		auto next = std::chrono::steady_clock::time_point::max();
+		for (auto it = r.entries.begin(); it != r.entries.end();) {
+			ModelEntry &entry = it->second;
+			if (entry.users > 0 || entry.loading) {
+				++it;
+				continue;
+			}
+			if (entry.expires <= now) {
+				obs_log(LOG_INFO, "Unloading whisper model %s, unused for %d s",
+					std::get<0>(it->first).c_str(),
+					(int)std::chrono::duration_cast<std::chrono::seconds>(
+						entry.keep_alive)
+						.count());
+				expired.push_back(std::move(entry.model));
+				it = r.entries.erase(it);
+				continue;
+			}
+			unused = true;
+			next = std::min(next, entry.expires);
+			++it;
+		}
+		if (!expired.empty()) {
+			// freeing the weights takes a while, do not block acquire() meanwhile
+			lock.unlock();
+			expired.clear();
+			lock.lock();
+			continue;
+		}
+		if (!unused) {
+			break;
+		}
+		r.cv.wait_until(lock, next);
+	}
+	r.reaper_running = false;
+}
+
+void release_model(const ModelKey &key)
+{
+	ModelRegistry &r = registry();
+	std::shared_ptr<WhisperModel> unload;
+	{
+		std::lock_guard<std::mutex> lock(r.mutex);
+		auto it = r.entries.find(key);
+		if (it == r.entries.end() || it->second.users == 0) {
+			return;
+		}
+		ModelEntry &entry = it->second;
+		if (--entry.users > 0) {
+			return;
+		}
+		if (entry.keep_alive.count() <= 0) {
+			unload = std::move(entry.model);
+			r.entries.erase(it);
+		} else {
+			entry.expires = std::chrono::steady_clock::now() + entry.keep_alive;
+			if (!r.reaper_running && !r.stopping) {
+				// a reaper that ran out of work may still be returning
+				if (r.reaper.joinable()) {
+					r.reaper.join();
+				}
+				r.reaper_running = true;
+				r.reaper = std::thread(reap_unused_models);
+			} else {
+				r.cv.notify_all();
+			}
+		}
+	}
+	if (unload) {
+		obs_log(LOG_INFO, "Unloading whisper model %s", std::get<0>(key).c_str());
+	}
+}
+
+// The reference handed out to a filter, releasing it returns the model to the registry
+std::shared_ptr<WhisperModel> make_reference(const ModelKey &key,
+					     const std::shared_ptr<WhisperModel> &model)
+{
+	return std::shared_ptr<WhisperModel>(model.get(), [key, model](WhisperModel *) {
+		release_model(key);
+	});
+}
+
+} // namespace
+
+std::shared_ptr<WhisperModel> WhisperModel::acquire(const std::string &model_path,
+						    const whisper_context_params &params,
+						    std::chrono::milliseconds keep_alive)
+{
+	ModelRegistry &r = registry();
+	const ModelKey key = make_key(model_path, params);
+
+	std::unique_lock<std::mutex> lock(r.mutex);
+	for (;;) {
+		auto it = r.entries.find(key);
+		if (it == r.entries.end()) {
+			break;
+		}
+		ModelEntry &entry = it->second;
+		if (entry.loading) {
+			r.cv.wait(lock);
+			continue;
+		}
+		entry.users++;
+		entry.keep_alive = keep_alive;
+		obs_log(LOG_INFO, "Using the loaded whisper model %s (%d filters)",
+			model_path.c_str(), (int)entry.users);
+		return make_reference(key, entry.model);
+	}
+
+	r.entries[key].loading = true;
+	lock.unlock();
+	obs_log(LOG_INFO, "Loading whisper model %s", model_path.c_str());
+	struct whisper_context *ctx = load_model(model_path, params);
+	lock.lock();
+
+	auto it = r.entries.find(key);
+	// waiting callers retry the load themselves on failure
+	r.cv.notify_all();
+	if (ctx == nullptr) {
+		r.entries.erase(it);
+		return nullptr;
+	}
+	ModelEntry &entry = it->second;
+	entry.model = std::make_shared<WhisperModel>(ctx);
+	entry.loading = false;
+	entry.users = 1;
+	entry.keep_alive = keep_alive;
+	return make_reference(key, entry.model);
+}
+
+void WhisperModel::release_unused()
+{
+	ModelRegistry &r = registry();
+	std::vector<std::shared_ptr<WhisperModel>> unused;
+	{
+		std::unique_lock<std::mutex> lock(r.mutex);
+		r.stopping = true;
+		r.cv.notify_all();
+		if (r.reaper.joinable()) {
+			lock.unlock();
+			r.reaper.join();
+			lock.lock();
+		}
+		r.stopping = false;
+		for (auto it = r.entries.begin(); it != r.entries.end();) {
+			if (it->second.users == 0 && !it->second.loading) {
+				unused.push_back(std::move(it->second.model));
+				it = r.entries.erase(it);
+			} else {
+				++it;
+			}
+		}
+	}
+	if (!unused.empty()) {
+		obs_log(LOG_INFO, "Unloaded %d unused whisper models", (int)unused.size());
+	}
+}
+
+WhisperModel::~WhisperModel()
+{
+	whisper_free(ctx);
+}
+
+struct whisper_state *WhisperModel::create_state() const
+{
+	return whisper_init_state(ctx);
+}
+
+void release_unused_whisper_models()
+{
+	WhisperModel::release_unused();
+}
@@ -0,0 +1,54 @@
+/**
+ * @file whisper-model-registry.h
+ * @brief Process-wide registry of the loaded whisper models.
+ *
+ * Every filter used to load its own copy of the model weights, and to free it whenever the
+ * filter was disabled. The registry loads a model file once per set of context parameters and
+ * hands out the shared weights; every filter decodes with its own whisper_state created from
+ * them. A model that no filter uses anymore stays loaded for a grace period, so that toggling a
+ * filter or switching scenes does not read the model from disk again.
+ */
+#ifndef WHISPER_MODEL_REGISTRY_H
+#define WHISPER_MODEL_REGISTRY_H
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+#include <whisper.h>
+
+class WhisperModel {
+public:
+	/**
+	 * @brief Returns the model loaded with these parameters, loading it if needed.
+	 *
+	 * Callers asking for a model that is being loaded wait for that load. The model is
+	 * unloaded keep_alive after the last reference to it is released (right away for 0).
+	 *
+	 * @return nullptr if the model cannot be loaded.
+	 */
+	static std::shared_ptr<WhisperModel> acquire(const std::string &model_path,
+						     const whisper_context_params &params,
+						     std::chrono::milliseconds keep_alive);
+
+	/** Unloads the models that are kept for their grace period, on plugin unload */
+	static void release_unused();
+
+	explicit WhisperModel(struct whisper_context *ctx) : ctx(ctx) {}
+	~WhisperModel();
+	WhisperModel(const WhisperModel &) = delete;
+	WhisperModel &operator=(const WhisperModel &) = delete;
+
+	/** The shared weights, for the calls that take the context and a state */
+	struct whisper_context *get_context() const { return ctx; }
+
+	/** Decoding state of one filter, free it with whisper_free_state(). nullptr on failure */
+	struct whisper_state *create_state() const;
+
+private:
+	struct whisper_context *ctx;
+};
+
+extern "C" void release_unused_whisper_models();
+
+#endif // WHISPER_MODEL_REGISTRY_H
@@ -5,9 +5,261 @@
 #include <obs-module.h>
 
 #include "whisper-utils.h"
+#include "whisper-model-utils.h"
 #include "whisper-processing.h"
 #include "plugin-support.h"
 #include "model-utils/model-downloader.h"
+#include "model-utils/model-find-utils.h"
+
+#include <filesystem>
+
+// the profile is read and checked against the machine once, not on every settings update
+static std::mutex machine_calibration_mutex;
+static bool machine_calibration_loaded = false;
+static MachineCalibration machine_calibration_cached;
+
+static std::string machine_calibration_path()
+{
+	char *profile_path = obs_module_config_path("calibration.json");
+	if (profile_path == nullptr) {
+		return "";
+	}
+	const std::string path = profile_path;
+	bfree(profile_path);
+	return path;
+}
+
+MachineCalibration machine_calibration()
+{
+	std::lock_guard<std::mutex> lock(machine_calibration_mutex);
+	if (!machine_calibration_loaded) {
+		MachineCalibration &cached = machine_calibration_cached;
+		const std::string path = machine_calibration_path();
+		cached.available = !path.empty() && load_calibration_profile(path, cached.profile);
+		cached.applies = cached.available && calibration_profile_applies(cached.profile);
+		if (cached.available && !cached.applies) {
+			obs_log(LOG_INFO, "The calibration profile is of another machine (%s, %d CPUs)",
+				cached.profile.machine.c_str(), cached.profile.usable_cpus);
+		}
+		machine_calibration_loaded = true;
+	}
+	return machine_calibration_cached;
+}
+
+bool save_machine_calibration(const CalibrationProfile &profile)
+{
+	const std::string path = machine_calibration_path();
+	std::error_code error;
+	if (!path.empty()) {
+		std::filesystem::create_directories(std::filesystem::path(path).parent_path(),
+						    error);
+	}
+	if (path.empty() || !save_calibration_profile(path, profile)) {
+		obs_log(LOG_ERROR, "Calibration: cannot write the profile %s", path.c_str());
+		return false;
+	}
+	obs_log(LOG_INFO, "Calibration profile saved to %s", path.c_str());
+	std::lock_guard<std::mutex> lock(machine_calibration_mutex);
+	machine_calibration_cached = {true, calibration_profile_applies(profile), profile};
+	machine_calibration_loaded = true;
+	return true;
+}
+
+bool calibration_profile_for_settings(obs_data_t *settings, CalibrationProfile &profile)
+{
+	if (!obs_data_get_bool(settings, "use_calibration_profile")) {
+		return false;
+	}
+	const MachineCalibration calibration = machine_calibration();
+	if (!calibration.applies) {
+		return false;
+	}
+	profile = calibration.profile;
+	return true;
+}
+
+// the speech clip of the Calibrate button, downloaded like a model
+static const ModelInfo &calibration_clip_info()
+{
+	static const ModelInfo info{"Calibration clip",
+				    "calibration-clip",
+				    MODEL_TYPE_TRANSCRIPTION,
+				    {{CALIBRATION_CLIP_URL, ""}},
+				    {}};
+	return info;
+}
+
+// the models of the model list with their files installed
+static std::vector<CalibrationModel> installed_whisper_models()
+{
+	std::vector<CalibrationModel> models;
+	for (const auto &[name, info] : models_info()) {
+		if (info.type != MODEL_TYPE_TRANSCRIPTION) {
+			continue;
+		}
+		const std::string file = find_model_bin_file(info);
+		if (!file.empty()) {
+			models.push_back({name, file});
+		}
+	}
+	return models;
+}
+
+// runs the settings of the filter again on the UI thread, they pick up the new profile
+static void update_filter_settings(void *param)
+{
+	obs_weak_source_t *weak_source = static_cast<obs_weak_source_t *>(param);
+	obs_source_t *source = obs_weak_source_get_source(weak_source);
+	obs_weak_source_release(weak_source);
+	if (source != nullptr) {
+		obs_source_update(source, nullptr);
+		obs_source_release(source);
+	}
+}
+
+static void machine_calibration_thread(struct transcription_filter_data *gf,
+				       const std::string clip_file)
+{
+	std::vector<float> clip;
+	const std::vector<CalibrationModel> models = installed_whisper_models();
+	CalibrationProfile profile;
+	if (!load_wav_clip(clip_file, clip)) {
+		obs_log(LOG_ERROR, "Calibration: cannot read the clip %s", clip_file.c_str());
+	} else if (models.empty()) {
+		obs_log(LOG_ERROR, "Calibration: no installed models");
+	} else if (calibrate_whisper_models(gf->calibration_data.get(), clip, models, profile) &&
+		   save_machine_calibration(profile) && gf->context != nullptr) {
+		obs_queue_task(OBS_TASK_UI, update_filter_settings,
+			       obs_source_get_weak_source(gf->context), false);
+	}
+	gf->calibrating = false;
+}
+
+static void start_machine_calibration(struct transcription_filter_data *gf,
+				      const std::string &clip_file)
+{
+	std::lock_guard<std::mutex> lock(gf->calibration_mutex);
+	if (gf->calibrating) {
+		return;
+	}
+	if (gf->calibration_thread.joinable()) {
+		gf->calibration_thread.join();
+	}
+	// the sweep decodes with the parameters of the filter on models and states of its own
+	auto calibration_data = std::make_unique<transcription_filter_data>();
+	calibration_data->log_level = gf->log_level;
+	calibration_data->gpu_devices = gf->gpu_devices;
+	calibration_data->dynamic_audio_ctx = gf->dynamic_audio_ctx;
+	// the sweep warms up every thread count itself
+	calibration_data->model_warm_up = false;
+	{
+		std::lock_guard<std::mutex> ctx_lock(gf->whisper_ctx_mutex);
+		calibration_data->gpu_device = gf->gpu_device;
+		calibration_data->enable_flash_attn = gf->enable_flash_attn;
+		calibration_data->enable_token_ts_dtw = gf->enable_token_ts_dtw;
+		calibration_data->model_keep_alive_sec = gf->model_keep_alive_sec;
+		calibration_data->whisper_params = gf->whisper_params;
+	}
+	calibration_data->whisper_params.abort_callback_user_data = calibration_data.get();
+	// the clip is English speech, the strings of the settings may change while the sweep runs
+	calibration_data->whisper_params.language = "en";
+	calibration_data->whisper_params.detect_language = false;
+	calibration_data->whisper_params.initial_prompt = nullptr;
+	calibration_data->whisper_params.suppress_regex = nullptr;
+	gf->calibration_data = std::move(calibration_data);
+	gf->calibrating = true;
+	obs_log(LOG_INFO, "Calibration: started, the filter drops its audio until it is done");
+	gf->calibration_thread = std::thread(machine_calibration_thread, gf, clip_file);
+}
+
+void calibrate_machine(struct transcription_filter_data *gf)
+{
+	if (gf->calibrating) {
+		obs_log(LOG_INFO, "Calibration: already running");
+		return;
+	}
+	const ModelInfo &clip_info = calibration_clip_info();
+	const std::optional<std::filesystem::path> clip_folder = find_model_folder(clip_info);
+	if (clip_folder.has_value()) {
+		start_machine_calibration(gf,
+					  find_model_file_in_folder(clip_folder->string(), ".wav"));
+		return;
+	}
+	download_model_with_ui_dialog(clip_info, [gf](int download_status,
+						      const std::string &path) {
+		if (download_status == 0) {
+			start_machine_calibration(gf, find_model_file_in_folder(path, ".wav"));
+		} else {
+			obs_log(LOG_ERROR, "Calibration: failed to download the clip");
+		}
+	});
+}
+
+void stop_machine_calibration(struct transcription_filter_data *gf)
+{
+	std::lock_guard<std::mutex> lock(gf->calibration_mutex);
+	if (gf->calibration_data) {
+		// cancels the running calibration inference, the sweep stops before the next one
+		gf->calibration_data->inference_abort.request(INFERENCE_ABORT_SHUTDOWN);
+	}
+	if (gf->calibration_thread.joinable()) {
+		gf->calibration_thread.join();
+	}
+	gf->calibration_data.reset();
+}
+
+/**
+ * @brief Finds the file of an additional model of the settings (the partial or the language ID
+ * model), or downloads it.
+ *
+ * The additional models are loaded with the main one, a downloaded model is loaded with the
+ * current model when it arrives.
+ *
+ * @param kind Name of the model in the logs.
+ * @param path_field Member holding the model of the settings.
+ * @param file_field Member holding its file once found.
+ */
+static void update_extra_whisper_model(struct transcription_filter_data *gf, const char *kind,
+				       const std::string &model_path,
+				       std::string transcription_filter_data::*path_field,
+				       std::string transcription_filter_data::*file_field,
+				       const std::string &silero_vad_model_file)
+{
+	gf->*path_field = model_path;
+	gf->*file_field = "";
+	if (model_path.empty()) {
+		return;
+	}
+	if (models_info().count(model_path) == 0) {
+		obs_log(LOG_WARNING, "%s model '%s' does not exist", kind, model_path.c_str());
+		return;
+	}
+	const ModelInfo &model_info = models_info().at(model_path);
+	const std::string model_file_found = find_model_bin_file(model_info);
+	if (!model_file_found.empty()) {
+		gf->*file_field = model_file_found;
+		return;
+	}
+	obs_log(LOG_WARNING, "%s whisper model does not exist", kind);
+	const std::string kind_str = kind;
+	download_model_with_ui_dialog(model_info, [gf, kind_str, model_path, path_field, file_field,
+						   silero_vad_model_file](int download_status,
+									  const std::string &path) {
+		if (download_status != 0) {
+			obs_log(LOG_ERROR, "%s model download failed", kind_str.c_str());
+			return;
+		}
+		obs_log(LOG_INFO, "%s model download complete", kind_str.c_str());
+		if (gf->*path_field != model_path) {
+			// another model was selected meanwhile
+			return;
+		}
+		gf->*file_field = path;
+		if (gf->whisper_context != nullptr) {
+			restart_whisper_models(gf, silero_vad_model_file.c_str());
+		}
+	});
+}
 
 void update_whisper_model(struct transcription_filter_data *gf, bool force_whisper_restart)
 {
@@ -31,6 +283,21 @@ void update_whisper_model(struct transcription_filter_data *gf, bool force_whisp
 			? obs_data_get_string(s, "whisper_model_path_external")
 			: "";
 	const bool new_dtw_timestamps = obs_data_get_bool(s, "dtw_token_timestamps");
+	const std::string new_partial_model_path =
+		obs_data_get_string(s, "partial_whisper_model_path") != nullptr
+			? obs_data_get_string(s, "partial_whisper_model_path")
+			: "";
+	const std::string new_language_id_model_path =
+		obs_data_get_string(s, "language_id_model_path") != nullptr
+			? obs_data_get_string(s, "language_id_model_path")
+			: "";
+	CalibrationProfile calibration;
+	if (!obs_data_has_user_value(s, "whisper_model_path") &&
+	    calibration_profile_for_settings(s, calibration) &&
+	    models_info().count(calibration.selected.model_name) > 0) {
+		// the default model was not chosen, the calibration picked the model
+		new_model_path = calibration.selected.model_name;
+	}
 	obs_data_release(s);
 
 	// update the whisper model path
@@ -55,6 +322,16 @@ void update_whisper_model(struct transcription_filter_data *gf, bool force_whisp
 	std::string silero_vad_model_file_str = std::string(silero_vad_model_file);
 	bfree(silero_vad_model_file);
 
+	// loaded with the model (re)loaded below
+	update_extra_whisper_model(gf, "Partial", new_partial_model_path,
+				   &transcription_filter_data::partial_whisper_model_path,
+				   &transcription_filter_data::partial_whisper_model_file,
+				   silero_vad_model_file_str);
+	update_extra_whisper_model(gf, "Language ID", new_language_id_model_path,
+				   &transcription_filter_data::language_id_model_path,
+				   &transcription_filter_data::language_id_model_file,
+				   silero_vad_model_file_str);
+
 	if (gf->whisper_model_path.empty() || gf->whisper_model_path != new_model_path ||
 	    is_external_model) {
 
@@ -69,9 +346,8 @@ void update_whisper_model(struct transcription_filter_data *gf, bool force_whisp
 
 		// check if the new model is external file
 		if (!is_external_model) {
-			// new model is not external file
-			shutdown_whisper_thread(gf);
-
+			// new model is not external file, the current model keeps running until the
+			// new one is loaded
 			if (models_info().count(new_model_path) == 0) {
 				obs_log(LOG_WARNING, "Model '%s' does not exist",
 					new_model_path.c_str());
@@ -96,7 +372,7 @@ void update_whisper_model(struct transcription_filter_data *gf, bool force_whisp
 						download_coreml_encoder_model_if_available(
 							model_info,
 							[gf, path, silero_vad_model_file_str]() {
-								start_whisper_thread_with_path(
+								reload_whisper_models(
 									gf, path,
 									silero_vad_model_file_str
 										.c_str());
@@ -112,7 +388,7 @@ void update_whisper_model(struct transcription_filter_data *gf, bool force_whisp
 				download_coreml_encoder_model_if_available(
 					model_info,
 					[gf, model_file_found, silero_vad_model_file_str]() {
-						start_whisper_thread_with_path(
+						reload_whisper_models(
 							gf, model_file_found,
 							silero_vad_model_file_str.c_str());
 					});
@@ -124,16 +400,16 @@ void update_whisper_model(struct transcription_filter_data *gf, bool force_whisp
 				obs_log(LOG_WARNING, "External model file path is empty");
 			} else {
 				// check if the external model file is not currently loaded
-				if (gf->whisper_model_file_currently_loaded ==
-				    external_model_file_path) {
+				const std::string loading = gf->model_swap.requested_model_file();
+				if ((loading.empty() ? gf->whisper_model_file_currently_loaded
+						     : loading) == external_model_file_path &&
+				    !force_whisper_restart) {
 					obs_log(LOG_INFO, "External model file is already loaded");
 					return;
 				} else {
-					shutdown_whisper_thread(gf);
 					gf->whisper_model_path = new_model_path;
-					start_whisper_thread_with_path(
-						gf, external_model_file_path,
-						silero_vad_model_file_str.c_str());
+					reload_whisper_models(gf, external_model_file_path,
+							      silero_vad_model_file_str.c_str());
 				}
 			}
 		}
@@ -146,17 +422,14 @@ void update_whisper_model(struct transcription_filter_data *gf, bool force_whisp
 			// dtw_token_timestamps changed
 			obs_log(gf->log_level, "dtw_token_timestamps changed from %d to %d",
 				gf->enable_token_ts_dtw, new_dtw_timestamps);
-			gf->enable_token_ts_dtw = new_dtw_timestamps;
-			shutdown_whisper_thread(gf, false);
-			start_whisper_thread_with_path(gf, gf->whisper_model_file_currently_loaded,
-						       silero_vad_model_file_str.c_str());
-		}
-
-		if (force_whisper_restart) {
+			{
+				std::lock_guard<std::mutex> lock(gf->whisper_ctx_mutex);
+				gf->enable_token_ts_dtw = new_dtw_timestamps;
+			}
+			restart_whisper_models(gf, silero_vad_model_file_str.c_str());
+		} else if (force_whisper_restart) {
 			obs_log(gf->log_level, "Restarting whisper due to force restart flag");
-			shutdown_whisper_thread(gf, false);
-			start_whisper_thread_with_path(gf, gf->whisper_model_file_currently_loaded,
-						       silero_vad_model_file_str.c_str());
+			restart_whisper_models(gf, silero_vad_model_file_str.c_str());
 		}
 	}
 }
@@ -4,7 +4,32 @@
 #include <obs.h>
 
 #include "transcription-filter-data.h"
+#include "calibration.h"
 
 void update_whisper_model(struct transcription_filter_data *gf, bool force_whisper_restart = false);
 
+// The calibration profile of this machine, loaded from the module config directory once
+struct MachineCalibration {
+	// a profile was found
+	bool available = false;
+	// it was measured on this machine with the CPUs it has now
+	bool applies = false;
+	CalibrationProfile profile;
+};
+MachineCalibration machine_calibration();
+
+// Saves the profile of a calibration of this machine, the filters use it from now on
+bool save_machine_calibration(const CalibrationProfile &profile);
+
+// The calibration profile of the filter settings: the profile of this machine when the filter
+// uses it, see calibration.h
+bool calibration_profile_for_settings(obs_data_t *settings, CalibrationProfile &profile);
+
+// Calibrates the machine on the installed models in the background, see calibration.h, after
+// downloading the speech clip if needed. The filter drops its audio while the sweep runs and
+// applies its settings again with the new profile
+void calibrate_machine(struct transcription_filter_data *gf);
+// Stops the calibration of the filter, if any, and waits for it
+void stop_machine_calibration(struct transcription_filter_data *gf);
+
 #endif // WHISPER_MODEL_UTILS_H
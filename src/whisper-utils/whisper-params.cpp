@@ -141,14 +141,34 @@ void apply_whisper_params_from_settings(whisper_full_params &params, obs_data_t
 	params.beam_search.patience = (float)obs_data_get_double(settings, "beam_search.patience");
 }
 
+void apply_partial_decoding_profile(whisper_full_params &params,
+				    const transcription_filter_data &gf)
+{
+	params.strategy = (whisper_sampling_strategy)gf.partial_strategy;
+	params.greedy.best_of = 1;
+	if (!gf.partial_temperature_fallback) {
+		// a partial that fails the thresholds is shown as decoded, not decoded again
+		params.temperature_inc = 0.0f;
+	}
+	params.no_timestamps = gf.partial_no_timestamps;
+	if (gf.partial_max_tokens > 0) {
+		params.max_tokens = gf.partial_max_tokens;
+	}
+}
+
 void add_whisper_params_group_properties(obs_properties_t *ppts)
 {
 	obs_properties_t *g = obs_properties_create();
 	obs_properties_add_group(ppts, "whisper_params_group", MT_("whisper_parameters"),
 				 OBS_GROUP_NORMAL, g);
 
-	obs_properties_add_list(g, "strategy", MT_("whisper_sampling_strategy"),
-				OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+	obs_property_t *strategy = obs_properties_add_list(
+		g, "strategy", MT_("whisper_sampling_strategy"), OBS_COMBO_TYPE_LIST,
+		OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(strategy, MT_("whisper_sampling_greedy"),
+				  WHISPER_SAMPLING_GREEDY);
+	obs_property_list_add_int(strategy, MT_("whisper_sampling_beam_search"),
+				  WHISPER_SAMPLING_BEAM_SEARCH);
 	obs_properties_add_int(g, "n_threads", MT_("n_threads"), 1, 8, 1);
 	obs_properties_add_int(g, "n_max_text_ctx", MT_("n_max_text_ctx"), 1, 20000, 1);
 	obs_properties_add_int(g, "offset_ms", MT_("offset_ms"), 0, 10000, 100);
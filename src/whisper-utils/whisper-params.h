@@ -49,4 +49,18 @@ void apply_whisper_params_from_settings(whisper_full_params &params, obs_data_t
  */
 void add_whisper_params_group_properties(obs_properties_t *ppts);
 
+/**
+ * @brief Turns the whisper parameters of a final into the ones of a partial.
+ *
+ * A partial is replaced by the next one within a second, so it is decoded fast: with the
+ * strategy of the partial profile, a single greedy candidate, no temperature fallback, no
+ * timestamp tokens and a few tokens at most. The language, prompt, thresholds and beam size
+ * stay those of the finals.
+ *
+ * @param params The parameters of the finals, modified.
+ * @param gf The filter, with the partial profile.
+ */
+void apply_partial_decoding_profile(whisper_full_params &params,
+				    const transcription_filter_data &gf);
+
 #endif // WHISPER_PARAMS_H
@@ -8,56 +8,71 @@
 #include "transcription-filter-data.h"
 #include "whisper-processing.h"
 #include "whisper-utils.h"
+#include "whisper-params.h"
 #include "transcription-utils.h"
 
-#ifdef _WIN32
-#include <fstream>
-#define NOMINMAX
-#include <Windows.h>
-#endif
-
 #include "model-utils/model-find-utils.h"
 #include "vad-processing.h"
+#include "inference-scheduler.h"
+#include "compute-threads.h"
+#include "audio-ctx.h"
+#include "quality-controller.h"
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <regex>
 
-struct whisper_context *init_whisper_context(const std::string &model_path_in,
-					     struct transcription_filter_data *gf)
-{
-	std::string model_path = model_path_in;
-
-	obs_log(LOG_INFO, "Loading whisper model from %s", model_path.c_str());
+// log level of the whisper library messages, the log callback outlives the filters
+static std::atomic<int> whisper_log_level{LOG_DEBUG};
 
-	if (std::filesystem::is_directory(model_path)) {
-		obs_log(LOG_INFO,
-			"Model path is a directory, not a file, looking for .bin file in folder");
-		// look for .bin file
-		const std::string model_bin_file = find_model_file_in_folder(model_path);
-		if (model_bin_file.empty()) {
-			obs_log(LOG_ERROR, "Model bin file not found in folder: %s",
-				model_path.c_str());
-			return nullptr;
-		}
-		model_path = model_bin_file;
-	}
-
-	whisper_log_set(
-		[](enum ggml_log_level level, const char *text, void *user_data) {
-			UNUSED_PARAMETER(level);
-			struct transcription_filter_data *ctx =
-				static_cast<struct transcription_filter_data *>(user_data);
-			// remove trailing newline
-			char *text_copy = bstrdup(text);
-			text_copy[strcspn(text_copy, "\n")] = 0;
-			obs_log(ctx->log_level, "Whisper: %s", text_copy);
-			bfree(text_copy);
-		},
-		gf);
+/**
+ * @brief Runs a short inference on silence right after the load.
+ *
+ * Without it the first caption pays for touching the compute buffers of the new state and for
+ * the first use of the backend (e.g. compiling the GPU kernels), 2-3 times the steady latency.
+ * The encoder runs with the context of the decodes. Like a final, it waits for its threads
+ * from the inference scheduler.
+ */
+static void warm_up_whisper_state(struct whisper_context *ctx, struct whisper_state *state,
+				  const ModelLoadRequest &request,
+				  const transcription_filter_data *gf)
+{
+	const InferenceScheduler::Slot slot = InferenceScheduler::instance().admit(
+		gf, INFERENCE_JOB_FINAL, request.warm_up_threads);
+	whisper_full_params params = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+	params.n_threads = std::max(slot.threads(), 1);
+	params.audio_ctx = request.warm_up_audio_ctx;
+	params.language = "en";
+	params.detect_language = false;
+	params.no_context = true;
+	params.single_segment = true;
+	params.no_timestamps = true;
+	params.max_tokens = 1;
+	params.temperature_inc = 0.0f;
+	params.print_progress = false;
+	params.print_realtime = false;
+	params.print_timestamps = false;
+	params.print_special = false;
+	const std::vector<float> silence(WHISPER_SAMPLE_RATE, 0.0f);
+	const uint64_t warm_up_start_ms = now_ms();
+	const int result =
+		whisper_full_with_state(ctx, state, params, silence.data(), (int)silence.size());
+	obs_log(LOG_INFO, "Whisper warm-up inference %s in %llu ms",
+		result == 0 ? "done" : "failed", (unsigned long long)(now_ms() - warm_up_start_ms));
+}
 
-	struct whisper_context_params cparams = whisper_context_default_params();
+ModelLoadRequest whisper_model_load_request(const transcription_filter_data *gf,
+					    const std::string &model_file,
+					    const std::string &partial_model_file,
+					    const std::string &language_id_model_file)
+{
+	ModelLoadRequest request;
+	request.model_file = model_file;
+	request.partial_model_file = partial_model_file;
+	request.language_id_model_file = language_id_model_file;
 
+	whisper_context_params &cparams = request.context_params;
 	if (gf->gpu_device < 0) {
 		cparams.use_gpu = false;
 		obs_log(LOG_INFO, "Using CPU for inference");
@@ -94,54 +109,246 @@ struct whisper_context *init_whisper_context(const std::string &model_path_in,
 		cparams.dtw_aheads_preset = WHISPER_AHEADS_NONE;
 	}
 
-	struct whisper_context *ctx = nullptr;
-	try {
-#ifdef _WIN32
-		// convert model path UTF8 to wstring (wchar_t) for whisper
-		int count = MultiByteToWideChar(CP_UTF8, 0, model_path.c_str(),
-						(int)model_path.length(), NULL, 0);
-		std::wstring model_path_ws(count, 0);
-		MultiByteToWideChar(CP_UTF8, 0, model_path.c_str(), (int)model_path.length(),
-				    &model_path_ws[0], count);
-
-		// Read model into buffer
-		std::ifstream modelFile(model_path_ws, std::ios::binary);
-		if (!modelFile.is_open()) {
-			obs_log(LOG_ERROR, "Failed to open whisper model file %s",
+	request.log_level = gf->log_level;
+	request.keep_alive_sec = std::max(gf->model_keep_alive_sec, 0);
+	if (gf->model_warm_up) {
+		request.warm_up_threads = std::max(gf->whisper_params.n_threads, 1);
+		request.warm_up_audio_ctx = gf->whisper_params.audio_ctx;
+	}
+	return request;
+}
+
+/**
+ * @brief Takes a model file (or the .bin file of a folder) from the model registry with the
+ * context parameters of the request and creates a decoding state on it.
+ */
+static bool load_whisper_model(const std::string &model_path_in, const ModelLoadRequest &request,
+			       const struct transcription_filter_data *gf,
+			       std::shared_ptr<WhisperModel> &model, struct whisper_state *&state)
+{
+	std::string model_path = model_path_in;
+
+	obs_log(LOG_INFO, "Loading whisper model from %s", model_path.c_str());
+
+	if (std::filesystem::is_directory(model_path)) {
+		obs_log(LOG_INFO,
+			"Model path is a directory, not a file, looking for .bin file in folder");
+		// look for .bin file
+		const std::string model_bin_file = find_model_file_in_folder(model_path);
+		if (model_bin_file.empty()) {
+			obs_log(LOG_ERROR, "Model bin file not found in folder: %s",
 				model_path.c_str());
-			return nullptr;
-		}
-		modelFile.seekg(0, std::ios::end);
-		const size_t modelFileSize = modelFile.tellg();
-		modelFile.seekg(0, std::ios::beg);
-		std::vector<char> modelBuffer(modelFileSize);
-		modelFile.read(modelBuffer.data(), modelFileSize);
-		modelFile.close();
-
-		// Initialize whisper
-		ctx = whisper_init_from_buffer_with_params(modelBuffer.data(), modelFileSize,
-							   cparams);
-#else
-		ctx = whisper_init_from_file_with_params(model_path.c_str(), cparams);
-#endif
-	} catch (const std::exception &e) {
-		obs_log(LOG_ERROR, "Exception while loading whisper model: %s", e.what());
-		return nullptr;
+			return false;
+		}
+		model_path = model_bin_file;
 	}
-	if (ctx == nullptr) {
+
+	whisper_log_level = request.log_level;
+	whisper_log_set(
+		[](enum ggml_log_level level, const char *text, void *user_data) {
+			UNUSED_PARAMETER(level);
+			UNUSED_PARAMETER(user_data);
+			// remove trailing newline
+			char *text_copy = bstrdup(text);
+			text_copy[strcspn(text_copy, "\n")] = 0;
+			obs_log(whisper_log_level, "Whisper: %s", text_copy);
+			bfree(text_copy);
+		},
+		nullptr);
+
+	const uint64_t load_start_ms = now_ms();
+	model = WhisperModel::acquire(model_path, request.context_params,
+				      std::chrono::seconds(request.keep_alive_sec));
+	if (!model) {
 		obs_log(LOG_ERROR, "Failed to load whisper model");
-		return nullptr;
+		return false;
+	}
+	state = model->create_state();
+	if (state == nullptr) {
+		obs_log(LOG_ERROR, "Failed to create the whisper state");
+		model.reset();
+		return false;
 	}
 
+	// the weights take about the size of the file, whisper logs the size of the state
+	std::error_code error;
+	const uintmax_t weights_size = std::filesystem::file_size(model_path, error);
+	obs_log(LOG_INFO, "Whisper model %s ready in %llu ms, %.1f MB of weights",
+		model_path.c_str(), (unsigned long long)(now_ms() - load_start_ms),
+		error ? 0.0 : (double)weights_size / (1024.0 * 1024.0));
+	if (request.warm_up_threads > 0) {
+		warm_up_whisper_state(model->get_context(), state, request, gf);
+	}
+	return true;
+}
+
+bool load_whisper_models(const ModelLoadRequest &request, struct transcription_filter_data *gf,
+			 WhisperModelSet &models)
+{
+	if (!load_whisper_model(request.model_file, request, gf, models.model, models.state)) {
+		return false;
+	}
+	models.model_file = request.model_file;
+	models.warmed_up = request.warm_up_threads > 0;
 	obs_log(LOG_INFO, "Whisper model loaded: %s", whisper_print_system_info());
-	return ctx;
+
+	if (!request.partial_model_file.empty()) {
+		if (load_whisper_model(request.partial_model_file, request, gf,
+				       models.partial_model, models.partial_state)) {
+			obs_log(LOG_INFO, "Partials are decoded with %s",
+				request.partial_model_file.c_str());
+		} else {
+			obs_log(LOG_WARNING,
+				"Failed to load the partial model, the partials use the main model");
+		}
+	}
+
+	if (!request.language_id_model_file.empty()) {
+		if (!load_whisper_model(request.language_id_model_file, request, gf,
+					models.language_id_model, models.language_id_state)) {
+			obs_log(LOG_WARNING,
+				"Failed to load the language ID model, the main model detects the language");
+		} else if (!whisper_is_multilingual(models.language_id_model->get_context())) {
+			obs_log(LOG_WARNING,
+				"%s is an English-only model, it cannot detect the language",
+				request.language_id_model_file.c_str());
+			whisper_free_state(models.language_id_state);
+			models.language_id_state = nullptr;
+			models.language_id_model.reset();
+		} else {
+			obs_log(LOG_INFO, "The language is detected with %s",
+				request.language_id_model_file.c_str());
+		}
+	}
+	return true;
+}
+
+void swap_whisper_models(struct transcription_filter_data *gf, WhisperModelSet &models)
+{
+	std::swap(gf->whisper_model, models.model);
+	std::swap(gf->whisper_state, models.state);
+	std::swap(gf->partial_whisper_model, models.partial_model);
+	std::swap(gf->partial_whisper_state, models.partial_state);
+	std::swap(gf->language_id_model, models.language_id_model);
+	std::swap(gf->language_id_state, models.language_id_state);
+	std::swap(gf->whisper_model_file_currently_loaded, models.model_file);
+	std::swap(gf->whisper_model_warmed_up, models.warmed_up);
+
+	gf->whisper_context = gf->whisper_model ? gf->whisper_model->get_context() : nullptr;
+	gf->partial_whisper_context =
+		gf->partial_whisper_model ? gf->partial_whisper_model->get_context() : nullptr;
+	gf->language_id_context = gf->language_id_model ? gf->language_id_model->get_context()
+							: nullptr;
+	if (gf->whisper_context != nullptr &&
+	    (!gf->mel_cache.is_initialized() ||
+	     gf->mel_cache.get_n_mel() != whisper_model_n_mels(gf->whisper_context))) {
+		// the frames of the old model are computed again with the bands of the new one
+		gf->mel_cache.init(whisper_model_n_mels(gf->whisper_context));
+	}
+	// the new models may detect another language
+	gf->language_id.reset();
+	// and decode at another speed
+	gf->quality.reset(now_ms());
+	gf->partial_latency_controller.reset();
+	gf->first_inference_after_load = true;
+}
+
+void release_whisper_model(struct transcription_filter_data *gf)
+{
+	if (gf->whisper_state != nullptr) {
+		whisper_free_state(gf->whisper_state);
+		gf->whisper_state = nullptr;
+	}
+	gf->whisper_context = nullptr;
+	if (gf->partial_whisper_state != nullptr) {
+		whisper_free_state(gf->partial_whisper_state);
+		gf->partial_whisper_state = nullptr;
+	}
+	gf->partial_whisper_context = nullptr;
+	if (gf->language_id_state != nullptr) {
+		whisper_free_state(gf->language_id_state);
+		gf->language_id_state = nullptr;
+	}
+	gf->language_id_context = nullptr;
+	// the registry keeps the weights for the other filters or the grace period
+	gf->whisper_model.reset();
+	gf->partial_whisper_model.reset();
+	gf->language_id_model.reset();
+}
+
+/**
+ * @brief Whether an inference runs on the partial model: a partial, or a final while the quality
+ * controller falls back to the smaller model, with one loaded. The caller holds
+ * whisper_ctx_mutex.
+ */
+static bool uses_partial_model(const transcription_filter_data *gf, int vad_state)
+{
+	return (vad_state == VAD_STATE_PARTIAL || gf->quality.use_smaller_model()) &&
+	       gf->partial_whisper_state != nullptr;
+}
+
+int partial_interval_ms(const transcription_filter_data *gf)
+{
+	const int interval_ms = gf->adaptive_partial_latency
+					? gf->partial_latency_controller.interval(
+						  gf->partial_latency, gf->input_backlog_ms)
+					: gf->partial_latency;
+	return gf->quality.partial_interval(interval_ms);
+}
+
+/**
+ * @brief Whether partials go through the local agreement.
+ *
+ * Not without the VAD: that mode ends a segment on the amount of audio in the buffer, which
+ * the agreement trims.
+ */
+static bool partial_agreement_enabled(const transcription_filter_data *gf)
+{
+	return gf->partial_agreement && gf->vad_mode != VAD_MODE_DISABLED;
+}
+
+/**
+ * @brief Whether the language is left to whisper, the language ID cache then picks it.
+ */
+static bool language_is_auto(const transcription_filter_data *gf)
+{
+	const char *language = gf->whisper_params.language;
+	return language == nullptr || language[0] == '\0' || strcmp(language, "auto") == 0;
+}
+
+static void log_quality_transition(const QualityController::Transition &transition)
+{
+	obs_log(LOG_INFO,
+		"Decoding quality %s: %s -> %s (%s: real-time factor %.2f, backlog %llu ms)",
+		transition.to > transition.from ? "lowered" : "raised",
+		QualityController::stage_name(transition.from),
+		QualityController::stage_name(transition.to),
+		QualityController::cause_name(transition.cause), transition.rtf,
+		(unsigned long long)transition.backlog_ms);
+}
+
+/**
+ * @brief The fast decoding overload policy: holds the decoding at greedy without temperature
+ * fallback while the backlog is over its limit, with the quality controller enabled or not.
+ */
+static void update_overload_floor(transcription_filter_data *gf)
+{
+	const bool fast_decoding = gf->overload_active &&
+				   gf->overload_policy == OVERLOAD_POLICY_FAST_DECODING;
+	QualityController::Transition transition;
+	if (gf->quality.set_floor(fast_decoding ? QUALITY_STAGE_NO_FALLBACK : QUALITY_STAGE_FULL,
+				  QUALITY_CAUSE_OVERLOAD_POLICY, gf->input_backlog_ms, transition)) {
+		log_quality_transition(transition);
+	}
 }
 
 struct DetectionResultWithText run_whisper_inference(struct transcription_filter_data *gf,
 						     const float *pcm32f_data_,
 						     size_t pcm32f_num_samples, uint64_t t0 = 0,
 						     uint64_t t1 = 0,
-						     int vad_state = VAD_STATE_WAS_OFF)
+						     int vad_state = VAD_STATE_WAS_OFF,
+						     int n_threads = 0, int audio_ctx = 0,
+						     int mel_frames = 0)
 {
 	if (gf == nullptr) {
 		obs_log(LOG_ERROR, "run_whisper_inference: gf is null");
@@ -160,55 +367,81 @@ struct DetectionResultWithText run_whisper_inference(struct transcription_filter
 		return {DETECTION_RESULT_UNKNOWN, "", t0, t1, {}, ""};
 	}
 
-	obs_log(gf->log_level, "%s: processing %d samples, %.3f sec, %d threads", __func__,
-		int(pcm32f_num_samples), float(pcm32f_num_samples) / WHISPER_SAMPLE_RATE,
-		gf->whisper_params.n_threads);
+	obs_log(gf->log_level, "%s: processing %d samples, %.3f sec, %d threads, audio_ctx %d",
+		__func__, int(pcm32f_num_samples), float(pcm32f_num_samples) / WHISPER_SAMPLE_RATE,
+		gf->whisper_params.n_threads, audio_ctx);
 
-	bool should_free_buffer = false;
-	float *pcm32f_data = (float *)pcm32f_data_;
+	const float *pcm32f_data = pcm32f_data_;
 	size_t pcm32f_size = pcm32f_num_samples;
+	// samples of padding before the audio, the token times are made relative to the audio
+	size_t padding_samples = 0;
 
 	// incoming duration in ms
 	const uint64_t incoming_duration_ms =
 		(uint64_t)(pcm32f_num_samples * 1000 / WHISPER_SAMPLE_RATE);
 
-	if (pcm32f_num_samples < WHISPER_SAMPLE_RATE) {
+	if (pcm32f_num_samples < WHISPER_SAMPLE_RATE && audio_ctx > 0) {
+		// whisper does not decode less than a second, the short context does not need the
+		// audio in the middle: append silence
+		std::vector<float> &padded = gf->short_segment_buffer;
+		padded.assign((size_t)(1.01f * (float)(WHISPER_SAMPLE_RATE)), 0.0f);
+		memcpy(padded.data(), pcm32f_data_, pcm32f_num_samples * sizeof(float));
+		pcm32f_data = padded.data();
+		pcm32f_size = padded.size();
+	} else if (pcm32f_num_samples < WHISPER_SAMPLE_RATE) {
 		obs_log(gf->log_level,
 			"Speech segment is less than 1 second, padding with white noise to 1 second");
 		const size_t new_size = (size_t)(1.01f * (float)(WHISPER_SAMPLE_RATE));
-		// create a new buffer and copy the data to it in the middle
-		pcm32f_data = (float *)bzalloc(new_size * sizeof(float));
+		// reuse the padding buffer, it only allocates on the first short segment
+		std::vector<float> &padded = gf->short_segment_buffer;
+		padded.resize(new_size);
 
 		// add low volume white noise
 		const float noise_level = 0.01f;
 		for (size_t i = 0; i < new_size; ++i) {
-			pcm32f_data[i] =
-				noise_level * ((float)rand() / (float)RAND_MAX * 2.0f - 1.0f);
+			padded[i] = noise_level * ((float)rand() / (float)RAND_MAX * 2.0f - 1.0f);
 		}
 
-		memcpy(pcm32f_data + (new_size - pcm32f_num_samples) / 2, pcm32f_data_,
+		// copy the data to it in the middle
+		padding_samples = (new_size - pcm32f_num_samples) / 2;
+		memcpy(padded.data() + padding_samples, pcm32f_data_,
 		       pcm32f_num_samples * sizeof(float));
+		pcm32f_data = padded.data();
 		pcm32f_size = new_size;
-		should_free_buffer = true;
 	}
 
-	// duration in ms
-	const uint64_t whisper_duration_ms = (uint64_t)(pcm32f_size * 1000 / WHISPER_SAMPLE_RATE);
+	// duration in ms, the mel of the segment has a frame every 10 ms
+	const uint64_t whisper_duration_ms =
+		mel_frames > 0 ? (uint64_t)mel_frames * 10
+			       : (uint64_t)(pcm32f_size * 1000 / WHISPER_SAMPLE_RATE);
 
 	std::lock_guard<std::mutex> lock(gf->whisper_ctx_mutex);
 	if (gf->whisper_context == nullptr) {
 		obs_log(LOG_WARNING, "whisper context is null");
 		return {DETECTION_RESULT_UNKNOWN, "", t0, t1, {}, ""};
 	}
+	const bool partial_model = uses_partial_model(gf, vad_state);
+	struct whisper_context *ctx = partial_model ? gf->partial_whisper_context
+						    : gf->whisper_context;
+	struct whisper_state *state = partial_model ? gf->partial_whisper_state
+						    : gf->whisper_state;
 
+	// outlives the inference, the parameters point to it
+	std::string initial_prompt;
 	if (gf->n_context_sentences > 0 && !gf->last_transcription_sentence.empty()) {
 		// set the initial prompt to the last transcription sentences (concatenated)
-		std::string initial_prompt = gf->last_transcription_sentence[0];
+		initial_prompt = gf->last_transcription_sentence[0];
 		for (size_t i = 1; i < gf->last_transcription_sentence.size(); ++i) {
 			initial_prompt += " " + gf->last_transcription_sentence[i];
 		}
-		gf->whisper_params.initial_prompt = initial_prompt.c_str();
-		obs_log(gf->log_level, "Initial prompt: %s", gf->whisper_params.initial_prompt);
+	}
+	// the audio of the committed tokens was trimmed, they are the context of the tail
+	const std::string committed_text = gf->local_agreement.committed_text();
+	if (!committed_text.empty()) {
+		if (initial_prompt.empty() && gf->whisper_params.initial_prompt != nullptr) {
+			initial_prompt = gf->whisper_params.initial_prompt;
+		}
+		initial_prompt += committed_text;
 	}
 
 	obs_log(gf->log_level, "Running whisper inference. single segment? %s",
@@ -217,6 +450,39 @@ struct DetectionResultWithText run_whisper_inference(struct transcription_filter
 	// run the inference
 	int whisper_full_result = -1;
 	gf->whisper_params.duration_ms = (int)(whisper_duration_ms);
+	whisper_full_params params = gf->whisper_params;
+	if (!initial_prompt.empty()) {
+		params.initial_prompt = initial_prompt.c_str();
+		obs_log(gf->log_level, "Initial prompt: %s", params.initial_prompt);
+	}
+	if (vad_state == VAD_STATE_PARTIAL) {
+		// the partials are decoded fast, the finals with the full quality
+		apply_partial_decoding_profile(params, *gf);
+	}
+	if (partial_agreement_enabled(gf) || !gf->local_agreement.empty()) {
+		// the agreement places the tokens in the audio to trim it
+		params.token_timestamps = true;
+		params.no_timestamps = false;
+	}
+	if (language_is_auto(gf)) {
+		// decode with the cached language, whisper_full stops after the language detection
+		// when asked for it
+		params.detect_language = false;
+		if (gf->language_id.has_language()) {
+			params.language = whisper_lang_str(gf->language_id.language_id());
+		}
+	}
+	if (audio_ctx > 0) {
+		params.audio_ctx = audio_ctx;
+	}
+	if (n_threads > 0) {
+		// the threads the inference scheduler admitted the job with
+		params.n_threads = n_threads;
+	}
+	// the stage the quality controller lowered the decoding to, the fast decoding overload
+	// policy included
+	update_overload_floor(gf);
+	gf->quality.apply(params, vad_state == VAD_STATE_PARTIAL);
 	try {
 		// whisper_full_params whisper_params_tmp = whisper_full_default_params(whisper_sampling_strategy::WHISPER_SAMPLING_BEAM_SEARCH);
 		// whisper_params_tmp.language = gf->whisper_params.language;
@@ -228,47 +494,50 @@ struct DetectionResultWithText run_whisper_inference(struct transcription_filter
 		// whisper_params_tmp.suppress_blank = false;
 		// whisper_params_pretty_print(gf->whisper_params);
 		// whisper_params_pretty_print(whisper_params_tmp);
-		whisper_full_result = whisper_full(gf->whisper_context, gf->whisper_params,
-						   pcm32f_data, (int)pcm32f_size);
+		if (mel_frames > 0 &&
+		    whisper_set_mel_with_state(ctx, state, gf->mel_input.data(),
+					       mel_frames + MelCache::PADDING_FRAMES,
+					       gf->mel_cache.get_n_mel()) == 0) {
+			// whisper_full only computes the mel when it is given samples
+			whisper_full_result =
+				whisper_full_with_state(ctx, state, params, nullptr, 0);
+		} else {
+			whisper_full_result = whisper_full_with_state(ctx, state, params,
+								      pcm32f_data, (int)pcm32f_size);
+		}
 	} catch (const std::exception &e) {
 		obs_log(LOG_ERROR, "Whisper exception: %s. Filter restart is required", e.what());
-		whisper_free(gf->whisper_context);
-		gf->whisper_context = nullptr;
-		if (should_free_buffer) {
-			bfree(pcm32f_data);
-		}
+		release_whisper_model(gf);
 		return {DETECTION_RESULT_UNKNOWN, "", t0, t1, {}, ""};
 	}
-	if (should_free_buffer) {
-		bfree(pcm32f_data);
-	}
-
-	std::string language = gf->whisper_params.language;
-	if (gf->whisper_params.language == nullptr || strlen(gf->whisper_params.language) == 0 ||
-	    strcmp(gf->whisper_params.language, "auto") == 0) {
-		int lang_id = whisper_lang_auto_detect(gf->whisper_context, 0, 1, nullptr);
-		language = whisper_lang_str(lang_id);
-		obs_log(gf->log_level, "Detected language: %s", language.c_str());
-	}
 
 	if (whisper_full_result != 0) {
-		obs_log(LOG_WARNING, "failed to process audio, error %d", whisper_full_result);
+		if (gf->inference_abort.should_abort()) {
+			obs_log(gf->log_level, "Inference aborted, error %d", whisper_full_result);
+		} else {
+			obs_log(LOG_WARNING, "failed to process audio, error %d",
+				whisper_full_result);
+		}
 		return {DETECTION_RESULT_UNKNOWN, "", t0, t1, {}, ""};
 	}
 
+	std::string language = params.language != nullptr ? params.language : "";
+	if (language.empty() || language == "auto") {
+		// no language was cached, whisper_full detected it before decoding
+		language = whisper_lang_str(whisper_full_lang_id_from_state(state));
+	}
+
 	float sentence_p = 0.0f;
 	std::string text = "";
 	std::string tokenIds = "";
 	std::vector<whisper_token_data> tokens;
-	for (int n_segment = 0; n_segment < whisper_full_n_segments(gf->whisper_context);
-	     ++n_segment) {
-		const int n_tokens = whisper_full_n_tokens(gf->whisper_context, n_segment);
+	for (int n_segment = 0; n_segment < whisper_full_n_segments_from_state(state); ++n_segment) {
+		const int n_tokens = whisper_full_n_tokens_from_state(state, n_segment);
 		for (int j = 0; j < n_tokens; ++j) {
 			// get token
 			whisper_token_data token =
-				whisper_full_get_token_data(gf->whisper_context, n_segment, j);
-			const std::string token_str =
-				whisper_token_to_str(gf->whisper_context, token.id);
+				whisper_full_get_token_data_from_state(state, n_segment, j);
+			const std::string token_str = whisper_token_to_str(ctx, token.id);
 			bool keep = true;
 			// if the token starts with '[' and ends with ']', don't keep it
 			if (token_str[0] == '[' && token_str[token_str.size() - 1] == ']') {
@@ -301,6 +570,10 @@ struct DetectionResultWithText run_whisper_inference(struct transcription_filter
 			}
 
 			if (keep) {
+				const int64_t padding_cs =
+					(int64_t)(padding_samples * 100 / WHISPER_SAMPLE_RATE);
+				token.t0 = std::max<int64_t>(token.t0 - padding_cs, 0);
+				token.t1 = std::max<int64_t>(token.t1 - padding_cs, 0);
 				sentence_p += token.p;
 				text += token_str;
 				tokens.push_back(token);
@@ -310,6 +583,10 @@ struct DetectionResultWithText run_whisper_inference(struct transcription_filter
 		}
 	}
 	sentence_p /= (float)tokens.size();
+	if (language_is_auto(gf) && gf->language_id.has_language() && !tokens.empty()) {
+		// decodes in the wrong language come out with a low confidence
+		gf->language_id.report_decode(sentence_p);
+	}
 	if (sentence_p < gf->sentence_psum_accept_thresh) {
 		obs_log(gf->log_level, "Sentence psum %.3f below threshold %.3f, skipping",
 			sentence_p, gf->sentence_psum_accept_thresh);
@@ -336,29 +613,324 @@ struct DetectionResultWithText run_whisper_inference(struct transcription_filter
 		language};
 }
 
+/**
+ * @brief Whether the energy gate found the whole whisper buffer clearly silent.
+ *
+ * Only without the VAD segmentation, which sends speech segments only. Audio after the last
+ * classified window (less than a window) does not count.
+ */
+static bool segment_is_gated(transcription_filter_data *gf)
+{
+	if (!gf->energy_gate_enabled || gf->vad_mode == VAD_MODE_ACTIVE) {
+		return false;
+	}
+	const uint64_t front = gf->whisper_buffer.front_position();
+	return gf->gate_position > front && gf->last_voiced_sample <= front;
+}
+
+/**
+ * @brief Encoder context for a segment: sized to it in the dynamic mode, unless the user set
+ * audio_ctx in the whisper parameters.
+ */
+static int segment_audio_ctx(const transcription_filter_data *gf, size_t num_samples)
+{
+	if (!gf->dynamic_audio_ctx || gf->whisper_params.audio_ctx != 0) {
+		return 0;
+	}
+	return audio_ctx_for_samples(num_samples);
+}
+
+/**
+ * @brief Why the result of a short context decode looks degenerate, nullptr if it is usable.
+ */
+static const char *short_ctx_failure(const transcription_filter_data *gf,
+				     const DetectionResultWithText &result, size_t num_samples)
+{
+	if (result.result == DETECTION_RESULT_UNKNOWN) {
+		return "decoding failed";
+	}
+	if (result.result == DETECTION_RESULT_SILENCE && gf->vad_mode != VAD_MODE_ACTIVE) {
+		// without the VAD the segment may really be silent
+		return nullptr;
+	}
+	std::vector<int> ids;
+	float mean_p = 0.0f;
+	for (const whisper_token_data &token : result.tokens) {
+		ids.push_back(token.id);
+		mean_p += token.p;
+	}
+	mean_p /= (float)std::max<size_t>(ids.size(), 1);
+	return audio_ctx_degenerate_reason(ids, mean_p, gf->sentence_psum_accept_thresh,
+					   (double)num_samples / WHISPER_SAMPLE_RATE);
+}
+
+/**
+ * @brief Builds the spectrogram of the segment at the front of the whisper buffer in
+ * gf->mel_input from the cached frames, see mel-cache.h.
+ *
+ * @return Number of frames of the segment, 0 when whisper is given the samples.
+ */
+static int build_mel_input(transcription_filter_data *gf, size_t num_samples, int vad_state)
+{
+	// shorter segments are padded to the second whisper needs as samples
+	if (!gf->incremental_mel || !gf->mel_cache.is_initialized() ||
+	    num_samples < WHISPER_SAMPLE_RATE ||
+	    gf->mel_cache.end_position() != gf->whisper_buffer.back_position()) {
+		return 0;
+	}
+	{
+		std::lock_guard<std::mutex> lock(gf->whisper_ctx_mutex);
+		if (uses_partial_model(gf, vad_state) &&
+		    whisper_model_n_mels(gf->partial_whisper_context) !=
+			    gf->mel_cache.get_n_mel()) {
+			// the cache has the bands of the main model
+			return 0;
+		}
+	}
+	ProfileScope("build mel");
+	const uint64_t front = gf->whisper_buffer.front_position();
+	return gf->mel_cache.build(gf->whisper_buffer.data(), front, num_samples, gf->mel_input);
+}
+
+/**
+ * @brief Places the tokens of the last inference on the whisper buffer.
+ *
+ * Their times are in 10 ms units from the start of the audio given to whisper: the guard
+ * before the front of the buffer, or the first frame of the cached spectrogram.
+ */
+static std::vector<StreamToken> to_stream_tokens(transcription_filter_data *gf,
+						  const std::vector<whisper_token_data> &tokens,
+						  int vad_state)
+{
+	std::vector<StreamToken> stream_tokens;
+	const int64_t first = gf->inference_first_sample;
+	std::lock_guard<std::mutex> lock(gf->whisper_ctx_mutex);
+	if (gf->whisper_context == nullptr) {
+		return stream_tokens;
+	}
+	// the partial model may have another vocabulary (English-only or multilingual)
+	struct whisper_context *ctx = uses_partial_model(gf, vad_state) ? gf->partial_whisper_context
+									: gf->whisper_context;
+	for (const whisper_token_data &token : tokens) {
+		const int64_t start = first + token.t0 * WHISPER_SAMPLE_RATE / 100;
+		const int64_t end = first + std::max(token.t0, token.t1) * WHISPER_SAMPLE_RATE / 100;
+		stream_tokens.push_back({token.id,
+					 whisper_token_to_str(ctx, token.id), token.p,
+					 (uint64_t)std::max<int64_t>(start, 0),
+					 (uint64_t)std::max<int64_t>(end, 0)});
+	}
+	return stream_tokens;
+}
+
+/**
+ * @brief Runs a partial through the local agreement, its caption becomes the committed and
+ * the tentative text.
+ */
+static void agree_on_partial(transcription_filter_data *gf, DetectionResultWithText &result)
+{
+	if (result.result != DETECTION_RESULT_PARTIAL && result.result != DETECTION_RESULT_SILENCE) {
+		// inference failed, this is no hypothesis
+		return;
+	}
+	const size_t committed = gf->local_agreement.insert(
+		result.result == DETECTION_RESULT_PARTIAL
+			? to_stream_tokens(gf, result.tokens, VAD_STATE_PARTIAL)
+			: std::vector<StreamToken>());
+	obs_log(gf->log_level, "Local agreement: %zu tokens committed (%zu in total), %zu tentative",
+		committed, gf->local_agreement.committed().size(),
+		gf->local_agreement.tentative().size());
+	const std::string text = gf->local_agreement.text();
+	if (!text.empty()) {
+		result.result = DETECTION_RESULT_PARTIAL;
+		result.text = text;
+	}
+}
+
+/**
+ * @brief Ends the segment of the local agreement, the final result is the committed text
+ * followed by the final decode of the tail.
+ */
+static void finish_agreement(transcription_filter_data *gf, DetectionResultWithText &result)
+{
+	const std::vector<StreamToken> tokens = gf->local_agreement.finish(
+		result.result == DETECTION_RESULT_SPEECH
+			? to_stream_tokens(gf, result.tokens, VAD_STATE_WAS_OFF)
+			: std::vector<StreamToken>());
+	if (tokens.empty()) {
+		return;
+	}
+	std::string text;
+	for (const StreamToken &token : tokens) {
+		text += token.text;
+	}
+	result.result = DETECTION_RESULT_SPEECH;
+	result.text = text;
+}
+
+/**
+ * @brief Input frames once the segment of a partial reaches the segment duration: the final of
+ * its audio is due then, the partial is superseded.
+ */
+static uint64_t partial_supersede_frames(transcription_filter_data *gf, uint64_t start_offset_ms,
+					 uint64_t end_offset_ms)
+{
+	const uint64_t segment_end_ms = start_offset_ms + (uint64_t)gf->segment_duration;
+	const uint64_t missing_ms = segment_end_ms > end_offset_ms ? segment_end_ms - end_offset_ms
+								   : 0;
+	return gf->input_ring.frames_available() + missing_ms * gf->sample_rate / 1000;
+}
+
+/**
+ * @brief Detects the language of the segment before decoding it, when the language ID cache
+ * asks for it (see language-id.h), on the language ID model if one is loaded.
+ */
+static void update_language(transcription_filter_data *gf, const float *samples,
+			    size_t num_samples, uint64_t start_offset_ms, int n_threads)
+{
+	std::lock_guard<std::mutex> lock(gf->whisper_ctx_mutex);
+	if (gf->whisper_context == nullptr || !language_is_auto(gf) ||
+	    !whisper_is_multilingual(gf->whisper_context)) {
+		return;
+	}
+	const uint64_t detect_start_ms = now_ms();
+	if (!gf->language_id.detection_due(detect_start_ms, start_offset_ms)) {
+		return;
+	}
+	const bool own_model = gf->language_id_state != nullptr;
+	struct whisper_context *ctx = own_model ? gf->language_id_context : gf->whisper_context;
+	struct whisper_state *state = own_model ? gf->language_id_state : gf->whisper_state;
+	gf->language_probs.resize((size_t)whisper_lang_max_id() + 1);
+	if (whisper_pcm_to_mel_with_state(ctx, state, samples, (int)num_samples, n_threads) != 0) {
+		obs_log(LOG_WARNING, "Language ID: failed to compute the spectrogram");
+		return;
+	}
+	const int lang_id = whisper_lang_auto_detect_with_state(ctx, state, 0, n_threads,
+								 gf->language_probs.data());
+	if (lang_id < 0) {
+		obs_log(LOG_WARNING, "Language ID: detection failed, error %d", lang_id);
+		return;
+	}
+	const float probability = gf->language_probs[(size_t)lang_id];
+	gf->language_id.update(lang_id, probability, detect_start_ms, start_offset_ms);
+	obs_log(gf->log_level, "Language ID: %s (p %.3f) in %llu ms%s", whisper_lang_str(lang_id),
+		probability, (unsigned long long)(now_ms() - detect_start_ms),
+		own_model ? " on the language ID model" : "");
+}
+
 void run_inference_and_callbacks(transcription_filter_data *gf, uint64_t start_offset_ms,
-				 uint64_t end_offset_ms, int vad_state)
-{
-	// get the data from the entire whisper buffer
-	// add 50ms of silence to the beginning and end of the buffer
-	const size_t pcm32f_size = gf->whisper_buffer.size / sizeof(float);
-	const size_t pcm32f_size_with_silence = pcm32f_size + 2 * WHISPER_SAMPLE_RATE / 100;
-	// allocate a new buffer and copy the data to it
-	float *pcm32f_data = (float *)bzalloc(pcm32f_size_with_silence * sizeof(float));
-	if (vad_state == VAD_STATE_PARTIAL) {
-		// peek instead of pop, since this is a partial run that keeps the data in the buffer
-		deque_peek_front(&gf->whisper_buffer, pcm32f_data + WHISPER_SAMPLE_RATE / 100,
-				 pcm32f_size * sizeof(float));
-	} else {
-		deque_pop_front(&gf->whisper_buffer, pcm32f_data + WHISPER_SAMPLE_RATE / 100,
-				pcm32f_size * sizeof(float));
+				 uint64_t end_offset_ms, int vad_state, size_t num_samples)
+{
+	// run on the whisper buffer in place, with 10ms of silence at the beginning and end of
+	// the buffer
+	size_t pcm32f_size_with_silence = 0;
+	const float *pcm32f_data = gf->whisper_buffer.data_with_guards(pcm32f_size_with_silence);
+	size_t pcm32f_size = gf->whisper_buffer.size();
+	if (num_samples > 0 && num_samples < pcm32f_size) {
+		// only the start of the buffer: the audio after it stays in place for the next
+		// segment, so there is no silence at the end
+		pcm32f_size_with_silence = gf->whisper_buffer.guard_size() + num_samples;
+		pcm32f_size = num_samples;
 	}
 
 	auto inference_start_ts = now_ms();
 
-	struct DetectionResultWithText inference_result =
-		run_whisper_inference(gf, pcm32f_data, pcm32f_size_with_silence, start_offset_ms,
-				      end_offset_ms, vad_state);
+	struct DetectionResultWithText inference_result;
+	InferenceAbortReason abort_reason = INFERENCE_ABORT_NONE;
+	if (segment_is_gated(gf)) {
+		// whisper would only return silence (or hallucinate) on it
+		gf->skipped_inferences++;
+		obs_log(gf->log_level, "Energy gate: no sound in the segment, inference skipped");
+		inference_result = {DETECTION_RESULT_SILENCE, "", start_offset_ms, end_offset_ms, {},
+				    ""};
+	} else {
+		// wait for a share of the CPU, a partial that waits longer than the partial
+		// interval is dropped, the next one covers newer audio
+		const bool partial = vad_state == VAD_STATE_PARTIAL;
+		const int partial_interval = partial_interval_ms(gf);
+		int n_threads = 0;
+		{
+			// the settings update rewrites the parameters
+			std::lock_guard<std::mutex> lock(gf->whisper_ctx_mutex);
+			n_threads = gf->whisper_params.n_threads;
+		}
+		InferenceScheduler::Slot slot = InferenceScheduler::instance().admit(
+			gf, partial ? INFERENCE_JOB_PARTIAL : INFERENCE_JOB_FINAL, n_threads,
+			std::chrono::milliseconds(partial ? partial_interval : 0));
+		if (!slot) {
+			obs_log(gf->log_level, "Inference scheduler: partial dropped, waited %d ms",
+				partial_interval);
+			gf->quality.report_inference(now_ms() - inference_start_ts);
+			gf->partial_latency_controller.report_partial(now_ms() - inference_start_ts);
+			return;
+		}
+		const uint64_t whisper_start_ms = now_ms();
+		update_language(gf, pcm32f_data, pcm32f_size_with_silence, start_offset_ms,
+				slot.threads());
+		const uint64_t front = gf->whisper_buffer.front_position();
+		const int mel_frames = build_mel_input(gf, pcm32f_size, vad_state);
+		gf->inference_first_sample =
+			mel_frames > 0 ? (int64_t)MelCache::first_frame_center(front)
+				       : (int64_t)front - (int64_t)gf->whisper_buffer.guard_size();
+		const int audio_ctx = segment_audio_ctx(gf, pcm32f_size_with_silence);
+		gf->inference_abort.begin(partial, partial_supersede_frames(gf, start_offset_ms,
+									   end_offset_ms));
+		inference_result = run_whisper_inference(gf, pcm32f_data, pcm32f_size_with_silence,
+							 start_offset_ms, end_offset_ms, vad_state,
+							 slot.threads(), audio_ctx, mel_frames);
+		gf->whisper_runs++;
+		const char *failure = audio_ctx > 0 && !gf->inference_abort.should_abort()
+					      ? short_ctx_failure(gf, inference_result, pcm32f_size)
+					      : nullptr;
+		if (failure != nullptr) {
+			gf->audio_ctx_fallbacks++;
+			obs_log(gf->log_level, "audio_ctx %d: %s, decoding with the full context",
+				audio_ctx, failure);
+			inference_result = run_whisper_inference(
+				gf, pcm32f_data, pcm32f_size_with_silence, start_offset_ms,
+				end_offset_ms, vad_state, slot.threads(), 0, mel_frames);
+		}
+		abort_reason = gf->inference_abort.end();
+		const uint64_t whisper_ms = now_ms() - whisper_start_ms;
+		gf->whisper_run_ms += whisper_ms;
+		if (gf->first_inference_after_load) {
+			gf->first_inference_after_load = false;
+			obs_log(LOG_INFO,
+				"First inference after the model load: %llu ms for %zu ms of audio%s",
+				(unsigned long long)whisper_ms,
+				pcm32f_size * 1000 / WHISPER_SAMPLE_RATE,
+				gf->whisper_model_warmed_up ? ", warmed up" : ", not warmed up");
+		}
+		if (partial) {
+			std::lock_guard<std::mutex> lock(gf->whisper_ctx_mutex);
+			if (uses_partial_model(gf, vad_state)) {
+				gf->partial_model_runs++;
+				gf->partial_model_run_ms += whisper_ms;
+			}
+		}
+		// the whisper thread takes no new audio while it waits for the scheduler either
+		gf->quality.report_inference(now_ms() - inference_start_ts);
+		if (partial) {
+			gf->partials_run++;
+			gf->partial_latency_controller.report_partial(now_ms() - inference_start_ts);
+		}
+	}
+	if (abort_reason != INFERENCE_ABORT_NONE) {
+		// nothing to show: the final of the audio is next, or the audio is dropped
+		obs_log(gf->log_level, "Inference aborted: %s",
+			InferenceAbort::reason_name(abort_reason));
+		return;
+	}
+
+	if (vad_state == VAD_STATE_PARTIAL && partial_agreement_enabled(gf)) {
+		agree_on_partial(gf, inference_result);
+	} else if (vad_state != VAD_STATE_PARTIAL && !gf->local_agreement.empty()) {
+		finish_agreement(gf, inference_result);
+	}
+
+	// delay between capturing the end of this audio and having its transcription
+	const uint64_t now_offset_ms = now_ms() - gf->start_timestamp_ms;
+	gf->inference_lag_ms = now_offset_ms > end_offset_ms ? now_offset_ms - end_offset_ms : 0;
+
 	// output inference result to a text source
 	set_text_callback(inference_start_ts, gf, inference_result);
 
@@ -367,8 +939,364 @@ void run_inference_and_callbacks(transcription_filter_data *gf, uint64_t start_o
 				     inference_result);
 	}
 
-	// free the buffer
-	bfree(pcm32f_data);
+	if (vad_state != VAD_STATE_PARTIAL) {
+		// a partial run keeps the data in the buffer, a final run consumes it
+		gf->whisper_buffer.pop_front(pcm32f_size);
+	} else if (partial_agreement_enabled(gf)) {
+		// the next decodes start at the last committed token
+		const uint64_t front = gf->whisper_buffer.front_position();
+		const uint64_t trim = gf->local_agreement.trim_position();
+		if (trim > front) {
+			gf->whisper_buffer.pop_front(
+				(size_t)std::min<uint64_t>(trim - front, gf->whisper_buffer.size()));
+		}
+	}
+}
+
+/**
+ * @brief Runs an inference of the calibration, which stop_machine_calibration can cancel.
+ *
+ * It waits for the whole thread budget of the inference scheduler, the inferences of the other
+ * filters run between the ones of the calibration instead of next to them.
+ *
+ * @param ms Time of the inference, without the wait.
+ * @return false when it was cancelled.
+ */
+static bool run_calibration_inference(transcription_filter_data *gf, const float *data,
+				      size_t samples, uint64_t t0, uint64_t t1, int n_threads,
+				      double &ms)
+{
+	InferenceScheduler &scheduler = InferenceScheduler::instance();
+	const InferenceScheduler::Slot slot =
+		scheduler.admit(gf, INFERENCE_JOB_FINAL, scheduler.get_thread_budget());
+	const auto start = std::chrono::steady_clock::now();
+	gf->inference_abort.begin(false);
+	run_whisper_inference(gf, data, samples, t0, t1, VAD_STATE_WAS_OFF, n_threads,
+			      segment_audio_ctx(gf, samples));
+	const bool completed = gf->inference_abort.end() == INFERENCE_ABORT_NONE;
+	ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start)
+		     .count();
+	return completed;
+}
+
+/**
+ * @brief Runs the audio in segments with each thread count and adds a run per thread count to
+ * the profile. The audio holds full segments, see calibration_sweep_audio. The models of the
+ * filter are loaded and run. Stops without adding the run when the calibration is stopped.
+ */
+static void calibrate_loaded_model(transcription_filter_data *gf, const CalibrationModel &model,
+				   const std::vector<float> &audio,
+				   const std::vector<int> &thread_counts,
+				   CalibrationProfile &profile)
+{
+	const size_t segment_samples = CALIBRATION_SEGMENT_MSEC * WHISPER_SAMPLE_RATE / 1000;
+	std::error_code error;
+	const uintmax_t model_bytes = std::filesystem::file_size(model.file, error);
+
+	for (int n_threads : thread_counts) {
+		// untimed, the compute threads start and the buffers of the state are touched
+		double ms = 0.0;
+		if (gf->inference_abort.shutdown_requested() ||
+		    !run_calibration_inference(gf, audio.data(), segment_samples, 0,
+					       CALIBRATION_SEGMENT_MSEC, n_threads, ms)) {
+			return;
+		}
+
+		std::vector<double> latencies;
+		double total_ms = 0.0;
+		for (size_t offset = 0; offset < audio.size(); offset += segment_samples) {
+			const uint64_t t0 = offset * 1000 / WHISPER_SAMPLE_RATE;
+			if (!run_calibration_inference(gf, audio.data() + offset, segment_samples,
+						       t0, t0 + CALIBRATION_SEGMENT_MSEC, n_threads,
+						       ms)) {
+				// the time of a cancelled inference means nothing
+				return;
+			}
+			latencies.push_back(ms);
+			total_ms += ms;
+		}
+
+		CalibrationRun run;
+		run.model_name = model.name;
+		run.model_file = model.file;
+		run.model_bytes = error ? 0 : (uint64_t)model_bytes;
+		run.n_threads = n_threads;
+		run.rtf = total_ms / ((double)audio.size() * 1000.0 / WHISPER_SAMPLE_RATE);
+		run.p95_ms = latency_percentile(latencies, 0.95);
+		run.segments = (int)latencies.size();
+		profile.runs.push_back(run);
+		obs_log(LOG_INFO, "Calibration: %s, %d threads: RTF %.3f, p95 %.0f ms",
+			model.file.c_str(), n_threads, run.rtf, run.p95_ms);
+	}
+}
+
+bool calibrate_whisper_models(struct transcription_filter_data *gf,
+			      const std::vector<float> &clip,
+			      const std::vector<CalibrationModel> &models,
+			      CalibrationProfile &profile)
+{
+	if (clip.size() < WHISPER_SAMPLE_RATE) {
+		obs_log(LOG_ERROR, "Calibration: the clip is shorter than a second");
+		return false;
+	}
+	profile.machine = calibration_machine_id();
+	profile.usable_cpus = usable_cpu_count();
+	profile.created = (uint64_t)std::chrono::duration_cast<std::chrono::seconds>(
+				  std::chrono::system_clock::now().time_since_epoch())
+				  .count();
+	profile.runs.clear();
+	const std::vector<int> thread_counts = calibration_thread_counts(profile.usable_cpus);
+	const size_t segment_samples = CALIBRATION_SEGMENT_MSEC * WHISPER_SAMPLE_RATE / 1000;
+	const std::vector<float> audio =
+		calibration_sweep_audio(clip, segment_samples, CALIBRATION_MIN_SEGMENTS);
+	obs_log(LOG_INFO, "Calibration: %d usable CPUs, %zu models, %.1f s clip, %.1f s per run",
+		profile.usable_cpus, models.size(), (double)clip.size() / WHISPER_SAMPLE_RATE,
+		(double)audio.size() / WHISPER_SAMPLE_RATE);
+
+	for (const CalibrationModel &model : models) {
+		ModelLoadRequest request;
+		{
+			std::lock_guard<std::mutex> lock(gf->whisper_ctx_mutex);
+			request = whisper_model_load_request(gf, model.file);
+		}
+		WhisperModelSet loaded;
+		if (!load_whisper_models(request, gf, loaded)) {
+			obs_log(LOG_WARNING, "Calibration: failed to load %s", model.file.c_str());
+			continue;
+		}
+		{
+			std::lock_guard<std::mutex> lock(gf->whisper_ctx_mutex);
+			swap_whisper_models(gf, loaded);
+		}
+		calibrate_loaded_model(gf, model, audio, thread_counts, profile);
+		std::lock_guard<std::mutex> lock(gf->whisper_ctx_mutex);
+		release_whisper_model(gf);
+		if (gf->inference_abort.shutdown_requested()) {
+			break;
+		}
+	}
+	InferenceScheduler::instance().forget(gf);
+	if (gf->inference_abort.shutdown_requested()) {
+		obs_log(LOG_INFO, "Calibration: stopped");
+		return false;
+	}
+
+	if (!calibration_select(profile)) {
+		obs_log(LOG_ERROR, "Calibration: no model could be run");
+		return false;
+	}
+	obs_log(LOG_INFO, "Calibration: %s with %d threads, RTF %.3f, p95 %.0f ms%s",
+		profile.selected.model_file.c_str(), profile.selected.n_threads,
+		profile.selected.rtf, profile.selected.p95_ms,
+		profile.meets_target ? "" : ", no model meets the target");
+	return true;
+}
+
+/**
+ * @brief Number of input frames the segmentation needs before it can make progress.
+ *
+ * VAD segmentation runs on a few VAD windows at a time, the other modes wait for the next
+ * partial (or the end of the segment when partials are off). The whisper thread sleeps until
+ * that much audio arrived, instead of waking for every audio packet.
+ */
+static size_t whisper_wake_threshold_frames(transcription_filter_data *gf)
+{
+	uint64_t needed_samples = 0;
+	if (gf->vad_mode == VAD_MODE_ACTIVE && gf->vad) {
+		// the streaming VAD takes any amount of audio, wake up for a few windows at a time
+		needed_samples = gf->vad->get_window_size_samples() * 4;
+	} else if (gf->partial_transcription) {
+		needed_samples = (uint64_t)partial_interval_ms(gf) * WHISPER_SAMPLE_RATE / 1000;
+	} else {
+		const uint64_t segment =
+			(uint64_t)gf->segment_duration * WHISPER_SAMPLE_RATE / 1000;
+		const uint64_t pending = gf->whisper_buffer.size();
+		needed_samples = segment > pending ? segment - pending : 0;
+	}
+
+	const uint64_t needed_ms = std::clamp<uint64_t>(
+		needed_samples * 1000 / WHISPER_SAMPLE_RATE, WHISPER_LOOP_MIN_WAKE_MSEC,
+		WHISPER_LOOP_MAX_SLEEP_MSEC);
+	return (size_t)(needed_ms * gf->sample_rate / 1000);
+}
+
+/**
+ * @brief Longest the whisper thread may sleep without new audio.
+ *
+ * Bounded by the time left until the current subtitle expires.
+ */
+static std::chrono::milliseconds whisper_loop_sleep_time(transcription_filter_data *gf)
+{
+	uint64_t sleep_ms = WHISPER_LOOP_MAX_SLEEP_MSEC;
+	if (!gf->cleared_last_sub) {
+		const uint64_t expires = gf->last_sub_render_time + gf->max_sub_duration;
+		const uint64_t now = now_ms();
+		sleep_ms = std::min<uint64_t>(sleep_ms, expires > now ? expires - now + 1 : 1);
+	}
+	return std::chrono::milliseconds(sleep_ms);
+}
+
+/**
+ * @brief Logs the decoding time of the main and the partial model, once partials ran on the
+ * partial model.
+ */
+static void log_model_latency(transcription_filter_data *gf, int log_level)
+{
+	const uint64_t partial_runs = gf->partial_model_runs;
+	if (partial_runs == 0) {
+		return;
+	}
+	const uint64_t partial_ms = gf->partial_model_run_ms;
+	const uint64_t main_runs = gf->whisper_runs - partial_runs;
+	const uint64_t main_ms = gf->whisper_run_ms - partial_ms;
+	obs_log(log_level,
+		"Whisper models: main %llu runs, %.1f ms per run; partial %llu runs, %.1f ms per run",
+		(unsigned long long)main_runs,
+		(double)main_ms / (double)std::max<uint64_t>(main_runs, 1),
+		(unsigned long long)partial_runs,
+		(double)partial_ms / (double)std::max<uint64_t>(partial_runs, 1));
+}
+
+/**
+ * @brief Swaps in the models loaded in the background, between two inferences, see
+ * model-swap.h. Logs the load time, how long the models waited for the end of a segment and
+ * how long the swap held the whisper context.
+ */
+static void swap_in_loaded_models(transcription_filter_data *gf, bool segment_boundary)
+{
+	std::unique_ptr<WhisperModelSet> models = gf->model_swap.take(segment_boundary, now_ms());
+	if (!models) {
+		return;
+	}
+	const uint64_t swap_start_ms = now_ms();
+	const uint64_t load_ms = models->loaded_ms - models->requested_ms;
+	const uint64_t wait_ms = swap_start_ms - models->loaded_ms;
+	{
+		std::lock_guard<std::mutex> lock(gf->whisper_ctx_mutex);
+		if (gf->whisper_context == nullptr) {
+			// shutting down, the loaded models are dropped
+			return;
+		}
+		swap_whisper_models(gf, *models);
+	}
+	// the old models are released outside the lock, the next inference waits for it though
+	models.reset();
+	const uint64_t gap_ms = now_ms() - swap_start_ms;
+	obs_log(LOG_INFO,
+		"Whisper models swapped to %s: loaded in %llu ms, swapped %llu ms later%s, inference paused %llu ms",
+		gf->whisper_model_file_currently_loaded.c_str(), (unsigned long long)load_ms,
+		(unsigned long long)wait_ms, segment_boundary ? "" : " in the middle of a segment",
+		(unsigned long long)gap_ms);
+}
+
+/**
+ * @brief Steps the decoding quality down or up with the load of the whisper thread, see
+ * quality-controller.h, and logs every transition with its cause.
+ */
+static void update_quality(transcription_filter_data *gf)
+{
+	update_overload_floor(gf);
+	if (!gf->adaptive_quality) {
+		const bool lowered = gf->quality.measured_stage() != QUALITY_STAGE_FULL;
+		gf->quality.reset(now_ms());
+		if (lowered) {
+			obs_log(LOG_INFO, "Decoding quality: controller disabled, back to %s",
+				QualityController::stage_name(gf->quality.stage()));
+		}
+		return;
+	}
+	const whisper_full_params &params = gf->whisper_params;
+	gf->quality.set_available(QUALITY_STAGE_GREEDY,
+				  params.strategy == WHISPER_SAMPLING_BEAM_SEARCH ||
+					  params.greedy.best_of > 1 ||
+					  (gf->partial_transcription &&
+					   gf->partial_strategy == WHISPER_SAMPLING_BEAM_SEARCH));
+	gf->quality.set_available(QUALITY_STAGE_NO_FALLBACK, params.temperature_inc > 0.0f);
+	gf->quality.set_available(QUALITY_STAGE_LONGER_PARTIALS, gf->partial_transcription);
+	{
+		std::lock_guard<std::mutex> lock(gf->whisper_ctx_mutex);
+		gf->quality.set_available(QUALITY_STAGE_SMALLER_MODEL,
+					  gf->partial_whisper_state != nullptr);
+	}
+
+	QualityController::Transition transition;
+	if (gf->quality.update(now_ms(), gf->input_backlog_ms, transition)) {
+		log_quality_transition(transition);
+	}
+}
+
+/**
+ * @brief Logs the partials run per second, the current partial interval and the partials
+ * skipped for lack of new speech since the last statistics.
+ */
+static void log_partial_stats(transcription_filter_data *gf, uint64_t partials_from,
+			      uint64_t skipped_from, uint64_t elapsed_ms, int log_level)
+{
+	if (!gf->partial_transcription) {
+		return;
+	}
+	const float seconds = (float)std::max<uint64_t>(elapsed_ms, 1) / 1000.0f;
+	obs_log(log_level,
+		"Partials: %.2f/s, interval %d ms, %.0f ms per partial, %llu skipped without new speech",
+		(float)(gf->partials_run - partials_from) / seconds,
+		gf->partial_interval_current.load(),
+		gf->partial_latency_controller.average_run_ms(),
+		(unsigned long long)(gf->partials_skipped - skipped_from));
+}
+
+static void log_whisper_wake_stats(transcription_filter_data *gf, const WakeScheduler::stats &from,
+				   uint64_t elapsed_ms, int log_level)
+{
+	const WakeScheduler::stats &to = gf->whisper_wake.get_stats();
+	const float seconds = (float)std::max<uint64_t>(elapsed_ms, 1) / 1000.0f;
+	obs_log(log_level,
+		"Whisper thread: %.2f wakeups/s, %.2f wasted/s (%llu audio, %llu deadline, %llu notified, %llu without audio)",
+		(float)(to.wakeups - from.wakeups) / seconds,
+		(float)(to.wasted_wakeups - from.wasted_wakeups) / seconds,
+		(unsigned long long)(to.data_wakeups - from.data_wakeups),
+		(unsigned long long)(to.deadline_wakeups - from.deadline_wakeups),
+		(unsigned long long)(to.notified_wakeups - from.notified_wakeups),
+		(unsigned long long)(to.wasted_wakeups - from.wasted_wakeups));
+}
+
+// pinning of the whisper thread, see compute-threads.h
+struct WhisperThreadAffinity {
+	// CPUs of the thread before it was pinned, to unpin it
+	std::vector<int> default_cpus;
+	bool pinned = false;
+	// of the CPU list applied
+	uint64_t generation = 0;
+};
+
+/**
+ * @brief Pins the whisper thread to the CPU list of the settings, or unpins it once the list is
+ * cleared. The compute threads are created by this thread and inherit its affinity.
+ */
+static void apply_inference_cpu_affinity(transcription_filter_data *gf,
+					 WhisperThreadAffinity &affinity)
+{
+	std::string list;
+	{
+		std::lock_guard<std::mutex> lock(gf->whisper_ctx_mutex);
+		list = gf->inference_cpu_affinity;
+		affinity.generation = gf->inference_cpu_affinity_generation;
+	}
+	if (list.empty()) {
+		if (affinity.pinned && set_current_thread_affinity(affinity.default_cpus)) {
+			affinity.pinned = false;
+			obs_log(gf->log_level, "Whisper thread unpinned");
+		}
+		return;
+	}
+	std::vector<int> cpus;
+	if (!parse_cpu_list(list, cpus)) {
+		obs_log(LOG_WARNING, "Invalid inference CPU list '%s'", list.c_str());
+	} else if (!set_current_thread_affinity(cpus)) {
+		obs_log(LOG_WARNING, "Could not pin the whisper thread to CPUs '%s'", list.c_str());
+	} else {
+		affinity.pinned = true;
+		obs_log(gf->log_level, "Whisper thread pinned to CPUs '%s'", list.c_str());
+	}
 }
 
 void whisper_loop(void *data)
@@ -383,11 +1311,24 @@ void whisper_loop(void *data)
 
 	obs_log(gf->log_level, "Starting whisper thread");
 
+	WhisperThreadAffinity affinity;
+	get_current_thread_affinity(affinity.default_cpus);
+	apply_inference_cpu_affinity(gf, affinity);
+
 	vad_state current_vad_state = {false, 0, 0, 0};
 
 	const char *whisper_loop_name = "Whisper loop";
 	profile_register_root(whisper_loop_name, 50 * 1000 * 1000);
 
+	const uint64_t loop_start_ms = now_ms();
+	uint64_t last_stats_ms = loop_start_ms;
+	gf->quality.reset(loop_start_ms);
+	const uint64_t start_partials = gf->partials_run;
+	const uint64_t start_skipped_partials = gf->partials_skipped;
+	uint64_t last_partials = start_partials;
+	uint64_t last_skipped_partials = start_skipped_partials;
+	WakeScheduler::stats last_stats = gf->whisper_wake.get_stats();
+
 	// Thread main loop
 	while (true) {
 		ProfileScope(whisper_loop_name);
@@ -401,9 +1342,31 @@ void whisper_loop(void *data)
 			}
 		}
 
+		if (gf->inference_cpu_affinity_generation != affinity.generation) {
+			// the CPU list of the settings changed, between two inferences
+			apply_inference_cpu_affinity(gf, affinity);
+		}
+
+		if (gf->calibrating) {
+			// the inferences of the filter would load the CPUs the calibration measures
+			gf->clear_buffers = true;
+		}
 		if (gf->clear_buffers) {
-			deque_pop_front(&gf->resampled_buffer, nullptr, 0);
-			deque_pop_front(&gf->whisper_buffer, nullptr, 0);
+			// the whisper thread is the consumer of the input ring, so it is the only
+			// one allowed to drop its content
+			gf->input_ring.discard();
+			deque_pop_front(&gf->resampled_buffer, nullptr, gf->resampled_buffer.size);
+			gf->whisper_buffer.clear();
+			gf->local_agreement.reset();
+			gf->mel_cache.reset();
+			gf->decimator.reset();
+			if (gf->vad) {
+				gf->vad->stream_reset();
+			}
+			gf->last_speech_sample = 0;
+			gf->gate_position = 0;
+			gf->last_voiced_sample = 0;
+			gf->partial_voiced_sample = 0;
 			current_vad_state = {false, now_ms(), 0, 0};
 			gf->clear_buffers = false;
 		}
@@ -416,6 +1379,11 @@ void whisper_loop(void *data)
 			current_vad_state = vad_disabled_segmentation(gf, current_vad_state);
 		}
 
+		// between two inferences, at the end of a segment when there is no speech
+		swap_in_loaded_models(gf, !current_vad_state.vad_on);
+		update_quality(gf);
+		gf->partial_interval_current = partial_interval_ms(gf);
+
 		if (!gf->cleared_last_sub) {
 			// check if we should clear the current sub depending on the minimum subtitle duration
 			uint64_t now = now_ms();
@@ -431,14 +1399,38 @@ void whisper_loop(void *data)
 		if (gf->input_cv.has_value())
 			gf->input_cv->notify_one();
 
-		// Sleep using the condition variable wshiper_thread_cv
-		// This will wake up the thread if there is new data in the input buffer
-		// or if the whisper context is null
-		std::unique_lock<std::mutex> lock(gf->whisper_ctx_mutex);
-		if (gf->input_buffers->size == 0) {
-			gf->wshiper_thread_cv.wait_for(lock, std::chrono::milliseconds(250));
+		const uint64_t now = now_ms();
+		if (now - last_stats_ms >= WHISPER_LOOP_STATS_INTERVAL_MSEC) {
+			log_whisper_wake_stats(gf, last_stats, now - last_stats_ms, gf->log_level);
+			log_model_latency(gf, gf->log_level);
+			log_partial_stats(gf, last_partials, last_skipped_partials,
+					  now - last_stats_ms, gf->log_level);
+			last_partials = gf->partials_run;
+			last_skipped_partials = gf->partials_skipped;
+			last_stats = gf->whisper_wake.get_stats();
+			last_stats_ms = now;
 		}
+
+		// Sleep until enough new audio for the segmentation is in the input ring, the
+		// current subtitle expires or the thread is notified (e.g. on shutdown)
+		gf->whisper_wake.set_threshold_frames(whisper_wake_threshold_frames(gf));
+		gf->whisper_wake.wait(whisper_loop_sleep_time(gf),
+				      [gf] { return gf->input_ring.frames_available(); });
 	}
 
+	log_whisper_wake_stats(gf, WakeScheduler::stats(), now_ms() - loop_start_ms, LOG_INFO);
+	log_model_latency(gf, LOG_INFO);
+	log_partial_stats(gf, start_partials, start_skipped_partials, now_ms() - loop_start_ms,
+			  LOG_INFO);
+	if (gf->quality.transitions() > 0) {
+		obs_log(LOG_INFO, "Decoding quality: %llu transitions, ended at %s",
+			(unsigned long long)gf->quality.transitions(),
+			QualityController::stage_name(gf->quality.stage()));
+	}
+	if (gf->language_id.detections() > 0) {
+		obs_log(LOG_INFO, "Language ID: %llu detections for %llu decodes",
+			(unsigned long long)gf->language_id.detections(),
+			(unsigned long long)gf->whisper_runs.load());
+	}
 	obs_log(gf->log_level, "Exiting whisper thread");
 }
@@ -3,6 +3,9 @@
 
 #include <whisper.h>
 
+#include "calibration.h"
+#include "model-swap.h"
+
 // buffer size in msec
 #define DEFAULT_BUFFER_SIZE_MSEC 3000
 // overlap in msec
@@ -10,6 +13,16 @@
 #define MAX_OVERLAP_SIZE_MSEC 1000
 #define MIN_OVERLAP_SIZE_MSEC 125
 #define MAX_MS_WORK_BUFFER 11000
+// initial capacity of the whisper buffer in msec, it grows if a segment is longer
+#define WHISPER_BUFFER_CAPACITY_MSEC 30000
+// silence added before and after the audio sent to inference
+#define WHISPER_BUFFER_GUARD_SAMPLES (WHISPER_SAMPLE_RATE / 100)
+// longest sleep of the whisper thread when not enough new audio arrives
+#define WHISPER_LOOP_MAX_SLEEP_MSEC 500
+// least amount of new audio that wakes the whisper thread
+#define WHISPER_LOOP_MIN_WAKE_MSEC 20
+// interval of the whisper thread wakeup statistics in the log
+#define WHISPER_LOOP_STATS_INTERVAL_MSEC 60000
 
 enum DetectionResult {
 	DETECTION_RESULT_UNKNOWN = 0,
@@ -30,9 +43,36 @@ struct DetectionResultWithText {
 };
 
 void whisper_loop(void *data);
-struct whisper_context *init_whisper_context(const std::string &model_path,
-					     struct transcription_filter_data *gf);
+// The request to load the models with the settings of the filter, the caller holds
+// whisper_ctx_mutex
+ModelLoadRequest whisper_model_load_request(const struct transcription_filter_data *gf,
+					    const std::string &model_file,
+					    const std::string &partial_model_file = "",
+					    const std::string &language_id_model_file = "");
+// Takes the models of the request from the model registry with the context parameters of the
+// request and creates their whisper states. Only the main model is required, the language ID
+// model has to be multilingual. Does not touch the models of the filter
+bool load_whisper_models(const ModelLoadRequest &request, struct transcription_filter_data *gf,
+			 WhisperModelSet &models);
+// Exchanges the models of the filter with the given ones, which then hold the old models. The
+// caller holds whisper_ctx_mutex, and frees the old models after releasing it
+void swap_whisper_models(struct transcription_filter_data *gf, WhisperModelSet &models);
+// Frees the whisper states of the filter and returns the models to the registry
+void release_whisper_model(struct transcription_filter_data *gf);
+// Audio between two partials: the partial latency, or the interval measured by the partial
+// latency controller (see partial-latency.h), longer while the quality controller lowers the
+// decoding (see quality-controller.h)
+int partial_interval_ms(const struct transcription_filter_data *gf);
+// Runs inference on the first num_samples of the whisper buffer (0 for all of it)
 void run_inference_and_callbacks(transcription_filter_data *gf, uint64_t start_offset_ms,
-				 uint64_t end_offset_ms, int vad_state);
+				 uint64_t end_offset_ms, int vad_state, size_t num_samples = 0);
+// Sweeps the models and the thread counts of the machine on a 16 kHz mono speech clip and fills
+// the runs and the selection of the profile, see calibration.h. The whisper thread of the filter
+// does not run, its whisper parameters are used. A SHUTDOWN requested on its inference_abort
+// stops the sweep
+bool calibrate_whisper_models(struct transcription_filter_data *gf,
+			      const std::vector<float> &clip,
+			      const std::vector<CalibrationModel> &models,
+			      CalibrationProfile &profile);
 
 #endif // WHISPER_PROCESSING_H
@@ -9,12 +9,15 @@
 void shutdown_whisper_thread(struct transcription_filter_data *gf, bool clear_model_path)
 {
 	obs_log(gf->log_level, "shutdown_whisper_thread");
+	// a model loading in the background would be swapped in after the restart
+	gf->model_swap.stop();
 	if (gf->whisper_context != nullptr) {
+		// the running inference holds the mutex, stop it instead of waiting for it
+		gf->inference_abort.request(INFERENCE_ABORT_SHUTDOWN);
 		// acquire the mutex before freeing the context
 		std::lock_guard<std::mutex> lock(gf->whisper_ctx_mutex);
-		whisper_free(gf->whisper_context);
-		gf->whisper_context = nullptr;
-		gf->wshiper_thread_cv.notify_all();
+		release_whisper_model(gf);
+		gf->whisper_wake.notify();
 	}
 	if (gf->whisper_thread.joinable()) {
 		gf->whisper_thread.join();
@@ -40,16 +43,62 @@ void start_whisper_thread_with_path(struct transcription_filter_data *gf,
 	initialize_vad(gf, silero_vad_model_file);
 
 	obs_log(gf->log_level, "Create whisper context");
-	gf->whisper_context = init_whisper_context(whisper_model_path, gf);
-	if (gf->whisper_context == nullptr) {
+	WhisperModelSet models;
+	if (!load_whisper_models(whisper_model_load_request(gf, whisper_model_path,
+							    gf->partial_whisper_model_file,
+							    gf->language_id_model_file),
+				 gf, models)) {
 		obs_log(LOG_ERROR, "Failed to initialize whisper context");
 		return;
 	}
-	gf->whisper_model_file_currently_loaded = whisper_model_path;
+	// models holds nothing afterwards, the filter had no models
+	swap_whisper_models(gf, models);
+	gf->inference_abort.reset();
 	std::thread new_whisper_thread(whisper_loop, gf);
 	gf->whisper_thread.swap(new_whisper_thread);
 }
 
+void reload_whisper_models(struct transcription_filter_data *gf,
+			   const std::string &whisper_model_path, const char *silero_vad_model_file)
+{
+	bool running = false;
+	ModelLoadRequest load_request;
+	{
+		// the loader thread takes the settings of the request, not of the filter
+		std::lock_guard<std::mutex> lock(gf->whisper_ctx_mutex);
+		running = gf->whisper_context != nullptr;
+		if (running) {
+			load_request = whisper_model_load_request(gf, whisper_model_path,
+								  gf->partial_whisper_model_file,
+								  gf->language_id_model_file);
+		}
+	}
+	if (!running) {
+		// nothing to keep running, load the models on this thread
+		shutdown_whisper_thread(gf, false);
+		start_whisper_thread_with_path(gf, whisper_model_path, silero_vad_model_file);
+		return;
+	}
+	obs_log(gf->log_level, "Loading %s in the background", whisper_model_path.c_str());
+	gf->model_swap.request(
+		load_request,
+		[gf](const ModelLoadRequest &request, WhisperModelSet &models) {
+			return load_whisper_models(request, gf, models);
+		},
+		[gf]() { gf->whisper_wake.notify(); });
+}
+
+void restart_whisper_models(struct transcription_filter_data *gf,
+			    const char *silero_vad_model_file)
+{
+	// the model being loaded, if any, is the model of the settings
+	std::string model_file = gf->model_swap.requested_model_file();
+	if (model_file.empty()) {
+		model_file = gf->whisper_model_file_currently_loaded;
+	}
+	reload_whisper_models(gf, model_file, silero_vad_model_file);
+}
+
 // Finds start of 2-token overlap between two sequences of tokens
 // Returns a pair of indices of the first overlapping tokens in the two sequences
 // If no overlap is found, the function returns {-1, -1}
@@ -42,6 +42,27 @@ void shutdown_whisper_thread(struct transcription_filter_data *gf, bool clear_mo
 void start_whisper_thread_with_path(struct transcription_filter_data *gf, const std::string &path,
 				    const char *silero_vad_model_file);
 
+/**
+ * @brief Loads new models while the running whisper thread keeps transcribing.
+ *
+ * The models (and the partial and language ID models of the filter) are loaded on a
+ * background thread and swapped in by the whisper thread at the end of a segment, see
+ * model-swap.h. Starts the whisper thread instead when it does not run.
+ *
+ * @param gf Pointer to the transcription filter data structure.
+ * @param whisper_model_path Model file to load.
+ * @param silero_vad_model_file Silero VAD model file, used when the thread starts.
+ */
+void reload_whisper_models(struct transcription_filter_data *gf,
+			   const std::string &whisper_model_path, const char *silero_vad_model_file);
+
+/**
+ * @brief Reloads the current model, e.g. after a context parameter or the partial model
+ * changed, see reload_whisper_models.
+ */
+void restart_whisper_models(struct transcription_filter_data *gf,
+			    const char *silero_vad_model_file);
+
 /**
  * @brief Finds the start of overlap between two sequences.
  *